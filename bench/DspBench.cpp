@@ -0,0 +1,1084 @@
+//
+//  DspBench.cpp
+//  carradio
+//
+//  Throughput benchmark for the SDR demodulation pipeline, runs without a
+//  dongle.  Each IQ fixture is either a recording in rtl_sdr format
+//  (interleaved unsigned 8 bit I/Q at 1 MS/s) or synthesized on the fly:
+//
+//    fm_stereo  broadcast FM, L/R tones, 19 kHz pilot, 250 kHz below the LO
+//    nfm_voice  12.5 kHz NFM voice channel, keyed for half the recording
+//    noise      receiver noise only
+//
+//  Every stage of the FM chain and every decoder is run over the fixture
+//  block by block, reporting ns per input sample, real-time factor and heap
+//  allocations per block.  Where a faster variant stands in for a reference
+//  one, both outputs on the same fixture are compared as an SNR, and the
+//  run fails if one falls below its limit.  The fast atan2 is also held to
+//  the exact one's distortion of a demodulated tone, fm_tone, made here
+//  whatever fixtures are given.  Results go to stdout as JSON
+//  so runs can be diffed and tracked, a readable table goes to stderr.
+//
+//  dsp_bench [-s seconds] [-r repeats] [-w dir]
+//            [-fm file] [-nfm file] [-noise file]
+//
+//    -w dir  write the synthesized fixtures to dir as .u8 files
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <cmath>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <numeric>
+
+#include "IQConvert.hpp"
+#include "RtlSdr.hpp"
+#include "Filter.hpp"
+#include "FmDecode.hpp"
+#include "VhfDecode.hpp"
+#include "NoiseSquelch.hpp"
+#include "AmDecode.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "BandSweep.hpp"
+#include "ToneControl.hpp"
+#include "QuadRouter.hpp"
+#include "PcmFrames.hpp"
+
+using namespace std;
+
+// MARK: -   allocation counter
+
+static atomic<uint64_t> s_allocs(0);
+
+void* operator new(size_t size){
+	s_allocs.fetch_add(1, memory_order_relaxed);
+	if(void* p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// MARK: -   fixtures
+
+static constexpr double sample_rate   = RtlSdr::default_sampleRate;
+static constexpr size_t block_length  = RtlSdr::default_blockLength;
+static constexpr double station_offset = -0.25 * sample_rate;		// as RadioMgr tunes
+static constexpr double pcm_rate      = 44100;
+static constexpr unsigned int downsample = 4;							// as RadioMgr, 250 kS/s
+
+typedef struct {
+	string					name;
+	vector<uint8_t>		raw;			// rtl_sdr bytes
+	vector<IQSampleVector> blocks;
+} fixture_t;
+
+static uint8_t to_u8(double v){
+	long b = lrint(127.5 + 127.5 * v);
+	return uint8_t(b < 0 ? 0 : (b > 255 ? 255 : b));
+}
+
+static vector<uint8_t> synth_fm_stereo(size_t nsamples){
+	vector<uint8_t> raw(2 * nsamples);
+	mt19937 rng(1);
+	normal_distribution<double> noise(0, 0.01);
+	double phase = 0;
+
+	// RDS subcarrier, random differentially coded biphase bits
+	uniform_int_distribution<int> coin(0, 1);
+	int rds_symbol = 1;
+	size_t rds_bit = SIZE_MAX;
+
+	for(size_t i = 0; i < nsamples; i++){
+		double t = i / sample_rate;
+		double l = 0.5 * sin(2 * M_PI * 1000 * t);
+		double r = 0.5 * sin(2 * M_PI * 400 * t);
+
+		double bits = t * RdsDecoder::bit_rate;
+		if(size_t(bits) != rds_bit){
+			rds_bit = size_t(bits);
+			if(coin(rng))
+				rds_symbol = -rds_symbol;
+		}
+		double rds = (bits - floor(bits) < 0.5) ? rds_symbol : -rds_symbol;
+
+		double m = 0.45 * ((l + r) / 2 + (l - r) / 2 * sin(2 * M_PI * 38000 * t))
+					+ 0.1 * sin(2 * M_PI * 19000 * t)
+					+ 0.03 * rds * cos(2 * M_PI * 57000 * t);
+		phase += 2 * M_PI * (75000 * m + station_offset) / sample_rate;
+		raw[2*i]   = to_u8(0.5 * cos(phase) + noise(rng));
+		raw[2*i+1] = to_u8(0.5 * sin(phase) + noise(rng));
+	}
+	return raw;
+}
+
+static vector<uint8_t> synth_nfm_voice(size_t nsamples){
+	vector<uint8_t> raw(2 * nsamples);
+	mt19937 rng(2);
+	normal_distribution<double> noise(0, 0.02);
+	double phase = 0;
+
+	for(size_t i = 0; i < nsamples; i++){
+		double t = i / sample_rate;
+		bool keyed = i < nsamples / 2;
+
+		// a few formants with a 4 Hz syllable envelope
+		double env = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+		double v = env * (0.5 * sin(2 * M_PI * 350 * t)
+								+ 0.3 * sin(2 * M_PI * 1200 * t)
+								+ 0.2 * sin(2 * M_PI * 2600 * t));
+		phase += 2 * M_PI * (2500 * v + station_offset) / sample_rate;
+		double a = keyed ? 0.3 : 0;
+		raw[2*i]   = to_u8(a * cos(phase) + noise(rng));
+		raw[2*i+1] = to_u8(a * sin(phase) + noise(rng));
+	}
+	return raw;
+}
+
+static vector<uint8_t> synth_noise(size_t nsamples){
+	vector<uint8_t> raw(2 * nsamples);
+	mt19937 rng(3);
+	normal_distribution<double> noise(0, 0.1);
+
+	for(auto &b : raw)
+		b = to_u8(noise(rng));
+	return raw;
+}
+
+static bool read_file(const char* path, vector<uint8_t>& raw){
+	FILE* fp = fopen(path, "rb");
+	if(!fp){
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	raw.clear();
+	uint8_t buf[65536];
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		raw.insert(raw.end(), buf, buf + n);
+	fclose(fp);
+	raw.resize(raw.size() & ~size_t(1));
+	return !raw.empty();
+}
+
+static bool write_file(const string& path, const vector<uint8_t>& raw){
+	FILE* fp = fopen(path.c_str(), "wb");
+	if(!fp){
+		fprintf(stderr, "can't create %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok = fwrite(raw.data(), 1, raw.size(), fp) == raw.size();
+	fclose(fp);
+	return ok;
+}
+
+static void make_blocks(fixture_t& f){
+	size_t nsamples = f.raw.size() / 2;
+	f.blocks.clear();
+	for(size_t pos = 0; pos + block_length <= nsamples; pos += block_length){
+		IQSampleVector blk(block_length);
+		IQConvert::u8ToIQ(f.raw.data() + 2 * pos, blk.data(), block_length);
+		f.blocks.push_back(move(blk));
+	}
+}
+
+// MARK: -   timing
+
+typedef struct {
+	string		fixture;
+	string		stage;
+	string		type;
+	double		rate;			// input sample rate of the stage
+	uint64_t		samples;
+	uint64_t		blocks;
+	double		secs;
+	uint64_t		allocs;
+} result_t;
+
+static vector<result_t> s_results;
+static int s_repeats = 3;
+
+static double now_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Run process() over every block, once untimed to size the buffers, then
+ * s_repeats times with the clock and allocation counter running.
+ */
+template <class Block>
+static void run_stage(const string& fixture, const string& stage, const string& type,
+							 double rate, const vector<Block>& blocks,
+							 function<void(const Block&)> process){
+
+	if(blocks.empty())
+		return;
+
+	process(blocks[0]);
+
+	uint64_t samples = 0;
+	uint64_t allocs = s_allocs.load();
+	double start = now_secs();
+
+	for(int r = 0; r < s_repeats; r++){
+		for(auto &b : blocks){
+			process(b);
+			samples += b.size();
+		}
+	}
+
+	result_t res;
+	res.secs = now_secs() - start;
+	res.allocs = s_allocs.load() - allocs;
+	res.fixture = fixture;
+	res.stage = stage;
+	res.type = type;
+	res.rate = rate;
+	res.samples = samples;
+	res.blocks = blocks.size() * s_repeats;
+	s_results.push_back(res);
+
+	fprintf(stderr, "%-10s %-24s %-6s %9.2f ns/sample %9.1fx realtime %6.2f allocs/block\n",
+			  fixture.c_str(), stage.c_str(), type.c_str(),
+			  res.secs * 1e9 / samples,
+			  (samples / rate) / res.secs,
+			  double(res.allocs) / res.blocks);
+}
+
+// MARK: -   accuracy
+
+typedef struct {
+	string		fixture;
+	string		stage;
+	string		type;			// variant checked, against what
+	uint64_t		samples;
+	double		snr;			// reference power over error power, dB
+	double		max_error;
+	double		min_snr;		// limit
+	bool			pass;
+} check_t;
+
+static vector<check_t> s_checks;
+
+// reported for identical outputs, -ffast-math has no infinity
+static constexpr double exact_snr = 999;
+
+static inline double power(double v)				{ return v * v; }
+static inline double power(const IQSample& v)	{ return norm(v); }
+
+/**
+ * Compare test against ref sample by sample, as the SNR of the difference,
+ * and record whether it reaches min_snr.  Differing lengths fail.
+ */
+template <class A, class B>
+static bool check_match(const string& fixture, const string& stage, const string& type,
+								const vector<A>& ref, const vector<B>& test, double min_snr){
+
+	size_t n = min(ref.size(), test.size());
+	double signal = 0, error = 0, peak = 0;
+	for(size_t i = 0; i < n; i++){
+		double e = power(ref[i] - A(test[i]));
+		signal += power(ref[i]);
+		error += e;
+		peak = max(peak, e);
+	}
+
+	check_t c;
+	c.fixture = fixture;
+	c.stage = stage;
+	c.type = type;
+	c.samples = n;
+	c.snr = error > 0 ? 10 * log10(signal / error) : exact_snr;
+	c.max_error = sqrt(peak);
+	c.min_snr = min_snr;
+	c.pass = n > 0 && ref.size() == test.size() && c.snr >= min_snr;
+	s_checks.push_back(c);
+
+	fprintf(stderr, "%-10s %-24s %-14s %7.1f dB SNR %10.2e max error  %s\n",
+			  fixture.c_str(), stage.c_str(), type.c_str(), c.snr, c.max_error,
+			  c.pass ? "ok" : ref.size() != test.size() ? "FAIL length" : "FAIL");
+	return c.pass;
+}
+
+/** Concatenate the blocks of a stage's output, for check_match(). */
+template <class T>
+static void append(vector<T>& all, const vector<T>& block){
+	all.insert(all.end(), block.begin(), block.end());
+}
+
+/** Power of the tone at freq in every step'th sample of x, by Goertzel. */
+static double tone_power(const SampleVector& x, size_t start, size_t n, size_t step,
+								 double freq, double rate){
+	double coeff = 2 * cos(2 * M_PI * freq / rate);
+	double s1 = 0, s2 = 0;
+	for(size_t i = 0; i < n; i++){
+		double s0 = x[start + i * step] + coeff * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	return (s1 * s1 + s2 * s2 - coeff * s1 * s2) / (double(n) * n);
+}
+
+/**
+ * Fundamental over the 2nd to 5th harmonics of a tone in dB, the THD with
+ * the sign turned so that more is better.  Measured over whole cycles of
+ * the left channel of interleaved stereo audio, after skipping start
+ * frames while the filters settle.
+ */
+static double tone_thd(const SampleVector& audio, size_t start, double freq, double rate){
+	size_t frames = audio.size() / 2;
+	size_t cycle = size_t(rate) / gcd(size_t(rate), size_t(freq));
+	size_t n = frames > start ? (frames - start) / cycle * cycle : 0;
+	if(n == 0)
+		return 0;
+
+	double harmonics = 0;
+	for(int k = 2; k <= 5; k++)
+		harmonics += tone_power(audio, 2 * start, n, 2, k * freq, rate);
+	double fundamental = tone_power(audio, 2 * start, n, 2, freq, rate);
+	return 10 * log10(fundamental / max(harmonics, 1.0e-30));
+}
+
+/**
+ * Record the distortion of test against ref, both from tone_thd().  It
+ * passes unless test is more than max_loss dB worse.  The check keeps
+ * test's figure as its snr and ref's less max_loss as its limit.
+ */
+static bool check_thd(const string& fixture, const string& stage, const string& type,
+							 double ref_db, double test_db, size_t samples, double max_loss){
+	check_t c;
+	c.fixture = fixture;
+	c.stage = stage;
+	c.type = type;
+	c.samples = samples;
+	c.snr = test_db;
+	c.max_error = 0;
+	c.min_snr = ref_db - max_loss;
+	c.pass = samples > 0 && test_db >= c.min_snr;
+	s_checks.push_back(c);
+
+	fprintf(stderr, "%-10s %-24s %-14s %7.1f dB THD %7.1f dB exact      %s\n",
+			  fixture.c_str(), stage.c_str(), type.c_str(), -test_db, -ref_db,
+			  c.pass ? "ok" : "FAIL");
+	return c.pass;
+}
+
+static void print_json(FILE* fp){
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"benchmark\": \"dsp_bench\",\n");
+	fprintf(fp, "  \"sample_rate\": %.0f,\n", sample_rate);
+	fprintf(fp, "  \"block_length\": %zu,\n", block_length);
+	fprintf(fp, "  \"pcm_rate\": %.0f,\n", pcm_rate);
+	fprintf(fp, "  \"repeats\": %d,\n", s_repeats);
+	fprintf(fp, "  \"iq_convert\": \"%s\",\n", IQConvert::methodName(IQConvert::method()).c_str());
+	fprintf(fp, "  \"results\": [\n");
+
+	for(size_t i = 0; i < s_results.size(); i++){
+		auto &r = s_results[i];
+		fprintf(fp, "    {\"fixture\": \"%s\", \"stage\": \"%s\", \"type\": \"%s\", "
+				  "\"rate\": %.0f, \"samples\": %llu, \"blocks\": %llu, "
+				  "\"ns_per_sample\": %.3f, \"realtime\": %.2f, \"allocs_per_block\": %.3f}%s\n",
+				  r.fixture.c_str(), r.stage.c_str(), r.type.c_str(),
+				  r.rate, (unsigned long long) r.samples, (unsigned long long) r.blocks,
+				  r.secs * 1e9 / r.samples,
+				  (r.samples / r.rate) / r.secs,
+				  double(r.allocs) / r.blocks,
+				  i + 1 < s_results.size() ? "," : "");
+	}
+	fprintf(fp, "  ],\n");
+
+	fprintf(fp, "  \"checks\": [\n");
+	for(size_t i = 0; i < s_checks.size(); i++){
+		auto &c = s_checks[i];
+		fprintf(fp, "    {\"fixture\": \"%s\", \"stage\": \"%s\", \"type\": \"%s\", "
+				  "\"samples\": %llu, \"snr_db\": %.2f, \"max_error\": %.3e, "
+				  "\"min_snr_db\": %.1f, \"pass\": %s}%s\n",
+				  c.fixture.c_str(), c.stage.c_str(), c.type.c_str(),
+				  (unsigned long long) c.samples, c.snr, c.max_error,
+				  c.min_snr, c.pass ? "true" : "false",
+				  i + 1 < s_checks.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+// MARK: -   stages
+
+template <class T>
+static vector<vector<T>> convert_blocks(const vector<SampleVector>& in){
+	vector<vector<T>> out;
+	for(auto &b : in)
+		out.push_back(vector<T>(b.begin(), b.end()));
+	return out;
+}
+
+/** Run the FM chain stage by stage, each fed with the previous stage's output. */
+static void bench_fm_stages(const fixture_t& f){
+
+	const string& name = f.name;
+	const double rate_bb = sample_rate / downsample;
+	const int tuning_shift = lrint(-64.0 * station_offset / sample_rate);
+	const double max_dev = FmDecoder::default_freq_dev / rate_bb;
+	const double cutoff_if = FmDecoder::default_bandwidth_if / sample_rate;
+
+	// raw bytes split into blocks
+	vector<vector<uint8_t>> raw_blocks;
+	for(size_t pos = 0; pos + 2 * block_length <= f.raw.size(); pos += 2 * block_length)
+		raw_blocks.push_back(vector<uint8_t>(f.raw.begin() + pos, f.raw.begin() + pos + 2 * block_length));
+
+	{
+		IQSampleVector out(block_length);
+		run_stage<vector<uint8_t>>(name, "IQConvert", "float", sample_rate * 2, raw_blocks,
+			[&](const vector<uint8_t>& in){ IQConvert::u8ToIQ(in.data(), out.data(), in.size() / 2); });
+	}
+
+	// tuned and filtered signal for the later stages
+	vector<IQSampleVector> tuned, decimated;
+	vector<SampleVector> baseband;
+	{
+		FineTuner tuner(64, tuning_shift);
+		DecimatingFilterFirIQ filter(8 * downsample, cutoff_if, downsample);
+		PhaseDiscriminator disc(max_dev);
+		for(auto &b : f.blocks){
+			IQSampleVector t, d;
+			SampleVector bb;
+			tuner.process(b, t);
+			filter.process(t, d);
+			disc.process(d, bb);
+			tuned.push_back(move(t));
+			decimated.push_back(move(d));
+			baseband.push_back(move(bb));
+		}
+	}
+
+	{
+		FineTuner tuner(64, tuning_shift);
+		IQSampleVector out;
+		run_stage<IQSampleVector>(name, "FineTuner", "float", sample_rate, f.blocks,
+			[&](const IQSampleVector& in){ tuner.process(in, out); });
+	}
+	{
+		LowPassFilterFirIQ filter(10, cutoff_if);
+		IQSampleVector out;
+		run_stage<IQSampleVector>(name, "LowPassFilterFirIQ", "float", sample_rate, tuned,
+			[&](const IQSampleVector& in){ filter.process(in, out); });
+	}
+	{
+		DecimatingFilterFirIQ filter(8 * downsample, cutoff_if, downsample);
+		IQSampleVector out;
+		run_stage<IQSampleVector>(name, "DecimatingFilterFirIQ", "float", sample_rate, tuned,
+			[&](const IQSampleVector& in){ filter.process(in, out); });
+	}
+	{
+		PhaseDiscriminator disc(max_dev, PhaseDiscriminator::ATAN2_FAST);
+		SampleVector out;
+		run_stage<IQSampleVector>(name, "PhaseDiscriminator", "fast", rate_bb, decimated,
+			[&](const IQSampleVector& in){ disc.process(in, out); });
+	}
+	{
+		PhaseDiscriminator disc(max_dev, PhaseDiscriminator::ATAN2_EXACT);
+		SampleVector out;
+		run_stage<IQSampleVector>(name, "PhaseDiscriminator", "exact", rate_bb, decimated,
+			[&](const IQSampleVector& in){ disc.process(in, out); });
+	}
+	{
+		// the fast atan2 against std::atan2 on the same IF
+		PhaseDiscriminator fast(max_dev, PhaseDiscriminator::ATAN2_FAST);
+		PhaseDiscriminator exact(max_dev, PhaseDiscriminator::ATAN2_EXACT);
+		SampleVector out, ref, test;
+		for(auto &b : decimated){
+			exact.process(b, out);
+			append(ref, out);
+			fast.process(b, out);
+			append(test, out);
+		}
+		check_match(name, "PhaseDiscriminator", "fast vs exact", ref, test, 90);
+	}
+	{
+		PilotPhaseLockT<float> pll(19000 / rate_bb, 50 / rate_bb, 0.04);
+		SampleVector out;
+		run_stage<SampleVector>(name, "PilotPhaseLock", "float", rate_bb, baseband,
+			[&](const SampleVector& in){ pll.process(in, out); });
+	}
+	{
+		auto baseband_d = convert_blocks<double>(baseband);
+		PilotPhaseLockT<double> pll(19000 / rate_bb, 50 / rate_bb, 0.04);
+		vector<double> out;
+		run_stage<vector<double>>(name, "PilotPhaseLock", "double", rate_bb, baseband_d,
+			[&](const vector<double>& in){ pll.process(in, out); });
+	}
+	{
+		PilotPhaseLockT<float> pll(19000 / rate_bb, 50 / rate_bb, 0.04);
+		pll.set_third_harmonic(true);
+		SampleVector out;
+		run_stage<SampleVector>(name, "PilotPhaseLock", "57k", rate_bb, baseband,
+			[&](const SampleVector& in){ pll.process(in, out); });
+	}
+	{
+		// locked subcarrier for every baseband block
+		vector<IQSampleVector> carriers;
+		PilotPhaseLockT<float> pll(19000 / rate_bb, 50 / rate_bb, 0.04);
+		pll.set_third_harmonic(true);
+		SampleVector out;
+		for(auto &b : baseband){
+			pll.process(b, out);
+			carriers.push_back(pll.get_third_harmonic());
+		}
+
+		RdsDecoder rds(rate_bb);
+		size_t k = 0;
+		run_stage<SampleVector>(name, "RdsDecoder", "float", rate_bb, baseband,
+			[&](const SampleVector& in){ rds.process(in, carriers[k++ % carriers.size()]); });
+	}
+	{
+		DownsampleFilter filter(int(rate_bb / 1000.0),
+										FmDecoder::default_bandwidth_pcm / rate_bb,
+										rate_bb / pcm_rate, false);
+		SampleVector out;
+		run_stage<SampleVector>(name, "DownsampleFilter", "float", rate_bb, baseband,
+			[&](const SampleVector& in){ filter.process(in, out); });
+	}
+	{
+		RationalResampler resampler(int(rate_bb / 1000.0),
+											 FmDecoder::default_bandwidth_pcm / rate_bb,
+											 lrint(rate_bb), lrint(pcm_rate));
+		SampleVector out;
+		run_stage<SampleVector>(name, "RationalResampler", "float", rate_bb, baseband,
+			[&](const SampleVector& in){ resampler.process(in, out); });
+	}
+	{
+		NoiseSquelch squelch(rate_bb);
+		run_stage<SampleVector>(name, "NoiseSquelch", "float", rate_bb, baseband,
+			[&](const SampleVector& in){ squelch.process(in); });
+	}
+
+	// fixed point front end
+	vector<IQSampleQ15Vector> q15, q15_tuned, q15_decimated;
+	{
+		FineTunerQ15 tuner(64, tuning_shift);
+		DecimatingFilterFirQ15 filter(8 * downsample, cutoff_if, downsample);
+		for(auto &b : raw_blocks){
+			IQSampleQ15Vector q(b.size() / 2), t, d;
+			IQConvert::u8ToQ15(b.data(), q.data(), q.size());
+			tuner.process(q, t);
+			filter.process(t, d);
+			q15.push_back(move(q));
+			q15_tuned.push_back(move(t));
+			q15_decimated.push_back(move(d));
+		}
+	}
+	{
+		IQSampleQ15Vector out(block_length);
+		run_stage<vector<uint8_t>>(name, "IQConvert", "q15", sample_rate * 2, raw_blocks,
+			[&](const vector<uint8_t>& in){ IQConvert::u8ToQ15(in.data(), out.data(), in.size() / 2); });
+	}
+	{
+		FineTunerQ15 tuner(64, tuning_shift);
+		IQSampleQ15Vector out;
+		run_stage<IQSampleQ15Vector>(name, "FineTuner", "q15", sample_rate, q15,
+			[&](const IQSampleQ15Vector& in){ tuner.process(in, out); });
+	}
+	{
+		DecimatingFilterFirQ15 filter(8 * downsample, cutoff_if, downsample);
+		IQSampleQ15Vector out;
+		run_stage<IQSampleQ15Vector>(name, "DecimatingFilterFirIQ", "q15", sample_rate, q15_tuned,
+			[&](const IQSampleQ15Vector& in){ filter.process(in, out); });
+	}
+	{
+		PhaseDiscriminatorQ15 disc(max_dev);
+		SampleQ15Vector out;
+		run_stage<IQSampleQ15Vector>(name, "PhaseDiscriminator", "q15", rate_bb, q15_decimated,
+			[&](const IQSampleQ15Vector& in){ disc.process(in, out); });
+	}
+}
+
+/**
+ * The scanner's Channelizer against the decoder's way to one channel, the
+ * fixture mixed down with FineTuner and run through DecimatingFilterFirIQ.
+ * Both filter with the same Lanczos taps, the channelizer rotates to
+ * baseband after the filter instead of before, so only the constant phase
+ * of the mixer differs.
+ */
+static void bench_channelizer(const fixture_t& f){
+
+	const string& name = f.name;
+	const unsigned int order = 120, decimation = 20;		// as RadioMgr scans
+	const double cutoff = 12500 / sample_rate;
+
+	Channelizer channelizer(order, decimation);
+	channelizer.add_channel(station_offset / sample_rate, cutoff);
+
+	FineTuner tuner(64, lrint(-64.0 * station_offset / sample_rate));
+	DecimatingFilterFirIQ filter(order, cutoff, decimation);
+
+	IQSampleVector tuned, mixed, ref, test;
+	for(auto &b : f.blocks){
+		tuner.process(b, tuned);
+		filter.process(tuned, mixed);
+		channelizer.process(b);
+		append(ref, mixed);
+		append(test, channelizer.channel_output(0));
+	}
+
+	// line up the mixer phase
+	IQSample dot = 0;
+	for(size_t i = 0; i < min(ref.size(), test.size()); i++)
+		dot += ref[i] * conj(test[i]);
+	IQSample rot = abs(dot) > 0 ? dot / abs(dot) : IQSample(1);
+	for(auto &s : test)
+		s *= rot;
+
+	check_match(name, "Channelizer", "vs mixed", ref, test, 60);
+
+	{
+		Channelizer ch(order, decimation);
+		ch.add_channel(station_offset / sample_rate, cutoff);
+		run_stage<IQSampleVector>(name, "Channelizer", "1ch", sample_rate, f.blocks,
+			[&](const IQSampleVector& in){ ch.process(in); });
+	}
+}
+
+/** All the audio a decoder makes from the fixture, for check_match(). */
+template <class Decoder, class T>
+static void decode_all(Decoder& dec, const fixture_t& f, vector<T>& all){
+	vector<T> audio;
+	all.clear();
+	for(auto &b : f.blocks){
+		dec.process(b, audio);
+		append(all, audio);
+	}
+}
+
+/**
+ * A decoder on the Q15 front end against its float twin, over the blocks
+ * where both hear a carrier.  On noise the discriminators turn rounding
+ * differences near the origin into clicks, there is nothing to compare,
+ * so a fixture without a carrier records no check.
+ */
+template <class Decoder, class Carrier>
+static void check_fixed_point(Decoder& floating, Decoder& fixed, const fixture_t& f,
+										const string& stage, Carrier carrier, double min_snr){
+	SampleVector ref, test, a, b;
+	for(auto &blk : f.blocks){
+		floating.process(blk, a);
+		fixed.process(blk, b);
+		if(carrier(floating) && carrier(fixed)){
+			append(ref, a);
+			append(test, b);
+		}
+	}
+	if(!ref.empty())
+		check_match(f.name, stage, "q15 vs float", ref, test, min_snr);
+}
+
+/** Whole decoders, as RadioMgr constructs them. */
+static void bench_decoders(const fixture_t& f, bool fm, bool vhf, bool am){
+
+	const string& name = f.name;
+	const double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm, 0.45 * pcm_rate);
+
+	if(fm){
+		for(int mode = 0; mode < 6; mode++){
+			FmDecoder dec(sample_rate, station_offset, pcm_rate, true,
+							  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+			const char* type = "fast";
+			if(mode == 1){
+				dec.set_discriminator_method(PhaseDiscriminator::ATAN2_EXACT);
+				type = "exact";
+			}
+			else if(mode == 2){
+				dec.set_fixed_point(true);
+				type = "q15";
+			}
+			else if(mode == 3){
+				// against "fast", the cost of RDS on top of the audio
+				dec.set_rds_enabled(true);
+				type = "rds";
+			}
+			else if(mode == 4){
+				// time per call is the latency, the audio is that block's
+				dec.set_threading(FmDecoder::THREADS_FORK_JOIN);
+				type = "fork";
+			}
+			else if(mode == 5){
+				// time per call, the audio comes one block later on top
+				dec.set_threading(FmDecoder::THREADS_PIPELINED);
+				type = "pipe";
+			}
+			SampleVector audio;
+			run_stage<IQSampleVector>(name, "FmDecoder", type, sample_rate, f.blocks,
+				[&](const IQSampleVector& in){ dec.process(in, audio); dec.process_rds(); });
+		}
+		{
+			FmDecoderT<double> dec(sample_rate, station_offset, pcm_rate, true,
+										  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+										  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+			vector<double> audio;
+			run_stage<IQSampleVector>(name, "FmDecoder", "double", sample_rate, f.blocks,
+				[&](const IQSampleVector& in){ dec.process(in, audio); });
+		}
+
+		// the fast atan2 against std::atan2, each from a fresh decoder
+		// over the whole fixture
+		FmDecoder exact(sample_rate, station_offset, pcm_rate, true,
+							 FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							 FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		FmDecoder fast(sample_rate, station_offset, pcm_rate, true,
+							FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		exact.set_discriminator_method(PhaseDiscriminator::ATAN2_EXACT);
+
+		SampleVector ref, test;
+		decode_all(exact, f, ref);
+		decode_all(fast, f, test);
+		check_match(name, "FmDecoder", "fast vs exact", ref, test, 60);
+
+		// float against double, both with the exact atan2 so only the
+		// precision differs
+		FmDecoderT<double> dbl(sample_rate, station_offset, pcm_rate, true,
+									  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+									  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		dbl.set_discriminator_method(PhaseDiscriminatorT<double>::ATAN2_EXACT);
+
+		vector<double> ref_double;
+		decode_all(dbl, f, ref_double);
+		check_match(name, "FmDecoder", "float vs double", ref_double, ref, 60);
+
+		// the Q15 front end against the float one it stands in for, where
+		// both have the pilot
+		FmDecoder fixed(sample_rate, station_offset, pcm_rate, true,
+							 FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							 FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		FmDecoder floating(sample_rate, station_offset, pcm_rate, true,
+								 FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+								 FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		fixed.set_fixed_point(true);
+		check_fixed_point(floating, fixed, f, "FmDecoder",
+								[](const FmDecoder& d){ return d.stereo_detected(); }, 60);
+
+		// retuned to the same station after a pass over the fixture, the
+		// second pass has to come out as from a new decoder
+		{
+			FmDecoder dec(sample_rate, station_offset, pcm_rate, true,
+							  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+			SampleVector retuned;
+			decode_all(dec, f, retuned);
+			dec.retune(station_offset, FmDecoder::default_bandwidth_if);
+			decode_all(dec, f, retuned);
+			check_match(name, "FmDecoder", "retune vs new", test, retuned, exact_snr);
+		}
+
+		// the threaded modes against the serial decoder, block by block.
+		// They run the same code on the same data, so the audio is the
+		// same, the pipeline's a block later.
+		for(auto mode : {FmDecoder::THREADS_FORK_JOIN, FmDecoder::THREADS_PIPELINED}){
+			FmDecoder serial(sample_rate, station_offset, pcm_rate, true,
+								  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+								  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+			FmDecoder dec(sample_rate, station_offset, pcm_rate, true,
+							  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+			dec.set_threading(mode);
+			bool pipelined = mode == FmDecoder::THREADS_PIPELINED;
+
+			SampleVector serial_all, threaded_all, audio, previous;
+			for(auto &b : f.blocks){
+				serial.process(b, audio);
+				if(pipelined){
+					append(serial_all, previous);
+					previous.swap(audio);
+				}
+				else
+					append(serial_all, audio);
+
+				dec.process(b, audio);
+				append(threaded_all, audio);
+			}
+			check_match(name, "FmDecoder", pipelined ? "serial vs pipe" : "serial vs fork",
+							serial_all, threaded_all, exact_snr);
+		}
+	}
+
+	if(vhf){
+		for(int mode = 0; mode < 3; mode++){
+			// "sql" adds the noise squelch, the IF level never holds it closed
+			VhfDecoder dec(sample_rate, station_offset, pcm_rate,
+								VhfDecoder::default_deemphasis, 12500,
+								VhfDecoder::default_freq_dev, bandwidth_pcm, downsample,
+								mode == 2 ? -200 : 0);
+			dec.set_fixed_point(mode == 1);
+			const char* type = mode == 0 ? "float" : mode == 1 ? "q15" : "sql";
+			SampleVector audio;
+			run_stage<IQSampleVector>(name, "VhfDecoder", type, sample_rate, f.blocks,
+				[&](const IQSampleVector& in){ dec.process(in, audio); });
+		}
+
+		// retuned to the same channel, as from a new decoder
+		{
+			VhfDecoder fresh(sample_rate, station_offset, pcm_rate,
+								  VhfDecoder::default_deemphasis, 12500,
+								  VhfDecoder::default_freq_dev, bandwidth_pcm, downsample, -200);
+			VhfDecoder dec(sample_rate, station_offset, pcm_rate,
+								VhfDecoder::default_deemphasis, 12500,
+								VhfDecoder::default_freq_dev, bandwidth_pcm, downsample, -200);
+			SampleVector ref, retuned;
+			decode_all(fresh, f, ref);
+			decode_all(dec, f, retuned);
+			dec.retune(station_offset, 12500);
+			decode_all(dec, f, retuned);
+			// squelched from the first block there is no audio to compare
+			if(!ref.empty())
+				check_match(name, "VhfDecoder", "retune vs new", ref, retuned, exact_snr);
+		}
+
+		// the Q15 front end against float, where both squelches are open,
+		// no tail so they close as soon as the carrier goes
+		VhfDecoder fixed(sample_rate, station_offset, pcm_rate,
+							  VhfDecoder::default_deemphasis, 12500,
+							  VhfDecoder::default_freq_dev, bandwidth_pcm, downsample, -200);
+		VhfDecoder floating(sample_rate, station_offset, pcm_rate,
+								  VhfDecoder::default_deemphasis, 12500,
+								  VhfDecoder::default_freq_dev, bandwidth_pcm, downsample, -200);
+		fixed.set_fixed_point(true);
+		fixed.set_squelch_dwell(0);
+		floating.set_squelch_dwell(0);
+		check_fixed_point(floating, fixed, f, "VhfDecoder",
+								[](const VhfDecoder& d){ return !d.isSquelched(); }, 40);
+	}
+
+	if(am){
+		AmDecoder dec(sample_rate, station_offset, pcm_rate);
+		SampleVector audio;
+		run_stage<IQSampleVector>(name, "AmDecoder", "float", sample_rate, f.blocks,
+			[&](const IQSampleVector& in){ dec.process(in, audio); });
+	}
+}
+
+/**
+ * Distortion of a demodulated tone, fast atan2 against std::atan2.  The
+ * SNR checks weigh every error alike, this one only counts what lands
+ * on the harmonics of the tone, which is what a listener hears.  A mono
+ * 1 kHz tone at three quarters of full deviation, quantized as the
+ * dongle delivers it, through whole decoders.
+ */
+static void bench_thd(){
+	const double tone = 1000;
+	const double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm, 0.45 * pcm_rate);
+
+	fixture_t f;
+	f.name = "fm_tone";
+	size_t nsamples = 8 * block_length;
+	f.raw.resize(2 * nsamples);
+	double phase = 0;
+	for(size_t i = 0; i < nsamples; i++){
+		double m = 0.75 * sin(2 * M_PI * tone * i / sample_rate);
+		phase += 2 * M_PI * (FmDecoder::default_freq_dev * m + station_offset) / sample_rate;
+		f.raw[2*i]   = to_u8(0.5 * cos(phase));
+		f.raw[2*i+1] = to_u8(0.5 * sin(phase));
+	}
+	make_blocks(f);
+
+	double thd[2];
+	size_t frames = 0;
+	for(int fast = 0; fast < 2; fast++){
+		FmDecoder dec(sample_rate, station_offset, pcm_rate, true,
+						  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+						  FmDecoder::default_freq_dev, bandwidth_pcm, downsample);
+		dec.set_discriminator_method(fast ? PhaseDiscriminator::ATAN2_FAST
+											 : PhaseDiscriminator::ATAN2_EXACT);
+		SampleVector audio;
+		decode_all(dec, f, audio);
+		thd[fast] = tone_thd(audio, size_t(0.1 * pcm_rate), tone, pcm_rate);
+		frames = audio.size() / 2;
+	}
+	check_thd(f.name, "FmDecoder", "thd vs exact", thd[0], thd[1], frames, 0.5);
+}
+
+/** Tone controls and quad routing on decoded stereo audio, as AudioOutput runs them. */
+static void bench_tone(const fixture_t& f){
+
+	FmDecoder dec(sample_rate, station_offset, pcm_rate, true);
+	vector<SampleVector> audio;
+	for(auto &b : f.blocks){
+		SampleVector out;
+		dec.process(b, out);
+		audio.push_back(move(out));
+	}
+
+	// one of each band, then balance on top
+	for(int mode = 0; mode < 2; mode++){
+		ToneControl tone;
+		tone.setBass(0.5);
+		tone.setMidrange(-0.25);
+		tone.setTreble(0.5);
+		if(mode == 1)
+			tone.setBalance(0.3);
+
+		SampleVector work;
+		run_stage<SampleVector>(f.name, "ToneControl", mode == 0 ? "eq" : "eq+bal", pcm_rate * 2, audio,
+			[&](const SampleVector& in){
+				work = in;
+				if(tone.update(2, pcm_rate))
+					tone.process(work.data(), work.size() / 2);
+			});
+	}
+
+	// AirPlay rate audio into a 48 kHz PCM, as AudioOutput converts it
+	const unsigned int rate_in = lrint(pcm_rate), rate_out = 48000;
+	const double cutoff = PcmFrames::srcCutoff(rate_in, rate_out);
+	{
+		RationalResampler src(PcmFrames::src_filterOrder, cutoff, rate_in, rate_out, 2);
+		SampleVector out;
+		run_stage<SampleVector>(f.name, "RationalResampler", "stereo", pcm_rate * 2, audio,
+			[&](const SampleVector& in){ src.process(in, out); });
+	}
+	{
+		// interleaved frames must come out as each channel on its own
+		RationalResampler stereo(PcmFrames::src_filterOrder, cutoff, rate_in, rate_out, 2);
+		RationalResampler left(PcmFrames::src_filterOrder, cutoff, rate_in, rate_out);
+		RationalResampler right(PcmFrames::src_filterOrder, cutoff, rate_in, rate_out);
+
+		SampleVector l, r, out_l, out_r, out, ref, test;
+		for(auto &b : audio){
+			size_t n = b.size() / 2;
+			l.resize(n);
+			r.resize(n);
+			for(size_t i = 0; i < n; i++){
+				l[i] = b[2 * i];
+				r[i] = b[2 * i + 1];
+			}
+			left.process(l, out_l);
+			right.process(r, out_r);
+			stereo.process(b, out);
+
+			for(size_t i = 0; i < out_l.size() && i < out_r.size(); i++){
+				ref.push_back(out_l[i]);
+				ref.push_back(out_r[i]);
+			}
+			append(test, out);
+		}
+		check_match(f.name, "RationalResampler", "stereo vs mono", ref, test, 100);
+	}
+
+	// "delay" adds the rear delay, "rear" the low-pass on top
+	for(int mode = 0; mode < 3; mode++){
+		QuadRouter router;
+		router.setFader(0.25);
+		if(mode >= 1)
+			router.setRearDelay(12);
+		if(mode == 2)
+			router.setRearLowPass(4000);
+
+		const char* type = mode == 0 ? "fader" : mode == 1 ? "delay" : "rear";
+		SampleVector quad;
+		run_stage<SampleVector>(f.name, "QuadRouter", type, pcm_rate * 2, audio,
+			[&](const SampleVector& in){
+				router.update(pcm_rate);
+				router.process(in.data(), in.size() / 2, quad);
+			});
+	}
+}
+
+/** Band view analysis, a spectrum per block as the analyzer thread makes them. */
+static void bench_spectrum(const fixture_t& f){
+
+	SpectrumAnalyzer analyzer;
+	vector<float> columns;
+	run_stage<IQSampleVector>(f.name, "SpectrumAnalyzer", "float", sample_rate, f.blocks,
+		[&](const IQSampleVector& in){ analyzer.process(in); analyzer.finishFrame(columns); });
+}
+
+/** Station search, one window per block as the sweep thread gets them. */
+static void bench_sweep(const fixture_t& f){
+
+	BandSweep sweep(sample_rate);
+	vector<BandSweep::station_t> found;
+	run_stage<IQSampleVector>(f.name, "BandSweep", "float", sample_rate, f.blocks,
+		[&](const IQSampleVector& in){ found.clear(); sweep.analyze(88200000, in, found); });
+}
+
+// MARK: -   main
+
+static void usage(){
+	fprintf(stderr, "usage: dsp_bench [-s seconds] [-r repeats] [-w dir] "
+			  "[-fm file] [-nfm file] [-noise file]\n");
+}
+
+int main(int argc, const char * argv[]) {
+
+	double seconds = 2.0;
+	const char* write_dir = NULL;
+	const char* paths[3] = {NULL, NULL, NULL};
+
+	for(int i = 1; i < argc; i++){
+		bool more = i + 1 < argc;
+		if(!strcmp(argv[i], "-s") && more)				seconds = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-r") && more)		s_repeats = max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "-w") && more)		write_dir = argv[++i];
+		else if(!strcmp(argv[i], "-fm") && more)		paths[0] = argv[++i];
+		else if(!strcmp(argv[i], "-nfm") && more)		paths[1] = argv[++i];
+		else if(!strcmp(argv[i], "-noise") && more)	paths[2] = argv[++i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	size_t nsamples = max(size_t(seconds * sample_rate), block_length);
+	nsamples -= nsamples % block_length;
+
+	const char* names[3] = {"fm_stereo", "nfm_voice", "noise"};
+	vector<uint8_t> (*synth[3])(size_t) = {synth_fm_stereo, synth_nfm_voice, synth_noise};
+
+	fixture_t fixtures[3];
+	for(int i = 0; i < 3; i++){
+		fixture_t& f = fixtures[i];
+		f.name = names[i];
+
+		if(paths[i]){
+			if(!read_file(paths[i], f.raw))
+				return 1;
+		}
+		else {
+			f.raw = synth[i](nsamples);
+			if(write_dir && !write_file(string(write_dir) + "/" + f.name + ".u8", f.raw))
+				return 1;
+		}
+
+		make_blocks(f);
+		if(f.blocks.empty()){
+			fprintf(stderr, "%s: fixture shorter than one block\n", f.name.c_str());
+			return 1;
+		}
+	}
+
+	bench_fm_stages(fixtures[0]);
+	bench_decoders(fixtures[0], true, false, false);
+	bench_decoders(fixtures[1], false, true, false);
+	bench_channelizer(fixtures[1]);
+	bench_decoders(fixtures[2], true, true, true);
+	bench_thd();
+	bench_tone(fixtures[0]);
+	bench_spectrum(fixtures[0]);
+	bench_sweep(fixtures[0]);
+	bench_sweep(fixtures[2]);
+
+	print_json(stdout);
+
+	for(auto &c : s_checks)
+		if(!c.pass)
+			return 2;
+	return 0;
+}
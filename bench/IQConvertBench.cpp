@@ -0,0 +1,64 @@
+//
+//  IQConvertBench.cpp
+//  carradio
+//
+//  Micro benchmark for the RTL-SDR byte to IQSample conversion kernels.
+//  Reports Msamples/s for every method this CPU supports and checks each
+//  one against the lookup table.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <cmath>
+#include <vector>
+
+#include "IQConvert.hpp"
+#include "RtlSdr.hpp"
+
+using namespace std;
+
+static double now_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char * argv[]) {
+
+	const size_t nsamples = RtlSdr::default_blockLength;
+	const int 	 blocks   = (argc > 1) ? atoi(argv[1]) : 2000;
+
+	vector<uint8_t> raw(2 * nsamples);
+	for(auto &b : raw)
+		b = rand() & 0xff;
+
+	IQSampleVector ref(nsamples);
+	IQSampleVector out(nsamples);
+
+	IQConvert::convert(IQConvert::CONVERT_LUT, raw.data(), ref.data(), nsamples);
+
+	printf("startup method: %s\n", IQConvert::methodName(IQConvert::method()).c_str());
+
+	for(auto method : IQConvert::availableMethods()){
+
+		IQConvert::convert(method, raw.data(), out.data(), nsamples);
+
+		double maxerr = 0;
+		for(size_t i = 0; i < nsamples; i++)
+			maxerr = fmax(maxerr, abs(out[i] - ref[i]));
+
+		double start = now_secs();
+		for(int i = 0; i < blocks; i++)
+			IQConvert::convert(method, raw.data(), out.data(), nsamples);
+		double elapsed = now_secs() - start;
+
+		double msps = (double(nsamples) * blocks) / elapsed / 1.0e6;
+
+		printf("%-5s %9.1f Msamples/s  %7.1fx realtime  maxerr %g\n",
+				 IQConvert::methodName(method).c_str(),
+				 msps, msps / (RtlSdr::default_sampleRate / 1.0e6), maxerr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+//
+//  SweepStress.cpp
+//  carradio
+//
+//  Starts FM band sweeps and ends or cancels them while IQ blocks keep
+//  arriving, then checks that every sweep reported back and that the
+//  radio went back to reading blocks. Runs on a noise source, no dongle.
+//  Exits 2 if a check fails.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "RadioMgr.hpp"
+
+using namespace std;
+
+/** Gaussian noise blocks for as long as anyone asks. */
+class NoiseSource : public IQSource {
+public:
+	void stop() override {}
+	bool getDeviceInfo(device_info_t&) override { return false; }
+	bool setFrequency(uint32_t f) override { _freq = f; return true; }
+	uint32_t getFrequency() override { return _freq; }
+	bool setSampleRate(uint32_t) override { return true; }
+	uint32_t getSampleRate() override { return 1000000; }
+	int getTunerGain() override { return 0; }
+	vector<int> getTunerGains() override { return {0}; }
+	bool setTunerGain(int) override { return true; }
+	bool setOffsetTuning(bool) override { return true; }
+	bool setACGMode(bool) override { return true; }
+	bool setBiasTee(bool) override { return true; }
+	bool setDirectSampling(direct_sampling_t) override { return true; }
+	direct_sampling_t getDirectSampling() override { return DIRECT_SAMPLING_OFF; }
+	bool resetBuffer() override { return true; }
+	bool getSamples(IQSampleVector& samples) override {
+		samples.resize(16384);
+		for(auto &s : samples)
+			s = IQSample(_noise(_gen), _noise(_gen));
+		_blocks++;
+		return true;
+	}
+	bool startAsync() override { return false; }
+	void stopAsync() override {}
+	bool isAsync() override { return false; }
+	async_stats_t getAsyncStats() override { return {}; }
+
+	atomic<uint64_t> _blocks {0};
+
+private:
+	uint32_t 	_freq = 0;
+	mt19937 		_gen {1};
+	normal_distribution<float> _noise {0, 0.1f};
+};
+
+int main(int argc, const char * argv[]) {
+
+	const int rounds = (argc > 1) ? atoi(argv[1]) : 40;
+
+	NoiseSource source;
+	RadioMgr 	radio;
+
+	if(!radio.begin(&source, 48000)){
+		fprintf(stderr, "radio begin failed\n");
+		return 1;
+	}
+	radio.setON(true);
+	radio.setFrequencyandMode(RadioMgr::BROADCAST_FM, 101100000, true);
+	this_thread::sleep_for(chrono::milliseconds(300));
+
+	atomic<int> reported {0};
+	mt19937 		gen(7);
+	int started = 0, completed = 0, cancelled = 0;
+
+	for(int i = 0; i < rounds; i++){
+		if(!radio.startBandSweep([&](bool, vector<BandSweep::station_t>){ reported++; })){
+			this_thread::sleep_for(chrono::milliseconds(20));
+			continue;
+		}
+		started++;
+
+		// odd rounds cancel part way, even rounds let the sweep finish
+		if(i & 1){
+			this_thread::sleep_for(chrono::milliseconds(gen() % 30));
+			radio.cancelBandSweep();
+			cancelled++;
+		}
+		else {
+			while(radio.isSweeping())
+				this_thread::sleep_for(chrono::milliseconds(1));
+			completed++;
+		}
+
+		// blocks keep arriving straight after the sweep has let go
+		this_thread::sleep_for(chrono::milliseconds(gen() % 20));
+	}
+
+	// the queued retune has to hand the radio a decoder again
+	uint64_t before = source._blocks;
+	this_thread::sleep_for(chrono::milliseconds(300));
+	bool resumed = source._blocks > before;
+
+	while(radio.isSweeping())
+		this_thread::sleep_for(chrono::milliseconds(1));
+
+	printf("sweeps %d completed %d cancelled %d reported %d, reading %s\n",
+			 started, completed, cancelled, reported.load(), resumed ? "resumed" : "stalled");
+
+	bool ok = started > 0 && reported == started && resumed;
+	if(!ok)
+		printf("FAIL\n");
+	fflush(stdout);
+
+	radio.stop();
+
+	// the app singletons behind RadioMgr keep their threads, don't wait on them
+	_exit(ok ? 0 : 2);
+}
@@ -122,7 +122,7 @@ static ssize_t safe_read(int fd, void *buf, size_t count)
 
 
 
-bool AirplayInput::getSamples(SampleVector& audio){
+bool AirplayInput::getSamples(PcmFrames& audio){
 	
 	if(!_isSetup  )
 		return  false;
@@ -135,14 +135,17 @@ bool AirplayInput::getSamples(SampleVector& audio){
 	
 	if(nbytes > 0){
 		
-		int framesize = nbytes / 4;
+		audio.setFormat(PcmFrames::PCM_S16, pipe_sampleRate, pipe_channels);
+		
+		int bytesPerFrame = (int) audio.bytesPerFrame();
+		int framesize = nbytes / bytesPerFrame;
 		
 		if (framesize > default_blockLength)
 			framesize = default_blockLength;
 		
 		audio.resize(framesize);
 		
-		if( safe_read(_fd, audio.data(), framesize*4)  != framesize*4){
+		if( safe_read(_fd, audio.data(), framesize*bytesPerFrame)  != framesize*bytesPerFrame){
 			printf("read fail  %s \n",strerror(errno));
 			return false;
 		}
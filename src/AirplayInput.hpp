@@ -19,6 +19,7 @@
 #include "ErrorMgr.hpp"
 #include "CommonDefs.hpp"
 #include "IQSample.h"
+#include "PcmFrames.hpp"
 
 using namespace std;
 
@@ -29,6 +30,10 @@ public:
  
 	static constexpr int 	default_blockLength = 4096;
 	
+	// what shairport-sync writes to its pipe, S16 stereo
+	static constexpr unsigned int 	pipe_sampleRate = 44100;
+	static constexpr unsigned int 	pipe_channels = 2;
+	
 	AirplayInput();
 	~AirplayInput();
 	
@@ -38,7 +43,7 @@ public:
 	void stop();
 	bool isConnected();
  
-	bool getSamples(SampleVector& audio);
+	bool getSamples(PcmFrames& audio);
  
 	private:
  
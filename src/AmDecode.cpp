@@ -0,0 +1,265 @@
+//
+//  AmDecode.cpp
+//  carradio
+//
+
+#include <cassert>
+#include <cmath>
+
+#include "AmDecode.hpp"
+
+using namespace std;
+
+
+#pragma clang diagnostic ignored "-Wconversion"
+
+/** Total decimation from the IQ rate down to about the AM channel rate. */
+static unsigned int total_decimation(double sample_rate_if, double if_rate)
+{
+	 return max(1L, lrint(sample_rate_if / if_rate));
+}
+
+/** Split the total decimation so the second stage does the sharp filter. */
+static unsigned int second_stage_decimation(unsigned int total)
+{
+	 for (unsigned int d = 5; d > 1; d--) {
+		  if (total % d == 0 && total / d >= d)
+				return d;
+	 }
+	 return 1;
+}
+
+
+/* ****************  class AmDecoder  **************** */
+
+template <class T>
+AmDecoderT<T>::AmDecoderT(double sample_rate_if,
+								  double tuning_offset,
+								  double sample_rate_pcm,
+								  detector_t detector,
+								  double bandwidth_if,
+								  double bandwidth_pcm,
+								  double whistle_freq)
+
+	 // Initialize member fields
+	 : m_sample_rate_if(sample_rate_if)
+	 , m_decim1(total_decimation(sample_rate_if, if_rate_target) /
+					second_stage_decimation(total_decimation(sample_rate_if, if_rate_target)))
+	 , m_decim2(second_stage_decimation(total_decimation(sample_rate_if, if_rate_target)))
+	 , m_sample_rate_baseband(sample_rate_if / (m_decim1 * m_decim2))
+	 , m_tuning_table_size(64)
+	 , m_tuning_shift(lrint(-64.0 * tuning_offset / sample_rate_if))
+	 , m_detector(detector)
+	 , m_if_level(0)
+	 , m_baseband_level(0)
+	 , m_pll_phase(0)
+	 , m_pll_freq(0)
+	 , m_pll_error(0)
+	 , m_lock_cnt(0)
+	 , m_carrier(0)
+	 , m_min_carrier(1.0e-4)
+
+	 // Construct FineTuner
+	 , m_finetuner(m_tuning_table_size, m_tuning_shift)
+
+	 // First stage only has to keep the aliases out of the channel,
+	 // a short filter at the full IQ rate.
+	 , m_decimate1(8 * m_decim1,
+						min(0.4 / m_decim1, 3 * bandwidth_if / sample_rate_if),
+						m_decim1)
+
+	 // Second stage sets the channel selectivity at the low rate.
+	 , m_decimate2(16 * m_decim2,
+						bandwidth_if / (sample_rate_if / m_decim1),
+						m_decim2)
+
+	 // Adjacent channel whistle, only if it is below Nyquist.
+	 , m_use_notch(whistle_freq > 0 && whistle_freq < 0.5 * m_sample_rate_baseband)
+	 , m_notch(m_use_notch ? whistle_freq / m_sample_rate_baseband : 0.25)
+
+	 // Construct RationalResampler for mono channel
+	 , m_resample_mono(
+		  int(m_sample_rate_baseband / 1000.0),               // filter_order
+		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
+		  lrint(m_sample_rate_baseband),                      // rate_in
+		  lrint(sample_rate_pcm))                             // rate_out
+
+	 // Construct HighPassFilterIir
+	 , m_dcblock_mono(30.0 / sample_rate_pcm)
+{
+	 // Carrier PLL, 2nd order loop with ~20 Hz bandwidth, pulls in the
+	 // few Hz of crystal error on the AM band easily.
+	 double wn = 2.0 * M_PI * 20.0 / m_sample_rate_baseband;
+	 m_pll_alpha = 2.0 * 0.707 * wn;
+	 m_pll_beta  = wn * wn;
+	 m_pll_max_freq = 2.0 * M_PI * 500.0 / m_sample_rate_baseband;
+	 m_lock_delay = int(0.1 * m_sample_rate_baseband);
+
+	 // AGC follows the carrier with a 200 ms time constant, slow enough
+	 // to leave the audio alone, fast enough for fading under bridges.
+	 m_agc_coeff = 1.0 - exp(-1.0 / (0.2 * m_sample_rate_baseband));
+}
+
+
+template <class T>
+void AmDecoderT<T>::retune(double tuning_offset, double bandwidth_if)
+{
+	 m_tuning_shift = lrint(-double(m_tuning_table_size) * tuning_offset / m_sample_rate_if);
+
+	 m_finetuner.set_freq_shift(m_tuning_shift);
+	 m_decimate1.set_cutoff(min(0.4 / m_decim1, 3 * bandwidth_if / m_sample_rate_if));
+	 m_decimate2.set_cutoff(bandwidth_if / (m_sample_rate_if / m_decim1));
+
+	 // No history of the old station is carried into the new one.
+	 m_finetuner.reset();
+	 m_decimate1.reset();
+	 m_decimate2.reset();
+	 m_notch.reset();
+	 m_resample_mono.reset();
+	 m_dcblock_mono.reset();
+
+	 // Carrier PLL and AGC reacquire the new carrier.
+	 m_pll_phase = 0;
+	 m_pll_freq = 0;
+	 m_pll_error = 0;
+	 m_lock_cnt = 0;
+	 m_carrier = 0;
+	 m_if_level = 0;
+	 m_baseband_level = 0;
+}
+
+
+template <class T>
+void AmDecoderT<T>::process(const IQSampleVector& samples_in,
+									 vector<T>& audio)
+{
+	 // Fine tuning.
+	 m_finetuner.process(samples_in, m_buf_iftuned);
+
+	 // Decimate 1 MS/s to the channel rate as early as possible.
+	 m_decimate1.process(m_buf_iftuned, m_buf_decim1);
+	 m_decimate2.process(m_buf_decim1, m_buf_baseband);
+
+	 // Measure IF level.
+	 unsigned int n = m_buf_baseband.size();
+	 if (n == 0) {
+		  audio.clear();
+		  return;
+	 }
+
+	 double level = 0;
+	 for (unsigned int i = 0; i < n; i++)
+		  level += norm(m_buf_baseband[i]);
+	 double if_rms = sqrt(level / n);
+	 m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
+
+	 // Detect, strip the carrier and normalize.
+	 detect(m_buf_baseband);
+	 agc(m_buf_detect);
+
+	 // Measure baseband level.
+	 double baseband_mean, baseband_rms;
+	 samples_mean_rms(m_buf_detect, baseband_mean, baseband_rms);
+	 m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
+
+	 // Adjacent channel heterodyne.
+	 if (m_use_notch)
+		  m_notch.process_inplace(m_buf_detect);
+
+	 // Resample to audio rate and DC block.
+	 m_resample_mono.process(m_buf_detect, m_buf_mono);
+	 m_dcblock_mono.process_inplace(m_buf_mono);
+
+	 // Duplicate mono signal in left/right channels.
+	 mono_to_left_right(m_buf_mono, audio);
+}
+
+
+// Detect the baseband signal.
+template <class T>
+void AmDecoderT<T>::detect(const IQSampleVector& samples_in)
+{
+	 unsigned int n = samples_in.size();
+	 m_buf_detect.resize(n);
+
+	 if (m_detector == DETECT_ENVELOPE) {
+		  for (unsigned int i = 0; i < n; i++)
+				m_buf_detect[i] = abs(samples_in[i]);
+		  return;
+	 }
+
+	 // Synchronous detection: rotate the carrier onto the real axis and
+	 // keep the in-phase part.  Immune to the selective fading distortion
+	 // of the envelope detector.  Until the loop has locked, fall back to
+	 // the envelope.
+	 bool locked = carrier_locked();
+	 double err_avg = m_pll_error;
+
+	 for (unsigned int i = 0; i < n; i++) {
+		  IQSample lo(cos(m_pll_phase), -sin(m_pll_phase));
+		  IQSample y = samples_in[i] * lo;
+
+		  double err = atan2(y.imag(), y.real());
+		  m_pll_freq += m_pll_beta * err;
+		  m_pll_freq = max(-m_pll_max_freq, min(m_pll_max_freq, m_pll_freq));
+		  m_pll_phase += m_pll_freq + m_pll_alpha * err;
+		  if (m_pll_phase > M_PI)
+				m_pll_phase -= 2.0 * M_PI;
+		  else if (m_pll_phase < -M_PI)
+				m_pll_phase += 2.0 * M_PI;
+
+		  err_avg = 0.999 * err_avg + 0.001 * fabs(err);
+
+		  m_buf_detect[i] = locked ? T(y.real()) : T(abs(y));
+	 }
+
+	 m_pll_error = err_avg;
+
+	 // Update lock status.
+	 if (m_pll_error < 0.3) {
+		  if (m_lock_cnt < m_lock_delay)
+				m_lock_cnt += n;
+	 } else {
+		  m_lock_cnt = 0;
+	 }
+}
+
+
+// Remove carrier and normalize to modulation depth.
+template <class T>
+void AmDecoderT<T>::agc(vector<T>& samples)
+{
+	 unsigned int n = samples.size();
+	 double carrier = m_carrier;
+
+	 for (unsigned int i = 0; i < n; i++) {
+		  double x = samples[i];
+		  carrier += m_agc_coeff * (x - carrier);
+		  samples[i] = (x - carrier) / max(carrier, m_min_carrier);
+	 }
+
+	 m_carrier = carrier;
+}
+
+
+// Duplicate mono signal in left/right channels.
+template <class T>
+void AmDecoderT<T>::mono_to_left_right(const vector<T>& samples_mono,
+													vector<T>& audio)
+{
+	 unsigned int n = samples_mono.size();
+
+	 audio.resize(2*n);
+	 for (unsigned int i = 0; i < n; i++) {
+		  T m = samples_mono[i];
+		  audio[2*i]   = m;
+		  audio[2*i+1] = m;
+	 }
+}
+
+/* ****************  instantiations  **************** */
+
+template class AmDecoderT<float>;
+template class AmDecoderT<double>;
+
+/* end */
@@ -0,0 +1,146 @@
+//
+//  AmDecode.hpp
+//  carradio
+//
+//  Decoder for AM broadcast (530 - 1710 kHz).
+//
+//  The channel is only 10 kHz wide, so the 1 MS/s IQ stream is brought
+//  down to 25 kS/s in two decimating FIR stages right after the fine
+//  tuner.  Everything after that (detection, AGC, notch, resampling) runs
+//  at the low rate, which keeps AM far cheaper than the FM path.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include "Filter.hpp"
+#include "SDRDecoder.hpp"
+
+
+/** Complete decoder for AM broadcast signal. */
+template <class T>
+class AmDecoderT : public SDRDecoderT<T>
+{
+public:
+
+	 typedef enum  {
+		  DETECT_ENVELOPE = 0,		// magnitude of the IF signal
+		  DETECT_SYNC,					// carrier locked product detector
+	 } detector_t;
+
+	 static constexpr double default_bandwidth_if  =  7500;
+	 static constexpr double default_bandwidth_pcm =  5000;
+	 static constexpr double default_whistle_freq  = 10000;	// 9000 in ITU region 1
+	 static constexpr double if_rate_target        = 25000;
+
+	 /**
+	  * Construct AM decoder.
+	  *
+	  * sample_rate_if   :: IQ sample rate in Hz.
+	  * tuning_offset    :: Frequency offset in Hz of radio station with respect
+	  *                     to receiver LO frequency.
+	  * sample_rate_pcm  :: Audio sample rate.
+	  * detector         :: Envelope or synchronous detection.
+	  * bandwidth_if     :: Half bandwidth of IF signal in Hz.
+	  * bandwidth_pcm    :: Half bandwidth of audio signal in Hz.
+	  * whistle_freq     :: Adjacent channel heterodyne to notch out in Hz,
+	  *                     0 to disable.
+	  */
+	 AmDecoderT(double sample_rate_if,
+					double tuning_offset,
+					double sample_rate_pcm,
+					detector_t detector=DETECT_SYNC,
+					double bandwidth_if=default_bandwidth_if,
+					double bandwidth_pcm=default_bandwidth_pcm,
+					double whistle_freq=default_whistle_freq);
+
+	 /**
+	  * Process IQ samples and return audio samples.
+	  * Output is mono duplicated in left/right channels, interleaved.
+	  */
+	 void process(const IQSampleVector& samples_in,
+					  std::vector<T>& audio);
+
+	 /** Move to another station without rebuilding the decoder. */
+	 void retune(double tuning_offset, double bandwidth_if);
+
+	 /** Return RMS IF level (where full scale IQ signal is 1.0). */
+	 double get_if_level() const
+	 {
+		  return m_if_level;
+	 }
+
+	 /** Return RMS baseband signal level. */
+	 double get_baseband_level() const
+	 {
+		  return m_baseband_level;
+	 }
+
+	 /** Return true if the synchronous detector has locked on the carrier. */
+	 bool carrier_locked() const
+	 {
+		  return m_lock_cnt >= m_lock_delay;
+	 }
+
+	 void set_detector(detector_t detector) { m_detector = detector; }
+	 detector_t detector() const { return m_detector; }
+
+	 void set_squelch_level(int level)  {};
+	 void set_squelch_dwell(uint count) {};
+	 bool isSquelched() const  { return false; };
+	 bool canSquelch() const  { return false; };
+
+private:
+	 /** Detect into m_buf_detect, synchronous or envelope. */
+	 void detect(const IQSampleVector& samples_in);
+
+	 /** Remove carrier and normalize to modulation depth. */
+	 void agc(std::vector<T>& samples);
+
+	 /** Duplicate mono signal in left/right channels. */
+	 void mono_to_left_right(const std::vector<T>& samples_mono,
+									 std::vector<T>& audio);
+
+	 // Data members.
+	 const double    m_sample_rate_if;
+	 const unsigned int m_decim1;
+	 const unsigned int m_decim2;
+	 const double    m_sample_rate_baseband;
+	 const int       m_tuning_table_size;
+	 int             m_tuning_shift;
+	 detector_t      m_detector;
+	 double          m_if_level;
+	 double          m_baseband_level;
+
+	 // carrier PLL, runs at the baseband rate
+	 double          m_pll_phase;
+	 double          m_pll_freq;
+	 double          m_pll_max_freq;
+	 double          m_pll_alpha, m_pll_beta;
+	 double          m_pll_error;
+	 int             m_lock_delay;
+	 int             m_lock_cnt;
+
+	 // AGC
+	 double          m_carrier;
+	 double          m_agc_coeff;
+	 double          m_min_carrier;
+
+	 IQSampleVector  m_buf_iftuned;
+	 IQSampleVector  m_buf_decim1;
+	 IQSampleVector  m_buf_baseband;
+	 std::vector<T>  m_buf_detect;
+	 std::vector<T>  m_buf_mono;
+
+	 FineTuner              m_finetuner;
+	 DecimatingFilterFirIQ  m_decimate1;
+	 DecimatingFilterFirIQ  m_decimate2;
+	 bool                   m_use_notch;
+	 NotchFilterIirT<T>     m_notch;
+	 RationalResamplerT<T>  m_resample_mono;
+	 HighPassFilterIirT<T>  m_dcblock_mono;
+};
+
+typedef AmDecoderT<Sample> AmDecoder;
@@ -37,6 +37,7 @@ bool AudioLineInput::begin(unsigned int samplerate,  bool stereo,  int &error){
 	
 	_pcm = NULL;
 	_nchannels = stereo ? 2 : 1;
+	_sampleRate = samplerate;
 	
 //	printf("AudioLineInput PCM at %d\n", samplerate);
 
@@ -114,7 +115,7 @@ void AudioLineInput::stop(){
 }
 
 
-bool AudioLineInput::getSamples(SampleVector& audio){
+bool AudioLineInput::getSamples(PcmFrames& audio){
 	
 	if(!_isSetup || !_pcm)
 		return  false;
@@ -135,10 +136,12 @@ bool AudioLineInput::getSamples(SampleVector& audio){
 		if (avail > _blockLength)
 			avail = _blockLength;
 		
+		audio.setFormat(PcmFrames::PCM_S16, _sampleRate, _nchannels);
 		audio.resize(avail);
 
 		int cnt =  snd_pcm_readi(_pcm,  audio.data(), avail);
 		if(cnt > 0){
+			audio.resize(cnt);
 	 		return true;
 		}
 		
@@ -19,6 +19,7 @@
 #include "ErrorMgr.hpp"
 #include "CommonDefs.hpp"
 #include "IQSample.h"
+#include "PcmFrames.hpp"
 
 using namespace std;
 
@@ -43,12 +44,14 @@ public:
 	void stop();
 	bool isConnected() { return _isSetup; }
  
-	bool getSamples(SampleVector& audio);
+	/** S16 frames at the rate and channels given to begin(). */
+	bool getSamples(PcmFrames& audio);
  
 	private:
  
 	bool						_isSetup;
 	unsigned int         _nchannels;
+	unsigned int         _sampleRate;
 	struct _snd_pcm *   	_pcm;
 	 
 	int       				_blockLength;
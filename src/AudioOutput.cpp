@@ -3,6 +3,7 @@
 #include "ErrorMgr.hpp"
 #include <math.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include <stdio.h>
 #include <fcntl.h>
@@ -27,6 +28,12 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if defined(__APPLE__)
 typedef unsigned long snd_pcm_uframes_t;
 #endif
@@ -40,7 +47,16 @@ typedef unsigned long snd_pcm_uframes_t;
 	 _midrange = 0;
 	 
 	_pcm = NULL;
- 
+	_nchannels = 2;
+	_sampleRate = 0;
+	_activeResampler = NULL;
+	_newSource = false;
+	_lastFormat = PcmFrames::PCM_FLOAT;
+	_lastRate = 0;
+	_lastChannels = 0;
+	_useMmap = false;
+	_underruns = 0;
+	_xrunRecoveries = 0;
 }
 
 AudioOutput::~AudioOutput(){
@@ -56,17 +72,27 @@ bool AudioOutput::begin(unsigned int samplerate,  bool stereo){
 #define _MIXER_ 		"default"
 #define _MIXER_NAME_ "Speaker"
 #define _PCM_  		"duplicate"
+#define _PCM_QUAD_ 	"surround40"		// ALSA's standard front + rear device
 
 #define _PCM_CAPTURE_SOURCE_  "PCM Capture Source"
 #define _PCM_CAPTURE_LINE_    "Line"
 
  
 bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error){
+	return openPCM(samplerate, stereo ? 2 : 1, error);
+}
+
+bool AudioOutput::beginQuad(unsigned int samplerate,  int &error){
+	return openPCM(samplerate, 4, error);
+}
+
+bool AudioOutput::openPCM(unsigned int samplerate,  unsigned int channels,  int &error){
 	
 	bool success = false;
 	
 	_pcm = NULL;
-	_nchannels = stereo ? 2 : 1;
+	_nchannels = channels;
+	_sampleRate = samplerate;
 	_isMuted = false;
 	_isQuiet = false;
 	
@@ -76,7 +102,7 @@ bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error){
 #else
 	int r;
 	 
-	r = snd_pcm_open(&_pcm, _PCM_,
+	r = snd_pcm_open(&_pcm, channels == 4 ? _PCM_QUAD_ : _PCM_,
 								SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
 	if( r < 0){
 		error = r;
@@ -85,13 +111,26 @@ bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error){
 		
 		snd_pcm_nonblock(_pcm, 0);
 		
+		// Write straight into the ring buffer when the plugin chain
+		// allows it, otherwise fall back to snd_pcm_writei.
+		_useMmap = true;
 		r = snd_pcm_set_params(_pcm,
 									  SND_PCM_FORMAT_S16_LE,
-									  SND_PCM_ACCESS_RW_INTERLEAVED,
+									  SND_PCM_ACCESS_MMAP_INTERLEAVED,
 									  _nchannels,
 									  samplerate,
 									  1,               // allow soft resampling
 									  500000);         // latency in us
+		if( r < 0){
+			_useMmap = false;
+			r = snd_pcm_set_params(_pcm,
+										  SND_PCM_FORMAT_S16_LE,
+										  SND_PCM_ACCESS_RW_INTERLEAVED,
+										  _nchannels,
+										  samplerate,
+										  1,
+										  500000);
+		}
 		
 		if( r < 0){
 			error = r;
@@ -163,6 +202,7 @@ void AudioOutput::stop(){
 	 // Close device.
 	 if (_pcm != NULL) {
 		  snd_pcm_close(_pcm);
+		  _pcm = NULL;
 	 }
 		
 		snd_mixer_detach(_mixer, _MIXER_);
@@ -175,85 +215,272 @@ void AudioOutput::stop(){
 	_isSetup = false;
 }
 
-// Encode a list of samples as signed 16-bit little-endian integers.
-void AudioOutput::samplesToInt16(const SampleVector& samples,
-											vector<uint8_t>& bytes)
+// MARK: -  PCM output
+
+// Clamp to -1.0 - 1.0 and scale to signed 16 bit, rounding to nearest
+// like lrint.  Four samples at a time where the CPU has a rounding
+// float to int convert; the saturating narrow can't overflow after the
+// clamp, so every path gives the same result.
+static void samplesToInt16(const Sample* in, int16_t* out, size_t n)
 {
-	 bytes.resize(2 * samples.size());
-
-	 SampleVector::const_iterator i = samples.begin();
-	 SampleVector::const_iterator n = samples.end();
-	 vector<uint8_t>::iterator k = bytes.begin();
-
-	 while (i != n) {
-		  Sample s = *(i++);
-		  s = max(Sample(-1.0), min(Sample(1.0), s));
-		  long v = lrint(s * 32767);
-		  unsigned long u = v;
-		  *(k++) = u & 0xff;
-		  *(k++) = (u >> 8) & 0xff;
-	 }
+	size_t i = 0;
+	
+#if defined(__ARM_NEON) && (__ARM_ARCH >= 8)
+	const float32x4_t lo = vdupq_n_f32(-1.0f);
+	const float32x4_t hi = vdupq_n_f32(1.0f);
+	const float32x4_t scale = vdupq_n_f32(32767.0f);
+	
+	for (; i + 8 <= n; i += 8) {
+		float32x4_t a = vminq_f32(vmaxq_f32(vld1q_f32(in + i), lo), hi);
+		float32x4_t b = vminq_f32(vmaxq_f32(vld1q_f32(in + i + 4), lo), hi);
+		int32x4_t ia = vcvtnq_s32_f32(vmulq_f32(a, scale));
+		int32x4_t ib = vcvtnq_s32_f32(vmulq_f32(b, scale));
+		vst1q_s16(out + i, vcombine_s16(vqmovn_s32(ia), vqmovn_s32(ib)));
+	}
+#elif defined(__SSE2__)
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 hi = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	
+	for (; i + 8 <= n; i += 8) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi);
+		__m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+		__m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(ia, ib));
+	}
+#endif
+	
+	for (; i < n; i++) {
+		Sample s = max(Sample(-1.0), min(Sample(1.0), in[i]));
+		out[i] = lrintf(s * 32767);
+	}
+}
+
+static inline void samplesToInt16(const int16_t* in, int16_t* out, size_t n)
+{
+	memcpy(out, in, n * sizeof(int16_t));
+}
+
+static inline const int16_t* pcmSamples(const int16_t* in, size_t, vector<int16_t>& )
+{
+	return in;
+}
+
+static inline const int16_t* pcmSamples(const Sample* in, size_t n, vector<int16_t>& buf)
+{
+	buf.resize(n);
+	samplesToInt16(in, buf.data(), n);
+	return buf.data();
 }
 
-bool AudioOutput::writeAudio(const SampleVector& samples)
+// Resamplers are made the first time a rate shows up and kept, so
+// switching sources back and forth only costs clearing the history.
+RationalResampler* AudioOutput::resamplerFor(unsigned int rate, unsigned int channels)
 {
+	RationalResampler* src = NULL;
 	
-	if(!(_isQuiet || _isMuted) ){
-		
-#if defined(__APPLE__)
-		
-		fprintf(stderr,"Output %ld samples\n", samples.size());
-#else
-		// Write data.
-		
-		snd_pcm_writei(_pcm, samples.data(),  samples.size());
-		 
-#endif
+	for(auto &r : _resamplers)
+		if(r.rate == rate && r.channels == channels)
+			src = r.resampler.get();
+	
+	if(!src){
+		src_t r = {rate, channels,
+			make_unique<RationalResampler>(PcmFrames::src_filterOrder,
+													 PcmFrames::srcCutoff(rate, _sampleRate),
+													 rate, _sampleRate, channels)};
+		src = r.resampler.get();
+		_resamplers.push_back(move(r));
 	}
 	
- 	return true;
+	// the history is from the last time this source played
+	if(src != _activeResampler)
+		src->reset();
+	
+	_activeResampler = src;
+	return src;
 }
 
-bool AudioOutput::writeIQ(const SampleVector& samples)
+bool AudioOutput::writeFrames(PcmFrames& frames)
 {
+	unsigned int channels = frames.channels();
+	bool toQuad = _nchannels == 4 && channels == 2;
+	
+	if(channels != _nchannels && !toQuad)
+		return false;
+	
+	unsigned int rate = frames.sampleRate();
+	
+	// the filter history and the rear ring belong to the last source
+	if(_newSource.exchange(false) || frames.format() != _lastFormat
+		|| rate != _lastRate || channels != _lastChannels){
+		_tone.reset();
+		_router.reset();
+		_lastFormat = frames.format();
+		_lastRate = rate;
+		_lastChannels = channels;
+	}
 	
 	if( _isQuiet || _isMuted )
-	{
 		return true;
- 	}
 	
+	size_t n = frames.size();
+	bool convert = rate != 0 && rate != _sampleRate;
 	
-	// Convert samples to bytes.
-	samplesToInt16(samples, _bytebuf);
+	if(!convert)
+		_activeResampler = NULL;
 	
+	// everything after the conversion runs at the PCM rate
+	bool eq = _tone.update(channels, _sampleRate);
 	
+	// S16 blocks go out untouched unless something has to work on them
+	SampleVector* buf = &frames.floats();
+	
+	if(frames.format() == PcmFrames::PCM_S16){
+		if(!eq && !toQuad && !convert)
+			return writeFrames(frames.s16().data(), n);
+		
+		const vector<int16_t>& s16 = frames.s16();
+		size_t count = s16.size();
+		
+		_tonebuf.resize(count);
+		for(size_t i = 0; i < count; i++)
+			_tonebuf[i] = s16[i] * (Sample(1.0) / 32767);
+		buf = &_tonebuf;
+	}
+	
+	if(convert){
+		resamplerFor(rate, channels)->process(*buf, _srcbuf);
+		buf = &_srcbuf;
+		n = _srcbuf.size() / channels;
+	}
+	
+	Sample* samples = buf->data();
+	
+	if(eq)
+		_tone.process(samples, n);
+	
+	if(toQuad){
+		_router.update(_sampleRate);
+		_router.process(samples, n, _quadbuf);
+		return writeFrames(_quadbuf.data(), n);
+	}
+	
+	return writeFrames(samples, n);
+}
+
+bool AudioOutput::writeFrames(const Sample* samples, size_t frames)
+{
+	if( _isQuiet || _isMuted )
+		return true;
+	
+	return writeInterleaved(samples, frames);
+}
+
+bool AudioOutput::writeFrames(const int16_t* samples, size_t frames)
+{
+	if( _isQuiet || _isMuted )
+		return true;
+	
+	return writeInterleaved(samples, frames);
+}
+
+template <class T>
+bool AudioOutput::writeInterleaved(const T* samples, size_t frames)
+{
 #if defined(__APPLE__)
 	
-	fprintf(stderr,"Output %ld samples\n", samples.size());
+	fprintf(stderr,"Output %ld frames\n", frames);
 #else
-	// Write data.
-	unsigned int p = 0;
-	unsigned int n =  (unsigned int) samples.size() / _nchannels;
-	unsigned int framesize = 2 * _nchannels;
+	if(!_pcm)
+		return false;
 	
-	while (p < n) {
-		int k = snd_pcm_writei(_pcm, _bytebuf.data() + p * framesize, n - p);
+	if(!_useMmap){
+		const int16_t* pcm = pcmSamples(samples, frames * _nchannels, _pcmbuf);
 		
-		if (k < 0) {
-			//		ELOG_ERROR(ErrorMgr::FAC_AUDIO, 0, errno, "write failed");
-			// After an underrun, ALSA keeps returning error codes until we
-			// explicitly fix the stream.
-			snd_pcm_recover(_pcm, k, 0);
-			return false;
+		while (frames > 0) {
+			snd_pcm_sframes_t k = snd_pcm_writei(_pcm, pcm, frames);
 			
-		} else {
-			p += k;
+			if (k < 0) {
+				// After an underrun, ALSA keeps returning error codes until we
+				// explicitly fix the stream.
+				if(!recover((int) k))
+					return false;
+			} else {
+				pcm += k * _nchannels;
+				frames -= k;
+			}
+		}
+		return true;
+	}
+	
+	while (frames > 0) {
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(_pcm);
+		
+		if (avail < 0) {
+			if(!recover((int) avail))
+				return false;
+			continue;
+		}
+		
+		if (avail == 0) {
+			// The buffer is full.  A fresh or recovered stream only starts
+			// on its own from writei, a mapped one has to be kicked.
+			int r = snd_pcm_state(_pcm) == SND_PCM_STATE_PREPARED
+						? snd_pcm_start(_pcm) : snd_pcm_wait(_pcm, 1000);
+			if(r < 0 && !recover(r))
+				return false;
+			continue;
+		}
+		
+		const snd_pcm_channel_area_t* areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t count = min((snd_pcm_uframes_t) avail, (snd_pcm_uframes_t) frames);
+		
+		int r = snd_pcm_mmap_begin(_pcm, &areas, &offset, &count);
+		if (r < 0) {
+			if(!recover(r))
+				return false;
+			continue;
+		}
+		
+		// interleaved, so every channel shares the first area
+		int16_t* dst = (int16_t*) ((uint8_t*) areas[0].addr
+											+ (areas[0].first + offset * areas[0].step) / 8);
+		samplesToInt16(samples, dst, count * _nchannels);
+		
+		snd_pcm_sframes_t k = snd_pcm_mmap_commit(_pcm, offset, count);
+		if (k < 0) {
+			if(!recover((int) k))
+				return false;
+			continue;
 		}
+		
+		samples += k * _nchannels;
+		frames -= k;
 	}
+	
 #endif
 	
+	return true;
+}
+
+bool AudioOutput::recover(int err)
+{
+#if defined(__APPLE__)
+	return false;
+#else
+	if(err == -EPIPE)
+		_underruns++;
+	
+	if(snd_pcm_recover(_pcm, err, 1) < 0)
+		return false;
+	
+	if(err != -EINTR)
+		_xrunRecoveries++;
 	
 	return true;
+#endif
 }
 
 
@@ -555,24 +782,19 @@ bool 	AudioOutput::setVolume(double volIn){
  
 	volIn = fmax(0, fmin(1, volIn));  // pin volume
 	
+	// balance is applied to the samples by _tone
 	double left =  volIn;
 	double right  =  volIn;
 	double front =  volIn;
 	double back  =  volIn;
  
-	double adjustedBalance =  volIn * (1 - fabs(_balance));
-
-	if( _balance > 0) {
-		left = adjustedBalance;
-	}else if( _balance < 0) {
-		right = adjustedBalance;
-	}
-	
-	double adjustedFade =  volIn * (1 - fabs(_fader));
+	// with four channels the fader is applied by _router
+	double fader = _nchannels == 4 ? 0 : _fader;
+	double adjustedFade =  volIn * (1 - fabs(fader));
 
-	if( _fader > 0) {
+	if( fader > 0) {
 		back = adjustedFade;
-	}else if( _fader < 0) {
+	}else if( fader < 0) {
 		front = adjustedFade;
 	}
 	return true;
@@ -705,24 +927,19 @@ bool 	AudioOutput::setVolume(double volIn){
 	
 	volIn = fmax(0, fmin(1, volIn));  // pin volume
 	
+	// balance is applied to the samples by _tone
 	double left =  volIn;
 	double right  =  volIn;
 	double front =  volIn;
 	double back  =  volIn;
 	
-	double adjustedBalance =  volIn * (1 - fabs(_balance));
-	
-	if( _balance > 0) {
-		left = adjustedBalance;
-	}else if( _balance < 0) {
-		right = adjustedBalance;
-	}
-	
-	double adjustedFade =  volIn * (1 - fabs(_fader));
+	// with four channels the fader is applied by _router
+	double fader = _nchannels == 4 ? 0 : _fader;
+	double adjustedFade =  volIn * (1 - fabs(fader));
 	
-	if( _fader > 0) {
+	if( fader > 0) {
 		back = adjustedFade;
-	}else if( _fader < 0) {
+	}else if( fader < 0) {
 		front = adjustedFade;
 	}
 	
@@ -767,6 +984,10 @@ bool AudioOutput::setFader(double newFader) {
 	newFader = fmax(-1, fmin(1, newFader));  // pin balance
 
 	_fader = newFader;
+	_router.setFader(newFader);
+	
+	// a stereo PCM is duplicated to the rear speakers after the samples,
+	// only the mixer can tell front from rear there
 	return setVolume(volume());
 }
 
@@ -782,7 +1003,8 @@ bool AudioOutput::setBalance(double newBal) {
 	newBal = fmax(-1, fmin(1, newBal));  // pin balance
 
 	_balance = newBal;
-	return setVolume(volume());
+	_tone.setBalance(newBal);
+	return true;
 }
 
 
@@ -821,7 +1043,8 @@ bool AudioOutput::setBass(double val) {
 	val = fmax(-1, fmin(1, val));  // pin balance
 
 	_bass = val;
-	return true;;
+	_tone.setBass(val);
+	return true;
 }
 
 
@@ -835,7 +1058,8 @@ bool AudioOutput::setTreble(double val) {
 	val = fmax(-1, fmin(1, val));  // pin balance
 
 	_treble = val;
-	return true;;
+	_tone.setTreble(val);
+	return true;
 }
 
 
@@ -848,7 +1072,8 @@ bool AudioOutput::setMidrange(double val) {
 	val = fmax(-1, fmin(1, val));  // pin balance
 
 	_midrange = val;
-	return true;;
+	_tone.setMidrange(val);
+	return true;
 }
 
 
@@ -6,12 +6,18 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <mutex>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "IQSample.h"
+#include "PcmFrames.hpp"
+#include "ToneControl.hpp"
+#include "QuadRouter.hpp"
+#include "Filter.hpp"
 #include "RtlSdr.hpp"
 
 #include "ErrorMgr.hpp"
@@ -40,10 +46,45 @@ public:
 	
 	bool begin(unsigned int samplerate = 44100,  bool stereo = true);
 	bool begin(unsigned int samplerate,  bool stereo,  int &error);
+	
+	/** Four channels, FL FR RL RR.  Stereo blocks are spread over the
+	 *  front and rear pairs and the fader is applied to the samples. */
+	bool beginQuad(unsigned int samplerate,  int &error);
 	void stop();
 	
-	bool writeAudio(const SampleVector& samples);
-	bool writeIQ(const SampleVector& samples);
+	unsigned int channels() {return _nchannels;};
+	
+	/** The PCM stays open at this rate, blocks at other rates are converted to it. */
+	unsigned int sampleRate() {return _sampleRate;};
+	
+	/** Rear pair delay in ms and low-pass corner in Hz (0 for none), quad only. */
+	void setRearDelay(double ms) 		{ _router.setRearDelay(ms); };
+	void setRearLowPass(double hz) 	{ _router.setRearLowPass(hz); };
+	
+	/**
+	 * A block from any source, float or S16, with as many channels as the
+	 * PCM.  Tone controls, balance and fader are applied in place to float
+	 * blocks, S16 blocks are only converted when the tone isn't flat.
+	 */
+	bool writeFrames(PcmFrames& frames);
+	
+	/** The next block is from another source, the EQ and rear delay
+	 *  start over.  A change of format, rate or channels does the same. */
+	void newSource() { _newSource = true; };
+	
+	/**
+	 * Write interleaved frames to the PCM, blocking until all are queued.
+	 * Float samples are clamped to -1.0 - 1.0 and converted on the way
+	 * into the ring buffer.
+	 */
+	bool writeFrames(const Sample* samples, size_t frames);
+	bool writeFrames(const int16_t* samples, size_t frames);
+	
+	/** Times ALSA reported an underrun (-EPIPE). */
+	uint64_t underruns() {return _underruns;};
+	
+	/** Times the stream was recovered after an xrun or suspend. */
+	uint64_t xrunRecoveries() {return _xrunRecoveries;};
 	
 	bool 	setVolume(double );		// 0.0 - 1.0  % of max
 	double volume();
@@ -75,6 +116,7 @@ private:
 	
 	bool						_isSetup;
 	unsigned int         _nchannels;
+	unsigned int         _sampleRate;
 	struct _snd_pcm *   	_pcm;
 	
 	snd_mixer_t* 			_mixer;
@@ -91,8 +133,36 @@ private:
 	bool						_isMuted = false;
 	bool						_isQuiet= false;
 
-	vector<uint8_t>  		_bytebuf;
+	bool						_useMmap;
+	ToneControl				_tone;
+	QuadRouter				_router;
+	atomic<bool>			_newSource;			// set by newSource(), taken by the audio thread
+	PcmFrames::pcm_format_t	_lastFormat;		// of the last block, audio thread only
+	unsigned int			_lastRate;
+	unsigned int			_lastChannels;
+	SampleVector			_quadbuf;			// routed frames for a four channel PCM
+	
+	typedef struct {
+		unsigned int						rate;
+		unsigned int						channels;
+		unique_ptr<RationalResampler>	resampler;
+	} src_t;
+	
+	vector<src_t>			_resamplers;		// one per input format seen, kept for the next switch back
+	RationalResampler*	_activeResampler;
+	SampleVector			_srcbuf;				// frames converted to _sampleRate
+	
+	RationalResampler*	resamplerFor(unsigned int rate, unsigned int channels);
+	SampleVector			_tonebuf;			// S16 blocks on their way through the EQ
+	vector<int16_t>		_pcmbuf;			// converted frames when the PCM can't be mapped
+	atomic<uint64_t>		_underruns;
+	atomic<uint64_t>		_xrunRecoveries;
+
+	template <class T>
+	bool  writeInterleaved(const T* samples, size_t frames);
+	
+	bool  recover(int err);
 	
-	void  samplesToInt16(const SampleVector& samples, vector<uint8_t>& bytes);
+	bool  openPCM(unsigned int samplerate,  unsigned int channels,  int &error);
 };
 
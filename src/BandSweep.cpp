@@ -0,0 +1,299 @@
+//
+//  BandSweep.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+
+#include "BandSweep.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+// MARK: -   BandSweep
+
+BandSweep::BandSweep(uint32_t sampleRate)
+: _analyzer(fft_size, fft_size)
+, _channelizer(pilot_filter_order, pilot_decimation)
+{
+	_sampleRate = sampleRate;
+
+	// every window has the same layout around its tuner frequency,
+	// so one bank of channel filters serves the whole sweep
+	double mpx_rate = double(sampleRate) / pilot_decimation;
+	for(unsigned int ch = 0; ch < channels_per_window; ch++){
+		_channelizer.add_channel(channelOffset(ch) / sampleRate,
+										 FmDecoder::default_bandwidth_if / sampleRate);
+		_discriminators.emplace_back(FmDecoder::default_freq_dev / mpx_rate);
+	}
+
+	_running = false;
+	_active = false;
+	_completionCB = NULL;
+	_firstChannel = 0;
+	_lastChannel = 0;
+	_nextCapture = 0;
+	_analyzed = 0;
+	_mailboxFreq = 0;
+	_full = false;
+}
+
+BandSweep::~BandSweep(){
+	cancel();
+	stop();
+}
+
+bool BandSweep::begin(){
+
+	if(_running)
+		return true;
+
+	_running = true;
+	pthread_create(&_sweeperTID, NULL,
+						(THREADFUNCPTR) &BandSweep::SweeperThread, (void*)this);
+	return true;
+}
+
+void BandSweep::stop(){
+
+	if(!_running)
+		return;
+
+	{
+		lock_guard<mutex> lock(_mutex);
+		_running = false;
+	}
+	_cond.notify_all();
+	pthread_join(_sweeperTID, NULL);
+}
+
+bool BandSweep::start(completion_t cb, uint32_t firstChannel, uint32_t lastChannel){
+
+	unique_lock<mutex> lock(_mutex);
+
+	if(_active || !_running || lastChannel < firstChannel)
+		return false;
+
+	// a window of a cancelled sweep may still be on the bench
+	_cond.wait(lock, [this]{ return !_full || !_running; });
+
+	_windows.clear();
+	double center = channelOffset(channels_per_window - 1);
+	for(uint32_t freq = firstChannel; freq <= lastChannel;
+		 freq += channels_per_window * channel_spacing){
+		_windows.push_back(freq + uint32_t(center));
+	}
+
+	_firstChannel = firstChannel;
+	_lastChannel = lastChannel;
+	_nextCapture = 0;
+	_analyzed = 0;
+	_found.clear();
+	_completionCB = cb;
+	_active = true;
+
+	return true;
+}
+
+void BandSweep::cancel(){
+
+	completion_t cb = NULL;
+	{
+		lock_guard<mutex> lock(_mutex);
+		if(!_active)
+			return;
+
+		_active = false;
+		cb = _completionCB;
+		_completionCB = NULL;
+	}
+
+	if(cb)
+		cb(false, {});
+}
+
+bool BandSweep::nextWindow(uint32_t &tunerFreq){
+
+	lock_guard<mutex> lock(_mutex);
+
+	if(!_active || _nextCapture >= _windows.size())
+		return false;
+
+	tunerFreq = _windows[_nextCapture++];
+	return true;
+}
+
+bool BandSweep::submit(uint32_t tunerFreq, IQSampleVector& samples){
+
+	unique_lock<mutex> lock(_mutex);
+
+	_cond.wait(lock, [this]{ return !_full || !_running; });
+	if(!_active || !_running)
+		return false;
+
+	_mailbox.swap(samples);
+	_mailboxFreq = tunerFreq;
+	_full = true;
+	lock.unlock();
+
+	_cond.notify_all();
+	return true;
+}
+
+// Goertzel power of one tone, relative units.
+double BandSweep::tonePower(const SampleVector& x, size_t start, double freq){
+
+	double coeff = 2.0 * cos(2.0 * M_PI * freq);
+	double s1 = 0, s2 = 0;
+
+	for(size_t i = start, n = x.size(); i < n; i++){
+		double s0 = x[i] + coeff * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+
+	return s1 * s1 + s2 * s2 - coeff * s1 * s2;
+}
+
+// Pilot against the quiet band between mono audio and the stereo subcarrier.
+double BandSweep::pilotSNR(unsigned int ch){
+
+	double mpx_rate = double(_sampleRate) / pilot_decimation;
+
+	_discriminators[ch].process(_channelizer.channel_output(ch), _mpx);
+	if(_mpx.size() <= pilot_settle)
+		return 0;
+
+	double pilot = tonePower(_mpx, pilot_settle, FmDecoder::pilot_freq / mpx_rate);
+
+	static const double guard[] = {16500, 17500, 20500, 21500};
+	double noise = 0;
+	for(auto freq : guard)
+		noise += tonePower(_mpx, pilot_settle, freq / mpx_rate);
+	noise /= sizeof(guard) / sizeof(guard[0]);
+
+	return 10 * log10((pilot + 1.0e-20) / (noise + 1.0e-20));
+}
+
+void BandSweep::analyze(uint32_t tunerFreq, const IQSampleVector& samples,
+								vector<station_t>& found){
+
+	_analyzer.process(samples);
+	_analyzer.finishFrame(_bins);
+
+	double binHz = double(_sampleRate) / fft_size;
+	int half = fft_size / 2;
+
+	// noise floor from the quietest tenth of the window, stations are at
+	// most four channels of it and the gaps between them are plenty
+	_floorBins.clear();
+	for(int b = 0; b < (int)fft_size; b++){
+		double offset = fabs((b - half) * binHz);
+		if(offset > dc_guard && offset < usable_span)
+			_floorBins.push_back(_bins[b]);
+	}
+	if(_floorBins.empty())
+		return;
+
+	auto nth = _floorBins.begin() + _floorBins.size() / 10;
+	nth_element(_floorBins.begin(), nth, _floorBins.end());
+	double noiseFloor = *nth;
+
+	double level[channels_per_window];
+	bool candidate[channels_per_window];
+	bool anyCandidate = false;
+
+	for(unsigned int ch = 0; ch < channels_per_window; ch++){
+		uint32_t freq = tunerFreq + int(channelOffset(ch));
+
+		candidate[ch] = false;
+		level[ch] = -200;
+		if(freq < _firstChannel || freq > _lastChannel)
+			continue;
+
+		int first = half + (int) ceil((channelOffset(ch) - carrier_halfwidth) / binHz);
+		int last  = half + (int) floor((channelOffset(ch) + carrier_halfwidth) / binHz);
+
+		double power = 0;
+		for(int b = first; b <= last; b++)
+			power += pow(10.0, _bins[b] / 10.0);
+		level[ch] = 10 * log10(power / (last - first + 1) + 1.0e-20);
+
+		if(level[ch] - noiseFloor >= min_snr){
+			candidate[ch] = true;
+			anyCandidate = true;
+		}
+	}
+
+	if(!anyCandidate)
+		return;
+
+	_channelizer.process(samples);
+
+	for(unsigned int ch = 0; ch < channels_per_window; ch++){
+		if(!candidate[ch])
+			continue;
+
+		double snr = level[ch] - noiseFloor;
+		bool pilot = pilotSNR(ch) >= min_pilot_snr;
+
+		if(pilot || snr >= mono_snr){
+			station_t station = {
+				tunerFreq + int(channelOffset(ch)),
+				float(level[ch]),
+				float(snr),
+				pilot
+			};
+			found.push_back(station);
+		}
+	}
+}
+
+void BandSweep::Sweeper(){
+
+	while(true){
+
+		uint32_t tunerFreq;
+		{
+			unique_lock<mutex> lock(_mutex);
+			_cond.wait(lock, [this]{ return _full || !_running; });
+			if(!_running)
+				break;
+			tunerFreq = _mailboxFreq;
+		}
+
+		// the capture side is tuning and reading the next window meanwhile
+		analyze(tunerFreq, _mailbox, _found);
+
+		completion_t cb = NULL;
+		vector<station_t> stations;
+		{
+			lock_guard<mutex> lock(_mutex);
+			_full = false;
+			_analyzed++;
+
+			if(_active && _analyzed == _windows.size()){
+				_active = false;
+				cb = _completionCB;
+				_completionCB = NULL;
+
+				stations.swap(_found);
+				sort(stations.begin(), stations.end(),
+					  [] (const station_t& a, const station_t& b) { return a.frequency < b.frequency; });
+			}
+		}
+		_cond.notify_all();
+
+		if(cb)
+			cb(true, stations);
+	}
+}
+
+void* BandSweep::SweeperThread(void *context){
+	BandSweep* d = (BandSweep*)context;
+
+	d->Sweeper();
+
+	pthread_exit(NULL);
+	return((void *)1);
+}
@@ -0,0 +1,138 @@
+//
+//  BandSweep.hpp
+//  carradio
+//
+//  Station discovery across the FM band.
+//
+//  The band is cut into windows of four channels that one 1 MS/s capture
+//  covers, the tuner sits between the middle two so every channel is
+//  100 or 300 kHz off the LO, clear of the DC spike and the filter edge.
+//  RadioMgr steps the tuner through the windows and hands over one block
+//  from each.  The block is swapped into a mailbox and analysed on the
+//  sweep thread while the next window is being captured, so the sweep
+//  takes about as long as the captures themselves.
+//
+//  A window is FFTed and each channel's carrier level compared with the
+//  noise floor of the window.  Channels that stand out are demodulated
+//  and checked for the 19 kHz stereo pilot, which no noise or spur has.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <pthread.h>
+
+#include "IQSample.h"
+#include "Filter.hpp"
+#include "FmDecode.hpp"
+#include "SpectrumAnalyzer.hpp"
+
+using namespace std;
+
+class BandSweep
+{
+public:
+
+	static constexpr uint32_t 		default_firstChannel = 87900000;
+	static constexpr uint32_t 		default_lastChannel	= 107900000;
+	static constexpr uint32_t 		channel_spacing		= 200000;
+	static constexpr unsigned int channels_per_window	= 4;
+
+	static constexpr double 		min_snr			= 12.0;	// dB carrier over the window floor
+	static constexpr double 		mono_snr			= 25.0;	// dB, accepted without a pilot
+	static constexpr double 		min_pilot_snr	= 10.0;	// dB 19 kHz over the MPX guard band
+
+	typedef struct {
+		uint32_t		frequency;
+		float			level;		// dBFS, averaged over the channel
+		float			snr;			// dB over the window noise floor
+		bool			pilot;		// stereo pilot found
+	} station_t;
+
+	/** Called once per sweep from the sweep thread, or from cancel(). */
+	typedef std::function<void(bool completed, vector<station_t> stations)> completion_t;
+
+	BandSweep(uint32_t sampleRate = 1000000);
+	~BandSweep();
+
+	/** Start the sweep thread. */
+	bool begin();
+	void stop();
+
+	/** Plan the windows for a new sweep, false if one is running. */
+	bool start(completion_t cb,
+				  uint32_t firstChannel = default_firstChannel,
+				  uint32_t lastChannel = default_lastChannel);
+
+	/** Abandon the sweep, the completion is called with completed false. */
+	void cancel();
+
+	bool isActive() {return _active;};
+
+	/** Tuner frequency of the next window to capture, false once all are. */
+	bool nextWindow(uint32_t &tunerFreq);
+
+	/**
+	 * Hand over the block captured at tunerFreq.  samples is swapped with
+	 * the spent block of the last window, this only waits if that one is
+	 * still being analysed.
+	 */
+	bool submit(uint32_t tunerFreq, IQSampleVector& samples);
+
+	/** Analyse one window, stations found are appended.  For the benchmark. */
+	void analyze(uint32_t tunerFreq, const IQSampleVector& samples,
+					 vector<station_t>& found);
+
+private:
+
+	static constexpr unsigned int fft_size 			= 1024;
+	static constexpr unsigned int pilot_decimation 	= 4;		// 250 kS/s MPX
+	static constexpr unsigned int pilot_filter_order = 48;
+	static constexpr unsigned int pilot_settle 		= 64;		// MPX samples of old window
+	static constexpr double 		carrier_halfwidth = 80.0e3;	// Hz averaged for the level
+	static constexpr double 		dc_guard 			= 10.0e3;
+	static constexpr double 		usable_span 		= 450.0e3;	// +/- Hz around the tuner
+
+	double channelOffset(unsigned int ch) {
+		return (ch - (channels_per_window - 1) / 2.0) * channel_spacing;
+	}
+
+	double pilotSNR(unsigned int ch);
+
+	static double tonePower(const SampleVector& x, size_t start, double freq);
+
+	void Sweeper();
+	static void* SweeperThread(void *context);
+
+	uint32_t							_sampleRate;
+
+	SpectrumAnalyzer				_analyzer;			// used synchronously
+	vector<float>					_bins;
+	vector<float>					_floorBins;
+	Channelizer						_channelizer;
+	vector<PhaseDiscriminator>	_discriminators;
+	SampleVector					_mpx;
+
+	mutex								_mutex;
+	condition_variable			_cond;
+	atomic<bool>					_running;
+	atomic<bool>					_active;
+	pthread_t						_sweeperTID;
+
+	completion_t					_completionCB;
+	vector<uint32_t>				_windows;			// tuner frequencies
+	uint32_t							_firstChannel;
+	uint32_t							_lastChannel;
+	size_t							_nextCapture;
+	size_t							_analyzed;
+
+	IQSampleVector					_mailbox;
+	uint32_t							_mailboxFreq;
+	bool								_full;				// mailbox belongs to the sweeper
+	vector<station_t>				_found;
+};
@@ -861,6 +861,11 @@ void DisplayMgr::showAirplayChange(){
 		setEvent(EVT_NONE, MODE_RADIO );
 }
 
+void DisplayMgr::showRDSChange(){
+	if(_current_mode == MODE_RADIO)
+		setEvent(EVT_NONE, MODE_RADIO );
+}
+
 
 void DisplayMgr::showScannerChange(bool force){
 	
@@ -885,6 +890,11 @@ void DisplayMgr::showGPS(knobCallBack_t cb){
 	setEvent(EVT_PUSH, MODE_GPS);
 }
 
+void DisplayMgr::showSpectrum(knobCallBack_t cb){
+	_knobCB = cb;
+	setEvent(EVT_PUSH, MODE_SPECTRUM);
+}
+
 void DisplayMgr::showCANbus(uint8_t page){
 	_currentPage = page;
 	setEvent(EVT_PUSH, MODE_CANBUS);
@@ -938,6 +948,7 @@ bool  DisplayMgr::usesSelectorKnob(){
 	switch (_current_mode) {
 		case MODE_CANBUS:
 		case MODE_GPS:
+		case MODE_SPECTRUM:
 		case MODE_GPS_WAYPOINT:
 		case MODE_CHANNEL_INFO:
 		case MODE_GPS_WAYPOINTS:
@@ -1071,6 +1082,10 @@ bool DisplayMgr::processSelectorKnobAction( knob_action_t action){
 			wasHandled = processSelectorKnobActionForGPS(action);
 			break;
 			
+		case MODE_SPECTRUM:
+			wasHandled = processSelectorKnobActionForSpectrum(action);
+			break;
+			
 		case MODE_DTC_INFO:
 			wasHandled = processSelectorKnobActionForDTCInfo(action);
 			break;
@@ -1293,6 +1308,7 @@ bool DisplayMgr::isStickyMode(mode_state_t md){
 		case MODE_RADIO:
 		case MODE_SCANNER:
 		case MODE_GPS:
+		case MODE_SPECTRUM:
 		case MODE_GPS_WAYPOINT:
 		case MODE_INFO:
 		case MODE_CANBUS:
@@ -1579,9 +1595,18 @@ void DisplayMgr::DisplayUpdateLoop(){
 					}
 				}
 				
+				else if(_current_mode == MODE_SPECTRUM) {
+					
+					// check for {EVT_NONE,MODE_SPECTRUM}  which is a new spectrum
+					if(item.mode == MODE_SPECTRUM) {
+						shouldRedraw = false;
+						shouldUpdate = true;
+					}
+				}
+				
 				else if(_current_mode == MODE_RADIO) {
 					
-					// check for {EVT_NONE,MODE_RADIO}  which is a airplay change
+					// check for {EVT_NONE,MODE_RADIO}  which is a airplay or RDS change
 					if(item.mode == MODE_RADIO) {
 						shouldRedraw = false;
 						shouldUpdate = true;
@@ -1808,6 +1833,10 @@ void DisplayMgr::drawMode(modeTransition_t transition,
 				drawGPSScreen(transition);
 				break;
 				
+			case MODE_SPECTRUM:
+				drawSpectrumScreen(transition);
+				break;
+				
 			case MODE_GPS_WAYPOINTS:
 				drawGPSWaypointsScreen(transition);
 				break;
@@ -2095,31 +2124,21 @@ void DisplayMgr::drawRadioScreen(modeTransition_t transition){
 				_vfd.setFont(VFD::FONT_MINI); _vfd.write( " ");
 				_vfd.setFont(VFD::FONT_5x7); _vfd.write( hzstr);
 				
-				// Draw title centered inb char buffer
-				constexpr int  titleMaxSize = 20;
-				char titlebuff[titleMaxSize + 1];
-				memset(titlebuff,' ', titleMaxSize);
-				titlebuff[titleMaxSize] = '\0';
-				int titleStart =  centerX - ((titleMaxSize * 6)/2);
-				int titleBottom = centerY -10;
-				PiCarMgr::station_info_t info;
-				if(mgr->getStationInfo(mode, freq, info)){
-					string title = truncate(info.title, titleMaxSize);
-					int titleLen = (int)title.size();
-					int offset  = (titleMaxSize /2) - (titleLen/2);
-					memcpy( titlebuff+offset , title.c_str(), titleLen );
-				};
-				TRY(_vfd.setCursor( titleStart ,titleBottom ));
-				TRY(_vfd.write( titlebuff));
-				
+				drawRadioTitle(mode, freq);
 			}
 			_vfd.setCursor(0, 60);
+			int pty = 0;
 			if(mgr->isPresetChannel(mode, freq)){
 				_vfd.setFont(VFD::FONT_MINI);
-				_vfd.printPacket("PRESET");
+				_vfd.printPacket("PRESET  ");
+			}
+			else if(mode == RadioMgr::BROADCAST_FM
+					  && mgr->db()->getIntValue(VAL_RDS_PTY, pty) && pty > 0){
+				_vfd.setFont(VFD::FONT_MINI);
+				_vfd.printPacket("%-8s", RadioMgr::ptyString(pty).c_str());
 			}
 			else {
-				_vfd.printPacket("      ");
+				_vfd.printPacket("        ");
 			}
 		}
 	}
@@ -2135,6 +2154,10 @@ void DisplayMgr::drawRadioScreen(modeTransition_t transition){
 		
 		drawReceptionBars(0, centerY+19, radio->get_if_level());
 		_vfd.printPacket("%-8s", radio->isSquelched()?"SQLCH":"" );
+		
+		// keep the radiotext paging
+		if(mode == RadioMgr::BROADCAST_FM && transition == TRANS_IDLE)
+			drawRadioTitle(mode, radio->frequency());
 	}
 	
 	drawEngineCheck();
@@ -2142,6 +2165,76 @@ void DisplayMgr::drawRadioScreen(modeTransition_t transition){
 	drawTimeBox();
 }
 
+// Station title, or the RDS station name when we don't have one.  RDS
+// radiotext pages through the same line a couple of seconds at a time,
+// with the name shown between passes.
+
+void DisplayMgr::drawRadioTitle(RadioMgr::radio_mode_t mode, uint32_t freq){
+	
+	PiCarMgr* mgr	= PiCarMgr::shared();
+	PiCarDB*	db 	= mgr->db();
+	
+	int centerX = _vfd.width() /2;
+	int centerY = _vfd.height() /2;
+	
+	constexpr int  titleMaxSize = 20;
+	constexpr int  pageSeconds = 2;
+	
+	string title;
+	PiCarMgr::station_info_t info;
+	if(mgr->getStationInfo(mode, freq, info))
+		title = info.title;
+	
+	if(mode == RadioMgr::BROADCAST_FM){
+		string ps, rt;
+		
+		if(title.empty() && db->getStringValue(VAL_RDS_PS, ps))
+			title = Utils::trim(ps);
+		
+		if(db->getStringValue(VAL_RDS_RT, rt))
+			rt = Utils::trim(rt);
+		
+		// break the text into lines at word boundaries
+		vector<string> pages;
+		while(!rt.empty()){
+			size_t len = rt.size();
+			if(len > titleMaxSize){
+				len = rt.find_last_of(' ', titleMaxSize);
+				if(len == string::npos || len == 0)
+					len = titleMaxSize;
+			}
+			pages.push_back(Utils::trim(rt.substr(0, len)));
+			rt = Utils::trimStart(rt.substr(len));
+		}
+		
+		if(!pages.empty()){
+			int page = (time(NULL) / pageSeconds) % (pages.size() + 1);
+			if(page > 0)
+				title = pages[page - 1];
+			else if(title.empty())
+				title = pages[0];
+		}
+	}
+	
+	// Draw title centered inb char buffer
+	char titlebuff[titleMaxSize + 1];
+	memset(titlebuff,' ', titleMaxSize);
+	titlebuff[titleMaxSize] = '\0';
+	int titleStart =  centerX - ((titleMaxSize * 6)/2);
+	int titleBottom = centerY -10;
+	
+	if(!title.empty()){
+		title = truncate(title, titleMaxSize);
+		int titleLen = (int)title.size();
+		int offset  = (titleMaxSize /2) - (titleLen/2);
+		memcpy( titlebuff+offset , title.c_str(), titleLen );
+	}
+	
+	_vfd.setFont(VFD::FONT_5x7);
+	TRY(_vfd.setCursor( titleStart ,titleBottom ));
+	TRY(_vfd.write( titlebuff));
+}
+
 // MARK: -  other draws Screens
 
 
@@ -2706,6 +2799,91 @@ void DisplayMgr::drawCANBusScreen1(modeTransition_t transition){
 
 
 
+void DisplayMgr::drawSpectrumScreen(modeTransition_t transition){
+	
+	constexpr uint8_t topRow 	= 12;
+	constexpr uint8_t bottomRow = 63;
+	constexpr float 	 range_dB 	= 60;
+	
+	RadioMgr*			radio 	= PiCarMgr::shared()->radio();
+	SpectrumAnalyzer*	spectrum = radio->spectrum();
+	
+	uint8_t width = _vfd.width();
+	uint8_t plotHeight = bottomRow - topRow;
+	
+	if(transition == TRANS_LEAVING) {
+		spectrum->setEnabled(false);
+		spectrum->setFrameCallback(NULL);
+		return;
+	}
+	
+	if(transition == TRANS_ENTERING) {
+		_vfd.clearScreen();
+		
+		_vfd.setFont(VFD::FONT_MINI);
+		_vfd.setCursor(2, 7);
+		_vfd.printPacket("SPECTRUM");
+		
+		uint32_t freq = radio->frequency();
+		RadioMgr::radio_mode_t mode;
+		radio->getCurrentScannerChannel(mode, freq);
+		
+		if(radio->isOn() && freq > 1000){
+			string str = RadioMgr::hertz_to_string(freq, 3) + " "
+							+ RadioMgr::freqSuffixString(freq);
+			_vfd.setCursor(width - (str.size() * 5) - 2, 7);
+			_vfd.write(str);
+			
+			// the station sits a quarter sample rate below the tuner
+			uint8_t x = width / 4;
+			uint8_t buff[] = {VFD::VFD_SET_AREA, x, static_cast<uint8_t>(topRow - 3), x, static_cast<uint8_t>(topRow - 2)};
+			_vfd.writePacket(buff, sizeof(buff), 0);
+		}
+		
+		_spectrumHeights.assign(width, 0);
+		_spectrumFloor = 0;
+		
+		spectrum->setFrameCallback([=](){
+			setEvent(EVT_NONE, MODE_SPECTRUM);
+		});
+		spectrum->setEnabled(true);
+	}
+	
+	vector<float> columns;
+	if(!spectrum->getSpectrum(columns))
+		return;
+	
+	// noise floor from the quiet part of the band, smoothed so the
+	// picture does not bounce
+	vector<float> sorted = columns;
+	nth_element(sorted.begin(), sorted.begin() + sorted.size() / 10, sorted.end());
+	float floor_dB = sorted[sorted.size() / 10] - 3;
+	_spectrumFloor = (_spectrumFloor == 0) ? floor_dB : 0.8 * _spectrumFloor + 0.2 * floor_dB;
+	
+	// only send the columns whose bar changed, a full redraw is too
+	// much for the serial link at this rate
+	vector<uint8_t> buff;
+	
+	for(uint8_t x = 0; x < width && x < columns.size(); x++){
+		float level = (columns[x] - _spectrumFloor) / range_dB;
+		uint8_t h = uint8_t(min(max(level, 0.0f), 1.0f) * plotHeight);
+		uint8_t old = _spectrumHeights[x];
+		
+		if(h > old){
+			buff.insert(buff.end(), {VFD::VFD_SET_AREA, x, static_cast<uint8_t>(bottomRow - h + 1),
+				x, static_cast<uint8_t>(bottomRow - old)});
+		}
+		else if(h < old){
+			buff.insert(buff.end(), {VFD::VFD_CLEAR_AREA, x, static_cast<uint8_t>(bottomRow - old + 1),
+				x, static_cast<uint8_t>(bottomRow - h)});
+		}
+		_spectrumHeights[x] = h;
+	}
+	
+	if(buff.size())
+		_vfd.writePacket(buff.data(), buff.size(), 0);
+}
+
 void DisplayMgr::drawGPSScreen(modeTransition_t transition){
 	
 	uint8_t col = 0;
@@ -4174,6 +4352,25 @@ void DisplayMgr::drawEditStringScreen(modeTransition_t transition){
 // MARK: -  GPS waypoints
 
 
+bool DisplayMgr::processSelectorKnobActionForSpectrum( knob_action_t action){
+	bool wasHandled = false;
+	
+	auto savedCB = _knobCB;
+	
+	if(action == KNOB_DOUBLE_CLICK){
+		
+		popMode();
+		_knobCB = NULL;
+		wasHandled = true;
+		
+		if(savedCB) {
+			savedCB(action);
+		}
+	}
+	
+	return wasHandled;
+}
+
 bool DisplayMgr::processSelectorKnobActionForGPS( knob_action_t action){
 	bool wasHandled = false;
 	
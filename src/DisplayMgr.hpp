@@ -80,7 +80,8 @@ public:
 		MODE_SCANNER_CHANNELS,
 		MODE_CHANNEL_INFO,
 		MODE_SLIDER,
-		MODE_SELECT_SLIDER
+		MODE_SELECT_SLIDER,
+		MODE_SPECTRUM
 	}mode_state_t;
 
 	mode_state_t active_mode();
@@ -120,6 +121,9 @@ public:
 	
 	typedef std::function<void(knob_action_t action)> knobCallBack_t;
 	void showGPS(knobCallBack_t cb = nullptr);
+	
+	/** Band activity around the tuned station, double click to leave. */
+	void showSpectrum(knobCallBack_t cb = nullptr);
 
 	typedef std::function<void(bool didSucceed,
 										string uuid,
@@ -188,6 +192,7 @@ public:
 	void showRadioChange();
 	void showScannerChange(bool force = true);
 	void showAirplayChange();
+	void showRDSChange();
 	void enableAutoPlay(bool val) { _shouldAutoPlay	= val;};
  
 	void showCANbus(uint8_t page = 0);
@@ -252,12 +257,18 @@ private:
 	bool processSelectorKnobActionForScannerChannels( knob_action_t action);
 	bool processSelectorKnobActionForChannelInfo( knob_action_t action);
 	bool processSelectorKnobActionForInfo( knob_action_t action);
+	bool processSelectorKnobActionForSpectrum( knob_action_t action);
 	 
 	void drawRadioScreen(modeTransition_t transition);
+	void drawRadioTitle(RadioMgr::radio_mode_t mode, uint32_t freq);
 	void drawScannerScreen(modeTransition_t transition);
  
 	void drawGPSScreen(modeTransition_t transition);
  
+	void drawSpectrumScreen(modeTransition_t transition);
+	vector<uint8_t>	_spectrumHeights;		// bar drawn in each column
+	float					_spectrumFloor = 0;		// dB at the bottom of the plot
+ 
 	void drawCANBusScreen(modeTransition_t transition);
 	void drawCANBusScreen1(modeTransition_t transition);
 
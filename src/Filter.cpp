@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <algorithm>
 #include <complex>
+#include <numeric>
 
 #include "Filter.hpp"
 
@@ -57,6 +58,14 @@ FineTuner::FineTuner(unsigned int table_size, int freq_shift)
 	 : m_index(0)
 	 , m_table(table_size)
 {
+	 set_freq_shift(freq_shift);
+}
+
+
+// Change frequency shift.
+void FineTuner::set_freq_shift(int freq_shift)
+{
+	 unsigned int table_size = m_table.size();
 	 double phase_step = 2.0 * M_PI / double(table_size);
 	 for (unsigned int i = 0; i < table_size; i++) {
 		  double phi = (((int64_t)freq_shift * i) % table_size) * phase_step;
@@ -64,6 +73,7 @@ FineTuner::FineTuner(unsigned int table_size, int freq_shift)
 		  double psin = sin(phi);
 		  m_table[i] = IQSample(pcos, psin);
 	 }
+	 m_index = 0;
 }
 
 
@@ -144,10 +154,329 @@ void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
 }
 
 
+/* ****************  class DecimatingFilterFirIQ  **************** */
+
+// Construct decimating low-pass filter.
+DecimatingFilterFirIQ::DecimatingFilterFirIQ(unsigned int filter_order,
+															double cutoff,
+															unsigned int decimation)
+	 : m_decimation(decimation)
+	 , m_pos(0)
+	 , m_buf(filter_order)
+{
+	 assert(decimation >= 1);
+	 make_lanczos_coeff(filter_order, cutoff, m_coeff);
+}
+
+
+// Change cutoff frequency.
+void DecimatingFilterFirIQ::set_cutoff(double cutoff)
+{
+	 make_lanczos_coeff(m_coeff.size() - 1, cutoff, m_coeff);
+}
+
+
+// Clear the history, as constructed.
+void DecimatingFilterFirIQ::reset()
+{
+	 m_pos = 0;
+	 m_buf.assign(m_coeff.size() - 1, IQSample(0));
+}
+
+
+// Process samples.
+void DecimatingFilterFirIQ::process(const IQSampleVector& samples_in,
+												IQSampleVector& samples_out)
+{
+	 unsigned int order = m_coeff.size() - 1;
+	 unsigned int n = samples_in.size();
+
+	 // Append the new block behind the last 'order' input samples so that
+	 // every output is a straight dot product over contiguous memory.
+	 m_buf.resize(order + n);
+	 copy(samples_in.begin(), samples_in.end(), m_buf.begin() + order);
+
+	 unsigned int p = m_pos;
+	 samples_out.resize(p < n ? (n - p + m_decimation - 1) / m_decimation : 0);
+
+	 const IQSample::value_type* coeff = m_coeff.data();
+	 const IQSample::value_type* buf =
+		  reinterpret_cast<const IQSample::value_type*>(m_buf.data());
+
+	 // Output at input position p uses inputs p-order .. p, which live at
+	 // m_buf[p .. p+order].  Coefficients are symmetric.
+	 unsigned int i = 0;
+	 for (; p < n; p += m_decimation, i++) {
+		  const IQSample::value_type* x = buf + 2 * p;
+		  IQSample::value_type yr = 0, yi = 0;
+		  for (unsigned int j = 0; j <= order; j++) {
+				yr += x[2*j]   * coeff[j];
+				yi += x[2*j+1] * coeff[j];
+		  }
+		  samples_out[i] = IQSample(yr, yi);
+	 }
+
+	 assert(i == samples_out.size());
+
+	 // Update position in the next block.
+	 m_pos = p - n;
+
+	 // Keep the last 'order' samples as state.
+	 copy(m_buf.end() - order, m_buf.end(), m_buf.begin());
+	 m_buf.resize(order);
+}
+
+
+/* ****************  class Channelizer  **************** */
+
+Channelizer::Channelizer(unsigned int filter_order, unsigned int decimation)
+	 : m_order(filter_order)
+	 , m_decimation(decimation)
+	 , m_pos(0)
+	 , m_index(0)
+	 , m_buf(filter_order)
+{
+	 assert(decimation >= 1);
+}
+
+
+// Add a channel.
+unsigned int Channelizer::add_channel(double freq, double cutoff)
+{
+	 vector<double> proto;
+	 make_lanczos_coeff(m_order, cutoff, proto);
+
+	 // Output at p reads m_buf[p .. p+order], tap j sees a delay of
+	 // (order - j) samples, so the band-pass tap is h[j] * e^(jw(order-j)).
+	 Channel ch;
+	 ch.freq = freq;
+	 ch.level = 0;
+	 ch.coeff_re.resize(m_order + 1);
+	 ch.coeff_im.resize(m_order + 1);
+	 for (unsigned int j = 0; j <= m_order; j++) {
+		  double w = 2.0 * M_PI * freq * (m_order - j);
+		  ch.coeff_re[j] = proto[j] * cos(w);
+		  ch.coeff_im[j] = proto[j] * sin(w);
+	 }
+
+	 m_channels.push_back(move(ch));
+	 return m_channels.size() - 1;
+}
+
+
+void Channelizer::process(const IQSampleVector& samples_in)
+{
+	 run(samples_in, 1, 0);
+}
+
+
+void Channelizer::measure(const IQSampleVector& samples_in, unsigned int max_outputs)
+{
+	 run(samples_in, measure_stride(samples_in.size(), max_outputs), HUGE_VAL);
+}
+
+
+void Channelizer::process_above(const IQSampleVector& samples_in, double min_level,
+										  unsigned int max_outputs)
+{
+	 run(samples_in, measure_stride(samples_in.size(), max_outputs), min_level);
+}
+
+
+unsigned int Channelizer::measure_stride(unsigned int n, unsigned int max_outputs) const
+{
+	 unsigned int nout = n / m_decimation;
+	 return max(1u, nout / max(1u, max_outputs));
+}
+
+
+// Band-pass output at input position p, before the rotation to baseband.
+static inline void channel_output_at(const IQSample::value_type* x,
+												 const IQSample::value_type* cr,
+												 const IQSample::value_type* ci,
+												 unsigned int order,
+												 IQSample::value_type& yr, IQSample::value_type& yi)
+{
+	 yr = 0;
+	 yi = 0;
+	 for (unsigned int j = 0; j <= order; j++) {
+		  yr += cr[j] * x[2*j] - ci[j] * x[2*j+1];
+		  yi += cr[j] * x[2*j+1] + ci[j] * x[2*j];
+	 }
+}
+
+
+// With a min_level, measure every channel from every stride'th output
+// first and filter only those reaching it in full.  Without, filter every
+// channel in full.
+void Channelizer::run(const IQSampleVector& samples_in, unsigned int stride, double min_level)
+{
+	 unsigned int order = m_order;
+	 unsigned int n = samples_in.size();
+
+	 m_buf.resize(order + n);
+	 copy(samples_in.begin(), samples_in.end(), m_buf.begin() + order);
+
+	 unsigned int p0 = m_pos;
+	 unsigned int nout = p0 < n ? (n - p0 + m_decimation - 1) / m_decimation : 0;
+
+	 const IQSample::value_type* buf =
+		  reinterpret_cast<const IQSample::value_type*>(m_buf.data());
+
+	 for (auto& ch : m_channels) {
+
+		  const IQSample::value_type* cr = ch.coeff_re.data();
+		  const IQSample::value_type* ci = ch.coeff_im.data();
+		  IQSample::value_type yr, yi;
+
+		  if (min_level > 0) {
+				double level = 0;
+				unsigned int count = 0;
+				for (unsigned int p = p0; p < n; p += m_decimation * stride, count++) {
+					 channel_output_at(buf + 2 * p, cr, ci, order, yr, yi);
+					 level += yr * yr + yi * yi;
+				}
+				ch.level = count ? sqrt(level / count) : 0;
+
+				if (!(ch.level >= min_level)) {
+					 ch.out.clear();
+					 continue;
+				}
+		  }
+
+		  // Band-pass output at absolute input position P is rotated by
+		  // e^(-jwP) to bring the channel to baseband.
+		  double w = 2.0 * M_PI * ch.freq;
+		  double phase = -fmod(w * double(m_index + p0), 2.0 * M_PI);
+		  IQSample rot = polar(1.0f, float(-w * m_decimation));
+		  IQSample phasor = polar(1.0f, float(phase));
+
+		  ch.out.resize(nout);
+
+		  double level = 0;
+		  unsigned int p = p0;
+		  for (unsigned int k = 0; k < nout; k++, p += m_decimation) {
+				channel_output_at(buf + 2 * p, cr, ci, order, yr, yi);
+				level += yr * yr + yi * yi;
+				ch.out[k] = IQSample(yr, yi) * phasor;
+				phasor *= rot;
+		  }
+
+		  if (min_level <= 0)
+				ch.level = nout ? sqrt(level / nout) : 0;
+	 }
+
+	 // Advance to the next block, the decimation phase is shared.
+	 unsigned int p = p0 + nout * m_decimation;
+	 m_pos = p - n;
+	 m_index += n;
+
+	 copy(m_buf.end() - order, m_buf.end(), m_buf.begin());
+	 m_buf.resize(order);
+}
+
+
+/* ****************  class RationalResampler  **************** */
+
+// Construct rational resampler.
+template <class T>
+RationalResamplerT<T>::RationalResamplerT(unsigned int filter_order, double cutoff,
+													  unsigned int rate_in, unsigned int rate_out,
+													  unsigned int channels)
+	 : m_channels(channels)
+	 , m_pos(0)
+{
+	 assert(rate_in > 0 && rate_out > 0);
+	 assert(channels > 0 && channels <= max_channels);
+
+	 unsigned int g = gcd(rate_in, rate_out);
+	 m_interp = rate_out / g;
+	 m_decim  = rate_in / g;
+	 m_taps   = filter_order + 1;
+
+	 // Prototype filter runs at interp * rate_in.
+	 vector<double> proto;
+	 make_lanczos_coeff(m_taps * m_interp - 1, cutoff / m_interp, proto);
+
+	 // Split into phases.  Each phase is stored time reversed so it can be
+	 // applied as a dot product against the input in natural order, and
+	 // scaled by interp to restore unit gain after zero stuffing.
+	 m_coeff.resize(m_taps * m_interp);
+	 for (unsigned int ph = 0; ph < m_interp; ph++) {
+		  for (unsigned int k = 0; k < m_taps; k++) {
+				m_coeff[ph * m_taps + (m_taps - 1 - k)] =
+					 proto[ph + k * m_interp] * m_interp;
+		  }
+	 }
+
+	 m_buf.resize((m_taps - 1) * m_channels);
+}
+
+
+template <class T>
+void RationalResamplerT<T>::reset()
+{
+	 m_pos = 0;
+	 m_buf.assign((m_taps - 1) * m_channels, 0);
+}
+
+
+// Process samples.
+template <class T>
+void RationalResamplerT<T>::process(const vector<T>& samples_in,
+										  vector<T>& samples_out)
+{
+	 const unsigned int nch = m_channels;
+	 unsigned int hist = (m_taps - 1) * nch;
+	 uint64_t n = samples_in.size() / nch;
+	 uint64_t end = n * m_interp;
+
+	 m_buf.resize(hist + n * nch);
+	 copy(samples_in.begin(), samples_in.begin() + n * nch, m_buf.begin() + hist);
+
+	 uint64_t t = m_pos;
+	 samples_out.resize((t < end ? (end - t + m_decim - 1) / m_decim : 0) * nch);
+
+	 unsigned int i = 0;
+	 for (; t < end; t += m_decim, i += nch) {
+		  uint64_t     in_idx = t / m_interp;
+		  unsigned int phase  = t % m_interp;
+
+		  // Output at input frame in_idx uses frames in_idx-hist .. in_idx,
+		  // which live at m_buf[in_idx .. in_idx+hist].
+		  const T* x = m_buf.data() + in_idx * nch;
+		  const T* c = m_coeff.data() + phase * m_taps;
+
+		  if (nch == 1) {
+				T y = 0;
+				for (unsigned int j = 0; j < m_taps; j++)
+					 y += x[j] * c[j];
+				samples_out[i] = y;
+		  }
+		  else {
+				T y[max_channels] = { 0 };
+				for (unsigned int j = 0; j < m_taps; j++, x += nch)
+					 for (unsigned int k = 0; k < nch; k++)
+						  y[k] += x[k] * c[j];
+				for (unsigned int k = 0; k < nch; k++)
+					 samples_out[i + k] = y[k];
+		  }
+	 }
+
+	 assert(i == samples_out.size());
+
+	 m_pos = t - end;
+
+	 copy(m_buf.end() - hist, m_buf.end(), m_buf.begin());
+	 m_buf.resize(hist);
+}
+
+
 /* ****************  class DownsampleFilter  **************** */
 
 // Construct low-pass filter with optional downsampling.
-DownsampleFilter::DownsampleFilter(unsigned int filter_order, double cutoff,
+template <class T>
+DownsampleFilterT<T>::DownsampleFilterT(unsigned int filter_order, double cutoff,
 											  double downsample, bool integer_factor)
 	 : m_downsample(downsample)
 	 , m_downsample_int(integer_factor ? lrint(downsample) : 0)
@@ -168,8 +497,9 @@ DownsampleFilter::DownsampleFilter(unsigned int filter_order, double cutoff,
 
 
 // Process samples.
-void DownsampleFilter::process(const SampleVector& samples_in,
-										 SampleVector& samples_out)
+template <class T>
+void DownsampleFilterT<T>::process(const vector<T>& samples_in,
+										 vector<T>& samples_out)
 {
 	 unsigned int order = m_state.size();
 	 unsigned int n = samples_in.size();
@@ -187,7 +517,7 @@ void DownsampleFilter::process(const SampleVector& samples_in,
 		  // The first few samples need data from m_state.
 		  unsigned int i = 0;
 		  for (; p < n && p < order; p += pstep, i++) {
-				Sample y = 0;
+				T y = 0;
 				for (unsigned int j = 1; j <= p; j++)
 					 y += samples_in[p-j] * m_coeff[j];
 				for (unsigned int j = p + 1; j <= order; j++)
@@ -197,7 +527,7 @@ void DownsampleFilter::process(const SampleVector& samples_in,
 
 		  // Remaining samples only need data from samples_in.
 		  for (; p < n; p += pstep, i++) {
-				Sample y = 0;
+				T y = 0;
 				for (unsigned int j = 1; j <= order; j++)
 					 y += samples_in[p-j] * m_coeff[j];
 				samples_out[i] = y;
@@ -214,24 +544,24 @@ void DownsampleFilter::process(const SampleVector& samples_in,
 		  // the FIR coefficient table. This is a bitch.
 
 		  // Estimate number of output samples we can produce in this run.
-		  Sample p = m_pos_frac;
-		  Sample pstep = m_downsample;
+		  T p = m_pos_frac;
+		  T pstep = m_downsample;
 		  unsigned int n_out = int(2 + n / pstep);
 
 		  samples_out.resize(n_out);
 
 		  // Produce output samples.
 		  unsigned int i = 0;
-		  Sample pf = p;
+		  T pf = p;
 		  unsigned int pi = int(pf);
 		  while (pi < n) {
-				Sample k1 = pf - pi;
-				Sample k0 = 1 - k1;
+				T k1 = pf - pi;
+				T k0 = 1 - k1;
 
-				Sample y = 0;
+				T y = 0;
 				for (unsigned int j = 0; j <= order; j++) {
-					 Sample k = m_coeff[j] * k0 + m_coeff[j+1] * k1;
-					 Sample s = (j <= pi) ? samples_in[pi-j] : m_state[order+pi-j];
+					 T k = m_coeff[j] * k0 + m_coeff[j+1] * k1;
+					 T s = (j <= pi) ? samples_in[pi-j] : m_state[order+pi-j];
 					 y += k * s;
 				}
 				samples_out[i] = y;
@@ -266,7 +596,8 @@ void DownsampleFilter::process(const SampleVector& samples_in,
 /* ****************  class LowPassFilterRC  **************** */
 
 // Construct 1st order low-pass IIR filter.
-LowPassFilterRC::LowPassFilterRC(double timeconst)
+template <class T>
+LowPassFilterRCT<T>::LowPassFilterRCT(double timeconst)
 	 : m_timeconst(timeconst)
 	 , m_y1(0)
 {
@@ -274,8 +605,9 @@ LowPassFilterRC::LowPassFilterRC(double timeconst)
 
 
 // Process samples.
-void LowPassFilterRC::process(const SampleVector& samples_in,
-										SampleVector& samples_out)
+template <class T>
+void LowPassFilterRCT<T>::process(const vector<T>& samples_in,
+										vector<T>& samples_out)
 {
 	 /*
 	  * Continuous domain:
@@ -284,15 +616,15 @@ void LowPassFilterRC::process(const SampleVector& samples_in,
 	  * Discrete domain:
 	  *   H(z) = (1 - exp(-1/timeconst)) / (1 - exp(-1/timeconst) / z)
 	  */
-	 Sample a1 = - exp(-1/m_timeconst);;
-	 Sample b0 = 1 + a1;
+	 T a1 = - exp(-1/m_timeconst);;
+	 T b0 = 1 + a1;
 
 	 unsigned int n = samples_in.size();
 	 samples_out.resize(n);
 
-	 Sample y = m_y1;
+	 T y = m_y1;
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
+		  T x = samples_in[i];
 		  y = b0 * x - a1 * y;
 		  samples_out[i] = y;
 	 }
@@ -302,16 +634,17 @@ void LowPassFilterRC::process(const SampleVector& samples_in,
 
 
 // Process samples in-place.
-void LowPassFilterRC::process_inplace(SampleVector& samples)
+template <class T>
+void LowPassFilterRCT<T>::process_inplace(vector<T>& samples)
 {
-	 Sample a1 = - exp(-1/m_timeconst);;
-	 Sample b0 = 1 + a1;
+	 T a1 = - exp(-1/m_timeconst);;
+	 T b0 = 1 + a1;
 
 	 unsigned int n = samples.size();
 
-	 Sample y = m_y1;
+	 T y = m_y1;
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples[i];
+		  T x = samples[i];
 		  y = b0 * x - a1 * y;
 		  samples[i] = y;
 	 }
@@ -323,7 +656,8 @@ void LowPassFilterRC::process_inplace(SampleVector& samples)
 /* ****************  class LowPassFilterIir  **************** */
 
 // Construct 4th order low-pass IIR filter.
-LowPassFilterIir::LowPassFilterIir(double cutoff)
+template <class T>
+LowPassFilterIirT<T>::LowPassFilterIirT(double cutoff)
 	 : y1(0), y2(0), y3(0), y4(0)
 {
 	 typedef complex<double> CDbl;
@@ -364,16 +698,17 @@ LowPassFilterIir::LowPassFilterIir(double cutoff)
 
 
 // Process samples.
-void LowPassFilterIir::process(const SampleVector& samples_in,
-										 SampleVector& samples_out)
+template <class T>
+void LowPassFilterIirT<T>::process(const vector<T>& samples_in,
+										 vector<T>& samples_out)
 {
 	 unsigned int n = samples_in.size();
 
 	 samples_out.resize(n);
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
-		  Sample y = b0 * x - a1 * y1 - a2 * y2 - a3 * y3 - a4 * y4;
+		  T x = samples_in[i];
+		  T y = b0 * x - a1 * y1 - a2 * y2 - a3 * y3 - a4 * y4;
 		  y4 = y3; y3 = y2; y2 = y1; y1 = y;
 		  samples_out[i] = y;
 	 }
@@ -383,7 +718,8 @@ void LowPassFilterIir::process(const SampleVector& samples_in,
 /* ****************  class HighPassFilterIir  **************** */
 
 // Construct 2nd order high-pass IIR filter.
-HighPassFilterIir::HighPassFilterIir(double cutoff)
+template <class T>
+HighPassFilterIirT<T>::HighPassFilterIirT(double cutoff)
 	 : x1(0), x2(0), y1(0), y2(0)
 {
 	 typedef complex<double> CDbl;
@@ -423,16 +759,17 @@ HighPassFilterIir::HighPassFilterIir(double cutoff)
 
 
 // Process samples.
-void HighPassFilterIir::process(const SampleVector& samples_in,
-										  SampleVector& samples_out)
+template <class T>
+void HighPassFilterIirT<T>::process(const vector<T>& samples_in,
+										  vector<T>& samples_out)
 {
 	 unsigned int n = samples_in.size();
 
 	 samples_out.resize(n);
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
-		  Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		  T x = samples_in[i];
+		  T y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 		  x2 = x1; x1 = x;
 		  y2 = y1; y1 = y;
 		  samples_out[i] = y;
@@ -441,17 +778,198 @@ void HighPassFilterIir::process(const SampleVector& samples_in,
 
 
 // Process samples in-place.
-void HighPassFilterIir::process_inplace(SampleVector& samples)
+template <class T>
+void HighPassFilterIirT<T>::process_inplace(vector<T>& samples)
 {
 	 unsigned int n = samples.size();
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples[i];
-		  Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		  T x = samples[i];
+		  T y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 		  x2 = x1; x1 = x;
 		  y2 = y1; y1 = y;
 		  samples[i] = y;
 	 }
 }
 
+/* ****************  class NotchFilterIir  **************** */
+
+// Construct 2nd order notch filter.
+template <class T>
+NotchFilterIirT<T>::NotchFilterIirT(double freq, double radius)
+	 : x1(0), x2(0), y1(0), y2(0)
+{
+	 /*
+	  * Zeros on the unit circle at +/- w0, poles just inside at the same
+	  * angle.
+	  *   H(z) = g * (1 - 2 cos(w0) / z + 1 / z^2)
+	  *            / (1 - 2 r cos(w0) / z + r^2 / z^2)
+	  * with g chosen for unit gain at DC.
+	  */
+	 double c = cos(2 * M_PI * freq);
+	 b1 = -2 * c;
+	 a1 = -2 * radius * c;
+	 a2 = radius * radius;
+	 g  = (1 + a1 + a2) / (2 + b1);
+}
+
+
+// Process samples in-place.
+template <class T>
+void NotchFilterIirT<T>::process_inplace(vector<T>& samples)
+{
+	 unsigned int n = samples.size();
+
+	 for (unsigned int i = 0; i < n; i++) {
+		  T x = samples[i];
+		  T y = g * (x + b1 * x1 + x2) - a1 * y1 - a2 * y2;
+		  x2 = x1; x1 = x;
+		  y2 = y1; y1 = y;
+		  samples[i] = y;
+	 }
+}
+
+/* ****************  class FineTunerQ15  **************** */
+
+// Construct Q15 finetuner.
+FineTunerQ15::FineTunerQ15(unsigned int table_size, int freq_shift)
+	 : m_index(0)
+	 , m_table(table_size)
+{
+	 set_freq_shift(freq_shift);
+}
+
+
+// Change frequency shift.
+void FineTunerQ15::set_freq_shift(int freq_shift)
+{
+	 unsigned int table_size = m_table.size();
+	 double phase_step = 2.0 * M_PI / double(table_size);
+	 for (unsigned int i = 0; i < table_size; i++) {
+		  double phi = (((int64_t)freq_shift * i) % table_size) * phase_step;
+		  m_table[i].re = int16_t(lrint(cos(phi) * 32767));
+		  m_table[i].im = int16_t(lrint(sin(phi) * 32767));
+	 }
+	 m_index = 0;
+}
+
+
+// Process samples.
+void FineTunerQ15::process(const IQSampleQ15Vector& samples_in,
+									IQSampleQ15Vector& samples_out)
+{
+	 unsigned int tblidx = m_index;
+	 unsigned int tblsiz = m_table.size();
+	 unsigned int n = samples_in.size();
+
+	 samples_out.resize(n);
+
+	 // Input full scale is 0.5, a rotation cannot overflow.
+	 for (unsigned int i = 0; i < n; i++) {
+		  const IQSampleQ15& a = samples_in[i];
+		  const IQSampleQ15& t = m_table[tblidx];
+		  int32_t re = int32_t(a.re) * t.re - int32_t(a.im) * t.im;
+		  int32_t im = int32_t(a.re) * t.im + int32_t(a.im) * t.re;
+		  samples_out[i].re = int16_t((re + (1 << 14)) >> 15);
+		  samples_out[i].im = int16_t((im + (1 << 14)) >> 15);
+		  tblidx++;
+		  if (tblidx == tblsiz)
+				tblidx = 0;
+	 }
+
+	 m_index = tblidx;
+}
+
+
+/* ****************  class DecimatingFilterFirQ15  **************** */
+
+// Construct Q15 decimating low-pass filter.
+DecimatingFilterFirQ15::DecimatingFilterFirQ15(unsigned int filter_order,
+															  double cutoff,
+															  unsigned int decimation)
+	 : m_decimation(decimation)
+	 , m_pos(0)
+	 , m_buf(filter_order, IQSampleQ15{0, 0})
+{
+	 assert(decimation >= 1);
+	 m_coeff.resize(filter_order + 1);
+	 set_cutoff(cutoff);
+}
+
+
+// Change cutoff frequency.
+void DecimatingFilterFirQ15::set_cutoff(double cutoff)
+{
+	 vector<double> coeff;
+	 make_lanczos_coeff(m_coeff.size() - 1, cutoff, coeff);
+
+	 for (unsigned int i = 0; i < coeff.size(); i++)
+		  m_coeff[i] = int16_t(lrint(coeff[i] * 32768));
+}
+
+
+// Clear the history, as constructed.
+void DecimatingFilterFirQ15::reset()
+{
+	 m_pos = 0;
+	 m_buf.assign(m_coeff.size() - 1, IQSampleQ15{0, 0});
+}
+
+
+// Process samples.
+void DecimatingFilterFirQ15::process(const IQSampleQ15Vector& samples_in,
+												 IQSampleQ15Vector& samples_out)
+{
+	 unsigned int order = m_coeff.size() - 1;
+	 unsigned int n = samples_in.size();
+
+	 m_buf.resize(order + n);
+	 copy(samples_in.begin(), samples_in.end(), m_buf.begin() + order);
+
+	 unsigned int p = m_pos;
+	 samples_out.resize(p < n ? (n - p + m_decimation - 1) / m_decimation : 0);
+
+	 const int16_t* coeff = m_coeff.data();
+	 const int16_t* buf = reinterpret_cast<const int16_t*>(m_buf.data());
+
+	 // Input full scale is 0.5 and the Lanczos taps sum to 1 with little
+	 // overshoot, so the Q30 sums stay inside int32.
+	 unsigned int i = 0;
+	 for (; p < n; p += m_decimation, i++) {
+		  const int16_t* x = buf + 2 * p;
+		  int32_t yr = 0, yi = 0;
+		  for (unsigned int j = 0; j <= order; j++) {
+				yr += int32_t(x[2*j])   * coeff[j];
+				yi += int32_t(x[2*j+1]) * coeff[j];
+		  }
+		  samples_out[i].re = int16_t((yr + (1 << 14)) >> 15);
+		  samples_out[i].im = int16_t((yi + (1 << 14)) >> 15);
+	 }
+
+	 assert(i == samples_out.size());
+
+	 m_pos = p - n;
+
+	 copy(m_buf.end() - order, m_buf.end(), m_buf.begin());
+	 m_buf.resize(order);
+}
+
+
+/* ****************  instantiations  **************** */
+
+// float is the production sample type, double is kept for reference
+// builds and numeric comparison.
+template class RationalResamplerT<float>;
+template class RationalResamplerT<double>;
+template class DownsampleFilterT<float>;
+template class DownsampleFilterT<double>;
+template class LowPassFilterRCT<float>;
+template class LowPassFilterRCT<double>;
+template class LowPassFilterIirT<float>;
+template class LowPassFilterIirT<double>;
+template class HighPassFilterIirT<float>;
+template class HighPassFilterIirT<double>;
+template class NotchFilterIirT<float>;
+template class NotchFilterIirT<double>;
+
 /* end */
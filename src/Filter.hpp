@@ -1,6 +1,7 @@
 #ifndef SOFTFM_FILTER_H
 #define SOFTFM_FILTER_H
 
+#include <cstdint>
 #include <vector>
 #include "IQSample.h"
 
@@ -21,6 +22,12 @@ public:
 	  */
 	 FineTuner(unsigned int table_size, int freq_shift);
 
+	 /** Change the frequency shift, the table is rewritten in place. */
+	 void set_freq_shift(int freq_shift);
+
+	 /** Start again from phase zero. */
+	 void reset() { m_index = 0; }
+
 	 /** Process samples. */
 	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
 
@@ -53,13 +60,194 @@ private:
 };
 
 
+/**
+ *  Decimating low-pass filter for IQ samples, based on Lanczos FIR filter.
+ *
+ *  Only the samples that survive decimation are computed, so the cost is
+ *  (filter_order + 1) complex MACs per output sample instead of per input
+ *  sample.  This replaces LowPassFilterFirIQ followed by a separate
+ *  downsampler.
+ */
+class DecimatingFilterFirIQ
+{
+public:
+
+	 /**
+	  * Construct decimating low-pass filter.
+	  *
+	  * filter_order :: FIR filter order.
+	  * cutoff       :: Cutoff frequency relative to the input sample rate
+	  *                 (valid range 0.0 ... 0.5).
+	  * decimation   :: Integer decimation factor (>= 1).
+	  *
+	  * The output sample rate is (input_sample_rate / decimation)
+	  */
+	 DecimatingFilterFirIQ(unsigned int filter_order, double cutoff,
+								  unsigned int decimation);
+
+	 /** Change the cutoff, the order, decimation and filter state are kept. */
+	 void set_cutoff(double cutoff);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset();
+
+	 /** Process samples. */
+	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+private:
+	 unsigned int    m_decimation;
+	 unsigned int    m_pos;
+	 std::vector<IQSample::value_type> m_coeff;
+	 IQSampleVector  m_buf;		// filter state followed by the current block
+};
+
+
+/**
+ *  Bank of frequency translating decimating filters on one IQ stream.
+ *
+ *  Each channel is a Lanczos low-pass shifted up to the channel frequency,
+ *  evaluated only at the decimated output positions, and rotated down to
+ *  baseband at the output rate.  Nothing runs per channel at the input
+ *  rate, a channel costs (filter_order + 1) complex MACs per output
+ *  sample.  All channels share the input history and decimation phase.
+ */
+class Channelizer
+{
+public:
+
+	 /**
+	  * Construct empty channelizer.
+	  *
+	  * filter_order :: FIR filter order of every channel.
+	  * decimation   :: Integer decimation factor (>= 1).
+	  */
+	 Channelizer(unsigned int filter_order, unsigned int decimation);
+
+	 /**
+	  * Add a channel, returns its index.
+	  *
+	  * freq   :: Channel center relative to the input sample rate
+	  *           (valid range -0.5 .. 0.5).
+	  * cutoff :: Half bandwidth relative to the input sample rate.
+	  */
+	 unsigned int add_channel(double freq, double cutoff);
+
+	 /** Filter all channels, outputs in channel_output(). */
+	 void process(const IQSampleVector& samples_in);
+
+	 /**
+	  * Only update the channel levels, from at most max_outputs outputs
+	  * spread over the block.  Far cheaper than process(), enough for a
+	  * squelch decision.
+	  */
+	 void measure(const IQSampleVector& samples_in, unsigned int max_outputs = 256);
+
+	 /**
+	  * Measure as measure(), then filter in full only the channels whose
+	  * level reaches min_level.  The others come out empty in
+	  * channel_output().
+	  */
+	 void process_above(const IQSampleVector& samples_in, double min_level,
+							  unsigned int max_outputs = 256);
+
+	 unsigned int channel_count() const { return m_channels.size(); }
+
+	 /** Baseband samples of the last process() call. */
+	 const IQSampleVector& channel_output(unsigned int ch) const
+	 {
+		  return m_channels[ch].out;
+	 }
+
+	 /** RMS level of the last block (where full scale IQ signal is 1.0). */
+	 double get_level(unsigned int ch) const
+	 {
+		  return m_channels[ch].level;
+	 }
+
+private:
+	 struct Channel {
+		  double          freq;
+		  std::vector<IQSample::value_type> coeff_re;
+		  std::vector<IQSample::value_type> coeff_im;
+		  IQSampleVector  out;
+		  double          level;
+	 };
+
+	 unsigned int measure_stride(unsigned int n, unsigned int max_outputs) const;
+	 void run(const IQSampleVector& samples_in, unsigned int stride, double min_level);
+
+	 unsigned int    m_order;
+	 unsigned int    m_decimation;
+	 unsigned int    m_pos;
+	 std::uint64_t   m_index;		// input sample count at the start of m_buf
+	 IQSampleVector  m_buf;			// filter state followed by the current block
+	 std::vector<Channel> m_channels;
+};
+
+
+/**
+ *  Polyphase rational resampler for real-valued signals.
+ *
+ *  Resamples by interp/decim where the ratio is reduced from the integer
+ *  input and output rates.  Each output sample costs (filter_order + 1)
+ *  MACs with precomputed per-phase coefficients, no coefficient
+ *  interpolation is needed as in the fractional DownsampleFilter.
+ *
+ *  Several channels can be resampled together as interleaved frames,
+ *  sharing the coefficients and the output timing.
+ */
+template <class T>
+class RationalResamplerT
+{
+public:
+
+	 /**
+	  * Construct rational resampler with low-pass filter.
+	  *
+	  * filter_order :: FIR filter order, in input samples
+	  * cutoff       :: Cutoff frequency relative to the input sample rate
+	  *                 (valid range 0.0 .. 0.5)
+	  * rate_in      :: Input sample rate in Hz
+	  * rate_out     :: Output sample rate in Hz
+	  * channels     :: Interleaved channels per frame
+	  */
+	 RationalResamplerT(unsigned int filter_order, double cutoff,
+							 unsigned int rate_in, unsigned int rate_out,
+							 unsigned int channels=1);
+
+	 /** Process samples, whole frames of interleaved channels. */
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset();
+
+	 unsigned int interpolation() const { return m_interp; }
+	 unsigned int decimation() const { return m_decim; }
+	 unsigned int channels() const { return m_channels; }
+
+private:
+	 static constexpr unsigned int max_channels = 8;
+
+	 unsigned int    m_channels;
+	 unsigned int    m_interp;
+	 unsigned int    m_decim;
+	 unsigned int    m_taps;		// taps per phase
+	 uint64_t        m_pos;			// next output position in interp units
+	 std::vector<T>  m_coeff;		// m_interp phases of m_taps, time reversed
+	 std::vector<T>  m_buf;			// filter state followed by the current block
+};
+
+typedef RationalResamplerT<Sample> RationalResampler;
+
+
 /**
  *  Downsampler with low-pass FIR filter for real-valued signals.
  *
  *  Step 1: Low-pass filter based on Lanczos FIR filter
  *  Step 2: (optional) Decimation by an arbitrary factor (integer or float)
  */
-class DownsampleFilter
+template <class T>
+class DownsampleFilterT
 {
 public:
 
@@ -75,24 +263,27 @@ public:
 	  *
 	  * The output sample rate is (input_sample_rate / downsample)
 	  */
-	 DownsampleFilter(unsigned int filter_order, double cutoff,
+	 DownsampleFilterT(unsigned int filter_order, double cutoff,
 							double downsample=1, bool integer_factor=true);
 
 	 /** Process samples. */
-	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
 
 private:
 	 double          m_downsample;
 	 unsigned int    m_downsample_int;
 	 unsigned int    m_pos_int;
-	 Sample          m_pos_frac;
-	 SampleVector    m_coeff;
-	 SampleVector    m_state;
+	 T               m_pos_frac;
+	 std::vector<T>  m_coeff;
+	 std::vector<T>  m_state;
 };
 
+typedef DownsampleFilterT<Sample> DownsampleFilter;
+
 
 /** First order low-pass IIR filter for real-valued signals. */
-class LowPassFilterRC
+template <class T>
+class LowPassFilterRCT
 {
 public:
 
@@ -101,22 +292,28 @@ public:
 	  *
 	  * timeconst :: RC time constant in seconds (1 / (2 * PI * cutoff_freq)
 	  */
-	 LowPassFilterRC(double timeconst);
+	 LowPassFilterRCT(double timeconst);
 
 	 /** Process samples. */
-	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
 
 	 /** Process samples in-place. */
-	 void process_inplace(SampleVector& samples);
+	 void process_inplace(std::vector<T>& samples);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset() { m_y1 = 0; }
 
 private:
 	 double  m_timeconst;
-	 Sample  m_y1;
+	 T       m_y1;
 };
 
+typedef LowPassFilterRCT<Sample> LowPassFilterRC;
+
 
 /** Low-pass filter for real-valued signals based on Butterworth IIR filter. */
-class LowPassFilterIir
+template <class T>
+class LowPassFilterIirT
 {
 public:
 
@@ -126,19 +323,22 @@ public:
 	  * cutoff   :: Low-pass cutoff relative to the sample frequency
 	  *             (valid range 0.0 .. 0.5, 0.5 = Nyquist)
 	  */
-	 LowPassFilterIir(double cutoff);
+	 LowPassFilterIirT(double cutoff);
 
 	 /** Process samples. */
-	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
 
 private:
-	 Sample  b0, a1, a2, a3, a4;
-	 Sample  y1, y2, y3, y4;
+	 T  b0, a1, a2, a3, a4;
+	 T  y1, y2, y3, y4;
 };
 
+typedef LowPassFilterIirT<Sample> LowPassFilterIir;
+
 
 /** High-pass filter for real-valued signals based on Butterworth IIR filter. */
-class HighPassFilterIir
+template <class T>
+class HighPassFilterIirT
 {
 public:
 
@@ -148,17 +348,106 @@ public:
 	  * cutoff   :: High-pass cutoff relative to the sample frequency
 	  *             (valid range 0.0 .. 0.5, 0.5 = Nyquist)
 	  */
-	 HighPassFilterIir(double cutoff);
+	 HighPassFilterIirT(double cutoff);
 
 	 /** Process samples. */
-	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
+
+	 /** Process samples in-place. */
+	 void process_inplace(std::vector<T>& samples);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset() { x1 = x2 = y1 = y2 = 0; }
+
+private:
+	 T b0, b1, b2, a1, a2;
+	 T x1, x2, y1, y2;
+};
+
+typedef HighPassFilterIirT<Sample> HighPassFilterIir;
+
+
+/** Second order IIR notch for real-valued signals, removes a single tone. */
+template <class T>
+class NotchFilterIirT
+{
+public:
+
+	 /**
+	  * Construct notch filter.
+	  *
+	  * freq     :: Notch frequency relative to the sample frequency
+	  *             (valid range 0.0 .. 0.5, 0.5 = Nyquist)
+	  * radius   :: Pole radius, closer to 1.0 gives a narrower notch.
+	  */
+	 NotchFilterIirT(double freq, double radius=0.98);
 
 	 /** Process samples in-place. */
-	 void process_inplace(SampleVector& samples);
+	 void process_inplace(std::vector<T>& samples);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset() { x1 = x2 = y1 = y2 = 0; }
+
+private:
+	 T b1, a1, a2, g;
+	 T x1, x2, y1, y2;
+};
+
+typedef NotchFilterIirT<Sample> NotchFilterIir;
+
+
+/*
+ *  Q15 fixed point versions of the IF front end, for the low power
+ *  integer demodulation path.  Samples are int16 with int32 accumulators,
+ *  which maps onto NEON vmlal / vqdmulh.
+ */
+
+/** Fine tuner for Q15 IQ samples. */
+class FineTunerQ15
+{
+public:
+
+	 /** Same arguments as FineTuner. */
+	 FineTunerQ15(unsigned int table_size, int freq_shift);
+
+	 /** Change the frequency shift, the table is rewritten in place. */
+	 void set_freq_shift(int freq_shift);
+
+	 /** Start again from phase zero. */
+	 void reset() { m_index = 0; }
+
+	 /** Process samples. */
+	 void process(const IQSampleQ15Vector& samples_in, IQSampleQ15Vector& samples_out);
+
+private:
+	 unsigned int      m_index;
+	 IQSampleQ15Vector m_table;
+};
+
+
+/** Decimating low-pass filter for Q15 IQ samples, see DecimatingFilterFirIQ. */
+class DecimatingFilterFirQ15
+{
+public:
+
+	 /** Same arguments as DecimatingFilterFirIQ. */
+	 DecimatingFilterFirQ15(unsigned int filter_order, double cutoff,
+									unsigned int decimation);
+
+	 /** Change the cutoff, the order, decimation and filter state are kept. */
+	 void set_cutoff(double cutoff);
+
+	 /** Clear the filter history, for a new stream. */
+	 void reset();
+
+	 /** Process samples. */
+	 void process(const IQSampleQ15Vector& samples_in, IQSampleQ15Vector& samples_out);
 
 private:
-	 Sample b0, b1, b2, a1, a2;
-	 Sample x1, x2, y1, y2;
+	 unsigned int      m_decimation;
+	 unsigned int      m_pos;
+	 std::vector<int16_t> m_coeff;		// Q15
+	 IQSampleQ15Vector m_buf;			// filter state followed by the current block
 };
 
 #endif
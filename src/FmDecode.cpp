@@ -1,40 +1,17 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 
 #include "FmDecode.hpp"
+#include "IQConvert.hpp"
 
 using namespace std;
 
 
 #pragma clang diagnostic ignored "-Wconversion"
 
-///** Fast approximation of atan function. */
-//static inline Sample fast_atan(Sample x)
-//{
-//	 // http://stackoverflow.com/questions/7378187/approximating-inverse-trigonometric-funcions
-//
-//	 Sample y = 1;
-//	 Sample p = 0;
-//
-//	 if (x < 0) {
-//		  x = -x;
-//		  y = -1;
-//	 }
-//
-//	 if (x > 1) {
-//		  p = y;
-//		  y = -y;
-//		  x = 1 / x;
-//	 }
-//
-//	 const Sample b = 0.596227;
-//	 y *= (b*x + x*x) / (1 + 2*b*x + x*x);
-//
-//	 return (y + p) * Sample(M_PI_2);
-//}
-
-
 /** Compute RMS level over a small prefix of the specified sample vector. */
 static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
 {
@@ -55,37 +32,176 @@ static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
 /* ****************  class PhaseDiscriminator  **************** */
 
 // Construct phase discriminator.
-PhaseDiscriminator::PhaseDiscriminator(double max_freq_dev)
+template <class T>
+PhaseDiscriminatorT<T>::PhaseDiscriminatorT(double max_freq_dev, method_t method)
 	 : m_freq_scale_factor(1.0 / (max_freq_dev * 2.0 * M_PI))
+	 , m_method(method)
 { }
 
 
 // Process samples.
-void PhaseDiscriminator::process(const IQSampleVector& samples_in,
-											SampleVector& samples_out)
+template <class T>
+void PhaseDiscriminatorT<T>::process(const IQSampleVector& samples_in,
+											vector<T>& samples_out)
 {
 	 unsigned int n = samples_in.size();
 	 IQSample s0 = m_last_sample;
 
 	 samples_out.resize(n);
 
+	 if (n == 0)
+		  return;
+
+	 if (m_method == ATAN2_EXACT) {
+		  for (unsigned int i = 0; i < n; i++) {
+				IQSample s1(samples_in[i]);
+				IQSample d(conj(s0) * s1);
+				T w = atan2(d.imag(), d.real());
+				samples_out[i] = w * m_freq_scale_factor;
+				s0 = s1;
+		  }
+		  m_last_sample = s0;
+		  return;
+	 }
+
+	 // Pass 1: conjugate products of successive samples, split into
+	 // separate re/im arrays so both passes vectorize.
+	 m_buf_re.resize(n);
+	 m_buf_im.resize(n);
+
+	 const float* in = reinterpret_cast<const float*>(samples_in.data());
+	 float* re = m_buf_re.data();
+	 float* im = m_buf_im.data();
+
+	 re[0] = s0.real() * in[0] + s0.imag() * in[1];
+	 im[0] = s0.real() * in[1] - s0.imag() * in[0];
+	 for (unsigned int i = 1; i < n; i++) {
+		  float ar = in[2*i-2], ai = in[2*i-1];
+		  float br = in[2*i],   bi = in[2*i+1];
+		  re[i] = ar * br + ai * bi;
+		  im[i] = ar * bi - ai * br;
+	 }
+
+	 // Pass 2: polynomial atan2 and scaling.
+	 const T scale = m_freq_scale_factor;
+	 for (unsigned int i = 0; i < n; i++) {
+		  samples_out[i] = fast_atan2(im[i], re[i]) * scale;
+	 }
+
+	 m_last_sample = samples_in[n - 1];
+}
+
+
+/* ****************  class PhaseDiscriminatorQ15  **************** */
+
+int16_t PhaseDiscriminatorQ15::s_atan_table[(1 << atan_table_bits) + 2];
+bool    PhaseDiscriminatorQ15::s_atan_ready = PhaseDiscriminatorQ15::make_atan_table();
+
+// atan(i / size) for i = 0 .. size, in binary angle units (8192 = pi/4).
+bool PhaseDiscriminatorQ15::make_atan_table()
+{
+	 const int size = 1 << atan_table_bits;
+	 for (int i = 0; i <= size; i++)
+		  s_atan_table[i] = int16_t(lrint(atan(double(i) / size) * 32768.0 / M_PI));
+	 s_atan_table[size + 1] = s_atan_table[size];
+	 return true;
+}
+
+
+// Construct Q15 phase discriminator.  The largest step, half a cycle, is
+// 0.5 / max_freq_dev times full deviation and has to fit in int16.
+PhaseDiscriminatorQ15::PhaseDiscriminatorQ15(double max_freq_dev)
+	 : m_full_scale(int32_t(min(double(max_full_scale), floor(65534 * max_freq_dev))))
+	 , m_gain(int32_t(lrint(m_full_scale / (65536 * max_freq_dev) * 4096)))
+	 , m_last_phase(0)
+	 , m_has_phase(false)
+{ }
+
+
+// Process samples.
+void PhaseDiscriminatorQ15::process(const IQSampleQ15Vector& samples_in,
+												SampleQ15Vector& samples_out)
+{
+	 unsigned int n = samples_in.size();
+	 int16_t p0 = m_last_phase;
+
+	 samples_out.resize(n);
+	 if (n == 0)
+		  return;
+
+	 // The first sample of a stream has nothing to turn from, it reads
+	 // 0 as PhaseDiscriminator's does.
+	 if (!m_has_phase) {
+		  p0 = atan2_q15(samples_in[0].im, samples_in[0].re);
+		  m_has_phase = true;
+	 }
+
+	 // Full deviation is max_freq_dev * 65536 binary angle units per sample,
+	 // scale that to full_scale.
+	 for (unsigned int i = 0; i < n; i++) {
+		  int16_t p1 = atan2_q15(samples_in[i].im, samples_in[i].re);
+		  int32_t d = int16_t(p1 - p0);
+		  int64_t y = (int64_t(d) * m_gain) >> 12;
+		  samples_out[i] = int16_t(y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+		  p0 = p1;
+	 }
+
+	 m_last_phase = p0;
+}
+
+
+/* ****************  class FmFrontEndQ15  **************** */
+
+FmFrontEndQ15::FmFrontEndQ15(unsigned int tuning_table_size, int tuning_shift,
+									  unsigned int filter_order, double cutoff,
+									  unsigned int decimation, double max_freq_dev)
+	 : m_finetuner(tuning_table_size, tuning_shift)
+	 , m_iffilter(filter_order, cutoff, decimation)
+	 , m_phasedisc(max_freq_dev)
+	 , m_if_rms(0)
+{ }
+
+
+void FmFrontEndQ15::retune(int tuning_shift, double cutoff)
+{
+	 m_finetuner.set_freq_shift(tuning_shift);
+	 m_iffilter.set_cutoff(cutoff);
+
+	 m_finetuner.reset();
+	 m_iffilter.reset();
+	 m_phasedisc.reset();
+	 m_if_rms = 0;
+}
+
+
+void FmFrontEndQ15::process(const IQSampleVector& samples_in,
+									 SampleQ15Vector& baseband)
+{
+	 // Lossless, the IQ came from 8 bit samples.
+	 m_buf_in.resize(samples_in.size());
+	 IQConvert::iqToQ15(samples_in.data(), m_buf_in.data(), samples_in.size());
+
+	 m_finetuner.process(m_buf_in, m_buf_tuned);
+	 m_iffilter.process(m_buf_tuned, m_buf_filtered);
+
+	 // IF level over a small prefix, as rms_level_approx().
+	 unsigned int n = (m_buf_filtered.size() + 63) / 64;
+	 int64_t level = 0;
 	 for (unsigned int i = 0; i < n; i++) {
-		  IQSample s1(samples_in[i]);
-		  IQSample d(conj(s0) * s1);
-// TODO : implement fast approximation of atan2
-		  Sample w = atan2(d.imag(), d.real());
-		  samples_out[i] = w * m_freq_scale_factor;
-		  s0 = s1;
+		  const IQSampleQ15& s = m_buf_filtered[i];
+		  level += int32_t(s.re) * s.re + int32_t(s.im) * s.im;
 	 }
+	 m_if_rms = n ? sqrt(double(level) / n) / 16384.0 : 0;
 
-	 m_last_sample = s0;
+	 m_phasedisc.process(m_buf_filtered, baseband);
 }
 
 
 /* ****************  class PilotPhaseLock  **************** */
 
 // Construct phase-locked loop.
-PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
+template <class T>
+PilotPhaseLockT<T>::PilotPhaseLockT(double freq, double bandwidth, double minsignal)
 {
 	 /*
 	  * This is a type-2, 4th order phase-locked loop.
@@ -107,8 +223,6 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 	 // Set valid signal threshold.
 	 m_minsignal  = minsignal;
 	 m_lock_delay = int(20.0 / bandwidth);
-	 m_lock_cnt   = 0;
-	 m_pilot_level = 0;
 
 	 // Create 2nd order filter for I/Q representation of phase error.
 	 // Filter has two poles, unit DC gain.
@@ -127,8 +241,18 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 	 // the frequency. Then the frequency is integrated to produce the phase.
 	 // These integrators form the two remaining poles, both at z = 1.
 
-	 // Initialize frequency and phase.
-	 m_freq  = freq * 2.0 * M_PI;
+	 // Initialize frequency and phase, filter state and PPS generator.
+	 m_center_freq = freq * 2.0 * M_PI;
+	 reset();
+
+	 m_third_harmonic = false;
+}
+
+
+template <class T>
+void PilotPhaseLockT<T>::reset()
+{
+	 m_freq  = m_center_freq;
 	 m_phase = 0;
 
 	 m_phasor_i1 = 0;
@@ -137,20 +261,26 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 	 m_phasor_q2 = 0;
 	 m_loopfilter_x1 = 0;
 
-	 // Initialize PPS generator.
+	 m_lock_cnt    = 0;
+	 m_pilot_level = 0;
+
 	 m_pilot_periods = 0;
 	 m_pps_cnt       = 0;
 	 m_sample_cnt    = 0;
+	 m_pps_events.clear();
 }
 
 
 // Process samples.
-void PilotPhaseLock::process(const SampleVector& samples_in,
-									  SampleVector& samples_out)
+template <class T>
+void PilotPhaseLockT<T>::process(const vector<T>& samples_in,
+									  vector<T>& samples_out)
 {
 	 unsigned int n = samples_in.size();
 
 	 samples_out.resize(n);
+	 if (m_third_harmonic)
+		  m_buf_third.resize(n);
 
 	 bool was_locked = (m_lock_cnt >= m_lock_delay);
 	 m_pps_events.clear();
@@ -161,17 +291,25 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 	 for (unsigned int i = 0; i < n; i++) {
 
 		  // Generate locked pilot tone.
-		  Sample psin = sin(m_phase);
-		  Sample pcos = cos(m_phase);
+		  T psin = sin(T(m_phase));
+		  T pcos = cos(T(m_phase));
 
 		  // Generate double-frequency output.
 		  // sin(2*x) = 2 * sin(x) * cos(x)
 		  samples_out[i] = 2 * psin * pcos;
 
+		  // Generate conjugate triple-frequency phasor for RDS.
+		  // cos(3*x) = cos(x) * (4 * cos(x)^2 - 3)
+		  // sin(3*x) = sin(x) * (3 - 4 * sin(x)^2)
+		  if (m_third_harmonic) {
+				m_buf_third[i] = IQSample(pcos * (4 * pcos * pcos - 3),
+												  psin * (4 * psin * psin - 3));
+		  }
+
 		  // Multiply locked tone with input.
-		  Sample x = samples_in[i];
-		  Sample phasor_i = psin * x;
-		  Sample phasor_q = pcos * x;
+		  T x = samples_in[i];
+		  T phasor_i = psin * x;
+		  T phasor_q = pcos * x;
 
 		  // Run IQ phase error through low-pass filter.
 		  phasor_i = m_phasor_b0 * phasor_i
@@ -186,7 +324,7 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 		  m_phasor_q1 = phasor_q;
 
 		  // Convert I/Q ratio to estimate of phase error.
-		  Sample phase_err;
+		  T phase_err;
 		  if (phasor_i > abs(phasor_q)) {
 				// We are within +/- 45 degrees from lock.
 				// Use simple linear approximation of arctan.
@@ -253,7 +391,8 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 
 /* ****************  class FmDecoder  **************** */
 
-FmDecoder::FmDecoder(double sample_rate_if,
+template <class T>
+FmDecoderT<T>::FmDecoderT(double sample_rate_if,
 							double tuning_offset,
 							double sample_rate_pcm,
 							bool   stereo,
@@ -272,40 +411,45 @@ FmDecoder::FmDecoder(double sample_rate_if,
 	 , m_downsample(downsample)
 	 , m_stereo_enabled(stereo)
 	 , m_stereo_detected(false)
+	 , m_rds_enabled(false)
 	 , m_if_level(0)
 	 , m_baseband_mean(0)
 	 , m_baseband_level(0)
+	 , m_fixed_point(false)
 
 	 // Construct FineTuner
 	 , m_finetuner(m_tuning_table_size, m_tuning_shift)
 
-	 // Construct LowPassFilterFirIQ
-	 , m_iffilter(10, bandwidth_if / sample_rate_if)
+	 // Construct DecimatingFilterFirIQ, isolates the station and drops
+	 // the IF rate to the baseband rate in one pass.
+	 , m_iffilter(8 * downsample, bandwidth_if / sample_rate_if, downsample)
 
-	 // Construct PhaseDiscriminator
-	 , m_phasedisc(freq_dev / sample_rate_if)
+	 // Construct PhaseDiscriminator, runs at the baseband rate
+	 , m_phasedisc(freq_dev / m_sample_rate_baseband)
 
-	 // Construct DownsampleFilter for baseband
-	 , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
+	 // Same three stages in fixed point
+	 , m_frontend_q15(m_tuning_table_size, m_tuning_shift,
+							8 * downsample, bandwidth_if / sample_rate_if, downsample,
+							freq_dev / m_sample_rate_baseband)
 
 	 // Construct PilotPhaseLock
 	 , m_pilotpll(pilot_freq / m_sample_rate_baseband,       // freq
 					  50 / m_sample_rate_baseband,               // bandwidth
 					  0.04)                                      // minsignal
 
-	 // Construct DownsampleFilter for mono channel
+	 // Construct RationalResampler for mono channel
 	 , m_resample_mono(
 		  int(m_sample_rate_baseband / 1000.0),               // filter_order
 		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-		  false)                                              // integer_factor
+		  lrint(m_sample_rate_baseband),                      // rate_in
+		  lrint(sample_rate_pcm))                             // rate_out
 
-	 // Construct DownsampleFilter for stereo channel
+	 // Construct RationalResampler for stereo channel
 	 , m_resample_stereo(
 		  int(m_sample_rate_baseband / 1000.0),               // filter_order
 		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-		  false)                                              // integer_factor
+		  lrint(m_sample_rate_baseband),                      // rate_in
+		  lrint(sample_rate_pcm))                             // rate_out
 
 	 // Construct HighPassFilterIir
 	 , m_dcblock_mono(30.0 / sample_rate_pcm)
@@ -317,6 +461,13 @@ FmDecoder::FmDecoder(double sample_rate_if,
 	 , m_deemph_stereo(
 		  (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
 
+	 // Construct RdsDecoder, runs on the baseband
+	 , m_rds(m_sample_rate_baseband)
+
+	 , m_threading(THREADS_SERIAL)
+	 , m_in_flight(false)
+	 , m_in_flight_stereo(false)
+
 {
 	
 //	printf("FmDecoder PCM at %f\n", sample_rate_pcm);
@@ -325,46 +476,118 @@ FmDecoder::FmDecoder(double sample_rate_if,
 }
 
 
-void FmDecoder::process(const IQSampleVector& samples_in,
-								SampleVector& audio)
+template <class T>
+FmDecoderT<T>::~FmDecoderT()
 {
-	// Fine tuning.
-	m_finetuner.process(samples_in, m_buf_iftuned);
-	
-	// Low pass filter to isolate station.
-	m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
-	
+	 stop_branches();
+}
+
+
+template <class T>
+void FmDecoderT<T>::retune(double tuning_offset, double bandwidth_if)
+{
+	 m_tuning_shift = lrint(-double(m_tuning_table_size) * tuning_offset / m_sample_rate_if);
+
+	 m_finetuner.set_freq_shift(m_tuning_shift);
+	 m_iffilter.set_cutoff(bandwidth_if / m_sample_rate_if);
+	 m_frontend_q15.retune(m_tuning_shift, bandwidth_if / m_sample_rate_if);
+
+	 // Audio of the old station still in the pipeline is dropped.
+	 drain_branches();
+
+	 // No history of the old station is carried into the new one.
+	 m_finetuner.reset();
+	 m_iffilter.reset();
+	 m_phasedisc.reset();
+	 m_resample_mono.reset();
+	 m_resample_stereo.reset();
+	 m_dcblock_mono.reset();
+	 m_dcblock_stereo.reset();
+	 m_deemph_mono.reset();
+	 m_deemph_stereo.reset();
+	 m_pilotpll.reset();
+
+	 // Levels and stereo detection start over on the new station.
+	 m_stereo_detected = false;
+	 m_if_level = 0;
+	 m_baseband_mean = 0;
+	 m_baseband_level = 0;
+	 m_rds.reset();
+}
+
+
+template <class T>
+void FmDecoderT<T>::set_rds_enabled(bool enable)
+{
+	 if (enable && !m_rds_enabled)
+		  m_rds.reset();
+
+	 m_rds_enabled = enable;
+	 m_pilotpll.set_third_harmonic(enable);
+}
+
+
+template <class T>
+void FmDecoderT<T>::process_rds()
+{
+	 if (!m_rds_enabled || !m_pilotpll.locked())
+		  return;
+
+	 m_rds.process(m_buf_baseband, m_pilotpll.get_third_harmonic());
+}
+
+
+template <class T>
+void FmDecoderT<T>::process(const IQSampleVector& samples_in,
+								vector<T>& audio)
+{
+	double if_rms;
+
+	if (m_fixed_point) {
+
+		// Tune, filter and demodulate in Q15.
+		m_frontend_q15.process(samples_in, m_buf_baseband_q15);
+		q15_to_samples(m_buf_baseband_q15, m_frontend_q15.full_scale(), m_buf_baseband);
+		if_rms = m_frontend_q15.get_if_rms();
+
+	} else {
+
+		// Fine tuning.
+		m_finetuner.process(samples_in, m_buf_iftuned);
+
+		// Low pass filter to isolate station and decimate to baseband rate.
+		m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
+		if_rms = rms_level_approx(m_buf_iffiltered);
+
+		// Extract carrier frequency.
+		m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
+	}
+
 	// Measure IF level.
-	double if_rms = rms_level_approx(m_buf_iffiltered);
 	m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
 	
-	// Extract carrier frequency.
-	m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
-	
-	// Downsample baseband signal to reduce processing.
-	if (m_downsample > 1) {
-		SampleVector tmp(move(m_buf_baseband));
-		m_resample_baseband.process(tmp, m_buf_baseband);
-	}
-	
 	// Measure baseband level.
 	double baseband_mean, baseband_rms;
 	samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
 	m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
 	m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
 	
-	// Extract mono audio signal.
-	m_resample_mono.process(m_buf_baseband, m_buf_mono);
+	if (m_threading != THREADS_SERIAL) {
+		process_threaded(audio);
+		return;
+	}
 	
-	// DC blocking and de-emphasis.
-	m_dcblock_mono.process_inplace(m_buf_mono);
-	m_deemph_mono.process_inplace(m_buf_mono);
+	// Extract mono audio signal.
+	mono_branch(m_buf_baseband, m_buf_mono);
 	
-	if (m_stereo_enabled) {
+	if (m_stereo_enabled || m_rds_enabled) {
 		
 		// Lock on stereo pilot.
 		m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
-		m_stereo_detected = m_pilotpll.locked();
+		m_stereo_detected = m_stereo_enabled && m_pilotpll.locked();
+	}
+	
+	if (m_stereo_enabled) {
 		
 		// Demodulate stereo signal.
 		demod_stereo(m_buf_baseband, m_buf_rawstereo);
@@ -373,11 +596,7 @@ void FmDecoder::process(const IQSampleVector& samples_in,
 		// NOTE: This MUST be done even if no stereo signal is detected yet,
 		// because the downsamplers for mono and stereo signal must be
 		// kept in sync.
-		m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo);
-		
-		// DC blocking and de-emphasis.
-		m_dcblock_stereo.process_inplace(m_buf_stereo);
-		m_deemph_stereo.process_inplace(m_buf_stereo);
+		stereo_branch(m_buf_rawstereo, m_buf_stereo);
 		
 		if (m_stereo_detected) {
 			
@@ -402,9 +621,202 @@ void FmDecoder::process(const IQSampleVector& samples_in,
 }
 
 
+template <class T>
+void FmDecoderT<T>::mono_branch(const vector<T>& samples_baseband,
+										  vector<T>& samples_mono)
+{
+	 m_resample_mono.process(samples_baseband, samples_mono);
+
+	 // DC blocking and de-emphasis.
+	 m_dcblock_mono.process_inplace(samples_mono);
+	 m_deemph_mono.process_inplace(samples_mono);
+}
+
+
+template <class T>
+void FmDecoderT<T>::stereo_branch(const vector<T>& samples_rawstereo,
+											 vector<T>& samples_stereo)
+{
+	 m_resample_stereo.process(samples_rawstereo, samples_stereo);
+
+	 // DC blocking and de-emphasis.
+	 m_dcblock_stereo.process_inplace(samples_stereo);
+	 m_deemph_stereo.process_inplace(samples_stereo);
+}
+
+
+// MARK: - threaded branches
+
+// The branch keeps two blocks of room each way, one being worked on and
+// one being handed over.  The rings recycle their storage, so nothing
+// is allocated once the first blocks have been through.
+template <class T>
+FmDecoderT<T>::Branch::Branch(FmDecoderT* decoder)
+	 : decoder(decoder)
+	 , in(2, 16384)
+	 , out(2, 4096)
+{
+}
+
+
+template <class T>
+void* FmDecoderT<T>::BranchThread(void *context)
+{
+	 Branch* b = (Branch*) context;
+
+	 vector<T> samples_in;
+	 vector<T> samples_out;
+
+	 while (b->in.pull(samples_in)) {
+
+		  b->decoder->stereo_branch(samples_in, samples_out);
+
+		  // One spare sample so a block that resampled to nothing still
+		  // makes it through the ring, process_threaded() drops it.
+		  samples_out.push_back(0);
+		  b->out.push(samples_out);
+	 }
+
+	 return NULL;
+}
+
+
+template <class T>
+bool FmDecoderT<T>::start_branches()
+{
+	 typedef void * (*THREADFUNCPTR)(void *);
+
+	 if (m_stereo_branch)
+		  return true;
+
+	 m_stereo_branch.reset(new Branch(this));
+
+	 int err = pthread_create(&m_stereo_branch->tid, NULL,
+									  (THREADFUNCPTR) &FmDecoderT::BranchThread, m_stereo_branch.get());
+	 if (err != 0) {
+		  fprintf(stderr, "FmDecoder branch thread failed: %s\n", strerror(err));
+		  m_stereo_branch.reset();
+		  return false;
+	 }
+
+	 return true;
+}
+
+
+template <class T>
+void FmDecoderT<T>::stop_branches()
+{
+	 if (!m_stereo_branch)
+		  return;
+
+	 drain_branches();
+
+	 m_stereo_branch->in.push_end();
+	 pthread_join(m_stereo_branch->tid, NULL);
+
+	 m_stereo_branch.reset();
+}
+
+
+template <class T>
+void FmDecoderT<T>::drain_branches()
+{
+	 if (!m_in_flight)
+		  return;
+
+	 if (m_stereo_enabled)
+		  m_stereo_branch->out.pull(m_buf_stereo);
+
+	 m_buf_mono_late.clear();
+	 m_in_flight = false;
+}
+
+
+template <class T>
+void FmDecoderT<T>::set_threading(threading_t mode)
+{
+	 if (mode == m_threading)
+		  return;
+
+	 if (mode == THREADS_SERIAL)
+		  stop_branches();
+	 else {
+		  drain_branches();
+
+		  // no worker, no threading, the decoder carries on serially
+		  if (!start_branches())
+				mode = THREADS_SERIAL;
+	 }
+
+	 m_threading = mode;
+}
+
+
+// Same steps as the serial path, with the stereo branch on the worker
+// once the pilot PLL is done and the mono branch here meanwhile.  The
+// stereo filters are only ever touched by the worker while threaded,
+// the rings order those accesses with the calling thread.
+template <class T>
+void FmDecoderT<T>::process_threaded(vector<T>& audio)
+{
+	 if (m_buf_baseband.empty()) {
+		  audio.clear();
+		  return;
+	 }
+
+	 if (m_stereo_enabled || m_rds_enabled) {
+
+		  // Lock on stereo pilot.
+		  m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
+		  m_stereo_detected = m_stereo_enabled && m_pilotpll.locked();
+	 }
+
+	 if (m_stereo_enabled) {
+
+		  // Demodulate stereo signal, the branch always runs to keep the
+		  // mono and stereo resamplers in sync.  The push swaps the block
+		  // into the ring, the worker has it without a copy.
+		  demod_stereo(m_buf_baseband, m_buf_rawstereo);
+		  m_stereo_branch->in.push(m_buf_rawstereo);
+	 }
+
+	 // Extract mono audio signal while the worker does L-R.
+	 mono_branch(m_buf_baseband, m_buf_mono);
+
+	 bool stereo_detected = m_stereo_detected;
+
+	 if (m_threading == THREADS_PIPELINED) {
+
+		  // Collect the block handed over last time, this one runs on
+		  // while the caller gets the next samples.  Its mono waits
+		  // here for it.
+		  bool first = !m_in_flight;
+		  m_in_flight = true;
+		  swap(m_buf_mono, m_buf_mono_late);
+		  swap(stereo_detected, m_in_flight_stereo);
+
+		  if (first) {
+				audio.clear();
+				return;
+		  }
+	 }
+
+	 if (m_stereo_enabled) {
+		  m_stereo_branch->out.pull(m_buf_stereo);
+		  m_buf_stereo.pop_back();
+	 }
+
+	 if (m_stereo_enabled && stereo_detected)
+		  stereo_to_left_right(m_buf_mono, m_buf_stereo, audio);
+	 else
+		  mono_to_left_right(m_buf_mono, audio);
+}
+
+
 // Demodulate stereo L-R signal.
-void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
-									  SampleVector& samples_rawstereo)
+template <class T>
+void FmDecoderT<T>::demod_stereo(const vector<T>& samples_baseband,
+									  vector<T>& samples_rawstereo)
 {
 	 // Just multiply the baseband signal with the double-frequency pilot.
 	 // And multiply by two to get the full amplitude.
@@ -420,14 +832,15 @@ void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
 
 
 // Duplicate mono signal in left/right channels.
-void FmDecoder::mono_to_left_right(const SampleVector& samples_mono,
-											  SampleVector& audio)
+template <class T>
+void FmDecoderT<T>::mono_to_left_right(const vector<T>& samples_mono,
+											  vector<T>& audio)
 {
 	 unsigned int n = samples_mono.size();
 
 	 audio.resize(2*n);
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample m = samples_mono[i];
+		  T m = samples_mono[i];
 		  audio[2*i]   = m;
 		  audio[2*i+1] = m;
 	 }
@@ -435,20 +848,30 @@ void FmDecoder::mono_to_left_right(const SampleVector& samples_mono,
 
 
 // Extract left/right channels from mono/stereo signals.
-void FmDecoder::stereo_to_left_right(const SampleVector& samples_mono,
-												 const SampleVector& samples_stereo,
-												 SampleVector& audio)
+template <class T>
+void FmDecoderT<T>::stereo_to_left_right(const vector<T>& samples_mono,
+												 const vector<T>& samples_stereo,
+												 vector<T>& audio)
 {
 	 unsigned int n = samples_mono.size();
 	 assert(n == samples_stereo.size());
 
 	 audio.resize(2*n);
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample m = samples_mono[i];
-		  Sample s = samples_stereo[i];
+		  T m = samples_mono[i];
+		  T s = samples_stereo[i];
 		  audio[2*i]   = m + s;
 		  audio[2*i+1] = m - s;
 	 }
 }
 
+/* ****************  instantiations  **************** */
+
+template class PhaseDiscriminatorT<float>;
+template class PhaseDiscriminatorT<double>;
+template class PilotPhaseLockT<float>;
+template class PilotPhaseLockT<double>;
+template class FmDecoderT<float>;
+template class FmDecoderT<double>;
+
 /* end */
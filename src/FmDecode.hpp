@@ -20,38 +20,223 @@
 #pragma once
  
 #include <cstdint>
+#include <cmath>
 #include <vector>
+#include <memory>
+#include <pthread.h>
 #include "Filter.hpp"
 #include "SDRDecoder.hpp"
+#include "SPSCRing.hpp"
+#include "RdsDecode.hpp"
 
 /* Detect frequency by phase discrimination between successive samples. */
-class PhaseDiscriminator
+template <class T>
+class PhaseDiscriminatorT
 {
 public:
 
+	 typedef enum  {
+		  ATAN2_EXACT = 0,     // std::atan2 per sample
+		  ATAN2_FAST,          // branch free polynomial, vectorized per block
+	 } method_t;
+
+	 /**
+	  * Worst case phase error of ATAN2_FAST in radians, over the full circle
+	  * and including float rounding.  At broadcast FM deviation this is
+	  * better than -90 dB relative to full scale output.
+	  */
+	 static constexpr double fast_atan2_max_error = 1.0e-5;
+
 	 /**
 	  * Construct phase discriminator.
 	  *
 	  * max_freq_dev :: Full scale frequency deviation relative to the
 	  *                 full sample frequency.
+	  * method       :: How the phase difference is computed.
 	  */
-	 PhaseDiscriminator(double max_freq_dev);
+	 PhaseDiscriminatorT(double max_freq_dev, method_t method = ATAN2_FAST);
 
 	 /**
 	  * Process samples.
 	  * Output is a sequence of frequency estimates, scaled such that
 	  * output value +/- 1.0 represents the maximum frequency deviation.
 	  */
-	 void process(const IQSampleVector& samples_in, SampleVector& samples_out);
+	 void process(const IQSampleVector& samples_in, std::vector<T>& samples_out);
+
+	 void set_method(method_t method) { m_method = method; }
+	 method_t method() const { return m_method; }
+
+	 /** Forget the last sample, for a new stream. */
+	 void reset() { m_last_sample = 0; }
+
+	 /** Fast atan2 approximation, error is below fast_atan2_max_error. */
+	 static inline float fast_atan2(float y, float x);
 
 private:
-	 const Sample m_freq_scale_factor;
+	 const T      m_freq_scale_factor;
 	 IQSample     m_last_sample;
+	 method_t     m_method;
+	 std::vector<float> m_buf_re;
+	 std::vector<float> m_buf_im;
+};
+
+typedef PhaseDiscriminatorT<Sample> PhaseDiscriminator;
+
+
+/*
+ * Polynomial atan on the first octant, folded out to the full circle with
+ * selects instead of branches so the compiler can run it in SIMD lanes.
+ * 11th order odd minimax polynomial, max error ~2e-6 rad.
+ */
+template <class T>
+inline float PhaseDiscriminatorT<T>::fast_atan2(float y, float x)
+{
+	 float ax = std::fabs(x);
+	 float ay = std::fabs(y);
+	 float mx = std::fmax(ax, ay);
+	 float mn = std::fmin(ax, ay);
+	 float a  = mn / (mx + 1.0e-30f);
+	 float s  = a * a;
+
+	 float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s
+					  + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+
+	 r = (ay > ax) ? 1.57079637f - r : r;
+	 r = (x < 0)   ? 3.14159274f - r : r;
+	 r = (y < 0)   ? -r : r;
+	 return r;
+}
+
+
+/**
+ * Phase discriminator on Q15 IQ samples.
+ *
+ * The phase of every sample is found with an integer atan2 as a 16 bit
+ * binary angle (65536 = 2 pi), so the difference between successive
+ * samples wraps around the circle for free and no conjugate product is
+ * needed.  Phase resolution is 1e-4 rad.
+ *
+ * Full deviation comes out as full_scale(), at most a quarter of the
+ * int16 range, so a tuning error or overdeviation does not clip.  A
+ * narrow deviation gets less, so that even a half cycle step on noise
+ * still fits.
+ */
+class PhaseDiscriminatorQ15
+{
+public:
+
+	 static const int max_full_scale = 8192;
+
+	 /** Same argument as PhaseDiscriminator. */
+	 PhaseDiscriminatorQ15(double max_freq_dev);
+
+	 /** Process samples, full deviation is +/- full_scale(). */
+	 void process(const IQSampleQ15Vector& samples_in, SampleQ15Vector& samples_out);
+
+	 /** Output for full deviation. */
+	 int full_scale() const { return m_full_scale; }
+
+	 /** Forget the last phase, for a new stream. */
+	 void reset() { m_last_phase = 0; m_has_phase = false; }
+
+	 /** Binary angle of (x, y), 65536 is a full circle. */
+	 static inline int16_t atan2_q15(int32_t y, int32_t x);
+
+private:
+	 static const int atan_table_bits = 9;
+	 static int16_t   s_atan_table[(1 << atan_table_bits) + 2];
+	 static bool      s_atan_ready;
+	 static bool      make_atan_table();
+
+	 const int32_t    m_full_scale;
+	 const int32_t    m_gain;		// Q12
+	 int16_t          m_last_phase;
+	 bool             m_has_phase;
+};
+
+
+inline int16_t PhaseDiscriminatorQ15::atan2_q15(int32_t y, int32_t x)
+{
+	 int32_t ax = x < 0 ? -x : x;
+	 int32_t ay = y < 0 ? -y : y;
+	 int32_t mx = ax > ay ? ax : ay;
+	 int32_t mn = ax > ay ? ay : ax;
+
+	 if (mx == 0)
+		  return 0;
+
+	 // ratio in Q15, table lookup with linear interpolation, 0 .. 8192 (pi/4)
+	 const int shift = 15 - atan_table_bits;
+	 int32_t r = (mn << 15) / mx;
+	 int32_t idx = r >> shift;
+	 int32_t frac = r & ((1 << shift) - 1);
+	 int32_t a0 = s_atan_table[idx];
+	 int32_t a = a0 + (((s_atan_table[idx + 1] - a0) * frac) >> shift);
+
+	 a = (ay > ax) ? 16384 - a : a;
+	 a = (x < 0)   ? 32768 - a : a;
+	 a = (y < 0)   ? -a : a;
+	 return int16_t(a);
+}
+
+
+/**
+ * Integer FM front end: fine tuner, decimating IF filter and phase
+ * discriminator on Q15 data.  Selected per decoder with set_fixed_point(),
+ * the audio stages after it stay in the decoder's sample type.
+ */
+class FmFrontEndQ15
+{
+public:
+
+	 /**
+	  * tuning_table_size, tuning_shift :: as FineTuner
+	  * filter_order, cutoff, decimation :: as DecimatingFilterFirIQ
+	  * max_freq_dev :: as PhaseDiscriminator, relative to the baseband rate
+	  */
+	 FmFrontEndQ15(unsigned int tuning_table_size, int tuning_shift,
+						unsigned int filter_order, double cutoff,
+						unsigned int decimation, double max_freq_dev);
+
+	 /** New tuning shift and IF cutoff, the stages start over as constructed. */
+	 void retune(int tuning_shift, double cutoff);
+
+	 /** Demodulate IQ to Q15 baseband. */
+	 void process(const IQSampleVector& samples_in, SampleQ15Vector& baseband);
+
+	 /** Approximate RMS IF level of the last block (full scale IQ is 1.0). */
+	 double get_if_rms() const { return m_if_rms; }
+
+	 /** Baseband output for full deviation. */
+	 int full_scale() const { return m_phasedisc.full_scale(); }
+
+private:
+	 IQSampleQ15Vector      m_buf_in;
+	 IQSampleQ15Vector      m_buf_tuned;
+	 IQSampleQ15Vector      m_buf_filtered;
+	 FineTunerQ15           m_finetuner;
+	 DecimatingFilterFirQ15 m_iffilter;
+	 PhaseDiscriminatorQ15  m_phasedisc;
+	 double                 m_if_rms;
 };
 
 
+/** Convert fixed point baseband to the decoder sample type, 1.0 at full_scale. */
+template <class T>
+inline void q15_to_samples(const SampleQ15Vector& samples_in, int full_scale,
+									std::vector<T>& samples_out)
+{
+	 const T scale = T(1.0 / full_scale);
+	 unsigned int n = samples_in.size();
+	 samples_out.resize(n);
+	 for (unsigned int i = 0; i < n; i++)
+		  samples_out[i] = T(samples_in[i]) * scale;
+}
+
+
 /** Phase-locked loop for stereo pilot. */
-class PilotPhaseLock
+template <class T>
+class PilotPhaseLockT
 {
 public:
 
@@ -74,13 +259,16 @@ public:
 	  * bandwidth  :: bandwidth relative to sample frequency
 	  * minsignal  :: minimum pilot amplitude
 	  */
-	 PilotPhaseLock(double freq, double bandwidth, double minsignal);
+	 PilotPhaseLockT(double freq, double bandwidth, double minsignal);
 
 	 /**
 	  * Process samples and extract 19 kHz pilot tone.
 	  * Generate phase-locked 38 kHz tone with unit amplitude.
 	  */
-	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+	 void process(const std::vector<T>& samples_in, std::vector<T>& samples_out);
+
+	 /** Start over unlocked at the center frequency, as constructed. */
+	 void reset();
 
 	 /** Return true if the phase-locked loop is locked. */
 	 bool locked() const
@@ -100,26 +288,44 @@ public:
 		  return m_pps_events;
 	 }
 
+	 /**
+	  * Also generate the locked 57 kHz tone, the RDS subcarrier, as a
+	  * conjugate phasor exp(-3j * phase) for every input sample.
+	  */
+	 void set_third_harmonic(bool enable) { m_third_harmonic = enable; }
+
+	 /** 57 kHz phasor from the most recently processed block. */
+	 const IQSampleVector& get_third_harmonic() const
+	 {
+		  return m_buf_third;
+	 }
+
 private:
-	 Sample  m_minfreq, m_maxfreq;
-	 Sample  m_phasor_b0, m_phasor_a1, m_phasor_a2;
-	 Sample  m_phasor_i1, m_phasor_i2, m_phasor_q1, m_phasor_q2;
-	 Sample  m_loopfilter_b0, m_loopfilter_b1;
-	 Sample  m_loopfilter_x1;
-	 Sample  m_freq, m_phase;
-	 Sample  m_minsignal;
-	 Sample  m_pilot_level;
+	 double  m_minfreq, m_maxfreq;
+	 T       m_phasor_b0, m_phasor_a1, m_phasor_a2;
+	 T       m_phasor_i1, m_phasor_i2, m_phasor_q1, m_phasor_q2;
+	 T       m_loopfilter_b0, m_loopfilter_b1;
+	 T       m_loopfilter_x1;
+	 double  m_center_freq;
+	 double  m_freq, m_phase;     // loop state stays double
+	 T       m_minsignal;
+	 T       m_pilot_level;
 	 int     m_lock_delay;
 	 int     m_lock_cnt;
 	 int     m_pilot_periods;
 	 std::uint64_t         m_pps_cnt;
 	 std::uint64_t         m_sample_cnt;
 	 std::vector<PpsEvent> m_pps_events;
+	 bool                  m_third_harmonic;
+	 IQSampleVector        m_buf_third;
 };
 
+typedef PilotPhaseLockT<Sample> PilotPhaseLock;
+
 
 /** Complete decoder for FM broadcast signal. */
-class FmDecoder : public SDRDecoder
+template <class T>
+class FmDecoderT : public SDRDecoderT<T>
 {
 public:
 	
@@ -129,6 +335,13 @@ public:
 	 static constexpr double default_bandwidth_pcm =  15000;
 	 static constexpr double pilot_freq            =  19000;
 
+	 /** Where the audio branches run, see set_threading(). */
+	 typedef enum {
+		  THREADS_SERIAL = 0,     // everything on the calling thread
+		  THREADS_FORK_JOIN,      // L-R branch on a worker, audio of the same block
+		  THREADS_PIPELINED,      // L-R branch overlaps the next block, one block later
+	 } threading_t;
+
 	 /**
 	  * Construct FM decoder.
 	  *
@@ -146,10 +359,10 @@ public:
 	  *                     (75 kHz for broadcast FM)
 	  * bandwidth_pcm    :: Half bandwidth of audio signal in Hz
 	  *                     (15 kHz for broadcast FM)
-	  * downsample       :: Downsampling factor to apply after FM demodulation.
-	  *                     Set to 1 to disable.
+	  * downsample       :: Decimation factor applied by the IF filter, before
+	  *                     FM demodulation.  Set to 1 to disable.
 	  */
-	 FmDecoder(double sample_rate_if,
+	 FmDecoderT(double sample_rate_if,
 				  double tuning_offset,
 				  double sample_rate_pcm,
 				  bool   stereo=true,
@@ -159,6 +372,8 @@ public:
 				  double bandwidth_pcm=default_bandwidth_pcm,
 				  unsigned int downsample=1);
 
+	 ~FmDecoderT();
+
 	 /**
 	  * Process IQ samples and return audio samples.
 	  *
@@ -168,7 +383,10 @@ public:
 	  * vector only contains samples for one channel.
 	  */
 	 void process(const IQSampleVector& samples_in,
-					  SampleVector& audio);
+					  std::vector<T>& audio);
+
+	 /** Move to another station without rebuilding the decoder. */
+	 void retune(double tuning_offset, double bandwidth_if);
 
 	 /** Return true if a stereo signal is detected. */
 	 bool stereo_detected() const
@@ -211,54 +429,150 @@ public:
 	bool canSquelch() const  { return false; };
  
 	 /** Return PPS events from the most recently processed block. */
-	 std::vector<PilotPhaseLock::PpsEvent> get_pps_events() const
+	 std::vector<typename PilotPhaseLockT<T>::PpsEvent> get_pps_events() const
 	 {
 		  return m_pilotpll.get_pps_events();
 	 }
 
+	 /** Select exact or fast atan2 in the FM discriminator. */
+	 void set_discriminator_method(typename PhaseDiscriminatorT<T>::method_t method)
+	 {
+		  m_phasedisc.set_method(method);
+	 }
+
+	 /**
+	  * Run tuner, IF filter and discriminator in Q15 fixed point.
+	  * Cheaper on cores with weak floating point, stereo decoding and
+	  * de-emphasis stay in the decoder's sample type.
+	  */
+	 void set_fixed_point(bool enable) { m_fixed_point = enable; }
+	 bool fixed_point() const { return m_fixed_point; }
+
+	 /**
+	  * Decode RDS from the 57 kHz subcarrier.  This keeps the pilot PLL
+	  * running even when stereo is disabled.
+	  */
+	 void set_rds_enabled(bool enable);
+	 bool rds_enabled() const { return m_rds_enabled; }
+
+	 /**
+	  * Run RDS on the baseband of the last process() call.  Separate so
+	  * the caller can hand the audio on first, nothing here delays it.
+	  * Does nothing while the pilot is not locked.
+	  */
+	 void process_rds();
+
+	 const RdsDecoderT<T>& rds() const { return m_rds; }
+
+	 /**
+	  * Split the work over two cores.  The L-R resampling branch gets a
+	  * worker fed through an SPSCRing, which takes the demodulated block
+	  * over without a copy.  The front end, the pilot PLL and the mono
+	  * branch stay on the calling thread, so the baseband is never shared
+	  * and stays put for process_rds().  Fork-join waits for the L-R of the
+	  * block just given.  Pipelined lets it run on while the next block
+	  * comes in and returns the audio from the next call, so the first
+	  * call returns none.  The audio is identical in all modes.
+	  *
+	  * The IF front end deliberately gets no stage of its own.  The PLL and
+	  * both branches need its output of the same block, so it could only
+	  * overlap by running a block ahead: another block of latency on top
+	  * of pipelined mode, and a baseband shared with process_rds().
+	  *
+	  * Neither mode has yet measured faster than serial, so the decoder
+	  * starts serial and RadioMgr leaves it so unless the setting asks
+	  * otherwise.  If the worker cannot be started the decoder stays
+	  * serial, threading() tells.
+	  */
+	 void set_threading(threading_t mode);
+	 threading_t threading() const { return m_threading; }
+
 private:
+	 /** The L-R branch on its own thread. */
+	 struct Branch
+	 {
+		  Branch(FmDecoderT* decoder);
+
+		  FmDecoderT*     decoder;
+		  SPSCRing<T>     in;
+		  SPSCRing<T>     out;
+		  pthread_t       tid;
+	 };
+
+	 /** Resample, DC block and de-emphasize the mono signal. */
+	 void mono_branch(const std::vector<T>& samples_baseband,
+						   std::vector<T>& samples_mono);
+
+	 /** Resample, DC block and de-emphasize the demodulated L-R signal. */
+	 void stereo_branch(const std::vector<T>& samples_rawstereo,
+							  std::vector<T>& samples_stereo);
+
+	 /** Hand the L-R branch this block and collect the audio, threaded modes. */
+	 void process_threaded(std::vector<T>& audio);
+
+	 /** Start or stop the branch worker, start returns false if it could not. */
+	 bool start_branches();
+	 void stop_branches();
+
+	 /** Throw away a block still in the pipeline. */
+	 void drain_branches();
+
+	 static void* BranchThread(void *context);
+
 	 /** Demodulate stereo L-R signal. */
-	 void demod_stereo(const SampleVector& samples_baseband,
-							 SampleVector& samples_stereo);
+	 void demod_stereo(const std::vector<T>& samples_baseband,
+							 std::vector<T>& samples_stereo);
 
 	 /** Duplicate mono signal in left/right channels. */
-	 void mono_to_left_right(const SampleVector& samples_mono,
-									 SampleVector& audio);
+	 void mono_to_left_right(const std::vector<T>& samples_mono,
+									 std::vector<T>& audio);
 
 	 /** Extract left/right channels from mono/stereo signals. */
-	 void stereo_to_left_right(const SampleVector& samples_mono,
-										const SampleVector& samples_stereo,
-										SampleVector& audio);
+	 void stereo_to_left_right(const std::vector<T>& samples_mono,
+										const std::vector<T>& samples_stereo,
+										std::vector<T>& audio);
 
 	 // Data members.
 	 const double    m_sample_rate_if;
 	 const double    m_sample_rate_baseband;
 	 const int       m_tuning_table_size;
-	 const int       m_tuning_shift;
+	 int             m_tuning_shift;
 	 const double    m_freq_dev;
 	 const unsigned int m_downsample;
 	 const bool      m_stereo_enabled;
 	 bool            m_stereo_detected;
+	 bool            m_rds_enabled;
 	 double          m_if_level;
 	 double          m_baseband_mean;
 	 double          m_baseband_level;
+	 bool            m_fixed_point;
 
 	 IQSampleVector  m_buf_iftuned;
 	 IQSampleVector  m_buf_iffiltered;
-	 SampleVector    m_buf_baseband;
-	 SampleVector    m_buf_mono;
-	 SampleVector    m_buf_rawstereo;
-	 SampleVector    m_buf_stereo;
-
-	 FineTuner           m_finetuner;
-	 LowPassFilterFirIQ  m_iffilter;
-	 PhaseDiscriminator  m_phasedisc;
-	 DownsampleFilter    m_resample_baseband;
-	 PilotPhaseLock      m_pilotpll;
-	 DownsampleFilter    m_resample_mono;
-	 DownsampleFilter    m_resample_stereo;
-	 HighPassFilterIir   m_dcblock_mono;
-	 HighPassFilterIir   m_dcblock_stereo;
-	 LowPassFilterRC     m_deemph_mono;
-	 LowPassFilterRC     m_deemph_stereo;
+	 SampleQ15Vector m_buf_baseband_q15;
+	 std::vector<T>    m_buf_baseband;
+	 std::vector<T>    m_buf_mono;
+	 std::vector<T>    m_buf_rawstereo;
+	 std::vector<T>    m_buf_stereo;
+
+	 FineTuner              m_finetuner;
+	 DecimatingFilterFirIQ  m_iffilter;
+	 PhaseDiscriminatorT<T> m_phasedisc;
+	 FmFrontEndQ15          m_frontend_q15;
+	 PilotPhaseLockT<T>     m_pilotpll;
+	 RationalResamplerT<T>  m_resample_mono;
+	 RationalResamplerT<T>  m_resample_stereo;
+	 HighPassFilterIirT<T>  m_dcblock_mono;
+	 HighPassFilterIirT<T>  m_dcblock_stereo;
+	 LowPassFilterRCT<T>    m_deemph_mono;
+	 LowPassFilterRCT<T>    m_deemph_stereo;
+	 RdsDecoderT<T>         m_rds;
+
+	 threading_t              m_threading;
+	 std::unique_ptr<Branch>  m_stereo_branch;
+	 std::vector<T>           m_buf_mono_late;     // mono of the block in flight
+	 bool                     m_in_flight;         // a pipelined block is out
+	 bool                     m_in_flight_stereo;  // and its stereo_detected
 };
+
+typedef FmDecoderT<Sample> FmDecoder;
@@ -0,0 +1,298 @@
+//
+//  IQConvert.cpp
+//  carradio
+//
+
+#include "IQConvert.hpp"
+
+#include <time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static constexpr float IQ_SCALE = 1.0f / 128.0f;
+
+// MARK: -   LUT
+
+static float s_lut[256];
+
+static bool buildLUT(){
+	for(int i = 0; i < 256; i++)
+		s_lut[i] = (i - 128) * IQ_SCALE;
+	return true;
+}
+
+[[maybe_unused]] static bool s_lutReady = buildLUT();
+
+static void convert_lut(const uint8_t* in, IQSample* out, size_t nsamples){
+	float* f = reinterpret_cast<float*>(out);
+	size_t n = 2 * nsamples;
+
+	for(size_t i = 0; i < n; i++)
+		f[i] = s_lut[in[i]];
+}
+
+// MARK: -   NEON
+
+#if HAVE_NEON
+static void convert_neon(const uint8_t* in, IQSample* out, size_t nsamples){
+	float* f = reinterpret_cast<float*>(out);
+	size_t n = 2 * nsamples;
+	size_t i = 0;
+
+	const float32x4_t bias  = vdupq_n_f32(-128.0f * IQ_SCALE);
+	const float32x4_t scale = vdupq_n_f32(IQ_SCALE);
+
+	// 16 bytes -> 16 floats per pass
+	for(; i + 16 <= n; i += 16){
+		uint8x16_t b = vld1q_u8(in + i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+
+		float32x4_t f0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo)));
+		float32x4_t f1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo)));
+		float32x4_t f2 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi)));
+		float32x4_t f3 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi)));
+
+		vst1q_f32(f + i,      vmlaq_f32(bias, f0, scale));
+		vst1q_f32(f + i + 4,  vmlaq_f32(bias, f1, scale));
+		vst1q_f32(f + i + 8,  vmlaq_f32(bias, f2, scale));
+		vst1q_f32(f + i + 12, vmlaq_f32(bias, f3, scale));
+	}
+
+	for(; i < n; i++)
+		f[i] = s_lut[in[i]];
+}
+#endif
+
+// MARK: -   SSE2 / AVX2
+
+#if HAVE_X86
+static void convert_sse2(const uint8_t* in, IQSample* out, size_t nsamples){
+	float* f = reinterpret_cast<float*>(out);
+	size_t n = 2 * nsamples;
+	size_t i = 0;
+
+	const __m128i zero  = _mm_setzero_si128();
+	const __m128  bias  = _mm_set1_ps(128.0f);
+	const __m128  scale = _mm_set1_ps(IQ_SCALE);
+
+	for(; i + 16 <= n; i += 16){
+		__m128i b  = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i lo = _mm_unpacklo_epi8(b, zero);
+		__m128i hi = _mm_unpackhi_epi8(b, zero);
+
+		__m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+		__m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+		__m128 f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+		__m128 f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+
+		_mm_storeu_ps(f + i,      _mm_mul_ps(_mm_sub_ps(f0, bias), scale));
+		_mm_storeu_ps(f + i + 4,  _mm_mul_ps(_mm_sub_ps(f1, bias), scale));
+		_mm_storeu_ps(f + i + 8,  _mm_mul_ps(_mm_sub_ps(f2, bias), scale));
+		_mm_storeu_ps(f + i + 12, _mm_mul_ps(_mm_sub_ps(f3, bias), scale));
+	}
+
+	for(; i < n; i++)
+		f[i] = s_lut[in[i]];
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2(const uint8_t* in, IQSample* out, size_t nsamples){
+	float* f = reinterpret_cast<float*>(out);
+	size_t n = 2 * nsamples;
+	size_t i = 0;
+
+	const __m256 bias  = _mm256_set1_ps(128.0f);
+	const __m256 scale = _mm256_set1_ps(IQ_SCALE);
+
+	for(; i + 32 <= n; i += 32){
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(in + i + 16));
+
+		__m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b0));
+		__m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b0, 8)));
+		__m256 f2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b1));
+		__m256 f3 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b1, 8)));
+
+		_mm256_storeu_ps(f + i,      _mm256_mul_ps(_mm256_sub_ps(f0, bias), scale));
+		_mm256_storeu_ps(f + i + 8,  _mm256_mul_ps(_mm256_sub_ps(f1, bias), scale));
+		_mm256_storeu_ps(f + i + 16, _mm256_mul_ps(_mm256_sub_ps(f2, bias), scale));
+		_mm256_storeu_ps(f + i + 24, _mm256_mul_ps(_mm256_sub_ps(f3, bias), scale));
+	}
+
+	for(; i < n; i++)
+		f[i] = s_lut[in[i]];
+}
+#endif
+
+// MARK: -   Q15
+
+// Plain loops, both vectorize at -O2 -ftree-vectorize on NEON and SSE2.
+
+void IQConvert::u8ToQ15(const uint8_t* in, IQSampleQ15* out, size_t nsamples){
+	int16_t* q = reinterpret_cast<int16_t*>(out);
+	size_t n = 2 * nsamples;
+
+	for(size_t i = 0; i < n; i++)
+		q[i] = int16_t((int(in[i]) - 128) * 128);
+}
+
+void IQConvert::iqToQ15(const IQSample* in, IQSampleQ15* out, size_t nsamples){
+	const float* f = reinterpret_cast<const float*>(in);
+	int16_t* q = reinterpret_cast<int16_t*>(out);
+	size_t n = 2 * nsamples;
+
+	// u8ToIQ values are k/128, so k/128 * 16384 = k * 128 exactly.
+	for(size_t i = 0; i < n; i++)
+		q[i] = int16_t(f[i] * 16384.0f);
+}
+
+// MARK: -   method selection
+
+static bool methodSupported(IQConvert::method_t method){
+
+	switch (method) {
+		case IQConvert::CONVERT_LUT:
+			return true;
+
+#if HAVE_NEON
+		case IQConvert::CONVERT_NEON:
+			return true;
+#endif
+
+#if HAVE_X86
+		case IQConvert::CONVERT_SSE2:
+			return __builtin_cpu_supports("sse2");
+
+		case IQConvert::CONVERT_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+static IQConvert::convert_func_t kernelFor(IQConvert::method_t method){
+
+	switch (method) {
+#if HAVE_NEON
+		case IQConvert::CONVERT_NEON:	return convert_neon;
+#endif
+#if HAVE_X86
+		case IQConvert::CONVERT_SSE2:	return convert_sse2;
+		case IQConvert::CONVERT_AVX2:	return convert_avx2;
+#endif
+		default:								return convert_lut;
+	}
+}
+
+IQConvert::convert_func_t IQConvert::funcForMethod(method_t method){
+
+	if(!methodSupported(method))
+		return NULL;
+
+	return kernelFor(method);
+}
+
+// The Pi has NEON and nothing else to choose from.  On x86 the wider unit
+// is not always the faster one, the conversion is bound by its stores and
+// AVX2 has measured no faster than SSE2, so every kernel the CPU has is
+// timed on a block the size the dongle delivers and the quickest is kept.
+static IQConvert::method_t bestMethod(){
+
+#if HAVE_NEON
+	return IQConvert::CONVERT_NEON;
+#else
+	IQConvert::method_t best = IQConvert::CONVERT_LUT;
+
+#if HAVE_X86
+	const size_t nsamples = 65536;
+	vector<uint8_t> in(2 * nsamples, 128);
+	IQSampleVector out(nsamples);
+
+	double best_secs = 0;
+	for(auto m : {IQConvert::CONVERT_LUT, IQConvert::CONVERT_SSE2, IQConvert::CONVERT_AVX2}){
+		if(!methodSupported(m))
+			continue;
+
+		IQConvert::convert_func_t func = kernelFor(m);
+
+		// first pass warms the caches, the quickest of the rest counts
+		double secs = 0;
+		for(int pass = 0; pass < 5; pass++){
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			(func)(in.data(), out.data(), nsamples);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+			if(pass == 1 || (pass > 1 && t < secs))
+				secs = t;
+		}
+
+		if(best_secs == 0 || secs < best_secs){
+			best = m;
+			best_secs = secs;
+		}
+	}
+#endif
+	return best;
+#endif
+}
+
+IQConvert::method_t 			IQConvert::_method = bestMethod();
+IQConvert::convert_func_t 	IQConvert::_convert = IQConvert::funcForMethod(IQConvert::_method);
+
+
+bool IQConvert::setMethod(method_t method){
+
+	convert_func_t func = funcForMethod(method);
+	if(!func)
+		return false;
+
+	_method = method;
+	_convert = func;
+	return true;
+}
+
+bool IQConvert::convert(method_t method, const uint8_t* in, IQSample* out, size_t nsamples){
+
+	convert_func_t func = funcForMethod(method);
+	if(!func)
+		return false;
+
+	(func)(in, out, nsamples);
+	return true;
+}
+
+vector<IQConvert::method_t> IQConvert::availableMethods(){
+	vector<method_t> methods;
+
+	for(auto m : {CONVERT_LUT, CONVERT_NEON, CONVERT_SSE2, CONVERT_AVX2}){
+		if(methodSupported(m))
+			methods.push_back(m);
+	}
+	return methods;
+}
+
+string IQConvert::methodName(method_t method){
+
+	string str = "?";
+
+	switch (method) {
+		case CONVERT_LUT:		str = "LUT";	break;
+		case CONVERT_NEON:	str = "NEON";	break;
+		case CONVERT_SSE2:	str = "SSE2";	break;
+		case CONVERT_AVX2:	str = "AVX2";	break;
+		default: ;
+	}
+	return str;
+}
@@ -0,0 +1,68 @@
+//
+//  IQConvert.hpp
+//  carradio
+//
+//  Convert raw RTL-SDR bytes to IQ samples.
+//
+//  The RTL2832 delivers unsigned 8 bit I/Q pairs centered on 128.  Every
+//  byte has to become (b - 128) / 128 before any DSP can run, 2M times a
+//  second, so this is done with a vector unit: NEON on the Pi, and on x86
+//  whichever of SSE2 and AVX2 times faster at startup.  A 256 entry
+//  lookup table is used when no vector unit is available.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class IQConvert {
+
+public:
+
+	typedef enum  {
+		CONVERT_LUT = 0,		// scalar lookup table
+		CONVERT_NEON,			// ARM NEON  (Pi)
+		CONVERT_SSE2,			// x86 SSE2
+		CONVERT_AVX2,			// x86 AVX2
+	}method_t;
+
+	typedef void (*convert_func_t)(const uint8_t* in, IQSample* out, size_t nsamples);
+
+	/** Convert nsamples IQ pairs (2 * nsamples bytes) with the best available method. */
+	static inline void u8ToIQ(const uint8_t* in, IQSample* out, size_t nsamples){
+		_convert(in, out, nsamples);
+	}
+
+	/** Convert nsamples IQ pairs to Q15, lossless. */
+	static void u8ToQ15(const uint8_t* in, IQSampleQ15* out, size_t nsamples);
+	
+	/** Convert IQ that came from u8ToIQ to Q15, also lossless. */
+	static void iqToQ15(const IQSample* in, IQSampleQ15* out, size_t nsamples);
+
+	/** Convert with a specific method, returns false if it is not supported here. */
+	static bool convert(method_t method, const uint8_t* in, IQSample* out, size_t nsamples);
+
+	/** Method picked at startup, the fastest on this CPU. */
+	static method_t method() { return _method;};
+
+	/** Override the method picked at startup. */
+	static bool setMethod(method_t method);
+
+	/** Methods this CPU can run, LUT first. */
+	static vector<method_t> availableMethods();
+
+	static string methodName(method_t method);
+
+private:
+	static convert_func_t	_convert;
+	static method_t 			_method;
+
+	static convert_func_t funcForMethod(method_t method);
+};
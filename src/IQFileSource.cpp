@@ -0,0 +1,439 @@
+//
+//  IQFileSource.cpp
+//  carradio
+//
+
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "IQFileSource.hpp"
+#include "IQConvert.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+// MARK: -   IQFileSource
+
+IQFileSource::IQFileSource(){
+	_isSetup = false;
+	_format = FORMAT_U8;
+	_fd = -1;
+	_map = NULL;
+	_mapLength = 0;
+	_bytesPerSample = 2;
+	_nsamples = 0;
+	_blockLength = default_blockLength;
+
+	_pos = 0;
+	_seekTo = -1;
+	_loop = true;
+	_speed = 1.0;
+	_atEnd = false;
+	_async = false;
+
+	_sampleRate = default_sampleRate;
+	_frequency = 0;
+	_tunerGain = INT_MIN;
+	_directSampling = DIRECT_SAMPLING_OFF;
+
+	_paceStart = {0,0};
+	_paceSamples = 0;
+	_stats = {0,0,0};
+}
+
+IQFileSource::~IQFileSource(){
+	stop();
+}
+
+bool IQFileSource::begin(const string& path, int &error, format_t format){
+
+	stop();
+
+	if(format == FORMAT_AUTO)
+		format = formatForPath(path);
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0){
+		error = errno;
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0){
+		error = errno;
+		close(fd);
+		return false;
+	}
+
+	size_t bytesPerSample = (format == FORMAT_CF32) ? sizeof(IQSample) : 2;
+	size_t nsamples = st.st_size / bytesPerSample;
+
+	if(nsamples == 0){
+		error = EINVAL;
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		error = errno;
+		close(fd);
+		return false;
+	}
+
+	// read ahead aggressively, the replay walks the file front to back
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	_path = path;
+	_format = format;
+	_fd = fd;
+	_map = (const uint8_t*) map;
+	_mapLength = st.st_size;
+	_bytesPerSample = bytesPerSample;
+	_nsamples = nsamples;
+
+	_pos = 0;
+	_seekTo = -1;
+	_atEnd = false;
+	_stats = {0,0,0};
+	resetBuffer();
+
+	_isSetup = true;
+	return true;
+}
+
+void IQFileSource::stop(){
+
+	if(_isSetup){
+		munmap((void*)_map, _mapLength);
+		close(_fd);
+	}
+
+	_map = NULL;
+	_mapLength = 0;
+	_fd = -1;
+	_nsamples = 0;
+	_async = false;
+	_isSetup = false;
+}
+
+bool IQFileSource::getDeviceInfo(device_info_t& info){
+	if(!_isSetup)
+		return false;
+
+	info.index = 0;
+	info.name = "IQ file";
+	info.vendor = formatName(_format);
+	info.product = _path;
+	info.serial = "";
+	return true;
+}
+
+bool IQFileSource::setFrequency(uint32_t freq){
+	_frequency = freq;
+	return _isSetup;
+}
+
+uint32_t IQFileSource::getFrequency(){
+	return _frequency;
+}
+
+bool IQFileSource::setSampleRate(uint32_t rate){
+	if(rate == 0)
+		return false;
+
+	_sampleRate = rate;
+	resetBuffer();
+	return true;
+}
+
+uint32_t IQFileSource::getSampleRate(){
+	return _sampleRate;
+}
+
+int IQFileSource::getTunerGain(){
+	return _tunerGain;
+}
+
+std::vector<int> IQFileSource::getTunerGains(){
+	return {};
+}
+
+bool IQFileSource::setTunerGain(int gain){
+	_tunerGain = gain;
+	return true;
+}
+
+bool IQFileSource::setDirectSampling(direct_sampling_t mode){
+	_directSampling = mode;
+	return true;
+}
+
+bool IQFileSource::resetBuffer(){
+	clock_gettime(CLOCK_MONOTONIC, &_paceStart);
+	_paceSamples = 0;
+	return true;
+}
+
+IQSource::async_stats_t IQFileSource::getAsyncStats(){
+	return _stats;
+}
+
+void IQFileSource::setSpeed(double speed){
+	_speed = max(speed, 0.0);
+}
+
+bool IQFileSource::seek(double seconds){
+	if(!_isSetup || seconds < 0)
+		return false;
+
+	int64_t pos = llrint(seconds * _sampleRate);
+	if(pos >= (int64_t)_nsamples)
+		return false;
+
+	_seekTo = pos;
+	return true;
+}
+
+double IQFileSource::position(){
+	return double(_pos) / _sampleRate;
+}
+
+double IQFileSource::duration(){
+	return double(_nsamples) / _sampleRate;
+}
+
+bool IQFileSource::getSamples(IQSampleVector& samples){
+
+	if(!_isSetup)
+		return false;
+
+	int64_t seekTo = _seekTo.exchange(-1);
+	if(seekTo >= 0){
+		_pos = seekTo;
+		_atEnd = false;
+		resetBuffer();
+	}
+
+	size_t pos = _pos;
+
+	if(pos >= _nsamples){
+		if(!_loop){
+			_atEnd = true;
+			pace(_blockLength);
+			return false;
+		}
+		pos = 0;
+	}
+
+	size_t n = min(size_t(_blockLength), _nsamples - pos);
+	const uint8_t* data = _map + pos * _bytesPerSample;
+
+	samples.resize(n);
+	if(_format == FORMAT_CF32)
+		memcpy((void*)samples.data(), data, n * sizeof(IQSample));
+	else
+		IQConvert::u8ToIQ(data, samples.data(), n);
+
+	pos += n;
+	_pos = pos;
+
+	// fault the next block in while this one is processed
+	if(pos < _nsamples){
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t start = (pos * _bytesPerSample) & ~(page - 1);
+		size_t len = min(_blockLength * _bytesPerSample, _mapLength - start);
+		madvise((void*)(_map + start), len, MADV_WILLNEED);
+	}
+
+	_stats.blocks++;
+	pace(n);
+	return true;
+}
+
+// Sleep until the stream is back to real time times the speed factor.
+void IQFileSource::pace(size_t nsamples){
+
+	double speed = _speed;
+	_paceSamples += nsamples;
+
+	if(speed <= 0)
+		return;
+
+	double due = _paceSamples / (_sampleRate * speed);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - _paceStart.tv_sec)
+						+ (now.tv_nsec - _paceStart.tv_nsec) * 1e-9;
+
+	// the consumer stalled, don't try to catch up in a burst
+	if(elapsed - due > 1.0){
+		resetBuffer();
+		return;
+	}
+
+	if(due > elapsed){
+		struct timespec target = _paceStart;
+		double secs = floor(due);
+		target.tv_sec += (time_t) secs;
+		target.tv_nsec += (long) ((due - secs) * 1e9);
+		if(target.tv_nsec >= 1000000000L){
+			target.tv_sec++;
+			target.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL);
+	}
+}
+
+IQFileSource::format_t IQFileSource::formatForPath(const string& path){
+
+	size_t dot = path.find_last_of('.');
+	if(dot != string::npos){
+		string ext = path.substr(dot + 1);
+		transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		if(ext == "cf32" || ext == "cfile" || ext == "fc32")
+			return FORMAT_CF32;
+	}
+	return FORMAT_U8;
+}
+
+string IQFileSource::formatName(format_t format){
+
+	string str = "?";
+
+	switch (format) {
+		case FORMAT_AUTO:	str = "auto";	break;
+		case FORMAT_U8:	str = "u8";		break;
+		case FORMAT_CF32:	str = "cf32";	break;
+		default: ;
+	}
+	return str;
+}
+
+// MARK: -   IQRecorder
+
+IQRecorder::IQRecorder(){
+	_running = false;
+	_fp = NULL;
+	_format = IQFileSource::FORMAT_U8;
+	_ring = NULL;
+	_written = 0;
+}
+
+IQRecorder::~IQRecorder(){
+	stop();
+}
+
+bool IQRecorder::begin(const string& path, int &error, IQFileSource::format_t format){
+
+	stop();
+
+	if(format == IQFileSource::FORMAT_AUTO)
+		format = IQFileSource::formatForPath(path);
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if(!fp){
+		error = errno;
+		return false;
+	}
+
+	// a few blocks worth of stdio buffer keeps the writes large
+	setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+	lock_guard<mutex> lock(_mutex);
+
+	_fp = fp;
+	_format = format;
+	_written = 0;
+	_ring = new SPSCRing<IQSample>(ring_blocks, IQFileSource::default_blockLength);
+	_running = true;
+
+	pthread_create(&_writerTID, NULL,
+						(THREADFUNCPTR) &IQRecorder::WriterThread, (void*)this);
+	return true;
+}
+
+void IQRecorder::stop(){
+
+	{
+		lock_guard<mutex> lock(_mutex);
+		if(!_running)
+			return;
+		_running = false;
+		_ring->push_end();
+	}
+
+	// the writer drains what is queued, then sees the end marker
+	pthread_join(_writerTID, NULL);
+
+	lock_guard<mutex> lock(_mutex);
+	fclose(_fp);
+	_fp = NULL;
+	delete _ring;
+	_ring = NULL;
+}
+
+void IQRecorder::write(const IQSampleVector& samples){
+
+	lock_guard<mutex> lock(_mutex);
+	if(!_running)
+		return;
+
+	// copy into storage recycled from the ring, no allocation once warm
+	_spare.assign(samples.begin(), samples.end());
+	_ring->push(_spare);
+}
+
+uint64_t IQRecorder::blocksDropped(){
+	lock_guard<mutex> lock(_mutex);
+	return _ring ? _ring->drops() : 0;
+}
+
+void IQRecorder::Writer(){
+
+	IQSampleVector block;
+
+	while(_ring->pull(block)){
+
+		size_t n = block.size();
+		bool ok;
+
+		if(_format == IQFileSource::FORMAT_CF32){
+			ok = fwrite(block.data(), sizeof(IQSample), n, _fp) == n;
+		}
+		else {
+			// inverse of u8ToIQ, exact for samples that came from the dongle
+			_u8buf.resize(2 * n);
+			const float* f = reinterpret_cast<const float*>(block.data());
+			for(size_t i = 0; i < 2 * n; i++){
+				long b = lrintf(f[i] * 128.0f + 128.0f);
+				_u8buf[i] = uint8_t(b < 0 ? 0 : (b > 255 ? 255 : b));
+			}
+			ok = fwrite(_u8buf.data(), 1, 2 * n, _fp) == 2 * n;
+		}
+
+		if(!ok){
+			fprintf(stderr, "IQ recording write failed: %s\n", strerror(errno));
+			break;
+		}
+		_written += n;
+	}
+
+	fflush(_fp);
+}
+
+void* IQRecorder::WriterThread(void *context){
+	IQRecorder* d = (IQRecorder*)context;
+
+	d->Writer();
+
+	pthread_exit(NULL);
+	return((void *)1);
+}
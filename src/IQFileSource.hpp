@@ -0,0 +1,182 @@
+//
+//  IQFileSource.hpp
+//  carradio
+//
+//  Replay and record of raw IQ captures.
+//
+//  IQFileSource stands in for RtlSdr.  The capture is mmapped and each
+//  block is converted straight out of the page cache into the caller's
+//  recycled vector, there is no read buffer in between.  Replay is paced
+//  to the sample rate times a speed factor, 0 runs as fast as the
+//  consumer pulls.  The tuner calls are accepted and remembered so
+//  RadioMgr can drive it unchanged; replay with the radio set to the
+//  station the capture was made on and the decoder offsets line up.
+//
+//  IQRecorder writes the live stream to disk from its own thread, so a
+//  slow SD card never stalls the SDR reader.
+//
+//  Formats are headerless:
+//    u8    interleaved unsigned 8 bit I/Q, as rtl_sdr writes
+//    cf32  interleaved native float I/Q, as a GNU Radio file sink writes
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <time.h>
+#include <pthread.h>
+
+#include "IQSource.hpp"
+#include "SPSCRing.hpp"
+
+using namespace std;
+
+class IQFileSource : public IQSource
+{
+public:
+
+	typedef enum  {
+		FORMAT_AUTO = 0,		// from the file extension, .cf32/.cfile or u8
+		FORMAT_U8,
+		FORMAT_CF32,
+	}format_t;
+
+	static constexpr int 	default_blockLength = 65536;
+	static constexpr double default_sampleRate = 1.0e6;
+
+	IQFileSource();
+	~IQFileSource();
+
+	/** Map the capture, error is errno on failure. */
+	bool begin(const string& path, int &error, format_t format = FORMAT_AUTO);
+	void stop() override;
+
+	bool getDeviceInfo(device_info_t&) override;
+
+	bool setFrequency(uint32_t) override;
+	uint32_t getFrequency() override;
+
+	/** The file has no header, this sets the rate it is replayed at. */
+	bool setSampleRate(uint32_t) override;
+	uint32_t getSampleRate() override;
+
+	int getTunerGain() override;
+	std::vector<int> getTunerGains() override;
+	bool setTunerGain(int) override;
+
+	bool setOffsetTuning(bool) override {return true;};
+	bool setACGMode(bool) override {return true;};
+	bool setBiasTee(bool) override {return true;};
+
+	bool setDirectSampling(direct_sampling_t) override;
+	direct_sampling_t getDirectSampling() override {return _directSampling;};
+
+	/** Restart the pacing clock, the file position is kept. */
+	bool resetBuffer() override;
+
+	/**
+	 * Return the next block.  Returns false at the end of the file when
+	 * not looping, after waiting one block time so a reader loop does not
+	 * spin.
+	 */
+	bool getSamples(IQSampleVector& samples) override;
+
+	bool startAsync() override {_async = true; return true;};
+	void stopAsync() override {_async = false;};
+	bool isAsync() override {return _async;};
+
+	async_stats_t getAsyncStats() override;
+
+	// MARK: - replay control, safe from any thread
+
+	void setLoop(bool loop) {_loop = loop;};
+	bool getLoop() {return _loop;};
+
+	/** Replay speed relative to real time, 0 for as fast as possible. */
+	void setSpeed(double speed);
+	double getSpeed() {return _speed;};
+
+	/** Position in seconds, applied before the next block. */
+	bool seek(double seconds);
+	double position();
+	double duration();
+	bool atEnd() {return _atEnd;};
+
+	static format_t formatForPath(const string& path);
+	static string formatName(format_t format);
+
+private:
+
+	void pace(size_t nsamples);
+
+	bool						_isSetup;
+	string					_path;
+	format_t					_format;
+	int						_fd;
+	const uint8_t*			_map;
+	size_t					_mapLength;
+	size_t					_bytesPerSample;
+	size_t					_nsamples;
+	int						_blockLength;
+
+	atomic<size_t>			_pos;			// next sample
+	atomic<int64_t>		_seekTo;		// pending seek in samples, -1 for none
+	atomic<bool>			_loop;
+	atomic<double>			_speed;
+	atomic<bool>			_atEnd;
+	bool						_async;
+
+	uint32_t					_sampleRate;
+	uint32_t					_frequency;
+	int						_tunerGain;
+	direct_sampling_t		_directSampling;
+
+	struct timespec		_paceStart;
+	uint64_t					_paceSamples;
+	async_stats_t			_stats;
+};
+
+
+class IQRecorder
+{
+public:
+
+	static constexpr int 	ring_blocks = 32;		// ~2s at 1 MS/s
+
+	IQRecorder();
+	~IQRecorder();
+
+	/** Create the capture file and start the writer, error is errno. */
+	bool begin(const string& path, int &error,
+				  IQFileSource::format_t format = IQFileSource::FORMAT_AUTO);
+	void stop();
+
+	bool isRecording() {return _running;};
+
+	/** Queue a copy of the block, called from the SDR reader. */
+	void write(const IQSampleVector& samples);
+
+	uint64_t samplesWritten() {return _written;};
+
+	/** Blocks lost because the disk fell behind. */
+	uint64_t blocksDropped();
+
+private:
+
+	void Writer();
+	static void* WriterThread(void *context);
+
+	mutex						_mutex;
+	atomic<bool>			_running;
+	FILE*						_fp;
+	IQFileSource::format_t _format;
+	SPSCRing<IQSample>*	_ring;
+	IQSampleVector			_spare;
+	vector<uint8_t>		_u8buf;
+	pthread_t				_writerTID;
+	atomic<uint64_t>		_written;
+};
@@ -8,24 +8,43 @@
 
 #include <complex>
 #include <vector>
+#include <cstdint>
 
 typedef std::complex<float> IQSample;
 typedef std::vector<IQSample> IQSampleVector;
 
-typedef double Sample;
+/** IQ sample in Q15 fixed point for the integer demodulation path.
+ *  RTL-SDR bytes are stored as (b - 128) * 128, so full scale is 0.5 and
+ *  there is one bit of headroom for the fine tuner rotation.  The float
+ *  equivalent of a value is value / 16384. */
+struct IQSampleQ15 {
+	 int16_t re;
+	 int16_t im;
+};
+typedef std::vector<IQSampleQ15> IQSampleQ15Vector;
+
+/** Real-valued 16 bit sample, PhaseDiscriminatorQ15 gives its scale. */
+typedef std::vector<int16_t> SampleQ15Vector;
+
+/** Real-valued DSP sample type.  The filters and decoders are templates
+ *  on the sample type, float is what runs in the car, double is kept for
+ *  reference builds. */
+typedef float Sample;
 typedef std::vector<Sample> SampleVector;
 
 
 /** Compute mean and RMS over a sample vector. */
-inline void samples_mean_rms(const SampleVector& samples,
+template <class T>
+inline void samples_mean_rms(const std::vector<T>& samples,
 									  double& mean, double& rms)
 {
-	 Sample vsum = 0;
-	 Sample vsumsq = 0;
+	 // Accumulate in double, a float sum drifts over a 10k sample block.
+	 double vsum = 0;
+	 double vsumsq = 0;
 
 	 size_t n = samples.size();
-	 for (auto i = 0; i < n; i++) {
-		  Sample v = samples[i];
+	 for (size_t i = 0; i < n; i++) {
+		  double v = samples[i];
 		  vsum   += v;
 		  vsumsq += v * v;
 	 }
@@ -0,0 +1,88 @@
+//
+//  IQSource.hpp
+//  carradio
+//
+//  Interface RadioMgr uses to get IQ samples and steer the front end.
+//  RtlSdr is the live implementation, IQFileSource replays a capture
+//  from disk so the full reader / processor / output chain can run
+//  without a dongle.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class IQSource
+{
+public:
+	typedef struct  {
+		uint32_t index;
+		string 	name;
+		string   vendor;
+		string   product;
+		string   serial;
+	} device_info_t;
+
+	typedef struct  {
+		uint64_t	blocks;		// blocks delivered to the ring
+		uint64_t	overruns;	// blocks dropped because the ring was full
+		uint64_t	drops;		// short transfers from the device
+	} async_stats_t;
+
+	typedef enum  {
+		DIRECT_SAMPLING_OFF = 0,
+		DIRECT_SAMPLING_I,			// I branch ADC
+		DIRECT_SAMPLING_Q,			// Q branch ADC, the usual HF mod
+	}direct_sampling_t;
+
+	virtual ~IQSource() {};
+
+	virtual void stop() = 0;
+
+	virtual bool getDeviceInfo(device_info_t&) = 0;
+
+	/** Set center frequency in Hz. */
+	virtual bool setFrequency(uint32_t) = 0;
+
+	/** Return current center frequency in Hz. */
+	virtual uint32_t getFrequency() = 0;
+
+	virtual bool setSampleRate(uint32_t) = 0;
+
+	/** Return current sample frequency in Hz. */
+	virtual uint32_t getSampleRate() = 0;
+
+	/** Tuner gain in units of 0.1 dB, INT_MIN for auto. */
+	virtual int getTunerGain() = 0;
+	virtual std::vector<int> getTunerGains() = 0;
+	virtual bool setTunerGain(int) = 0;
+
+	virtual bool setOffsetTuning(bool) = 0;
+	virtual bool setACGMode(bool) = 0;
+	virtual bool setBiasTee(bool) = 0;
+
+	virtual bool setDirectSampling(direct_sampling_t) = 0;
+	virtual direct_sampling_t getDirectSampling() = 0;
+
+	/** Discard anything buffered, the next block is fresh data. */
+	virtual bool resetBuffer() = 0;
+
+	/**
+	 * Fetch the next block of samples.  Storage is swapped with the
+	 * caller's vector where the source can, so pass back the previous
+	 * block to avoid allocating.
+	 */
+	virtual bool getSamples(IQSampleVector& samples) = 0;
+
+	virtual bool startAsync() = 0;
+	virtual void stopAsync() = 0;
+	virtual bool isAsync() = 0;
+
+	virtual async_stats_t getAsyncStats() = 0;
+};
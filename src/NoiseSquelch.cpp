@@ -0,0 +1,138 @@
+//
+//  NoiseSquelch.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+
+#include "NoiseSquelch.hpp"
+
+using namespace std;
+
+
+/* ****************  class NoiseSquelch  **************** */
+
+// Two 2nd order Butterworth sections give 24 dB per octave, enough to keep
+// loud voice out of the noise band.  Their step response has died down
+// after a few periods of the corner, which is skipped after a reset.
+template <class T>
+NoiseSquelchT<T>::NoiseSquelchT(double sample_rate, double noise_corner)
+	 : m_sample_rate(sample_rate)
+	 , m_noise_corner(noise_corner)
+	 , m_settle(lrint(4 * sample_rate / noise_corner))
+	 , m_highpass1(noise_corner / sample_rate)
+	 , m_highpass2(noise_corner / sample_rate)
+	 , m_skip(m_settle)
+	 , m_reference(1)
+	 , m_threshold(default_threshold)
+	 , m_hysteresis(default_hysteresis)
+	 , m_tail(default_tail * sample_rate)
+	 , m_tail_left(0)
+	 , m_snr(0)
+	 , m_open(false)
+{
+}
+
+
+template <class T>
+void NoiseSquelchT<T>::reset()
+{
+	 // Restart the filters, the old channel's DC would ring through them.
+	 m_highpass1 = HighPassFilterIirT<T>(m_noise_corner / m_sample_rate);
+	 m_highpass2 = HighPassFilterIirT<T>(m_noise_corner / m_sample_rate);
+	 m_skip = m_settle;
+
+	 m_tail_left = 0;
+	 m_snr = 0;
+	 m_open = false;
+}
+
+
+template <class T>
+void NoiseSquelchT<T>::calibrate(const vector<T>& samples_noise)
+{
+	 reset();
+
+	 double power = noise_power(samples_noise);
+	 if (power > 0)
+		  m_reference = power;
+
+	 reset();
+}
+
+
+template <class T>
+double NoiseSquelchT<T>::noise_power(const vector<T>& samples_baseband)
+{
+	 m_highpass1.process(samples_baseband, m_buf_noise);
+	 m_highpass2.process_inplace(m_buf_noise);
+
+	 unsigned int n = m_buf_noise.size();
+	 unsigned int start = min(m_skip, n);
+	 m_skip -= start;
+
+	 if (start == n)
+		  return -1;
+
+	 // Independent partial sums, so the loop vectorizes without
+	 // reordering a single floating point sum.
+	 constexpr unsigned int lanes = 8;
+	 T acc[lanes] = { 0 };
+
+	 const T* p = m_buf_noise.data() + start;
+	 unsigned int count = n - start;
+	 unsigned int i = 0;
+
+	 for (; i + lanes <= count; i += lanes) {
+		  for (unsigned int k = 0; k < lanes; k++)
+				acc[k] += p[i + k] * p[i + k];
+	 }
+	 for (; i < count; i++)
+		  acc[0] += p[i] * p[i];
+
+	 double sum = 0;
+	 for (unsigned int k = 0; k < lanes; k++)
+		  sum += acc[k];
+
+	 return sum / count;
+}
+
+
+template <class T>
+bool NoiseSquelchT<T>::process(const vector<T>& samples_baseband, bool may_open)
+{
+	 double power = noise_power(samples_baseband);
+
+	 // Nothing left over after the filters settled, keep the state.
+	 if (power < 0)
+		  return m_open;
+
+	 m_snr = 10 * log10(m_reference / max(power, 1.0e-12));
+
+	 if (!m_open) {
+		  if (may_open && m_snr >= m_threshold) {
+				m_open = true;
+				m_tail_left = m_tail;
+		  }
+	 }
+	 else if (m_snr >= m_threshold - m_hysteresis) {
+		  m_tail_left = m_tail;
+	 }
+	 else {
+		  m_tail_left -= samples_baseband.size();
+		  if (m_tail_left <= 0) {
+				m_tail_left = 0;
+				m_open = false;
+		  }
+	 }
+
+	 return m_open;
+}
+
+/* ****************  instantiations  **************** */
+
+template class NoiseSquelchT<float>;
+template class NoiseSquelchT<double>;
+
+/* end */
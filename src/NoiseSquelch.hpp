@@ -0,0 +1,110 @@
+//
+//  NoiseSquelch.hpp
+//  carradio
+//
+//  Noise operated squelch for narrow band FM.
+//
+//  Without a carrier the discriminator turns receiver noise into a loud
+//  hiss that reaches well above the voice band.  A carrier quiets it, the
+//  stronger the carrier the quieter, whatever the tuner gain or the
+//  temperature of the front end, since the discriminator does not care
+//  about amplitude.  So the squelch high-passes the discriminator output
+//  above the voice band and compares its power against the power the same
+//  filters see from noise alone.  The ratio is the quieting in dB, which
+//  is what the threshold is given in.
+//
+//  The reference comes from calibrate(), fed with discriminator output of
+//  pure noise through the decoder's own IF filter and discriminator.
+//  Each block is measured as a whole, so the very first block on a
+//  channel decides open or closed.  Once open the SNR may drop by the
+//  hysteresis before the tail timer starts, and the squelch only closes
+//  after the tail has run out.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Filter.hpp"
+
+
+/** Squelch on the noise above the voice band of an FM discriminator. */
+template <class T>
+class NoiseSquelchT
+{
+public:
+
+	 static constexpr double default_noise_corner = 6000;	// Hz
+	 static constexpr double default_threshold    = 12;		// dB quieting
+	 static constexpr double default_hysteresis   = 4;		// dB
+	 static constexpr double default_tail         = 1.5;	// seconds
+
+	 /**
+	  * Construct squelch.
+	  *
+	  * sample_rate  :: Discriminator output sample rate in Hz.
+	  * noise_corner :: Lower edge of the noise band in Hz, above the
+	  *                 highest voice frequency.
+	  */
+	 NoiseSquelchT(double sample_rate,
+						double noise_corner=default_noise_corner);
+
+	 /**
+	  * Take the 0 dB point from discriminator output of receiver noise
+	  * alone, a block or two long.
+	  */
+	 void calibrate(const std::vector<T>& samples_noise);
+
+	 /** The calibrated noise band power, to reuse one calibration elsewhere. */
+	 double get_reference() const          { return m_reference; }
+	 void set_reference(double power)      { m_reference = power; }
+
+	 /**
+	  * Measure a block of discriminator output and update the state.
+	  *
+	  * may_open :: Other conditions for opening, such as a minimum IF
+	  *             level.  They do not hold the squelch closed once open.
+	  *
+	  * Returns true if the squelch is open.
+	  */
+	 bool process(const std::vector<T>& samples_baseband, bool may_open=true);
+
+	 /** New channel, the next block decides without a tail. */
+	 void reset();
+
+	 void set_threshold(double db)   { m_threshold = db; }
+	 void set_hysteresis(double db)  { m_hysteresis = db; }
+	 void set_tail(double seconds)   { m_tail = seconds * m_sample_rate; }
+
+	 double get_threshold() const    { return m_threshold; }
+	 double get_hysteresis() const   { return m_hysteresis; }
+	 double get_tail() const         { return m_tail / m_sample_rate; }
+
+	 bool is_open() const            { return m_open; }
+
+	 /** Quieting of the last block in dB. */
+	 double get_snr() const          { return m_snr; }
+
+private:
+
+	 /** Mean power of the noise band over the block. */
+	 double noise_power(const std::vector<T>& samples_baseband);
+
+	 const double           m_sample_rate;
+	 const double           m_noise_corner;
+	 const unsigned int     m_settle;			// samples of filter startup to skip
+	 HighPassFilterIirT<T>  m_highpass1;
+	 HighPassFilterIirT<T>  m_highpass2;
+	 std::vector<T>         m_buf_noise;
+	 unsigned int           m_skip;
+
+	 double                 m_reference;		// noise band power without a carrier
+	 double                 m_threshold;
+	 double                 m_hysteresis;
+	 double                 m_tail;				// samples
+	 double                 m_tail_left;
+	 double                 m_snr;
+	 bool                   m_open;
+};
+
+typedef NoiseSquelchT<Sample> NoiseSquelch;
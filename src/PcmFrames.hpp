@@ -0,0 +1,118 @@
+//
+//  PcmFrames.hpp
+//  carradio
+//
+//  A block of interleaved PCM audio that knows its own format.
+//
+//  The decoders produce float, the line input and AirPlay deliver signed
+//  16 bit, and both travel the same queue to AudioOutput.  Each block says
+//  which it holds, at what rate and with how many channels, so the S16
+//  sources are read straight into int16 storage and written to ALSA as is,
+//  and a DSP stage can work on either kind in place.
+//
+//  Both kinds of storage are kept, only the one named by format() is
+//  valid.  Blocks are recycled through SPSCBlockRing, so a slot that has
+//  carried both kinds keeps the capacity of both and switching sources
+//  allocates nothing after the first few blocks.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class PcmFrames
+{
+public:
+
+	typedef enum {
+		PCM_FLOAT = 0,		// Sample, -1.0 - 1.0
+		PCM_S16,				// int16_t
+	} pcm_format_t;
+
+	/** RationalResampler order for a block not at the PCM rate, taps per phase - 1. */
+	static constexpr unsigned int src_filterOrder = 32;
+
+	/** Its cutoff relative to rate_in, just under the lower Nyquist. */
+	static double srcCutoff(unsigned int rate_in, unsigned int rate_out) {
+		return 0.45 * (rate_in < rate_out ? rate_in : rate_out) / rate_in;
+	};
+
+	PcmFrames() {
+		_format = PCM_FLOAT;
+		_sampleRate = 0;
+		_channels = 2;
+	};
+
+	/** Start a new block, clearing the samples of the old one. */
+	void setFormat(pcm_format_t format, unsigned int sampleRate, unsigned int channels) {
+		clear();
+		_format = format;
+		_sampleRate = sampleRate;
+		_channels = channels > 0 ? channels : 1;
+	};
+
+	pcm_format_t format() const		{return _format;};
+	unsigned int sampleRate() const	{return _sampleRate;};
+	unsigned int channels() const		{return _channels;};
+
+	/** Interleaved samples, valid when the format is PCM_FLOAT. */
+	SampleVector& floats()						{return _floats;};
+	const SampleVector& floats() const		{return _floats;};
+
+	/** Interleaved samples, valid when the format is PCM_S16. */
+	vector<int16_t>& s16()						{return _s16;};
+	const vector<int16_t>& s16() const		{return _s16;};
+
+	/** Number of whole frames. */
+	size_t size() const {
+		return (_format == PCM_S16 ? _s16.size() : _floats.size()) / _channels;
+	};
+
+	bool empty() const {return size() == 0;};
+
+	/** Size the storage of the current format for frames, to read into. */
+	void resize(size_t frames) {
+		if(_format == PCM_S16)
+			_s16.resize(frames * _channels);
+		else
+			_floats.resize(frames * _channels);
+	};
+
+	/** Raw interleaved samples of the current format. */
+	void* data() {
+		return _format == PCM_S16 ? (void*) _s16.data() : (void*) _floats.data();
+	};
+
+	size_t bytesPerFrame() const {
+		return _channels * (_format == PCM_S16 ? sizeof(int16_t) : sizeof(Sample));
+	};
+
+	/** Keeps the format and the capacity. */
+	void clear() {
+		_floats.clear();
+		_s16.clear();
+	};
+
+	/** Reserve frames of the current format. */
+	void reserve(size_t frames) {
+		if(_format == PCM_S16)
+			_s16.reserve(frames * _channels);
+		else
+			_floats.reserve(frames * _channels);
+	};
+
+private:
+
+	pcm_format_t		_format;
+	unsigned int		_sampleRate;
+	unsigned int		_channels;
+
+	SampleVector		_floats;
+	vector<int16_t>	_s16;
+};
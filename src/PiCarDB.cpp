@@ -545,6 +545,12 @@ string PiCarDB::defaultPropertyFilePath(){
 	return "carradio.props.json";
 }
 
+string PiCarDB::propertyFilePath(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	
+	return _propertyFilePath.empty() ? defaultPropertyFilePath() : _propertyFilePath;
+}
+
 // MARK: - convenience utility
 
 uint8_t PiCarDB::canbusDisplayPropsCount(){
@@ -36,6 +36,9 @@ class PiCarDB  {
 	// MARK: - properties // persistent
 	bool savePropertiesToFile(string filePath = "") ;
 	bool restorePropertiesFromFile(string filePath = "");
+	
+	/** The properties file in use, the other data files live next to it. */
+	string propertyFilePath();
  
 	bool setProperty(string key, string value);
 	bool setProperty(string key, nlohmann::json  j);
@@ -157,6 +157,7 @@ PiCarMgr::PiCarMgr(){
 		{MENU_AUDIO,	"Audio"},
 		{MENU_GPS,		"GPS"},
 		{MENU_WAYPOINTS,	"Waypoints"},
+		{MENU_SPECTRUM,	"Spectrum"},
 		{MENU_CANBUS,	"Engine Status"},
 		{MENU_DTC,		"Diagnostics"},
  		{MENU_SETTINGS, "Settings"},
@@ -170,7 +171,7 @@ PiCarMgr::PiCarMgr(){
 	pthread_create(&_piCarLoopTID, NULL,
 						(THREADFUNCPTR) &PiCarMgr::PiCarLoopThread, (void*)this);
 		
-	_stations.clear();
+	_stationDB.clear();
 	_preset_stations.clear();
 	_scanner_freqs.clear();
 	
@@ -235,11 +236,19 @@ bool PiCarMgr::begin(){
 		// SETUP CANBUS
 		_can.begin();
 		
-		// find first RTS device
-		auto devices = RtlSdr::get_devices();
-		if(devices.size() > 0) {
-			if(!_radio.begin(devices[0].index, pcmrate))
-				throw Exception("failed to setup Radio ");
+		// replay a capture instead of the dongle, for bench testing
+		string replay_file;
+		if(_db.getProperty(PROP_IQ_REPLAY_FILE, &replay_file) && !replay_file.empty()){
+			if(!_radio.beginReplay(replay_file, pcmrate, error))
+				throw Exception("failed to open IQ replay " + replay_file, error);
+		}
+		else {
+			// find first RTS device
+			auto devices = RtlSdr::get_devices();
+			if(devices.size() > 0) {
+				if(!_radio.begin(devices[0].index, pcmrate))
+					throw Exception("failed to setup Radio ");
+			}
 		}
 		
 #if defined(__APPLE__)
@@ -253,8 +262,21 @@ bool PiCarMgr::begin(){
 		
 		//		_display.showStartup();  // show startup
 		
-		// setup audio out
-		if(!_audio.begin(pcmrate, true ))
+		// setup audio out, 4 channels drives the front and rear pairs separately
+		int audioChannels = 2;
+		_db.getIntProperty(PROP_AUDIO_CHANNELS, &audioChannels);
+		
+		if(audioChannels == 4){
+			float rearDelay = 0, rearLowPass = 0;
+			if(_db.getFloatProperty(PROP_AUDIO_REAR_DELAY, &rearDelay))
+				_audio.setRearDelay(rearDelay);
+			if(_db.getFloatProperty(PROP_AUDIO_REAR_LOWPASS, &rearLowPass))
+				_audio.setRearLowPass(rearLowPass);
+			
+			if(!_audio.beginQuad(pcmrate, error))
+				throw Exception("failed to setup Audio ", error);
+		}
+		else if(!_audio.begin(pcmrate, true ))
 			throw Exception("failed to setup Audio ");
 		
 		// quiet audio first
@@ -544,7 +566,13 @@ void PiCarMgr::saveRadioSettings(){
  
 	_db.setProperty(PROP_TUNER_MODE, _tuner_mode);
 	_db.setProperty(PROP_SQUELCH_LEVEL, _radio.getSquelchLevel());
+	_db.setProperty(PROP_SQUELCH_SNR, _radio.getSquelchSNR());
 	_db.setProperty(PROP_GAIN_LEVEL, _radio.getTunerGain());
+	_db.setProperty(PROP_TARGET_LATENCY, _radio.getTargetLatency());
+	_db.setProperty(PROP_AM_DIRECT_SAMPLING, _radio.getAMDirectSampling());
+	_db.setProperty(PROP_AM_UPCONVERTER, (int) _radio.getUpconverterOffset());
+	_db.setProperty(PROP_FIXED_POINT_DSP, _radio.getFixedPointDSP());
+	_db.setProperty(PROP_FM_THREADING, (int) _radio.getFMThreading());
 	_db.setProperty(PROP_LAST_RADIO_MODES, GetRadioModesJSON());
 	_db.setProperty(PROP_LAST_RADIO_MODE, RadioMgr::modeString(_lastRadioMode));
 	_db.setProperty(PROP_LAST_AUDIO_SETTING, GetAudioJSON());
@@ -632,12 +660,42 @@ void PiCarMgr::restoreRadioSettings(){
 	if(squelch_level < _radio.getMaxSquelchRange())
 		squelch_level = _radio.getMaxSquelchRange();
 	_radio.setSquelchLevel(squelch_level);
+
+	float squelch_snr = _radio.getSquelchSNR();
+	_db.getFloatProperty(PROP_SQUELCH_SNR, &squelch_snr);
+	_radio.setSquelchSNR(squelch_snr);
  
 	// SET Tuner Gain
 	int tuner_gain = INT_MIN;
 	_db.getIntProperty(PROP_GAIN_LEVEL, &tuner_gain);
 	_radio.setTunerGain(tuner_gain);
 
+	// SET audio latency target
+	int target_latency = RadioMgr::default_targetLatency;
+	_db.getIntProperty(PROP_TARGET_LATENCY, &target_latency);
+	_radio.setTargetLatency(target_latency);
+	
+	// SET AM input, direct sampling or upconverter
+	bool am_direct = true;
+	_db.getBoolProperty(PROP_AM_DIRECT_SAMPLING, &am_direct);
+	_radio.setAMDirectSampling(am_direct);
+	
+	int upconverter = 0;
+	_db.getIntProperty(PROP_AM_UPCONVERTER, &upconverter);
+	_radio.setUpconverterOffset(max(upconverter, 0));
+
+	// SET fixed point FM front end, for low power operation
+	bool fixed_point = false;
+	_db.getBoolProperty(PROP_FIXED_POINT_DSP, &fixed_point);
+	_radio.setFixedPointDSP(fixed_point);
+
+	// SET FM decoder threading, 0 serial, 1 fork-join, 2 pipelined
+	int fm_threading = FmDecoder::THREADS_SERIAL;
+	_db.getIntProperty(PROP_FM_THREADING, &fm_threading);
+	if(fm_threading < FmDecoder::THREADS_SERIAL || fm_threading > FmDecoder::THREADS_PIPELINED)
+		fm_threading = FmDecoder::THREADS_SERIAL;
+	_radio.setFMThreading((FmDecoder::threading_t) fm_threading);
+
 	// SET Preset stations
 	
 	_preset_stations.clear();
@@ -990,78 +1048,76 @@ bool PiCarMgr::getSavedFrequencyForMode( RadioMgr::radio_mode_t mode, uint32_t &
 // MARK: - stations File
 
 
-bool PiCarMgr::restoreStationsFromFile(string filePath){
-	bool success = false;
+// Next to the properties file, wherever that was restored from, not
+// wherever the process happens to have been started.
+
+string PiCarMgr::stationsFilePath(){
 	
-	std::ifstream	ifs;
+	std::filesystem::path dir = std::filesystem::path(_db.propertyFilePath()).parent_path();
+	return (dir / "stations.tsv").string();
+}
+
+bool PiCarMgr::restoreStationsFromFile(string filePath){
 	
 	// create a file path
 	if(filePath.size() == 0)
-		filePath = "stations.tsv";
+		filePath = stationsFilePath();
 	
-	try{
-		string line;
-		
-		_stations.clear();
+	return _stationDB.restoreFromFile(filePath);
+}
+
+bool PiCarMgr::saveStationsToFile(string filePath){
+	
+	if(filePath.size() == 0)
+		filePath = stationsFilePath();
+	
+	return _stationDB.saveToFile(filePath);
+}
+
+int PiCarMgr::mergeSweptStations(const vector<BandSweep::station_t>& found){
+	
+	int added = 0;
+	
+	GPSLocation_t here;
+	if(!_gps.GetLocation(here))
+		here.isValid = false;
+	
+	for(const auto& s : found){
+		station_info_t info;
 		
-		// open the file
-		ifs.open(filePath, ios::in);
-		if(!ifs.is_open()) return false;
+		// already known to be on the air here
+		if(_stationDB.lookup(RadioMgr::BROADCAST_FM, s.frequency, here, info))
+			continue;
 		
-		while ( std::getline(ifs, line) ) {
-			
-			// split the line looking for a token: and rest and ignore comments
-			line = Utils::trimStart(line);
-			if(line.size() == 0) continue;
-			if(line[0] == '#')  continue;
-			
-			vector<string> v = split<string>(line, "\t");
-			if(v.size() < 3)  continue;
-			
-			RadioMgr::radio_mode_t mode =  RadioMgr::stringToMode(v[0]);
-			uint32_t freq = atoi(v[1].c_str());
-			
-			string title = trimCNTRL(v[2]);
-			string location = trimCNTRL((v.size() >2) ?v[2]: string());
-			
-			if(freq != 0
-				&& mode != RadioMgr::MODE_UNKNOWN){
-				station_info_t info = {mode, freq, title, location};
-				_stations[mode].push_back(info);
-				
-			}
+		// No name or place until somebody or RDS gives it one.  Where it
+		// was heard goes in the position columns, the location column is
+		// for place names.
+		info = {RadioMgr::BROADCAST_FM, s.frequency, "", "", 0, 0, 0};
+		if(here.isValid){
+			info.latitude = here.latitude;
+			info.longitude = here.longitude;
+			info.range = StationDB::default_range;
 		}
-		for( auto &[mode, items]: _stations){
-			sort(items.begin(), items.end(),
-				  [] (const station_info_t& a,
-						const station_info_t& b) { return a.frequency < b.frequency; });
-		}
-		
 		
-		success = _stations.size() > 0;
-		ifs.close();
-	}
-	catch(std::ifstream::failure &err) {
-		ELOG_MESSAGE("READ stations:FAIL: %s", err.what());
-		success = false;
+		_stationDB.add(info);
+		added++;
 	}
-	return success;
+	
+	if(added > 0)
+		saveStationsToFile();
+	
+	return added;
 }
 
 bool PiCarMgr::getStationInfo(RadioMgr::radio_mode_t band,
 										uint32_t frequency,
 										station_info_t &info){
 	
-	if(_stations.count(band)){
-		for(const auto& e : _stations[band]){
-			if(e.frequency == frequency){
-				info = e;
-				return true;
-			}
-		}
-	}
+	GPSLocation_t here;
+	if(!_gps.GetLocation(here))
+		here.isValid = false;
 	
-	return false;
+	return _stationDB.lookup(band, frequency, here, info);
 }
 
 bool PiCarMgr::nextKnownStation(RadioMgr::radio_mode_t band,
@@ -1069,7 +1125,12 @@ bool PiCarMgr::nextKnownStation(RadioMgr::radio_mode_t band,
 										  bool tunerMovedCW,
 										  station_info_t &info){
 	
- 	if(_stations.count(band) == 0 ) {
+	GPSLocation_t here;
+	if(!_gps.GetLocation(here))
+		here.isValid = false;
+	
+	// only what can be heard here
+ 	if(!_stationDB.hasStations(band, here)) {
 		// if there are no known frequencies  all then to fallback to all.
 		info.band = band;
 		info.frequency =  _radio.nextFrequency(tunerMovedCW);
@@ -1078,27 +1139,7 @@ bool PiCarMgr::nextKnownStation(RadioMgr::radio_mode_t band,
 		return true;
 	}
 	
-	auto v = _stations[band];
-	// scan for next known freq
-	
-	if(tunerMovedCW){
-		
-		for ( auto i = v.begin(); i != v.end(); ++i ) {
-			if(frequency >= i->frequency)
-				continue;
- 			info =  *(i);
- 			return true;;
-		}
-	}
-	else {
-		for ( auto i = v.rbegin(); i != v.rend(); ++i ) {
-			if(frequency <= i->frequency)
-				continue;
-			info =  *(i);
- 			return true;;
-		}
-	}
- 	return false;
+	return _stationDB.next(band, frequency, tunerMovedCW, here, info);
 }
 
 
@@ -2039,6 +2080,10 @@ PiCarMgr::menu_mode_t PiCarMgr::currentMode(){
 			mode = MENU_WAYPOINTS;
 			break;
 
+		case DisplayMgr::MODE_SPECTRUM:
+			mode = MENU_SPECTRUM;
+			break;
+
 		case DisplayMgr::MODE_CANBUS:
 			mode = MENU_CANBUS;
 			break;
@@ -2152,6 +2197,10 @@ void PiCarMgr::setDisplayMode(menu_mode_t menuMode){
 		case MENU_WAYPOINTS:
 			displayWaypoints();
 			break;
+			
+		case MENU_SPECTRUM:
+			displaySpectrum();
+			break;
 
 		case MENU_CANBUS:
 			_display.showCANbus(1);
@@ -2185,6 +2234,39 @@ void PiCarMgr::setDisplayMode(menu_mode_t menuMode){
 }
 
 
+void PiCarMgr::displaySpectrum(){
+	_display.showSpectrum( [=](DisplayMgr::knob_action_t action ){
+		if(action == DisplayMgr::KNOB_DOUBLE_CLICK) {
+			displayMenu();
+		}
+	});
+}
+
+void PiCarMgr::findStations(){
+	
+	_display.showMessage("Scanning FM Band");
+	
+	bool started = _radio.startBandSweep([=](bool completed,
+														  vector<BandSweep::station_t> stations){
+		string msg = "Scan Cancelled";
+		
+		if(completed){
+			int added = mergeSweptStations(stations);
+			msg = to_string(stations.size()) + " Found, " + to_string(added) + " New";
+		}
+		
+		_display.showMessage(msg, 2,[=](){
+			displayMenu();
+		});
+	});
+	
+	if(!started){
+		_display.showMessage("Scan Failed", 2,[=](){
+			displayMenu();
+		});
+	}
+}
+
 void PiCarMgr::displayGPS(){
 	_display.showGPS( [=](DisplayMgr::knob_action_t action ){
 		if(action == DisplayMgr::KNOB_DOUBLE_CLICK) {
@@ -2363,7 +2445,10 @@ void PiCarMgr::displayAudioMenu(){
 	sprintf(buffer, "\x1d%-9s \x1c%-3d\x1d","Squelch", _radio.getSquelchLevel());
 	menu_items.push_back(string(buffer));
 
-	sprintf(buffer, "\x1d%-9s \x1c%3d\x1d","Gain", _radio.getTunerGain());
+	if(_radio.getTunerGain() == RadioMgr::tunerGain_softwareAGC)
+		sprintf(buffer, "\x1d%-9s \x1c%3s\x1d","Gain", "AGC");
+	else
+		sprintf(buffer, "\x1d%-9s \x1c%3d\x1d","Gain", _radio.getTunerGain());
 	menu_items.push_back(string(buffer));
 
 	sprintf(buffer, "\x1d%-9s \x1c%3d\x1d","Balance", int(_audio.balance() * 10));
@@ -2413,6 +2498,7 @@ void PiCarMgr::displayAudioMenu(){
 						static std::vector<int> gains =  {};
 						gains = _radio.getTunerGains();
 						gains.push_back(0);
+						gains.push_back(RadioMgr::tunerGain_softwareAGC);
 						
 						sort(gains.begin(), gains.end(),
 							  [] (const int & a,
@@ -2422,7 +2508,10 @@ void PiCarMgr::displayAudioMenu(){
 						
 						choices = {};
 						for(int i = 0; i < gains.size(); i++){
-							choices.push_back(to_string(gains[i]));
+							if(gains[i] == RadioMgr::tunerGain_softwareAGC)
+								choices.push_back("AGC");
+							else
+								choices.push_back(to_string(gains[i]));
 							if(gains[i] == gain)
 								current_choice = i;
 						}
@@ -2772,6 +2861,7 @@ vector<string> PiCarMgr::settingsMenuItems(){
 		"Shutdown Delay",
 		"Set ECU Time",
 		"Info",
+		"Find Stations",
 		"Exit",
 	};
 
@@ -2829,6 +2919,10 @@ void PiCarMgr::displaySettingsMenu(){
 						_display.showInfo();
 						break;
  
+					case 4:
+						findStations();
+						break;
+ 
 			 
 					default:
 						displayMenu();
@@ -43,6 +43,7 @@
 #include "AudioOutput.hpp"
 #include "RadioMgr.hpp"
 #include "GPSmgr.hpp"
+#include "StationDB.hpp"
 #include "PiCarCAN.hpp"
 #include "W1Mgr.hpp"
 #include "PropValKeys.hpp"
@@ -121,14 +122,16 @@ class PiCarMgr {
 	
 	// MARK: - stations File
 	
-	typedef struct {
-		RadioMgr::radio_mode_t	band;
-		uint32_t						frequency;
-		string						title;
-		string						location;
-		} station_info_t;
+	typedef StationDB::station_info_t station_info_t;
 
-	bool restoreStationsFromFile(string filePath = "stations.tsv");
+	/** An empty path is stations.tsv in the data directory. */
+	bool restoreStationsFromFile(string filePath = "");
+	bool saveStationsToFile(string filePath = "");
+	string stationsFilePath();
+	
+	/** Add the stations a band sweep heard that are not known to be on the
+	 *  air here, positioned where we are.  Returns how many were new. */
+	int  mergeSweptStations(const vector<BandSweep::station_t>& found);
 	bool getStationInfo(RadioMgr::radio_mode_t band, uint32_t frequency, station_info_t&);
 	bool nextKnownStation(RadioMgr::radio_mode_t band,
 								uint32_t frequency,
@@ -190,6 +193,7 @@ private:
 		MENU_CANBUS,
 		MENU_GPS,
 		MENU_WAYPOINTS,
+		MENU_SPECTRUM,
 		MENU_AUDIO,
 		MENU_DEBUG,
  		MENU_TIME,
@@ -227,6 +231,8 @@ private:
 	void setDisplayMode(menu_mode_t menuMode);
 	
 	void displayGPS();
+	void displaySpectrum();
+	void findStations();
 	void displayWaypoints(string intitialUUID = "");
 	void displayWaypoint(string uuid);
 	void waypointEditMenu(string uuid);
@@ -275,7 +281,7 @@ private:
 	map <RadioMgr::radio_mode_t,uint32_t> _lastFreqForMode;
 	menu_mode_t										_lastMenuMode;		// used for unwinding
 	
-	map<RadioMgr::radio_mode_t, vector<station_info_t>> _stations;
+	StationDB				_stationDB;
 	vector < RadioMgr::channel_t >  _preset_stations;
   	vector < RadioMgr::channel_t >  _scanner_freqs;
   
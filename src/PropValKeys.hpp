@@ -32,6 +32,15 @@ inline static const string VAL_RADIO_FREQ			= "freq";
 inline static const string VAL_MODULATION_MODE	= "mode";
 inline static const string VAL_RADIO_ON			= "radioON";
 inline static const string VAL_AUTO					= "auto";
+inline static const string VAL_AUDIO_LATENCY		= "audio_latency_ms";
+inline static const string VAL_IQ_QUEUE_DEPTH		= "iq_queue_ms";
+inline static const string VAL_PCM_QUEUE_DEPTH	= "pcm_queue_ms";
+inline static const string VAL_IQ_DROPPED			= "iq_dropped_blocks";
+inline static const string VAL_PCM_UNDERRUNS		= "pcm_underruns";
+inline static const string VAL_PCM_XRUNS			= "pcm_xrun_recoveries";
+inline static const string VAL_RDS_PS				= "rds_ps";
+inline static const string VAL_RDS_RT				= "rds_rt";
+inline static const string VAL_RDS_PTY				= "rds_pty";
 
 
 // json data
@@ -91,7 +100,17 @@ inline static const string  PROP_PRESET_MODE					= "mode";
 inline static const string  PROP_SYNC_CLOCK_TO_GPS			= "clocksync_gps_secs";
 inline static const string  PROP_W1_MAP						= "w1Map";
 inline static const string  PROP_SQUELCH_LEVEL				= "squelch";
+inline static const string  PROP_SQUELCH_SNR					= "squelch_snr_db";
 inline static const string  PROP_GAIN_LEVEL					= "gain";
+inline static const string  PROP_TARGET_LATENCY				= "target_latency_ms";
+inline static const string  PROP_AM_DIRECT_SAMPLING			= "am_direct_sampling";
+inline static const string  PROP_AM_UPCONVERTER				= "am_upconverter_hz";
+inline static const string  PROP_FIXED_POINT_DSP			= "fixed_point_dsp";
+inline static const string  PROP_FM_THREADING				= "fm_threading";
+inline static const string  PROP_IQ_REPLAY_FILE			= "iq_replay_file";
+inline static const string  PROP_AUDIO_CHANNELS			= "audio_channels";
+inline static const string  PROP_AUDIO_REAR_DELAY			= "audio_rear_delay_ms";
+inline static const string  PROP_AUDIO_REAR_LOWPASS		= "audio_rear_lowpass_hz";
 
 
 inline static const string  SERIAL_NUM							= "serial_num";
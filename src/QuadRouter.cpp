@@ -0,0 +1,161 @@
+//
+//  QuadRouter.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+
+#include "QuadRouter.hpp"
+
+// MARK: -   QuadRouter
+
+QuadRouter::QuadRouter(){
+	_fader = 0;
+	_rearDelay = 0;
+	_rearLowPass = 0;
+	_generation = 1;
+
+	_appliedGeneration = 0;
+	_sampleRate = 0;
+	_frontGain = 1;
+	_rearGain = 1;
+	_lpCoef = 1;
+	_delay = 0;
+
+	_ring.resize(2 * delayFrames);
+	reset();
+}
+
+void QuadRouter::setFader(double val){
+	_fader.store(fmax(-1, fmin(1, val)), memory_order_relaxed);
+	_generation.fetch_add(1, memory_order_release);
+}
+
+void QuadRouter::setRearDelay(double ms){
+	_rearDelay.store(fmax(0, fmin(max_rearDelay, ms)), memory_order_relaxed);
+	_generation.fetch_add(1, memory_order_release);
+}
+
+void QuadRouter::setRearLowPass(double hz){
+	_rearLowPass.store(fmax(0, hz), memory_order_relaxed);
+	_generation.fetch_add(1, memory_order_release);
+}
+
+void QuadRouter::reset(){
+	fill(_ring.begin(), _ring.end(), 0);
+	_ringPos = 0;
+	_lpState[0] = 0;
+	_lpState[1] = 0;
+}
+
+void QuadRouter::update(double sampleRate){
+
+	uint32_t generation = _generation.load(memory_order_acquire);
+
+	if(generation == _appliedGeneration && sampleRate == _sampleRate)
+		return;
+
+	if(sampleRate != _sampleRate)
+		reset();
+
+	_appliedGeneration = generation;
+	_sampleRate = sampleRate;
+
+	// same rule as the mixer used, the far pair is turned down
+	float fader = _fader.load(memory_order_relaxed);
+	_frontGain = fader < 0 ? 1 + fader : 1;
+	_rearGain = fader > 0 ? 1 - fader : 1;
+
+	double delay = _rearDelay.load(memory_order_relaxed) * sampleRate / 1000;
+	_delay = min<size_t>(lrint(delay), delayFrames - 1);
+
+	// one pole, matched at DC and close enough at the corner
+	double corner = _rearLowPass.load(memory_order_relaxed);
+	if(corner > 0 && corner < 0.45 * sampleRate)
+		_lpCoef = 1 - exp(-2 * M_PI * corner / sampleRate);
+	else
+		_lpCoef = 1;
+}
+
+void QuadRouter::process(const Sample* stereo, size_t frames, SampleVector& quad){
+
+	quad.resize(4 * frames);
+
+	const float gf = _frontGain;
+	const float gr = _rearGain;
+	const float a = _lpCoef;
+	const size_t mask = delayFrames - 1;
+	const size_t delay = _delay;
+
+	size_t pos = _ringPos;
+
+	Sample* ring = _ring.data();
+	Sample* out = quad.data();
+
+	if(frames == 0)
+		return;
+
+	if(a == 1){
+		// No low-pass, the rear pair is the input delayed.  Only the first
+		// frames of the block come out of the ring, the rest straight from
+		// the input, so both are plain gain loops that vectorize.
+		size_t fromRing = min(delay, frames);
+
+		for(size_t i = 0; i < fromRing; i++){
+			size_t tap = (pos + i - delay) & mask;
+			out[4 * i]     = stereo[2 * i] * gf;
+			out[4 * i + 1] = stereo[2 * i + 1] * gf;
+			out[4 * i + 2] = ring[2 * tap] * gr;
+			out[4 * i + 3] = ring[2 * tap + 1] * gr;
+		}
+
+		for(size_t i = fromRing; i < frames; i++){
+			out[4 * i]     = stereo[2 * i] * gf;
+			out[4 * i + 1] = stereo[2 * i + 1] * gf;
+			out[4 * i + 2] = stereo[2 * (i - delay)] * gr;
+			out[4 * i + 3] = stereo[2 * (i - delay) + 1] * gr;
+		}
+
+		// the ring keeps the last of the input for the next block
+		size_t keep = min(frames, delayFrames);
+		const Sample* tail = stereo + 2 * (frames - keep);
+		pos = (pos + frames - keep) & mask;
+		for(size_t i = 0; i < keep; i++, pos = (pos + 1) & mask){
+			ring[2 * pos] = tail[2 * i];
+			ring[2 * pos + 1] = tail[2 * i + 1];
+		}
+
+		// a low-pass switched on later starts from the signal
+		_lpState[0] = stereo[2 * frames - 2];
+		_lpState[1] = stereo[2 * frames - 1];
+		_ringPos = pos;
+		return;
+	}
+
+	float lp0 = _lpState[0];
+	float lp1 = _lpState[1];
+
+	for(size_t i = 0; i < frames; i++, stereo += 2, out += 4){
+		float l = stereo[0];
+		float r = stereo[1];
+
+		lp0 += a * (l - lp0);
+		lp1 += a * (r - lp1);
+
+		ring[2 * pos] = lp0;
+		ring[2 * pos + 1] = lp1;
+		size_t tap = (pos - delay) & mask;
+
+		out[0] = l * gf;
+		out[1] = r * gf;
+		out[2] = ring[2 * tap] * gr;
+		out[3] = ring[2 * tap + 1] * gr;
+
+		pos = (pos + 1) & mask;
+	}
+
+	_lpState[0] = lp0;
+	_lpState[1] = lp1;
+	_ringPos = pos;
+}
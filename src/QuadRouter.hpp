@@ -0,0 +1,83 @@
+//
+//  QuadRouter.hpp
+//  carradio
+//
+//  Spreads stereo audio over front and rear speaker pairs.
+//
+//  Every source is stereo, but the car has four speakers.  With a four
+//  channel PCM the router makes FL FR RL RR frames from each L R frame,
+//  the front pair and the rear pair each scaled by the fader.  The rear
+//  pair can be low-passed, to keep the highs up front, and delayed by a
+//  few ms so the sound seems to come from the front.
+//
+//  The block is written straight into the four channel buffer that goes
+//  to the PCM.  The front pair is never held back, the rear delay is a
+//  short ring of past rear frames and adds no latency to the output as a
+//  whole.  Without the low-pass the rear pair is a delayed copy and the
+//  loops are plain gains that vectorize, the low-pass is a recursion that
+//  runs frame by frame.
+//
+//  Settings are atomics picked up by the audio thread on the next block,
+//  like ToneControl.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class QuadRouter
+{
+public:
+
+	static constexpr double 		max_rearDelay	= 30;		// ms
+	static constexpr size_t 		delayFrames		= 2048;		// ring, a power of two past max_rearDelay at 48 kHz
+
+	QuadRouter();
+
+	// MARK: - control side, any thread, never blocks
+
+	/** -1.0 - 1.0, positive pulls the rear pair down, negative the front. */
+	void setFader(double val);
+
+	/** Rear pair delay in ms, 0 - max_rearDelay. */
+	void setRearDelay(double ms);
+
+	/** Rear pair low-pass corner in Hz, 0 for none. */
+	void setRearLowPass(double hz);
+
+	// MARK: - audio thread
+
+	/** Pick up any new settings for blocks at this rate. */
+	void update(double sampleRate);
+
+	/** Stereo frames in, four channel frames FL FR RL RR out. */
+	void process(const Sample* stereo, size_t frames, SampleVector& quad);
+
+	/** Forget the rear history, for a new source. */
+	void reset();
+
+private:
+
+	atomic<float>				_fader;
+	atomic<float>				_rearDelay;
+	atomic<float>				_rearLowPass;
+	atomic<uint32_t>			_generation;
+
+	// audio thread only
+	uint32_t						_appliedGeneration;
+	double						_sampleRate;
+	float							_frontGain;
+	float							_rearGain;
+	float							_lpCoef;				// 1 passes everything
+	size_t						_delay;				// frames
+	float							_lpState[2];
+	vector<Sample>				_ring;				// delayFrames stereo frames
+	size_t						_ringPos;
+};
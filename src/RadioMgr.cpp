@@ -19,12 +19,21 @@
 #include "PropValKeys.hpp"
 #include "FmDecode.hpp"
 #include "VhfDecode.hpp"
+#include "Filter.hpp"
+#include "AmDecode.hpp"
+#include <random>
 
 #define DEBUG_DEMOD 0
 typedef void * (*THREADFUNCPTR)(void *);
 
 
-RadioMgr::RadioMgr(){
+RadioMgr::RadioMgr()
+: _spectrum(SpectrumAnalyzer::default_fftSize, SpectrumAnalyzer::default_columns, RtlSdr::default_blockLength)
+, _source_buffer(source_ring_blocks, RtlSdr::default_blockLength)
+, _output_buffer(output_ring_blocks, output_block_capacity)
+, _windowDisc(VhfDecoder::default_freq_dev / scan_sample_rate)
+, _windowSquelch(scan_sample_rate)
+{
 	_mode = MODE_UNKNOWN;
 	_mux = MUX_MONO;
 	_sdrDecoder = NULL;
@@ -33,6 +42,15 @@ RadioMgr::RadioMgr(){
 	_isSetup = false;
 	_scannerChannels.clear();
 	_scannerMode	= false;
+	_scanWindows.clear();
+	_currentWindow = -1;
+	_channelizer = NULL;
+	_windowSettle = 0;
+	_sweeping = false;
+	_sweepWasReading = false;
+	_sweepWindow = 0;
+	_sweepSettle = 0;
+	_rdsUpdate = 0;
 	
 	_channelEventQueue= {};
 	
@@ -42,6 +60,21 @@ RadioMgr::RadioMgr(){
 	_shouldReadAirplay = false;
 	
 	_squelchLevel = 0;
+	_squelchSNR = NoiseSquelch::default_threshold;
+	_useAsyncSDR = true;
+	_sdr = &_rtlsdr;
+	_amDirectSampling = true;
+	_upconverterOffset = 0;
+	_fixedPointDSP = false;
+	_fmThreading = FmDecoder::THREADS_SERIAL;
+	
+	_targetLatency = default_targetLatency;
+	_iqDropped = 0;
+	_pcmDropped = 0;
+	
+	_spectrum.begin();
+	_sweep.begin();
+	_agc.begin([this](int gain){ return _sdr->setTunerGain(gain); });
 	
 	pthread_create(&_auxReaderTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::AuxReaderThread, (void*)this);
@@ -73,6 +106,14 @@ RadioMgr::~RadioMgr(){
 	pthread_join(_sdrReaderTID, NULL);
 	pthread_join(_sdrProcessorTID, NULL);
 	pthread_join(_outputProcessorTID, NULL);
+	
+	_spectrum.stop();
+	_agc.stop();
+	_sweep.stop();
+	flushDecoderCache();
+	
+	if(_channelizer)
+		delete _channelizer;
 }
  
 
@@ -87,43 +128,105 @@ bool RadioMgr::begin(uint32_t deviceIndex, int  pcmrate,  int &error){
 	_channelEventQueue= {};
 
 	_isSetup = false;
+	flushDecoderCache();		// built for the old audio rate
 	_pcmrate = pcmrate;
 	_shouldReadSDR = false;
 	_shouldReadAux = false;
 	_shouldReadAirplay = false;
 
-	if(! _sdr.begin(deviceIndex,error ) )
+	_sdr = &_rtlsdr;
+	
+	if(! _rtlsdr.begin(deviceIndex,error ) )
 		return false;
 	
-	if(! _sdr.setBiasTee(true))
+	if(! _sdr->setBiasTee(true))
 		return false;
  
 	// tSet Sample rate
-	if(! _sdr.setSampleRate(RtlSdr::default_sampleRate))
+	if(! _sdr->setSampleRate(RtlSdr::default_sampleRate))
 		return false;
 	
 	// start with auto gain
-	if(! _sdr.setTunerGain( INT_MIN ))
+	if(! _sdr->setTunerGain( INT_MIN ))
 		return false;
 	
 	_AGC_active = true;
+	_agc.setEnabled(false);
 	 
 	_isSetup = true;
  
 	return true;
 }
 
+bool RadioMgr::begin(IQSource* source, int  pcmrate){
+	
+	_channelEventQueue= {};
+
+	_isSetup = false;
+	flushDecoderCache();		// built for the old audio rate
+	_pcmrate = pcmrate;
+	_shouldReadSDR = false;
+	_shouldReadAux = false;
+	_shouldReadAirplay = false;
+
+	if(!source)
+		return false;
+	
+	_sdr = source;
+	
+	if(! _sdr->setSampleRate(RtlSdr::default_sampleRate))
+		return false;
+	
+	if(! _sdr->setTunerGain( INT_MIN ))
+		return false;
+	
+	_AGC_active = true;
+	_agc.setEnabled(false);
+	
+	_isSetup = true;
+ 
+	return true;
+}
+
+bool RadioMgr::beginReplay(const string& path, int  pcmrate,  int &error){
+	
+	if(! _fileSource.begin(path, error))
+		return false;
+	
+	return begin(&_fileSource, pcmrate);
+}
+
+bool RadioMgr::startRecording(const string& path, int &error){
+	return _recorder.begin(path, error);
+}
+
+void RadioMgr::stopRecording(){
+	_recorder.stop();
+}
+
+bool RadioMgr::isRecording(){
+	return _recorder.isRecording();
+}
+
 void RadioMgr::stop(){
 	
+	_recorder.stop();
+	
 	if(_isSetup  ){
-		_shouldReadSDR = false;
+		{
+			// no block may reach the decoder once the sweep has let go
+			std::lock_guard<std::mutex> lock(_mutex);
+			endBandSweep(true, false);
+			_shouldReadSDR = false;
+		}
+		
 		_shouldReadAux = false;
 		_shouldReadAirplay = false;
 		_shouldQuit = true;
 		
 		_lineInput.stop();
 		_airplayInput.stop();
-		_sdr.stop();
+		_sdr->stop();
 	}
 	
 	_isSetup = false;
@@ -140,7 +243,131 @@ void RadioMgr::stop(){
 
 
 bool RadioMgr::getDeviceInfo(RtlSdr::device_info_t& info){
-	return _sdr.getDeviceInfo(info);
+	return _sdr->getDeviceInfo(info);
+}
+
+bool RadioMgr::getSDRStats(RtlSdr::async_stats_t& stats){
+	if(!_isSetup)
+		return false;
+	
+	stats = _sdr->getAsyncStats();
+	return true;
+}
+
+// MARK: -  Latency
+
+/*
+ The target is split between the two queues.  The output side keeps a
+ jitter buffer of a quarter of the target (at least min_jitterBuffer) and
+ may grow to twice that, the IQ side gets whatever is left, at least one
+ block.  Anything beyond the limits is dropped oldest first by the
+ consumer, so a slow moment costs a glitch instead of permanent lag.
+ */
+
+void RadioMgr::setTargetLatency(int ms){
+	if(ms < 0)
+		ms = 0;
+	_targetLatency = ms;
+}
+
+double RadioMgr::pcmFramesPerMs(){
+	// the output queue counts frames at the source's rate, AudioOutput
+	// converts them to its own
+	unsigned int rate = _mode == AIRPLAY ? AirplayInput::pipe_sampleRate : _pcmrate;
+	return rate / 1000.0;
+}
+
+size_t RadioMgr::pcmJitterFill(){
+	int target = _targetLatency;
+	
+	if(target == 0)
+		return _pcmrate;		// the old fixed prefill, a second
+	
+	int jitter = max(min_jitterBuffer, target / 4);
+	return jitter * pcmFramesPerMs();
+}
+
+size_t RadioMgr::pcmQueueLimit(){
+	if(_targetLatency == 0)
+		return SIZE_MAX;
+	
+	return 2 * pcmJitterFill();
+}
+
+size_t RadioMgr::iqQueueLimit(){
+	int target = _targetLatency;
+	
+	if(target == 0)
+		return SIZE_MAX;
+	
+	int jitter = max(min_jitterBuffer, target / 4);
+	int iq_ms = max(target - 2 * jitter, 0);
+	size_t limit = iq_ms * RtlSdr::default_sampleRate / 1000;
+	
+	return max(limit, (size_t) RtlSdr::default_blockLength);
+}
+
+bool RadioMgr::getLatencyStats(latency_stats_t& stats){
+	if(!_isSetup)
+		return false;
+	
+	stats.iq_queue_ms = _source_buffer.queued_samples() / (RtlSdr::default_sampleRate / 1000.0);
+	stats.pcm_queue_ms = _output_buffer.queued_samples() / pcmFramesPerMs();
+	stats.latency_ms = stats.pcm_queue_ms + (_shouldReadSDR ? stats.iq_queue_ms : 0);
+	stats.iq_dropped = _iqDropped + _source_buffer.drops();
+	stats.pcm_dropped = _pcmDropped + _output_buffer.drops();
+	return true;
+}
+
+void RadioMgr::publishLatency(){
+	
+	// once a second is plenty for the DB
+	static time_t lastPublish = 0;
+	time_t now = time(NULL);
+	if(now == lastPublish)
+		return;
+	lastPublish = now;
+	
+	latency_stats_t stats;
+	if(!getLatencyStats(stats))
+		return;
+	
+	PiCarDB*	db = PiCarMgr::shared()->db();
+	db->updateValue(VAL_AUDIO_LATENCY, stats.latency_ms);
+	db->updateValue(VAL_IQ_QUEUE_DEPTH, stats.iq_queue_ms);
+	db->updateValue(VAL_PCM_QUEUE_DEPTH, stats.pcm_queue_ms);
+	db->updateValue(VAL_IQ_DROPPED, (uint32_t) stats.iq_dropped);
+	
+	AudioOutput*	audio  = PiCarMgr::shared()->audio();
+	db->updateValue(VAL_PCM_UNDERRUNS, (uint32_t) audio->underruns());
+	db->updateValue(VAL_PCM_XRUNS, (uint32_t) audio->xrunRecoveries());
+}
+
+// Station name, radiotext and program type for the display.
+
+void RadioMgr::publishRDS(const RdsDecoder& rds){
+	
+	if(rds.get_update_count() == _rdsUpdate)
+		return;
+	
+	_rdsUpdate = rds.get_update_count();
+	
+	PiCarDB*	db = PiCarMgr::shared()->db();
+	db->updateValue(VAL_RDS_PS, rds.get_ps());
+	db->updateValue(VAL_RDS_RT, rds.get_radiotext());
+	db->updateValue(VAL_RDS_PTY, rds.get_pty());
+	
+	PiCarMgr::shared()->display()->showRDSChange();
+}
+
+void RadioMgr::clearRDS(){
+	
+	PiCarDB*	db = PiCarMgr::shared()->db();
+	db->updateValue(VAL_RDS_PS, string());
+	db->updateValue(VAL_RDS_RT, string());
+	db->updateValue(VAL_RDS_PTY, 0);
+	
+	_rdsUpdate = 0;
 }
 
 bool RadioMgr::setON(bool isOn) {
@@ -161,17 +388,21 @@ bool RadioMgr::setON(bool isOn) {
 	if(!isOn){
 		std::lock_guard<std::mutex> lock(_mutex);
 		
+		endBandSweep(true, false);
+		
 		_shouldReadSDR = false;
 		_shouldReadAux = false;
 		_shouldReadAirplay = false;
 
-		_sdr.resetBuffer();
+		_sdr->resetBuffer();
 		_output_buffer.flush();
 		
-		// delete decoders
-		if(_sdrDecoder) {
-			delete _sdrDecoder;
-			_sdrDecoder = NULL;
+		// decoders stay warm in the cache for the next setON
+		_sdrDecoder = NULL;
+		
+		if(_channelizer) {
+			delete _channelizer;
+			_channelizer = NULL;
 		}
 		display->showTime();
 	}
@@ -290,21 +521,40 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 			
 //		printf("setFrequencyandModeInternal(%s %u) %d \n", modeString(newMode).c_str(), newFreq, force);
 
-		audio->setMute(true);
+		// Same band, only the station moves.  The front end is already set
+		// up and the decoder is retuned in place, so skip the mute; only the
+		// tuner PLL has to settle.  The queued audio of the old station is
+		// still dropped.
+		bool fastRetune = _sdrDecoder != NULL && newMode == _mode
+								&& (_mode == BROADCAST_FM || _mode == BROADCAST_AM
+									 || _mode == VHF || _mode == UHF);
+		
+		// tuning away from a sweep abandons it
+		endBandSweep(true, false);
+		
+		if(!fastRetune){
+			audio->setMute(true);
+			audio->newSource();
+		}
 		
 		// SOMETHING ABOUT MODES HERE?
 		_frequency = newFreq;
 		_mode = newMode;
 		_mux =  MUX_MONO;
 	 
-		// create proper decoder
-		if(_sdrDecoder) {
-			delete _sdrDecoder;
-			_sdrDecoder = NULL;
+		// the decoder goes back to the cache, the branch below picks one up
+		_sdrDecoder = NULL;
+		clearRDS();
+		_agc.reset();
+		
+		if(_channelizer) {
+			delete _channelizer;
+			_channelizer = NULL;
 		}
+		_currentWindow = -1;
 		
 		if(_mode == AUX) {
-			_sdr.resetBuffer();
+			_sdr->resetBuffer();
 			_output_buffer.flush();
 			_shouldReadSDR = false;
 			_shouldReadAux = true;
@@ -312,7 +562,7 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 			didUpdate = true;
 		}
 		else if(_mode == AIRPLAY) {
-			_sdr.resetBuffer();
+			_sdr->resetBuffer();
 			_output_buffer.flush();
 			_shouldReadSDR = false;
 			_shouldReadAux = false;
@@ -320,92 +570,114 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 		}
 		else if(_mode == VHF || _mode == UHF) {
 	
-			_sdr.resetBuffer();
+			_sdr->resetBuffer();
 			_output_buffer.flush();
 			
 			// Intentionally tune at a higher frequency to avoid DC offset.
-			double tuner_freq = newFreq + 0.25 * _sdr.getSampleRate();
+			double tuner_freq = newFreq + 0.25 * _sdr->getSampleRate();
 			
-			if(! _sdr.setOffsetTuning(false))
-				return false;
-	
-			if(! _sdr.setACGMode(false))
-				return false;
+			// scanning a window of channels, tune where the window wants
+			int window = _scannerMode ? scanWindowFor(newMode, newFreq) : -1;
+			if(window >= 0)
+				tuner_freq = _scanWindows[window].tunerFreq;
+			
+			if(!fastRetune){
+				if(! _sdr->setDirectSampling(RtlSdr::DIRECT_SAMPLING_OFF))
+					return false;
+				
+				if(! _sdr->setOffsetTuning(false))
+					return false;
+		
+				if(! _sdr->setACGMode(false))
+					return false;
+			}
  
-			if(! _sdr.setFrequency(tuner_freq))
+			if(! _sdr->setFrequency(tuner_freq))
 				return false;
 			
-			// changing FM frequencies means recreating the decoder
-			
-			// The baseband signal is empty above 100 kHz, so we can
-			// downsample to ~ 200 kS/s without loss of information.
-			// This will speed up later processing stages.
-			unsigned int downsample = max(1, int(RtlSdr::default_sampleRate / 215.0e3));
-			fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+			_sdrDecoder = warmDecoder(_mode, newFreq, newFreq - tuner_freq);
 			
-			// Prevent aliasing at very low output sample rates.
-			double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
-												0.45 * _pcmrate);
-			
-			double ifBandwdth = VhfDecoder::isNarrowBand(newFreq)
-								? 12500
-								: 25000;
-			
-			_sdrDecoder = new VhfDecoder(RtlSdr::default_sampleRate,
-												newFreq - tuner_freq,
-												_pcmrate,
-												  VhfDecoder::default_deemphasis,     // deemphasis,
-												  ifBandwdth,  							 // bandwidth_if
-												  VhfDecoder::default_freq_dev,       // freq_dev
-												bandwidth_pcm,
-												downsample,
-												_squelchLevel  // squelch level
-												);
+			if(window >= 0 && _scanWindows[window].channels.size() > 1){
+				double fs = _sdr->getSampleRate();
+				
+				_channelizer = new Channelizer(scan_filter_order, scan_decimation);
+				_windowNoiseRef.clear();
+				for(auto offset : _scanWindows[window].channels){
+					uint32_t freq = _scannerChannels[offset].second;
+					double bandwidth = ifBandwidth(_mode, freq);
+					_channelizer->add_channel((freq - tuner_freq) / fs, bandwidth / fs);
+					_windowNoiseRef.push_back(windowNoiseReference(bandwidth));
+				}
+				_currentWindow = window;
+				
+				// the first block after a retune still has the old channel in it
+				_windowSettle = 1;
+			}
 			
 			_shouldReadAux = false;
 			_shouldReadAirplay = false;
 
 			_shouldReadSDR = true;
 		}
-		else if(_mode == BROADCAST_FM) {
+		else if(_mode == BROADCAST_AM) {
 			
-			_sdr.resetBuffer();
+			_sdr->resetBuffer();
 			_output_buffer.flush();
 			
-			if(! _sdr.setOffsetTuning(false))
+			// The R820T cannot tune below 24 MHz.  Either sample the antenna
+			// directly or let an upconverter move the band up.
+			uint32_t rf_offset = _amDirectSampling ? 0 : _upconverterOffset;
+			
+			// a no-op unless the AM input setting changed
+			if(! _sdr->setDirectSampling(_amDirectSampling
+												  ? RtlSdr::DIRECT_SAMPLING_Q
+												  : RtlSdr::DIRECT_SAMPLING_OFF))
 				return false;
-	 
-			if(! _sdr.setACGMode(false))
-						return false;
-	
+			
+			if(!fastRetune){
+				if(! _sdr->setOffsetTuning(false))
+					return false;
+				
+				if(! _sdr->setACGMode(false))
+					return false;
+			}
+			
 			// Intentionally tune at a higher frequency to avoid DC offset.
-			double tuner_freq = newFreq + 0.25 * _sdr.getSampleRate();
+			double tuner_freq = newFreq + rf_offset + 0.25 * _sdr->getSampleRate();
 			
-			if(! _sdr.setFrequency(tuner_freq))
+			if(! _sdr->setFrequency(tuner_freq))
 				return false;
 			
-			// changing FM frequencies means recreating the decoder
+			_sdrDecoder = warmDecoder(_mode, newFreq, (newFreq + rf_offset) - tuner_freq);
+			
+			_shouldReadAux = false;
+			_shouldReadAirplay = false;
+			
+			_shouldReadSDR = true;
+		}
+		else if(_mode == BROADCAST_FM) {
 			
-			// The baseband signal is empty above 100 kHz, so we can
-			// downsample to ~ 200 kS/s without loss of information.
-			// This will speed up later processing stages.
-			unsigned int downsample = max(1, int(RtlSdr::default_sampleRate / 215.0e3));
-			fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+			_sdr->resetBuffer();
+			_output_buffer.flush();
+			
+			if(!fastRetune){
+				if(! _sdr->setDirectSampling(RtlSdr::DIRECT_SAMPLING_OFF))
+					return false;
+				
+				if(! _sdr->setOffsetTuning(false))
+					return false;
+		 
+				if(! _sdr->setACGMode(false))
+					return false;
+			}
+	
+			// Intentionally tune at a higher frequency to avoid DC offset.
+			double tuner_freq = newFreq + 0.25 * _sdr->getSampleRate();
 			
-			// Prevent aliasing at very low output sample rates.
-			double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
-												0.45 * _pcmrate);
+			if(! _sdr->setFrequency(tuner_freq))
+				return false;
 			
-			_sdrDecoder = new FmDecoder(RtlSdr::default_sampleRate,
-												newFreq - tuner_freq,
-												_pcmrate,
-												true,  // stereo
-												FmDecoder::default_deemphasis,     // deemphasis,
-												FmDecoder::default_bandwidth_if,   // bandwidth_if
-												FmDecoder::default_freq_dev,       // freq_dev
-												bandwidth_pcm,
-												downsample
-												);
+			_sdrDecoder = warmDecoder(_mode, newFreq, newFreq - tuner_freq);
 			
 			_shouldReadAux = false;
 			_shouldReadAirplay = false;
@@ -414,7 +686,7 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 		}
 		
 		
-		if(!wasMuted)
+		if(!wasMuted && !fastRetune)
 			audio->setMute(false);
 		
 		didUpdate = true;
@@ -433,6 +705,139 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 	
 	return true;
 }
+
+double RadioMgr::ifBandwidth(radio_mode_t mode, uint32_t freq){
+	
+	double bandwidth = 0;
+	
+	switch (mode) {
+		case BROADCAST_AM:
+			bandwidth = AmDecoder::default_bandwidth_if;
+			break;
+			
+		case BROADCAST_FM:
+			bandwidth = FmDecoder::default_bandwidth_if;
+			break;
+			
+		case VHF:
+		case UHF:
+			bandwidth = VhfDecoder::isNarrowBand(freq) ? 12500 : 25000;
+			break;
+			
+		default: ;
+	}
+	return bandwidth;
+}
+
+SDRDecoder* RadioMgr::makeDecoder(radio_mode_t mode, double tuning_offset, double bandwidth_if){
+	
+	SDRDecoder* decoder = NULL;
+	
+	if(mode == BROADCAST_AM){
+		
+		// Prevent aliasing at very low output sample rates.
+		double bandwidth_pcm = min(AmDecoder::default_bandwidth_pcm,
+											0.45 * _pcmrate);
+		
+		decoder = new AmDecoder(RtlSdr::default_sampleRate,
+										tuning_offset,
+										_pcmrate,
+										AmDecoder::DETECT_SYNC,
+										bandwidth_if,
+										bandwidth_pcm,
+										AmDecoder::default_whistle_freq
+										);
+	}
+	else if(mode == BROADCAST_FM || mode == VHF || mode == UHF){
+		
+		// The baseband signal is empty above 100 kHz, so we can
+		// downsample to ~ 200 kS/s without loss of information.
+		// This will speed up later processing stages.
+		unsigned int downsample = max(1, int(RtlSdr::default_sampleRate / 215.0e3));
+		fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+		
+		// Prevent aliasing at very low output sample rates.
+		double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
+											0.45 * _pcmrate);
+		
+		if(mode == BROADCAST_FM){
+			decoder = new FmDecoder(RtlSdr::default_sampleRate,
+											tuning_offset,
+											_pcmrate,
+											true,  // stereo
+											FmDecoder::default_deemphasis,     // deemphasis,
+											bandwidth_if,   						  // bandwidth_if
+											FmDecoder::default_freq_dev,       // freq_dev
+											bandwidth_pcm,
+											downsample
+											);
+		}
+		else {
+			decoder = new VhfDecoder(RtlSdr::default_sampleRate,
+											tuning_offset,
+											_pcmrate,
+											  VhfDecoder::default_deemphasis,     // deemphasis,
+											  bandwidth_if,  							 // bandwidth_if
+											  VhfDecoder::default_freq_dev,       // freq_dev
+											bandwidth_pcm,
+											downsample,
+											_squelchLevel  // squelch level
+											);
+		}
+	}
+	
+	return decoder;
+}
+
+// Reuse the decoder from the last time this mode and bandwidth was used,
+// retuned to the new station, or build one the first time.
+
+SDRDecoder* RadioMgr::warmDecoder(radio_mode_t mode, uint32_t freq, double tuning_offset){
+	
+	double bandwidth_if = ifBandwidth(mode, freq);
+	decoder_key_t key = {mode, int(bandwidth_if)};
+	
+	SDRDecoder* decoder = NULL;
+	
+	auto it = _decoderCache.find(key);
+	if(it != _decoderCache.end()){
+		decoder = it->second;
+		decoder->retune(tuning_offset, bandwidth_if);
+	}
+	else {
+		decoder = makeDecoder(mode, tuning_offset, bandwidth_if);
+		if(!decoder)
+			return NULL;
+		_decoderCache[key] = decoder;
+	}
+	
+	// settings may have changed while it sat in the cache
+	decoder->set_squelch_level(_squelchLevel);
+	
+	if(FmDecoder* fm = dynamic_cast<FmDecoder*>(decoder)){
+		fm->set_fixed_point(_fixedPointDSP);
+		fm->set_threading(_fmThreading);
+		fm->set_rds_enabled(true);
+	}
+	else if(VhfDecoder* vhf = dynamic_cast<VhfDecoder*>(decoder)){
+		vhf->set_fixed_point(_fixedPointDSP);
+		vhf->set_squelch_snr(_squelchSNR);
+	}
+	
+	return decoder;
+}
+
+void RadioMgr::flushDecoderCache(){
+	
+	std::lock_guard<std::mutex> lock(_mutex);
+	
+	_sdrDecoder = NULL;
+	
+	for(auto &it : _decoderCache)
+		delete it.second;
+	
+	_decoderCache.clear();
+}
  
 bool  RadioMgr::canSquelch(){
  	if(_scannerMode)
@@ -456,6 +861,13 @@ void 	 RadioMgr::setSquelchLevel(int level){
 
 }
 
+void 	 RadioMgr::setSquelchSNR(double db){
+	
+	_squelchSNR = db;
+	if(VhfDecoder* vhf = dynamic_cast<VhfDecoder*>(_sdrDecoder))
+		vhf->set_squelch_snr(db);
+}
+
 int 	RadioMgr::getMaxSquelchRange(){
 	return -45;
 }
@@ -467,7 +879,7 @@ std::vector<int> RadioMgr::getTunerGains(){
 	std::vector<int> gains = {};
 	
 	if(_isSetup)
-		gains = _sdr.getTunerGains();
+		gains = _sdr->getTunerGains();
  
 	return gains;
 }
@@ -475,8 +887,26 @@ std::vector<int> RadioMgr::getTunerGains(){
 bool RadioMgr::setTunerGain(int val){
 	if(_isSetup)
 	{
+		if(val == tunerGain_softwareAGC){
+			
+			// start from the middle of the range, manual gain mode
+			vector<int> gains = _sdr->getTunerGains();
+			if(gains.empty())
+				return false;
+			
+			sort(gains.begin(), gains.end());
+			int start = gains[gains.size() / 2];
+			if(! _sdr->setTunerGain(start))
+				return false;
+			
+			_AGC_active = false;
+			_agc.setEnabled(true, gains, start);
+			return true;
+		}
+		
+		_agc.setEnabled(false);
 		_AGC_active = val == 0;
-		return _sdr.setTunerGain(val );
+		return _sdr->setTunerGain(val );
  	}
 	else
 		return false;
@@ -484,8 +914,9 @@ bool RadioMgr::setTunerGain(int val){
 
 int RadioMgr::getTunerGain(){
 	if(_isSetup){
+		if(_agc.isEnabled()) return tunerGain_softwareAGC;
 		if(_AGC_active) return 0;
-		else  return _sdr.getTunerGain();
+		else  return _sdr->getTunerGain();
  	}
 	else
 		return INT_MIN;
@@ -575,6 +1006,26 @@ string RadioMgr::muxstring(radio_mux_t mux){
 	return str;
 }
 
+// RBDS program types, the North American table, short display names
+string RadioMgr::ptyString(int pty){
+	
+	static const char* names[32] = {
+		"",			"News",		"Info",		"Sports",
+		"Talk",		"Rock",		"Cls Rock",	"Adlt Hit",
+		"Soft Rck",	"Top 40",	"Country",	"Oldies",
+		"Soft",		"Nostalga",	"Jazz",		"Classicl",
+		"R & B",		"Soft R&B",	"Language",	"Rel Musc",
+		"Rel Talk",	"Persnlty",	"Public",	"College",
+		"",			"",			"",			"",
+		"",			"Weather",	"Test",		"ALERT!"
+	};
+	
+	if(pty < 0 || pty > 31)
+		return "";
+	
+	return names[pty];
+}
+
 
 string  RadioMgr::freqSuffixString(double hz){
 	
@@ -708,9 +1159,14 @@ string  RadioMgr::hertz_to_string(double hz, int precision){
 // MARK: -  Scanner
 bool RadioMgr::scanChannels( vector < RadioMgr::channel_t >  channels ){
 	
-	_scannerChannels = channels;
-	_scannerMode = channels.size() > 0;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 		
+		_scannerChannels = channels;
+		_scannerMode = channels.size() > 0;
+		buildScanWindows();
+	}
+	
 	if(_scannerMode){
 		_currentScanOffset = 0;
 		pauseScan(false);
@@ -805,6 +1261,12 @@ bool RadioMgr::tuneNextScannerChannel(){
  
 	uint  nextOffset =  (_currentScanOffset + 1) % _scannerChannels.size();
 	
+	// the channelizer already checked the rest of this window, skip to the next
+	if(_currentWindow >= 0 && !_scanWindows.empty()){
+		int nextWindow = (_currentWindow + 1) % _scanWindows.size();
+		nextOffset = _scanWindows[nextWindow].channels.front();
+	}
+	
 	channel_t channel = _scannerChannels[nextOffset];
 	_currentScanOffset = nextOffset;
 	
@@ -820,6 +1282,292 @@ bool RadioMgr::scannerLocked(){
 	return _scannerMode;
 }
 
+// Group the VHF/UHF scanner channels into windows that fit in one tuner
+// setting.  Each window is tuned a quarter sample rate above its lowest
+// channel, the same place a single channel is tuned.  Anything else, or a
+// channel that does not share, gets a window of its own.
+
+void RadioMgr::buildScanWindows(){
+	
+	_scanWindows.clear();
+	_currentWindow = -1;
+	
+	if(_channelizer) {
+		delete _channelizer;
+		_channelizer = NULL;
+	}
+	
+	double fs = _sdr->getSampleRate();
+	if(fs == 0)
+		fs = RtlSdr::default_sampleRate;
+	
+	vector<uint> pending;
+	for(uint i = 0; i < _scannerChannels.size(); i++)
+		pending.push_back(i);
+	
+	// lowest frequency first so each window starts at its bottom channel
+	stable_sort(pending.begin(), pending.end(), [this](uint a, uint b){
+		return _scannerChannels[a].second < _scannerChannels[b].second;
+	});
+	
+	while(!pending.empty()){
+		
+		scan_window_t window;
+		
+		uint first = pending.front();
+		radio_mode_t mode = _scannerChannels[first].first;
+		window.tunerFreq = _scannerChannels[first].second + 0.25 * fs;
+		
+		vector<uint> rest;
+		
+		for(auto offset : pending){
+			radio_mode_t chMode = _scannerChannels[offset].first;
+			double delta = double(_scannerChannels[offset].second) - window.tunerFreq;
+			double half = (VhfDecoder::isNarrowBand(_scannerChannels[offset].second) ? 12500 : 25000) / 2;
+			
+			bool fits = offset == first
+			|| ((mode == VHF || mode == UHF) && chMode == mode
+				 && fabs(delta) + half <= scan_window_span
+				 && fabs(delta) - half >= scan_dc_guard);
+			
+			if(fits)
+				window.channels.push_back(offset);
+			else
+				rest.push_back(offset);
+		}
+		
+		sort(window.channels.begin(), window.channels.end());
+		_scanWindows.push_back(window);
+		pending = rest;
+	}
+	
+	// step through the windows in the order the user listed the channels
+	sort(_scanWindows.begin(), _scanWindows.end(), [](const scan_window_t &a, const scan_window_t &b){
+		return a.channels.front() < b.channels.front();
+	});
+}
+
+int RadioMgr::scanWindowFor(radio_mode_t mode, uint32_t freq){
+	
+	for(int i = 0; i < (int)_scanWindows.size(); i++){
+		for(auto offset : _scanWindows[i].channels){
+			if(_scannerChannels[offset].first == mode
+				&& _scannerChannels[offset].second == freq)
+				return i;
+		}
+	}
+	return -1;
+}
+
+// Noise band power of seeded noise through one channelizer channel and
+// the discriminator, what the window squelch hears on an empty channel of
+// this bandwidth.  As VhfDecoder::calibrate_squelch() for its IF filter.
+
+double RadioMgr::windowNoiseReference(double bandwidth_if){
+	
+	int key = lrint(bandwidth_if);
+	auto it = _noiseRefCache.find(key);
+	if(it != _noiseRefCache.end())
+		return it->second;
+	
+	const unsigned int n = 1 << 17;
+	
+	mt19937 gen(1);
+	normal_distribution<float> noise(0, 0.1);
+	
+	IQSampleVector samples(n);
+	for (auto& s : samples)
+		s = IQSample(noise(gen), noise(gen));
+	
+	Channelizer channelizer(scan_filter_order, scan_decimation);
+	channelizer.add_channel(0, bandwidth_if / RtlSdr::default_sampleRate);
+	channelizer.process(samples);
+	
+	PhaseDiscriminator phasedisc(VhfDecoder::default_freq_dev / scan_sample_rate);
+	SampleVector baseband;
+	phasedisc.process(channelizer.channel_output(0), baseband);
+	
+	_windowSquelch.calibrate(baseband);
+	double reference = _windowSquelch.get_reference();
+	
+	_noiseRefCache[key] = reference;
+	return reference;
+}
+
+// First channel in scan order the squelch would open on, -1 if the whole
+// window is quiet.  The same two tests the VHF decoder makes on its first
+// block on a channel: the IF level has to reach the squelch level, then
+// the noise squelch decides.  Only the channels passing the level test
+// are filtered in full and demodulated.
+
+int RadioMgr::openChannelInWindow(const IQSampleVector& iqsamples){
+	
+	if(!_channelizer || _currentWindow < 0)
+		return -1;
+	
+	auto &channels = _scanWindows[_currentWindow].channels;
+	
+	// squelch off, the decoder plays whatever it is given
+	if(_squelchLevel == 0){
+		_channelizer->measure(iqsamples);
+		return channels.empty() ? -1 : channels[0];
+	}
+	
+	_channelizer->process_above(iqsamples, pow(10, _squelchLevel / 20.0));
+	_windowSquelch.set_threshold(_squelchSNR);
+	
+	for(uint ch = 0; ch < channels.size(); ch++){
+		double level = _channelizer->get_level(ch);
+		const IQSampleVector& iq = _channelizer->channel_output(ch);
+		
+		if(level <= 0 || int(20*log10(level)) <= _squelchLevel || iq.empty())
+			continue;
+		
+		_windowDisc.reset();
+		_windowDisc.process(iq, _windowBaseband);
+		
+		_windowSquelch.set_reference(_windowNoiseRef[ch]);
+		_windowSquelch.reset();
+		if(_windowSquelch.process(_windowBaseband))
+			return channels[ch];
+	}
+	
+	return -1;
+}
+
+// Move the decoder to another channel of the tuned window.  The tuner and
+// the sample queue are left alone, so there is no retune gap.
+
+void RadioMgr::switchScannerChannel(uint offset){
+	
+	DisplayMgr*		display 	= PiCarMgr::shared()->display();
+	PiCarDB*			db 		= PiCarMgr::shared()->db();
+	
+	channel_t channel = _scannerChannels[offset];
+	
+	double tuner_freq = _scanWindows[_currentWindow].tunerFreq;
+	_sdrDecoder = warmDecoder(channel.first, channel.second, channel.second - tuner_freq);
+	
+	_currentScanOffset = offset;
+	_frequency = channel.second;
+	_mode = channel.first;
+	
+	db->updateValue(VAL_MODULATION_MODE, _mode);
+	db->updateValue(VAL_RADIO_FREQ, _frequency);
+	display->showScannerChange(false);
+}
+
+// MARK: -  Band sweep
+
+bool RadioMgr::startBandSweep(BandSweep::completion_t cb){
+
+	if(!_isSetup || _sweeping)
+		return false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(!_sweep.start(cb))
+		return false;
+
+	uint32_t tunerFreq;
+	if(!_sweep.nextWindow(tunerFreq)){
+		_sweep.cancel();
+		return false;
+	}
+
+	_sweepWasReading = _shouldReadSDR;
+	if(_shouldReadSDR)
+		_output_buffer.flush();
+
+	// the decoder goes back to the cache, the radio is retuned when done.
+	// Nothing is decoded until then.
+	_shouldReadSDR = false;
+	_sdrDecoder = NULL;
+
+	if(_channelizer) {
+		delete _channelizer;
+		_channelizer = NULL;
+	}
+	_currentWindow = -1;
+
+	if(! _sdr->setDirectSampling(RtlSdr::DIRECT_SAMPLING_OFF)
+		|| ! _sdr->setOffsetTuning(false)
+		|| ! _sdr->setACGMode(false)
+		|| ! tuneSweepWindow(tunerFreq)){
+		_sweep.cancel();
+		if(_sweepWasReading)
+			queueSetFrequencyandMode(_mode, _frequency, true);
+		return false;
+	}
+
+	_sweeping = true;
+	_shouldReadSDR = true;
+
+	return true;
+}
+
+void RadioMgr::cancelBandSweep(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	endBandSweep(true, true);
+}
+
+bool RadioMgr::tuneSweepWindow(uint32_t tunerFreq){
+
+	if(! _sdr->setFrequency(tunerFreq))
+		return false;
+
+	// anything already read is from the last window
+	_sdr->resetBuffer();
+	_source_buffer.flush();
+
+	_sweepWindow = tunerFreq;
+	_sweepSettle = sweep_settle_blocks;
+	return true;
+}
+
+// Called from SDRProcessor with _mutex held, once per block.
+void RadioMgr::sweepStep(IQSampleVector& iqsamples){
+
+	if(_sweepSettle > 0){
+		_sweepSettle--;
+		return;
+	}
+
+	// the window is analysed on the sweep thread while the next one is read
+	if(!_sweep.submit(_sweepWindow, iqsamples)){
+		endBandSweep(true, true);
+		return;
+	}
+
+	uint32_t tunerFreq;
+	if(!_sweep.nextWindow(tunerFreq)){
+		endBandSweep(false, true);
+	}
+	else if(!tuneSweepWindow(tunerFreq)){
+		endBandSweep(true, true);
+	}
+}
+
+// Called with _mutex held.  Unless cancelled, the sweep thread finishes the
+// last window and calls the completion on its own.
+//
+// The sweep left no decoder behind, so SDR reading stays off.  The queued
+// retune turns it back on once it has installed one.
+void RadioMgr::endBandSweep(bool cancelled, bool restoreRadio){
+
+	if(!_sweeping)
+		return;
+
+	_sweeping = false;
+	_shouldReadSDR = false;
+
+	if(cancelled)
+		_sweep.cancel();
+
+	if(restoreRadio && _sweepWasReading)
+		queueSetFrequencyandMode(_mode, _frequency, true);
+}
+
 
 
 // MARK: -  AuxReader thread
@@ -829,7 +1577,7 @@ void RadioMgr::AuxReader(){
 		
 	static bool aux_setup = false;
 	 
-	SampleVector samples;
+	PcmFrames frames;
 	while(!_shouldQuit){
 		
 			// aux is off sleep for awhile.
@@ -851,8 +1599,8 @@ void RadioMgr::AuxReader(){
 		if(_lineInput.isConnected()){
 			
 			// get input
-			if( _lineInput.getSamples(samples)){
-				_output_buffer.push(move(samples));
+			if( _lineInput.getSamples(frames)){
+				_output_buffer.push(frames);
 			}
 		}
 	}
@@ -894,7 +1642,7 @@ void RadioMgr::AirplayReader(){
 
 	static bool airplay_setup = false;
 	 
-	SampleVector samples;
+	PcmFrames frames;
 	while(!_shouldQuit){
 		
 			// aux is off sleep for awhile.
@@ -923,8 +1671,8 @@ void RadioMgr::AirplayReader(){
  		if(_airplayInput.isConnected()){
 
 			// get input
-			if( _airplayInput.getSamples(samples)){
-				_output_buffer.push(move(samples));
+			if( _airplayInput.getSamples(frames)){
+				_output_buffer.push(frames);
 			}
 			else{
 				usleep(200000);
@@ -969,18 +1717,31 @@ void RadioMgr::SDRReader(){
 	while(!_shouldQuit){
 			// radio is off sleep for awhile.
 			if(!_isSetup || !_shouldReadSDR){
+				if(_sdr->isAsync())
+					_sdr->stopAsync();
 				usleep(200000);
 				continue;
 			}
 	 
-		if (!_sdr.getSamples(iqsamples)) {
+		if(_useAsyncSDR && !_sdr->isAsync()){
+			if(!_sdr->startAsync()){
+				fprintf(stderr, "SDR async start failed, using sync reads\n");
+				_useAsyncSDR = false;
+			}
+		}
+		
+		if (!_sdr->getSamples(iqsamples)) {
 			//			 fprintf(stderr, "ERROR: getSamples\n");
 			continue;
 		}
 		
 		//		printf("read: %ld\n", iqsamples.size());
 		
-		_source_buffer.push(move(iqsamples));
+		if(_recorder.isRecording())
+			_recorder.write(iqsamples);
+		
+		// iqsamples comes back with recycled storage for the next block
+		_source_buffer.push(iqsamples);
 	}
 	
 	_source_buffer.push_end();
@@ -1025,7 +1786,8 @@ void RadioMgr::SDRProcessor(){
 	PRINT_CLASS_TID;
 	
 	bool inbuf_length_warning = false;
-	SampleVector audiosamples;
+	IQSampleVector iqsamples;
+	PcmFrames audioframes;
 	double audio_level = 0;
 	bool got_stereo = false;
 	
@@ -1037,36 +1799,51 @@ void RadioMgr::SDRProcessor(){
 		}
 		
 		// Check for overflow of source buffer.
-		if (!inbuf_length_warning &&
-			 _source_buffer.queued_samples() > 10 * RtlSdr::default_sampleRate) {
+		if (!inbuf_length_warning && _source_buffer.drops() > 0) {
 			fprintf(stderr,
-					  "\nWARNING: Input buffer is growing (system too slow)\n");
+					  "\nWARNING: Input buffer overflow, dropping IQ (system too slow)\n");
 			inbuf_length_warning = true;
 		}
 		
-		// Pull next block from source buffer.
-		IQSampleVector iqsamples = _source_buffer.pull();
-		if (iqsamples.empty())
+		// swap the last block back to the reader and pull the next one.
+		if (!_source_buffer.pull(iqsamples))
 			continue;
 		
-		if(_mode == VHF ||  _mode == UHF || _mode == BROADCAST_FM){
+		// Behind the latency target, skip ahead to newer IQ.
+		size_t iqLimit = iqQueueLimit();
+		while(_source_buffer.queued_samples() > iqLimit
+				&& _source_buffer.try_pull(iqsamples)){
+			_iqDropped++;
+		}
+
+		if(_sweeping){
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if(_sweeping)
+				sweepStep(iqsamples);
+			continue;
+		}
+
+		if(_mode == VHF ||  _mode == UHF || _mode == BROADCAST_FM || _mode == BROADCAST_AM){
 			
 			/// this block is critical.  dont change frequencies in the middle of a process.
 			std::lock_guard<std::mutex> lock(_mutex);
 			
-			if(!_shouldReadSDR)
+			// a sweep or a mode change can leave no decoder for a while
+			if(!_shouldReadSDR || !_sdrDecoder)
 				continue;
 			
 				// Decode FM signal.
-			_sdrDecoder->process(iqsamples, audiosamples);
+			audioframes.setFormat(PcmFrames::PCM_FLOAT, _pcmrate, 2);
+			_sdrDecoder->process(iqsamples, audioframes.floats());
 			
 			// Measure audio level.
 			double audio_mean, audio_rms;
-			samples_mean_rms(audiosamples, audio_mean, audio_rms);
+			samples_mean_rms(audioframes.floats(), audio_mean, audio_rms);
 			audio_level = 0.95 * audio_level + 0.05 * audio_rms;
 			
 			// Set nominal audio volume.
-			adjust_gain(audiosamples, 0.5);
+			adjust_gain(audioframes.floats(), 0.5);
 			
 			if(_mode == BROADCAST_FM) {
 				// Stereo indicator change
@@ -1080,6 +1857,7 @@ void RadioMgr::SDRProcessor(){
 			}
 			
 			_IF_Level = 20*log10(_sdrDecoder->get_if_level());
+			_agc.reportLevel(_sdrDecoder->get_if_level());
 			_baseband_level =  20*log10(_sdrDecoder->get_baseband_level()) + 3.01;
 //
 //			if(_scannerMode){
@@ -1101,7 +1879,32 @@ void RadioMgr::SDRProcessor(){
 				
 				bool isSQLD = isSquelched();
 				
-				if(isSQLD){
+				if(_channelizer && !_scanningPaused && sqlCount == 0){
+					
+					// look at every channel in the window from this one block
+					if(_windowSettle > 0){
+						_windowSettle--;
+					}
+					else {
+						int open = openChannelInWindow(iqsamples);
+						
+						if(open < 0){
+							tuneNextScannerChannel();
+							display->LEDeventScannerStep();
+						}
+						else {
+							uint offset = open;
+							if(offset != _currentScanOffset)
+								switchScannerChannel(offset);
+							sqlCount++;
+						}
+					}
+				}
+				else if(isSQLD && _channelizer && !_scanningPaused){
+					// the held channel dropped, recheck the window before moving on
+					sqlCount = 0;
+				}
+				else if(isSQLD){
 					if(!_scanningPaused) {
 						tuneNextScannerChannel();
 						sqlCount = 0;
@@ -1129,9 +1932,20 @@ void RadioMgr::SDRProcessor(){
 				
 				// Write samples to output.
 				// Buffered write.
-				_output_buffer.push(move(audiosamples));
+				_output_buffer.push(audioframes);
+			}
+			
+			// Done with the IQ, let the band view have it if it wants it.
+			// This swaps the block out, nothing is copied.
+			_spectrum.offer(iqsamples);
+			
+			// RDS runs on the baseband the decoder kept from this block, now
+			// that the audio is queued it doesn't hold anything up.
+			if(_mode == BROADCAST_FM) {
+				FmDecoder* fm = dynamic_cast<FmDecoder *>(_sdrDecoder);
+				fm->process_rds();
+				publishRDS(fm->rds());
 			}
- 
 			
 #if DEBUG_DEMOD
 			
@@ -1199,6 +2013,8 @@ void RadioMgr::OutputProcessor(){
   
 	PRINT_CLASS_TID;
 	
+	PcmFrames frames;
+
 	while(!_shouldQuit){
 		
 		if(!_isSetup){
@@ -1213,25 +2029,27 @@ void RadioMgr::OutputProcessor(){
 			 // too often.
 			
 			
-			// revisit this..  the 2 is for stereo..
-			
-			_output_buffer.wait_buffer_fill(_pcmrate * 2);
-			
-			
+			// With a latency target this is a small jitter buffer,
+			// otherwise a full second.
+			_output_buffer.wait_buffer_fill(pcmJitterFill());
 		}
+		
 		// Get samples from buffer and write to output.
-		SampleVector samples =_output_buffer.pull();
-		AudioOutput*	 audio  = PiCarMgr::shared()->audio();
+		if(!_output_buffer.pull(frames))
+			continue;
 		
-		if(_mode	== AUX ){
-			audio->writeAudio(samples);
-		}
-		else if(_mode	== AIRPLAY ){
-			audio->writeAudio(samples);
-		}
-		else {
-			audio->writeIQ(samples);
+		// Drop the oldest audio when the queue is past the target.
+		size_t pcmLimit = pcmQueueLimit();
+		while(_output_buffer.queued_samples() > pcmLimit
+				&& _output_buffer.try_pull(frames)){
+			_pcmDropped++;
 		}
+		
+		publishLatency();
+		
+		AudioOutput*	 audio  = PiCarMgr::shared()->audio();
+		
+		audio->writeFrames(frames);
 	}
 	
  }
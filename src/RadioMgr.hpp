@@ -10,17 +10,28 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <mutex>
 #include <bitset>
+#include <queue>
+#include <map>
 #include <time.h>
 #include <unistd.h>
+#include <atomic>
 
 
 #include <sys/time.h>
 #include "RtlSdr.hpp"
+#include "IQFileSource.hpp"
 #include "SDRDecoder.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "BandSweep.hpp"
+#include "TunerAGC.hpp"
+#include "FmDecode.hpp"
+#include "NoiseSquelch.hpp"
 
-#include "DataBuffer.hpp"
+#include "SPSCRing.hpp"
+#include "PcmFrames.hpp"
 #include "ErrorMgr.hpp"
 #include "CommonDefs.hpp"
 #include "AudioLineInput.hpp"
@@ -28,6 +39,8 @@
 
 using namespace std;
 
+class Channelizer;
+
 
 class RadioMgr {
 	
@@ -58,17 +71,61 @@ public:
 	
 	bool begin(uint32_t deviceIndex  = 0, int  pcmrate = 48000);
 	bool begin(uint32_t deviceIndex, int  pcmrate,  int &error);
+	
+	/** Run from any IQ source, the caller keeps ownership. */
+	bool begin(IQSource* source, int  pcmrate);
+	
+	/** Run from a u8 or cf32 capture instead of the dongle, see IQFileSource. */
+	bool beginReplay(const string& path, int  pcmrate,  int &error);
+	IQFileSource* replaySource() {return &_fileSource;};
+	
 	void stop();
 	
+	/** Copy the live IQ stream to disk, format from the file extension. */
+	bool startRecording(const string& path, int &error);
+	void stopRecording();
+	bool isRecording();
+	
+	/** Band view of the tuned IQ, fed from SDRProcessor while enabled. */
+	SpectrumAnalyzer* spectrum() {return &_spectrum;};
+	
+	/** Look for the FM stations that can be heard here, see BandSweep.  The
+	 *  tuner is taken over for a few seconds and then goes back to whatever
+	 *  was playing.  Tuning or turning the radio off cancels the sweep. */
+	bool startBandSweep(BandSweep::completion_t cb);
+	void cancelBandSweep();
+	bool isSweeping() {return _sweeping;};
+	
 	bool isConnected() ;
 
 	bool getDeviceInfo(RtlSdr::device_info_t&);
 	
+	/** overrun and drop counters of the async IQ capture */
+	bool getSDRStats(RtlSdr::async_stats_t&);
+	
+	static constexpr int default_targetLatency = 250;	// ms
+	static constexpr int min_jitterBuffer 		= 20;		// ms
+
+	/** End to end audio latency target in ms, 0 for unbounded queues. */
+	void 	setTargetLatency(int ms);
+	int 	getTargetLatency() {return _targetLatency;};
+	
+	typedef struct {
+		double		iq_queue_ms;		// IQ waiting for SDRProcessor
+		double		pcm_queue_ms;		// audio waiting for OutputProcessor
+		double		latency_ms;			// sum of both
+		uint64_t		iq_dropped;			// IQ blocks dropped to hold the target
+		uint64_t		pcm_dropped;		// audio blocks dropped
+	} latency_stats_t;
+	
+	bool getLatencyStats(latency_stats_t&);
+	
 	static string freqSuffixString(double hz);
 	static string hertz_to_string(double hz, int precision = 1);
 	static string modeString(radio_mode_t);
 	static radio_mode_t stringToMode(string);
 	static string muxstring(radio_mux_t);
+	static string ptyString(int pty);
 	static bool freqRangeOfMode(radio_mode_t mode, uint32_t & minFreq,  uint32_t &maxFreq);
 
  	bool setON(bool);
@@ -105,6 +162,10 @@ public:
 	std::vector<int> getTunerGains();
 	bool setTunerGain(int);
 	int getTunerGain();
+	
+	/** Gain setting that hands the tuner to the software AGC, see TunerAGC. */
+	static constexpr int tunerGain_softwareAGC = INT_MIN + 1;
+	TunerAGC* tunerAGC() {return &_agc;};
 	 
 	uint32_t nextFrequency(bool up);
 	
@@ -113,30 +174,83 @@ public:
 	
 	bool hasAirplay();
 	
+	/** AM band input.  Either direct sampling on the Q branch, or an
+	 *  upconverter whose LO offset in Hz is added to the tuned frequency. */
+	void setAMDirectSampling(bool useDirect) {_amDirectSampling = useDirect;};
+	bool getAMDirectSampling() {return _amDirectSampling;};
+	void setUpconverterOffset(uint32_t hz) {_upconverterOffset = hz;};
+	uint32_t getUpconverterOffset() {return _upconverterOffset;};
+	
+	/** Quieting in dB the VHF noise squelch opens at, once the IF level
+	 *  is above the squelch level. */
+	void setSquelchSNR(double db);
+	double getSquelchSNR() {return _squelchSNR;};
+	
+	/** Run the FM and VHF front ends in Q15 fixed point, takes effect
+	 *  the next time the decoder is created. */
+	void setFixedPointDSP(bool useFixed) {_fixedPointDSP = useFixed;};
+	bool getFixedPointDSP() {return _fixedPointDSP;};
+	
+	/** Run the FM audio branches serially, fork-join or pipelined across
+	 *  cores, takes effect the next time an FM decoder is tuned. */
+	void setFMThreading(FmDecoder::threading_t mode) {_fmThreading = mode;};
+	FmDecoder::threading_t getFMThreading() {return _fmThreading;};
+	
 private:
 
 
 	bool					_isSetup;
  
-	RtlSdr				_sdr;
+	RtlSdr				_rtlsdr;
+	IQFileSource		_fileSource;
+	IQSource*			_sdr;
+	IQRecorder			_recorder;
+	SpectrumAnalyzer	_spectrum;
+	TunerAGC				_agc;
+	BandSweep			_sweep;
 	int					_pcmrate;
 	radio_mode_t 		_mode;
 	uint32_t				_frequency;
 	radio_mux_t 		_mux;
 	int					_squelchLevel;
+	double				_squelchSNR;
+	bool					_amDirectSampling;
+	uint32_t				_upconverterOffset;
+	bool					_fixedPointDSP;
+	FmDecoder::threading_t	_fmThreading;
 		
 	double				_IF_Level;
 	double 				_baseband_level;
 	
+	// RDS from the FM decoder, published to the db when it changes
+	unsigned int		_rdsUpdate;			// 0 forces the next publish
+	void publishRDS(const RdsDecoder& rds);
+	void clearRDS();
+	
 	bool					_isOn;
 	
 	bool 					_AGC_active;
+	bool					_useAsyncSDR;		// stream with rtlsdr_read_async
+	
+	atomic<int>			_targetLatency;	// ms, 0 = unbounded
+	atomic<uint64_t>	_iqDropped;
+	atomic<uint64_t>	_pcmDropped;
+	
+	size_t iqQueueLimit();
+	size_t pcmQueueLimit();
+	size_t pcmJitterFill();
+	double pcmFramesPerMs();
+	void   publishLatency();
 	 
-	// Create source data queue.
-	DataBuffer<IQSample> _source_buffer;
+	static constexpr size_t source_ring_blocks 	= 32;		// ~2 sec of IQ at 1 MHz
+	static constexpr size_t output_ring_blocks 	= 64;
+	static constexpr size_t output_block_capacity = 4096;	// frames
+
+	// Create source data queue.  SDRReader -> SDRProcessor
+	SPSCRing<IQSample> _source_buffer;
 	
-	// output data queue
-	DataBuffer<Sample>   _output_buffer;
+	// output data queue.  SDRProcessor, AuxReader or AirplayReader -> OutputProcessor
+	SPSCBlockRing<PcmFrames>   _output_buffer;
 
 
  	mutable std::mutex _mutex;		// when changing frequencies and modes.
@@ -149,6 +263,64 @@ private:
 	bool									_scannerMode;
 	bool									_scanningPaused;
  
+	// VHF/UHF scanner channels close enough to share one tuner setting.
+	// The channelizer checks all of them against the squelch from each
+	// block, the tuner only moves when the whole window is quiet.
+	typedef struct {
+		uint32_t			tunerFreq;
+		vector<uint>	channels;		// offsets into _scannerChannels, scan order
+	} scan_window_t;
+	
+	static constexpr double scan_window_span 	= 450.0e3;	// usable +/- Hz around the tuner
+	static constexpr double scan_dc_guard 		= 20.0e3;	// keep clear of the DC spike
+	static constexpr unsigned int scan_filter_order = 120;
+	static constexpr unsigned int scan_decimation 	= 20;
+	
+	vector<scan_window_t>		_scanWindows;
+	int								_currentWindow;		// -1 when not scanning a window
+	Channelizer*					_channelizer;
+	int								_windowSettle;		// blocks to skip after a retune
+	
+	// The VHF decoder's noise squelch, run on the channelizer output of
+	// the channels loud enough to open it.  Each channel's 0 dB point is
+	// noise through the channelizer filter of its bandwidth.
+	static constexpr double scan_sample_rate 	= RtlSdr::default_sampleRate / scan_decimation;
+	
+	PhaseDiscriminator			_windowDisc;
+	NoiseSquelch					_windowSquelch;
+	SampleVector					_windowBaseband;
+	vector<double>					_windowNoiseRef;		// per channel of the window
+	map<int, double>				_noiseRefCache;		// by IF bandwidth in Hz
+	
+	void buildScanWindows();
+	int  scanWindowFor(radio_mode_t mode, uint32_t freq);
+	double windowNoiseReference(double bandwidth_if);
+	int  openChannelInWindow(const IQSampleVector& iqsamples);
+	void switchScannerChannel(uint offset);
+ 
+	// Decoders are kept after use and retuned in place next time, keyed by
+	// mode and IF bandwidth.  _sdrDecoder points at one of these.
+	typedef pair<radio_mode_t, int> decoder_key_t;
+	map<decoder_key_t, SDRDecoder*>	_decoderCache;
+	
+	static double ifBandwidth(radio_mode_t mode, uint32_t freq);
+	SDRDecoder* makeDecoder(radio_mode_t mode, double tuning_offset, double bandwidth_if);
+	SDRDecoder* warmDecoder(radio_mode_t mode, uint32_t freq, double tuning_offset);
+	void flushDecoderCache();
+	
+	// Band sweep.  SDRProcessor skips the first block after each retune and
+	// hands the next one to _sweep, then moves on to the next window.
+	static constexpr int sweep_settle_blocks = 1;
+	
+	atomic<bool>		_sweeping;
+	bool					_sweepWasReading;		// restore _shouldReadSDR afterwards
+	uint32_t				_sweepWindow;			// tuner frequency being captured
+	int					_sweepSettle;
+	
+	bool tuneSweepWindow(uint32_t tunerFreq);
+	void sweepStep(IQSampleVector& iqsamples);
+	void endBandSweep(bool cancelled, bool restoreRadio);
+ 
 	bool setFrequencyandModeInternal(radio_mode_t, uint32_t freq = 0, bool force = false);
 
 	void queueSetFrequencyandMode(radio_mode_t, uint32_t freq = 0, bool force = false);
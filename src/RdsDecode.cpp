@@ -0,0 +1,502 @@
+//
+//  RdsDecode.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <bitset>
+
+#include "RdsDecode.hpp"
+
+using namespace std;
+
+
+/* ****************  block code  **************** */
+
+// Generator polynomial x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1.
+static const uint32_t rds_poly = 0x5B9;
+
+// Offset words A, B, C, D, C'.  The checkword of a good block is the
+// remainder of its data plus the offset word, so the syndrome of a good
+// block is the offset word itself.
+static const uint16_t rds_offset_word[] = { 0x0FC, 0x198, 0x168, 0x1B4, 0x350 };
+
+// The code corrects bursts of up to 5 bits, but at that length 40% of
+// random blocks would correct into something.  Up to 2 keeps the false
+// corrections near 5%.
+static const unsigned int rds_max_burst = 2;
+
+static uint32_t rds_burst_table[1 << 10];		// syndrome -> error pattern
+
+
+// Remainder of a 26 bit block by the generator polynomial.
+static uint16_t calc_syndrome(uint32_t block)
+{
+	 for (int i = 25; i >= 10; i--) {
+		  if (block & (1u << i))
+				block ^= rds_poly << (i - 10);
+	 }
+	 return uint16_t(block & 0x3FF);
+}
+
+
+// Error pattern for the syndrome of every correctable burst.
+static bool make_burst_table()
+{
+	 for (uint32_t burst = 1; burst < (1u << rds_max_burst); burst += 2) {
+		  unsigned int len = 32 - __builtin_clz(burst);
+		  for (unsigned int shift = 0; shift + len <= 26; shift++) {
+				uint32_t pattern = burst << shift;
+				rds_burst_table[calc_syndrome(pattern)] = pattern;
+		  }
+	 }
+	 return true;
+}
+
+static bool rds_burst_ready = make_burst_table();
+
+
+// Printable RDS characters, the basic set matches ASCII in this range.
+static inline char rds_char(unsigned int c)
+{
+	 return (c >= 0x20 && c < 0x7F) ? char(c) : ' ';
+}
+
+
+/* ****************  class RdsDecoder  **************** */
+
+// Two stages: down to ~50 kS/s with a short filter that only has to keep
+// the audio out of the alias bands, then the BPSK filter at ~25 kS/s.
+static unsigned int stage1_decimation(double sample_rate)
+{
+	 return max(1, int(sample_rate / 50000));
+}
+
+static unsigned int stage2_decimation(double sample_rate)
+{
+	 return max(1, int(sample_rate / stage1_decimation(sample_rate) / 24000));
+}
+
+
+template <class T>
+RdsDecoderT<T>::RdsDecoderT(double sample_rate)
+	 : m_sample_rate(sample_rate)
+
+	 , m_filter1(8 * stage1_decimation(sample_rate),
+					 8000 / sample_rate,
+					 stage1_decimation(sample_rate))
+
+	 // The L-R sideband ends 4 kHz below the subcarrier.
+	 , m_filter2(int(sample_rate / stage1_decimation(sample_rate) / 500),
+					 bandwidth * stage1_decimation(sample_rate) / sample_rate,
+					 stage2_decimation(sample_rate))
+
+	 // Two half symbols per bit.
+	 , m_clock_step(2 * bit_rate * stage1_decimation(sample_rate)
+						 * stage2_decimation(sample_rate) / sample_rate)
+
+	 , m_update_count(0)
+{
+	 (void) rds_burst_ready;
+	 reset();
+}
+
+
+template <class T>
+void RdsDecoderT<T>::reset()
+{
+	 m_carrier_sq    = 0;
+	 m_carrier_phase = 0;
+	 m_clock         = 0;
+	 m_last_sample   = 0;
+	 m_integrator    = 0;
+
+	 m_last_half     = 0;
+	 m_half_index    = 0;
+	 m_pair_level[0] = 0;
+	 m_pair_level[1] = 0;
+	 m_last_bit      = 0;
+
+	 m_register         = 0;
+	 m_bit_count        = 0;
+	 m_synced           = false;
+	 m_last_match_bit   = 0;
+	 m_last_match_block = -1;
+	 m_block_bits       = 0;
+	 m_expected_block   = OFFSET_A;
+	 m_error_history    = 0;
+	 m_block_count      = 0;
+	 m_block_errors     = 0;
+
+	 for (unsigned int i = 0; i < 4; i++) {
+		  m_group[i] = 0;
+		  m_group_valid[i] = false;
+	 }
+	 m_group_version_b = false;
+
+	 m_pi  = 0;
+	 m_pty = 0;
+	 m_pty_candidate = -1;
+	 m_tp  = false;
+	 m_ps.clear();
+	 m_ps_buf.assign(ps_length, ' ');
+	 m_ps_candidate.assign(ps_length, '\0');
+	 m_ps_segments = 0;
+	 m_rt.clear();
+	 m_rt_buf.assign(rt_length, ' ');
+	 m_rt_candidate.assign(rt_length, '\0');
+	 m_rt_segments  = 0;
+	 m_rt_ab        = -1;
+	 m_rt_version_b = false;
+
+	 m_update_count++;
+}
+
+
+template <class T>
+void RdsDecoderT<T>::process(const vector<T>& samples_baseband,
+									  const IQSampleVector& carrier)
+{
+	 if (samples_baseband.empty() || carrier.size() < samples_baseband.size())
+		  return;
+
+	 demod_bpsk(samples_baseband, carrier);
+}
+
+
+// Demodulate to half symbol values.
+template <class T>
+void RdsDecoderT<T>::demod_bpsk(const vector<T>& samples_baseband,
+										  const IQSampleVector& carrier)
+{
+	 unsigned int n = samples_baseband.size();
+
+	 // Mix the subcarrier down to zero.
+	 m_buf_mixed.resize(n);
+	 for (unsigned int i = 0; i < n; i++)
+		  m_buf_mixed[i] = carrier[i] * float(samples_baseband[i]);
+
+	 m_filter1.process(m_buf_mixed, m_buf_stage1);
+	 m_filter2.process(m_buf_stage1, m_buf_stage2);
+
+	 n = m_buf_stage2.size();
+	 if (n == 0)
+		  return;
+
+	 // The subcarrier keeps a fixed phase to the pilot harmonic, squaring
+	 // takes the BPSK off and leaves twice that phase.  Of the two answers
+	 // take the one next to the last, so the data does not flip sign.
+	 IQSample sq = 0;
+	 for (unsigned int i = 0; i < n; i++)
+		  sq += m_buf_stage2[i] * m_buf_stage2[i];
+	 m_carrier_sq = 0.7f * m_carrier_sq + 0.3f * sq / float(n);
+
+	 double phase = 0.5 * arg(m_carrier_sq);
+	 if (remainder(phase - m_carrier_phase, 2 * M_PI) > M_PI / 2
+		  || remainder(phase - m_carrier_phase, 2 * M_PI) < -M_PI / 2)
+		  phase += M_PI;
+	 m_carrier_phase = remainder(phase, 2 * M_PI);
+
+	 const IQSample rot = polar(1.0f, float(-m_carrier_phase));
+
+	 // Biphase symbols cross zero on half symbol boundaries, pull the
+	 // half symbol clock towards every crossing and integrate in between.
+	 const double timing_gain = 0.03;
+
+	 for (unsigned int i = 0; i < n; i++) {
+		  T x = real(m_buf_stage2[i] * rot);
+
+		  if ((x > 0) != (m_last_sample > 0)) {
+				double frac = m_last_sample / (m_last_sample - x);
+				double crossing = m_clock + frac * m_clock_step;
+				m_clock -= timing_gain * (crossing - floor(crossing + 0.5));
+		  }
+		  m_last_sample = x;
+
+		  m_clock += m_clock_step;
+		  if (m_clock >= 1.0) {
+				m_clock -= 1.0;
+				receive_half_symbol(m_integrator);
+				m_integrator = x;
+		  } else {
+				m_integrator += x;
+		  }
+	 }
+}
+
+
+// Pair half symbols into bits.
+template <class T>
+void RdsDecoderT<T>::receive_half_symbol(T value)
+{
+	 // The two halves of a biphase symbol always have opposite signs,
+	 // across a symbol boundary only half of the time.  Whichever
+	 // pairing has the larger mean difference is the symbol alignment.
+	 T diff = m_last_half - value;
+	 unsigned int phase = m_half_index & 1;
+
+	 m_pair_level[phase] = 0.98 * m_pair_level[phase] + 0.02 * fabs(diff);
+	 m_half_index++;
+	 m_last_half = value;
+
+	 unsigned int align = (m_pair_level[1] > m_pair_level[0]) ? 1 : 0;
+	 if (phase != align)
+		  return;
+
+	 // Differential decoding also takes care of the carrier sign.
+	 unsigned int bit = (diff > 0) ? 1 : 0;
+	 receive_bit(bit ^ m_last_bit);
+	 m_last_bit = bit;
+}
+
+
+// Shift one bit into the block register.
+template <class T>
+void RdsDecoderT<T>::receive_bit(unsigned int bit)
+{
+	 m_register = ((m_register << 1) | bit) & ((1u << block_bits) - 1);
+	 m_bit_count++;
+
+	 if (m_synced) {
+		  if (++m_block_bits == block_bits) {
+				m_block_bits = 0;
+				receive_block();
+		  }
+		  return;
+	 }
+
+	 // Look for two offset words the right number of blocks apart.
+	 uint16_t syndrome = calc_syndrome(m_register);
+
+	 for (unsigned int k = 0; k < NUM_OFFSETS; k++) {
+		  if (syndrome != rds_offset_word[k])
+				continue;
+
+		  int block = (k == OFFSET_CP) ? int(OFFSET_C) : int(k);
+
+		  if (m_last_match_block >= 0) {
+				unsigned int blocks = (block - m_last_match_block + 4) % 4;
+				if (blocks == 0)
+					 blocks = 4;
+
+				if (m_bit_count - m_last_match_bit == blocks * block_bits) {
+					 m_synced = true;
+					 m_expected_block = block;
+					 m_block_bits = 0;
+					 m_error_history = 0;
+					 for (unsigned int i = 0; i < 4; i++)
+						  m_group_valid[i] = false;
+
+					 receive_block();
+					 return;
+				}
+		  }
+
+		  m_last_match_bit = m_bit_count;
+		  m_last_match_block = block;
+		  break;
+	 }
+}
+
+
+// Check the block that just completed against the expected offset.
+template <class T>
+void RdsDecoderT<T>::receive_block()
+{
+	 unsigned int block = m_expected_block;
+	 uint32_t data = m_register;
+	 uint16_t syndrome = calc_syndrome(data);
+	 bool ok = false;
+	 bool version_b = false;
+
+	 if (syndrome == rds_offset_word[block]) {
+		  ok = true;
+	 } else if (block == OFFSET_C && syndrome == rds_offset_word[OFFSET_CP]) {
+		  ok = true;
+		  version_b = true;
+	 } else {
+		  uint32_t err = rds_burst_table[syndrome ^ rds_offset_word[block]];
+		  if (err == 0 && block == OFFSET_C) {
+				err = rds_burst_table[syndrome ^ rds_offset_word[OFFSET_CP]];
+				version_b = (err != 0);
+		  }
+		  if (err != 0) {
+				data ^= err;
+				ok = true;
+		  }
+	 }
+
+	 m_block_count++;
+	 if (!ok)
+		  m_block_errors++;
+
+	 // Too many bad blocks lately, hunt for the offsets again.
+	 m_error_history = (m_error_history << 1) | (ok ? 0 : 1);
+	 bitset<64> recent(m_error_history & ((uint64_t(1) << sync_window) - 1));
+	 if (recent.count() > sync_lost) {
+		  m_synced = false;
+		  m_last_match_block = -1;
+		  return;
+	 }
+
+	 if (block == OFFSET_A) {
+		  for (unsigned int i = 0; i < 4; i++)
+				m_group_valid[i] = false;
+	 }
+
+	 m_group[block] = uint16_t(data >> 10);
+	 m_group_valid[block] = ok;
+	 if (block == OFFSET_C)
+		  m_group_version_b = version_b;
+
+	 m_expected_block = (block + 1) % 4;
+
+	 if (block == OFFSET_D)
+		  decode_group();
+}
+
+
+// Decode a complete group.
+template <class T>
+void RdsDecoderT<T>::decode_group()
+{
+	 const uint16_t* g = m_group;
+	 const bool* valid = m_group_valid;
+
+	 if (valid[OFFSET_A])
+		  m_pi = g[OFFSET_A];
+	 else if (valid[OFFSET_C] && m_group_version_b)
+		  m_pi = g[OFFSET_C];
+
+	 if (!valid[OFFSET_B])
+		  return;
+
+	 unsigned int group_type = g[OFFSET_B] >> 12;
+	 bool version_b = (g[OFFSET_B] >> 11) & 1;
+
+	 m_tp = (g[OFFSET_B] >> 10) & 1;
+
+	 // Block B decides what the rest of the group is, so everything taken
+	 // from a group is confirmed by a second one before it is shown.
+	 int pty = (g[OFFSET_B] >> 5) & 0x1F;
+	 if (pty == m_pty_candidate && pty != m_pty) {
+		  m_pty = pty;
+		  m_update_count++;
+	 }
+	 m_pty_candidate = pty;
+
+	 if (group_type == 0 && valid[OFFSET_D]) {
+
+		  // Station name, two characters per group.
+		  unsigned int addr = g[OFFSET_B] & 0x3;
+		  unsigned int c[2] = { unsigned(g[OFFSET_D] >> 8), unsigned(g[OFFSET_D] & 0xFF) };
+		  if (!confirm_segment(m_ps_candidate, m_ps_buf, 2 * addr, c, 2))
+				return;
+		  m_ps_segments |= 1u << addr;
+
+		  if (m_ps_segments == 0xF) {
+				m_ps_segments = 0;
+				if (m_ps_buf != m_ps) {
+					 m_ps = m_ps_buf;
+					 m_update_count++;
+				}
+		  }
+
+	 } else if (group_type == 2) {
+
+		  // Radiotext, 4 characters per 2A group or 2 per 2B group.
+		  // The A/B flag toggles when a new message starts.
+		  int ab = (g[OFFSET_B] >> 4) & 1;
+		  if (ab != m_rt_ab || version_b != m_rt_version_b) {
+				m_rt_buf.assign(rt_length, ' ');
+				m_rt_candidate.assign(rt_length, '\0');
+				m_rt_segments = 0;
+				m_rt_ab = ab;
+				m_rt_version_b = version_b;
+		  }
+
+		  unsigned int addr = g[OFFSET_B] & 0xF;
+		  unsigned int c[4];
+		  unsigned int count = 0;
+
+		  if (!version_b && valid[OFFSET_C] && valid[OFFSET_D]) {
+				c[count++] = g[OFFSET_C] >> 8;
+				c[count++] = g[OFFSET_C] & 0xFF;
+		  }
+		  if (valid[OFFSET_D] && (version_b || count > 0)) {
+				c[count++] = g[OFFSET_D] >> 8;
+				c[count++] = g[OFFSET_D] & 0xFF;
+		  }
+		  if (count == 0)
+				return;
+
+		  if (!confirm_segment(m_rt_candidate, m_rt_buf, addr * count, c, count))
+				return;
+		  m_rt_segments |= 1u << addr;
+
+		  update_radiotext();
+	 }
+}
+
+
+// Characters of a segment go into buf when they match the ones received
+// last time at the same place, otherwise they wait in candidate.
+template <class T>
+bool RdsDecoderT<T>::confirm_segment(string& candidate, string& buf,
+												 unsigned int pos, const unsigned int* c,
+												 unsigned int count)
+{
+	 bool confirmed = true;
+
+	 for (unsigned int i = 0; i < count; i++) {
+		  char ch = (c[i] == 0x0D) ? '\r' : rds_char(c[i]);
+		  if (candidate[pos + i] != ch) {
+				candidate[pos + i] = ch;
+				confirmed = false;
+		  }
+	 }
+
+	 if (confirmed) {
+		  for (unsigned int i = 0; i < count; i++)
+				buf[pos + i] = candidate[pos + i];
+	 }
+
+	 return confirmed;
+}
+
+
+// Publish the radiotext once every segment up to its end is in.
+template <class T>
+void RdsDecoderT<T>::update_radiotext()
+{
+	 unsigned int seg_chars = m_rt_version_b ? 2 : 4;
+	 unsigned int length = seg_chars * 16;
+
+	 size_t end = m_rt_buf.find('\r');
+	 if (end == string::npos || end > length)
+		  end = length;
+
+	 unsigned int segments = (end == length) ? 16 : end / seg_chars + 1;
+	 uint32_t needed = (segments >= 32) ? 0xFFFFFFFF : ((1u << segments) - 1);
+	 if ((m_rt_segments & needed) != needed)
+		  return;
+
+	 string text = m_rt_buf.substr(0, end);
+	 size_t last = text.find_last_not_of(' ');
+	 text.erase(last == string::npos ? 0 : last + 1);
+
+	 if (!text.empty() && text != m_rt) {
+		  m_rt = text;
+		  m_update_count++;
+	 }
+}
+
+
+/* ****************  instantiations  **************** */
+
+template class RdsDecoderT<float>;
+template class RdsDecoderT<double>;
+
+/* end */
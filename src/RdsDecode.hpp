@@ -0,0 +1,174 @@
+//
+//  RdsDecode.hpp
+//  carradio
+//
+//  RDS / RBDS data from the 57 kHz subcarrier of a broadcast FM station.
+//
+//  The subcarrier is the third harmonic of the stereo pilot, so FmDecoder
+//  has its PilotPhaseLock hand over a locked 57 kHz phasor and this stage
+//  only has to mix the baseband down with it.  Two decimating filters take
+//  the BPSK signal to about 25 kS/s, the residual carrier phase comes from
+//  the squared signal, and a zero crossing timing loop integrates the
+//  biphase half symbols.  Pairs of half symbols give the differentially
+//  coded bits, then 26 bit blocks are synced on their offset words and
+//  short burst errors are corrected once in sync.
+//
+//  Groups 0A/0B (station name) and 2A/2B (radiotext) are decoded, along
+//  with the PI code and program type carried in every group.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "IQSample.h"
+#include "Filter.hpp"
+
+
+/** RDS demodulator and group decoder. */
+template <class T>
+class RdsDecoderT
+{
+public:
+
+	 static constexpr double subcarrier_freq = 57000;
+	 static constexpr double bit_rate        = 1187.5;	// 57000 / 48
+	 static constexpr double bandwidth       = 2400;		// half bandwidth of the BPSK
+
+	 static constexpr unsigned int ps_length = 8;
+	 static constexpr unsigned int rt_length = 64;
+
+	 /**
+	  * Construct RDS decoder.
+	  *
+	  * sample_rate :: Baseband (FM demodulator output) sample rate in Hz.
+	  */
+	 RdsDecoderT(double sample_rate);
+
+	 /**
+	  * Process a block of baseband samples.
+	  *
+	  * carrier :: Conjugate 57 kHz phasor locked to the pilot, one per
+	  *            baseband sample, see PilotPhaseLock::set_third_harmonic().
+	  */
+	 void process(const std::vector<T>& samples_baseband,
+					  const IQSampleVector& carrier);
+
+	 /** Forget the station, for a retune. */
+	 void reset();
+
+	 /** Return true while blocks are in sync. */
+	 bool synced() const { return m_synced; }
+
+	 /** Incremented whenever the station name, radiotext or PTY change. */
+	 unsigned int get_update_count() const { return m_update_count; }
+
+	 /** Program identification, 0 until received. */
+	 std::uint16_t get_pi() const { return m_pi; }
+
+	 /** Program type 0 .. 31, 0 is none. */
+	 int get_pty() const { return m_pty; }
+
+	 /** Traffic program flag. */
+	 bool get_tp() const { return m_tp; }
+
+	 /** Station name, empty until all four segments have been received. */
+	 const std::string& get_ps() const { return m_ps; }
+
+	 /** Radiotext, empty until a complete message has been received. */
+	 const std::string& get_radiotext() const { return m_rt; }
+
+	 /** Blocks received in sync, and of those the ones that could not be corrected. */
+	 std::uint64_t get_block_count() const { return m_block_count; }
+	 std::uint64_t get_block_errors() const { return m_block_errors; }
+
+private:
+
+	 /** Offset words, in the order the blocks are sent.  C' replaces C in version B groups. */
+	 enum { OFFSET_A = 0, OFFSET_B, OFFSET_C, OFFSET_D, OFFSET_CP, NUM_OFFSETS };
+
+	 static constexpr unsigned int block_bits   = 26;
+	 static constexpr unsigned int sync_window  = 50;	// blocks watched for errors
+	 static constexpr unsigned int sync_lost    = 20;	// bad blocks in the window to drop sync
+
+	 /** Demodulate to half symbol values. */
+	 void demod_bpsk(const std::vector<T>& samples_baseband,
+						  const IQSampleVector& carrier);
+
+	 /** Pair half symbols into bits. */
+	 void receive_half_symbol(T value);
+
+	 /** Shift one differentially decoded bit into the block register. */
+	 void receive_bit(unsigned int bit);
+
+	 /** Check the block that just completed against the expected offset. */
+	 void receive_block();
+
+	 /** Decode a complete group. */
+	 void decode_group();
+
+	 /** Take characters into buf once received the same twice. */
+	 static bool confirm_segment(std::string& candidate, std::string& buf,
+										  unsigned int pos, const unsigned int* c,
+										  unsigned int count);
+
+	 /** Publish the radiotext once every segment up to its end is in. */
+	 void update_radiotext();
+
+	 // Demodulator.
+	 const double           m_sample_rate;
+	 IQSampleVector         m_buf_mixed;
+	 IQSampleVector         m_buf_stage1;
+	 IQSampleVector         m_buf_stage2;
+	 DecimatingFilterFirIQ  m_filter1;
+	 DecimatingFilterFirIQ  m_filter2;
+	 IQSample               m_carrier_sq;		// smoothed square of the subcarrier
+	 double                 m_carrier_phase;
+	 double                 m_clock;			// half symbol phase 0 .. 1
+	 double                 m_clock_step;
+	 T                      m_last_sample;
+	 T                      m_integrator;
+
+	 // Symbols and bits.
+	 T                      m_last_half;
+	 unsigned int           m_half_index;
+	 double                 m_pair_level[2];	// mean |a - b| for both alignments
+	 unsigned int           m_last_bit;
+
+	 // Block sync.
+	 std::uint32_t          m_register;
+	 std::uint64_t          m_bit_count;
+	 bool                   m_synced;
+	 std::uint64_t          m_last_match_bit;
+	 int                    m_last_match_block;
+	 unsigned int           m_block_bits;
+	 unsigned int           m_expected_block;
+	 std::uint64_t          m_error_history;
+	 std::uint64_t          m_block_count;
+	 std::uint64_t          m_block_errors;
+
+	 // Group being assembled.
+	 std::uint16_t          m_group[4];
+	 bool                   m_group_valid[4];
+	 bool                   m_group_version_b;
+
+	 // Decoded data.
+	 unsigned int           m_update_count;
+	 std::uint16_t          m_pi;
+	 int                    m_pty;
+	 int                    m_pty_candidate;
+	 bool                   m_tp;
+	 std::string            m_ps;
+	 std::string            m_ps_buf;
+	 std::string            m_ps_candidate;
+	 unsigned int           m_ps_segments;
+	 std::string            m_rt;
+	 std::string            m_rt_buf;
+	 std::string            m_rt_candidate;
+	 std::uint32_t          m_rt_segments;
+	 int                    m_rt_ab;
+	 bool                   m_rt_version_b;
+};
+
+typedef RdsDecoderT<Sample> RdsDecoder;
@@ -6,8 +6,10 @@
 //
 #include <climits>
 #include <cstring>
+#include <unistd.h>
  
 #include "RtlSdr.hpp"
+#include "IQConvert.hpp"
 
 
 // MARK: -   RtlSdr
@@ -16,7 +18,14 @@ RtlSdr::RtlSdr(){
 	_isSetup = false;
 	_dev = NULL;
 	_blockLength = default_blockLength;
+	_directSampling = DIRECT_SAMPLING_OFF;
 	
+	_asyncRunning = false;
+	_asyncStarted = false;
+	_ringHead = 0;
+	_ringTail = 0;
+	_ringCount = 0;
+	_asyncStats = {0,0,0};
 }
 
 RtlSdr::~RtlSdr(){
@@ -35,13 +44,17 @@ bool RtlSdr::begin(uint32_t dev_index,  int &error){
 	else {
 		_isSetup = true;
 		_devIndex = dev_index;
+		_directSampling = DIRECT_SAMPLING_OFF;
 		success = true;
 	}
 	return success;
 }
 
 void RtlSdr::stop(){
+	stopAsync();
+	
 	if(_isSetup){
+		lock_guard<recursive_mutex> lock(_devMutex);
 		rtlsdr_close(_dev);
 	};
 	
@@ -60,6 +73,7 @@ void RtlSdr::stop(){
 // Return current sample frequency in Hz.
 uint32_t RtlSdr::getSampleRate()
 {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 return rtlsdr_get_sample_rate(_dev);
 }
 
@@ -67,6 +81,7 @@ uint32_t RtlSdr::getSampleRate()
 // Return current center frequency in Hz.
 uint32_t RtlSdr::getFrequency()
 {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 return rtlsdr_get_center_freq(_dev);
 }
 
@@ -74,6 +89,7 @@ uint32_t RtlSdr::getFrequency()
 // Return current tuner gain in units of 0.1 dB.
 int RtlSdr::getTunerGain()
 {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 return rtlsdr_get_tuner_gain(_dev);
 }
 
@@ -81,6 +97,7 @@ int RtlSdr::getTunerGain()
 // Return a list of supported tuner gain settings in units of 0.1 dB.
 vector<int> RtlSdr::getTunerGains()
 {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 int num_gains = rtlsdr_get_tuner_gains(_dev, NULL);
 	 if (num_gains <= 0)
 		  return vector<int>();
@@ -94,6 +111,7 @@ vector<int> RtlSdr::getTunerGains()
 
 // set tuner gain in units of 0.1 dB.
 bool RtlSdr::setTunerGain(int tuner_gain){
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	int r;
@@ -138,6 +156,7 @@ bool RtlSdr::setTunerGain(int tuner_gain){
 //	Enable or disable offset tuning for zero-IF tuners, which allows to avoid
 // problems caused by the DC offset of the ADCs and 1/f noise.
 bool RtlSdr::setOffsetTuning(bool on){
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 
 	int r;
 	r = rtlsdr_set_offset_tuning(_dev, on?1:0);
@@ -152,6 +171,7 @@ bool RtlSdr::setOffsetTuning(bool on){
 
 // set RTL AGC mode
 bool RtlSdr::setACGMode(bool agcmode) {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	int r;
@@ -174,6 +194,7 @@ bool RtlSdr::setACGMode(bool agcmode) {
 
 // Enable or disable the bias tee
 bool RtlSdr::setBiasTee(bool mode){
+	lock_guard<recursive_mutex> lock(_devMutex);
 	 
 	if (!_isSetup ||  !_dev)
 		 return false;
@@ -183,8 +204,28 @@ bool RtlSdr::setBiasTee(bool mode){
  	return (r == 0) ;
 };
 
+
+bool RtlSdr::setDirectSampling(direct_sampling_t mode){
+	lock_guard<recursive_mutex> lock(_devMutex);
+	
+	if (!_isSetup ||  !_dev)
+		 return false;
+	
+	if(mode == _directSampling)
+		return true;
+	
+	int r = rtlsdr_set_direct_sampling(_dev, int(mode));
+	if (r < 0) {
+		throw Exception("rtlsdr_set_direct_sampling failed");
+	}
+	
+	_directSampling = mode;
+	return true;
+}
+
  
 bool RtlSdr::setFrequency(uint32_t frequency) {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	int r;
@@ -203,6 +244,7 @@ bool RtlSdr::setFrequency(uint32_t frequency) {
 }
 
 bool RtlSdr::setSampleRate(uint32_t sample_rate) {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	int r;
@@ -221,6 +263,7 @@ bool RtlSdr::setSampleRate(uint32_t sample_rate) {
 }
 
 bool RtlSdr::resetBuffer() {
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	int r;
@@ -228,6 +271,13 @@ bool RtlSdr::resetBuffer() {
 	if (!_isSetup ||  !_dev)
 		 return false;
 
+	// the device buffer can not be reset while streaming,
+	// just throw away whatever is queued in the ring.
+	if(_asyncRunning){
+		flushRing();
+		return true;
+	}
+	
 	r = rtlsdr_reset_buffer(_dev);
 	if (r < 0) {
 		throw Exception("rtlsdr_reset_buffer failed ");
@@ -249,9 +299,32 @@ bool RtlSdr::getSamples(IQSampleVector& samples)
 	 if (!_isSetup ||  !_dev)
 		  return false;
 
-	 vector<uint8_t> buf(2 * _blockLength);
+	 if(_asyncRunning){
+		 unique_lock<mutex> lock(_ringMutex);
+		 
+		 if(_ringCount == 0)
+			 _ringCond.wait_for(lock, chrono::seconds(1));
+		 
+		 if(_ringCount == 0)
+			 return false;
+		 
+		 // hand the filled block to the caller and keep the caller's
+		 // storage in the ring for the next transfer.
+		 samples.swap(_ring[_ringTail]);
+		 
+		 // the callback must not allocate, so whatever came back gets its
+		 // capacity here on the consumer's thread.
+		 if(_ring[_ringTail].capacity() < (size_t) _blockLength)
+			 _ring[_ringTail].reserve(_blockLength);
+		 
+		 _ringTail = (_ringTail + 1) % _ring.size();
+		 _ringCount--;
+		 return true;
+	 }
+	
+	 _syncbuf.resize(2 * _blockLength);
 
-	 r = rtlsdr_read_sync(_dev, buf.data(), 2 * _blockLength, &n_read);
+	 r = rtlsdr_read_sync(_dev, _syncbuf.data(), 2 * _blockLength, &n_read);
 	 if (r < 0) {
 		 fprintf(stderr, "rtlsdr_read_sync failed\n");
  		  return false;
@@ -263,16 +336,151 @@ bool RtlSdr::getSamples(IQSampleVector& samples)
 	 }
 
 	 samples.resize(_blockLength);
-	 for (int i = 0; i < _blockLength; i++) {
-		  int32_t re = buf[2*i];
-		  int32_t im = buf[2*i+1];
-		  samples[i] = IQSample( (re - 128) / IQSample::value_type(128),
-										 (im - 128) / IQSample::value_type(128) );
-	 }
+	 IQConvert::u8ToIQ(_syncbuf.data(), samples.data(), _blockLength);
 
 	 return true;
 }
 
+// MARK: -   Async capture
+
+bool RtlSdr::startAsync(int nblocks){
+	
+	if (!_isSetup ||  !_dev)
+		 return false;
+
+	if(_asyncRunning)
+		return true;
+	
+	// the reader gave up on its own last time, collect it first
+	if(_asyncStarted){
+		pthread_join(_asyncTID, NULL);
+		_asyncStarted = false;
+	}
+	
+	if(nblocks < 2)
+		nblocks = 2;
+	
+	// preallocate the ring, this is the only place we allocate sample storage
+	_ring.resize(nblocks);
+	for(auto &blk : _ring){
+		blk.reserve(_blockLength);
+	}
+	
+	_ringHead = 0;
+	_ringTail = 0;
+	_ringCount = 0;
+	_asyncStats = {0,0,0};
+	
+	{
+		lock_guard<recursive_mutex> lock(_devMutex);
+		if(rtlsdr_reset_buffer(_dev) < 0)
+			return false;
+	}
+	
+	_asyncRunning = true;
+	
+	if(pthread_create(&_asyncTID, NULL, &RtlSdr::AsyncReaderThread, (void*)this) != 0){
+		_asyncRunning = false;
+		return false;
+	}
+	
+	_asyncStarted = true;
+	return true;
+}
+
+void RtlSdr::stopAsync(){
+	
+	// the reader may have stopped itself on an error, it still needs the join
+	if(!_asyncStarted)
+		return;
+	
+	if(_asyncRunning){
+		_asyncRunning = false;
+		rtlsdr_cancel_async(_dev);
+	}
+	pthread_join(_asyncTID, NULL);
+	_asyncStarted = false;
+	
+	flushRing();
+	_ringCond.notify_all();
+}
+
+RtlSdr::async_stats_t RtlSdr::getAsyncStats(){
+	lock_guard<mutex> lock(_ringMutex);
+	return _asyncStats;
+}
+
+void RtlSdr::flushRing(){
+	lock_guard<mutex> lock(_ringMutex);
+	_ringTail = _ringHead;
+	_ringCount = 0;
+}
+
+void* RtlSdr::AsyncReaderThread(void *context){
+	RtlSdr* d = (RtlSdr*)context;
+	
+	PRINT_CLASS_TID;
+	
+	// blocks until rtlsdr_cancel_async() is called
+	int r = rtlsdr_read_async(d->_dev, &RtlSdr::asyncCallbackWrapper, context,
+									  0,  // default number of USB transfers
+									  2 * d->_blockLength);
+	if(r < 0){
+		fprintf(stderr, "rtlsdr_read_async failed (%d)\n", r);
+	}
+	
+	d->_asyncRunning = false;
+	d->_ringCond.notify_all();
+	return NULL;
+}
+
+void RtlSdr::asyncCallbackWrapper(unsigned char *buf, uint32_t len, void *ctx){
+	RtlSdr* d = (RtlSdr*)ctx;
+	d->asyncCallback(buf, len);
+}
+
+// called on the libusb thread, must not block or allocate.
+void RtlSdr::asyncCallback(unsigned char *buf, uint32_t len){
+	
+	if(!_asyncRunning)
+		return;
+	
+	if(len != (uint32_t) 2 * _blockLength){
+		lock_guard<mutex> lock(_ringMutex);
+		_asyncStats.drops++;
+		return;
+	}
+	
+	IQSampleVector* blk = NULL;
+	{
+		lock_guard<mutex> lock(_ringMutex);
+		if(_ringCount == _ring.size()){
+			// consumer is too slow, drop this transfer
+			_asyncStats.overruns++;
+			return;
+		}
+		blk = &_ring[_ringHead];
+		
+		// getSamples() reserves every block it hands back, never grow one here
+		if(blk->capacity() < (size_t) _blockLength){
+			_asyncStats.drops++;
+			return;
+		}
+	}
+	
+	// the slot at _ringHead is not visible to the reader until _ringCount is bumped.
+	IQSampleVector& samples = *blk;
+	samples.resize(_blockLength);
+	IQConvert::u8ToIQ(buf, samples.data(), _blockLength);
+	
+	{
+		lock_guard<mutex> lock(_ringMutex);
+		_ringHead = (_ringHead + 1) % _ring.size();
+		_ringCount++;
+		_asyncStats.blocks++;
+	}
+	_ringCond.notify_one();
+}
 
 
 //
@@ -342,6 +550,7 @@ bool RtlSdr::getSamples(IQSampleVector& samples)
 //}
 
 bool RtlSdr::getDeviceInfo(device_info_t& info){
+	lock_guard<recursive_mutex> lock(_devMutex);
 	
 	bool success = false;
 	
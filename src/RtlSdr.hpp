@@ -14,73 +14,74 @@
 #include <string>
 #include <vector>
 #include <complex>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <pthread.h>
 
 #include "IQSample.h"
+#include "IQSource.hpp"
 #include "CommonDefs.hpp"
 #include "rtl-sdr.h"
 
 using namespace std;
 
 
-typedef std::complex<float> IQSample;
-typedef std::vector<IQSample> IQSampleVector;
-
-class RtlSdr
+class RtlSdr : public IQSource
 {
 public:
-	typedef struct  {
-		uint32_t index;
-		string 	name;
-		string   vendor;
-		string   product;
-		string   serial;
-	} device_info_t;
 	
 	static constexpr int 	default_blockLength = 65536;
 	static constexpr double default_sampleRate = 1.0e6;
+	static constexpr int 	default_asyncBlocks = 16;
 	
 	RtlSdr();
 	~RtlSdr();
 	
 	bool begin(uint32_t index, int &error);
-	void stop();
+	void stop() override;
 	
-	bool getDeviceInfo(device_info_t&);
+	bool getDeviceInfo(device_info_t&) override;
 	
 	/** Set center frequency in Hz. */
-	bool setFrequency(uint32_t);
+	bool setFrequency(uint32_t) override;
 	
 	/** Return current center frequency in Hz. */
-	uint32_t getFrequency();
+	uint32_t getFrequency() override;
 	
 	//Set the sample rate for the device, also selects the baseband filters
 	// according to the requested sample rate for tuners where this is possible.
-	bool setSampleRate(uint32_t);
+	bool setSampleRate(uint32_t) override;
 	
 	/** Return current sample frequency in Hz. */
-	uint32_t getSampleRate();
+	uint32_t getSampleRate() override;
 	
 	/** Return current tuner gain in units of 0.1 dB. */
-	int getTunerGain();
+	int getTunerGain() override;
 	
 	/** Return a list of supported tuner gain settings in units of 0.1 dB. */
-	std::vector<int> getTunerGains();
+	std::vector<int> getTunerGains() override;
 	
 	// set tuner gain in units of 0.1 dB.
-	bool setTunerGain(int);
+	bool setTunerGain(int) override;
 	
 	//	Enable or disable offset tuning for zero-IF tuners, which allows to avoid
 	// problems caused by the DC offset of the ADCs and 1/f noise.
-	bool setOffsetTuning(bool);
+	bool setOffsetTuning(bool) override;
 	
 	// set RTL AGC mode
-	bool setACGMode(bool);
+	bool setACGMode(bool) override;
 	 
 	// Enable or disable the bias tee
-	bool setBiasTee(bool);
+	bool setBiasTee(bool) override;
+	
+	// Feed an ADC branch straight from the antenna, bypassing the tuner.
+	// This is how the AM band is received without an upconverter.
+	bool setDirectSampling(direct_sampling_t) override;
+	direct_sampling_t getDirectSampling() override {return _directSampling;};
  
 	// reset buffer to start streaming
-	bool resetBuffer();
+	bool resetBuffer() override;
 	
 	/**
 	 * Fetch a bunch of samples from the device.
@@ -88,7 +89,20 @@ public:
 	 * This function must be called regularly to maintain streaming.
 	 * Return true for success, false if an error occurred.
 	 */
-	bool getSamples(IQSampleVector& samples);
+	bool getSamples(IQSampleVector& samples) override;
+	
+	/**
+	 * Start streaming with rtlsdr_read_async into a fixed ring of
+	 * preallocated blocks.  Once started getSamples() hands out ring blocks
+	 * by swapping storage with the caller's vector, so nothing is allocated
+	 * as long as the caller passes back a vector of the same capacity.
+	 */
+	bool startAsync(int nblocks);
+	bool startAsync() override {return startAsync(default_asyncBlocks);};
+	void stopAsync() override;
+	bool isAsync() override {return _asyncRunning;};
+	
+	async_stats_t getAsyncStats() override;
 	
 	
 	//	/**
@@ -121,6 +135,29 @@ private:
 	struct rtlsdr_dev * 	_dev;
 	uint32_t 				_devIndex;
 	int       				_blockLength;
-	
-	
+	direct_sampling_t		_directSampling;
+	
+	vector<uint8_t>		_syncbuf;
+	
+	// Tuner control goes over the RTL's I2C repeater in several transfers.
+	// The AGC thread, the channel manager and the band sweep all tune, so
+	// every control call holds this to keep their sequences apart.
+	recursive_mutex		_devMutex;
+	
+	// async capture ring
+	atomic<bool>				_asyncRunning;
+	bool							_asyncStarted;		// _asyncTID still needs a join
+	pthread_t					_asyncTID;
+	vector<IQSampleVector>	_ring;
+	size_t						_ringHead;		// next block the callback fills
+	size_t						_ringTail;		// next block handed to getSamples
+	size_t						_ringCount;
+	mutex							_ringMutex;
+	condition_variable		_ringCond;
+	async_stats_t				_asyncStats;
+	
+	void flushRing();
+	void asyncCallback(unsigned char *buf, uint32_t len);
+	static void asyncCallbackWrapper(unsigned char *buf, uint32_t len, void *ctx);
+	static void* AsyncReaderThread(void *context);
 };
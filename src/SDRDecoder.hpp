@@ -11,17 +11,19 @@
 #include <vector>
 #include "IQSample.h"
 
-class SDRDecoder {
+/** Decoder interface, templated on the audio sample type. */
+template <class T>
+class SDRDecoderT {
   
 public:
 
 	/** Destructor.
 	 *  Virtual to allow for subclassing.
 	 */
-	virtual ~SDRDecoder() {};
+	virtual ~SDRDecoderT() {};
 	
  	virtual void process(const IQSampleVector& samples_in,
-								SampleVector& audio) = 0;
+								std::vector<T>& audio) = 0;
 
 	virtual  double get_if_level()  const = 0;
 	
@@ -33,6 +35,16 @@ public:
  
 	virtual void 	set_squelch_level(int level)  = 0;
 	
+	/** How long the squelch stays open after the signal drops, in ms. */
 	virtual void 	set_squelch_dwell(uint count)  = 0;
  
+	/** Move to another station, tuning offset and IF half bandwidth in Hz
+	 *  as given to the constructor.  Buffers are kept, the coefficients
+	 *  are redone and the filter history and per station state cleared,
+	 *  so the audio starts as on a new decoder.
+	 */
+	virtual void 	retune(double tuning_offset, double bandwidth_if) = 0;
+ 
 };
+
+typedef SDRDecoderT<Sample> SDRDecoder;
@@ -0,0 +1,290 @@
+//
+//  SPSCRing.hpp
+//  carradio
+//
+//  Bounded single producer / single consumer queue of sample blocks.
+//
+//  The ring owns a fixed number of slots, each holding a vector that was
+//  reserved once at construction.  Blocks move by swapping vectors with a
+//  slot, so the producer gets back the storage of a block the consumer has
+//  finished with and nothing is allocated in steady state.  The hot path is
+//  two atomic index updates, the mutex is only touched to wake a consumer
+//  that went to sleep on an empty ring.
+//
+//  A block is normally a vector of samples, but any type with size(),
+//  empty(), clear() and reserve() will do, such as PcmFrames which carries
+//  its format along.  The queue length is counted in whatever size()
+//  returns.
+//
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+template <class Block>
+class SPSCBlockRing
+{
+public:
+
+	 /**
+	  * Construct ring.
+	  *
+	  * nblocks        :: Number of slots, rounded up to a power of two.
+	  * block_capacity :: Samples reserved per slot.  Larger blocks still
+	  *                   work, the slot just grows once.
+	  */
+	 SPSCBlockRing(size_t nblocks, size_t block_capacity)
+		  : m_head(0)
+		  , m_tail(0)
+		  , m_qlen(0)
+		  , m_end_marked(false)
+		  , m_flush_request(false)
+		  , m_consumer_waiting(false)
+		  , m_high_water(0)
+		  , m_drops(0)
+		  , m_dropped_samples(0)
+	 {
+		  size_t n = 1;
+		  while (n < nblocks)
+				n <<= 1;
+		  m_mask = n - 1;
+		  m_slots.resize(n);
+		  for (auto& s : m_slots)
+				s.reserve(block_capacity);
+		  m_producer_busy.clear();
+	 }
+
+	 // MARK: - producer side
+
+	 /**
+	  * Add a block to the ring and hand back recycled storage in its place.
+	  * The returned vector is empty but keeps its capacity.
+	  *
+	  * Returns false and counts a drop when the ring is full; samples is
+	  * then cleared and can be refilled.  Only one producer may push at a
+	  * time, a push that races another producer is dropped rather than
+	  * corrupting the ring (this happens briefly when the radio switches
+	  * between AUX, AirPlay and SDR).
+	  */
+	 bool push(Block& samples)
+	 {
+		  if (samples.empty())
+				return true;
+
+		  if (m_producer_busy.test_and_set(memory_order_acquire)) {
+				drop(samples);
+				return false;
+		  }
+
+		  size_t head = m_head.load(memory_order_relaxed);
+		  size_t tail = m_tail.load(memory_order_acquire);
+
+		  if (head - tail > m_mask) {
+				m_producer_busy.clear(memory_order_release);
+				drop(samples);
+				return false;
+		  }
+
+		  size_t n = samples.size();
+		  swap(samples, m_slots[head & m_mask]);
+		  samples.clear();
+
+		  size_t qlen = m_qlen.fetch_add(n, memory_order_relaxed) + n;
+		  if (qlen > m_high_water.load(memory_order_relaxed))
+				m_high_water.store(qlen, memory_order_relaxed);
+
+		  m_head.store(head + 1, memory_order_seq_cst);
+		  m_producer_busy.clear(memory_order_release);
+
+		  wake_consumer();
+		  return true;
+	 }
+
+	 /** Mark the end of the data stream. */
+	 void push_end()
+	 {
+		  m_end_marked.store(true, memory_order_seq_cst);
+		  wake_consumer();
+	 }
+
+	 // MARK: - consumer side
+
+	 /**
+	  * Swap the oldest block into samples, returning the previous contents
+	  * of samples to the ring for reuse.  Returns false if the ring is empty.
+	  */
+	 bool try_pull(Block& samples)
+	 {
+		  handle_flush();
+
+		  size_t tail = m_tail.load(memory_order_relaxed);
+		  if (tail == m_head.load(memory_order_acquire))
+				return false;
+
+		  Block& slot = m_slots[tail & m_mask];
+		  samples.clear();
+		  swap(samples, slot);
+		  m_qlen.fetch_sub(samples.size(), memory_order_relaxed);
+		  m_tail.store(tail + 1, memory_order_release);
+		  return true;
+	 }
+
+	 /**
+	  * As try_pull(), but wait for a block if the ring is empty.  Returns
+	  * false only once the end marker has been reached.
+	  */
+	 bool pull(Block& samples)
+	 {
+		  while (!try_pull(samples)) {
+				if (m_end_marked.load(memory_order_acquire))
+					 return try_pull(samples);
+				wait_for([this] { return !empty(); });
+		  }
+		  return true;
+	 }
+
+	 /**
+	  * Wait until the ring holds minfill samples, is full, or has an end
+	  * marker.  A bounded ring may never reach minfill, so full also ends
+	  * the wait.
+	  */
+	 void wait_buffer_fill(size_t minfill)
+	 {
+		  handle_flush();
+		  wait_for([this, minfill] {
+				return m_qlen.load(memory_order_relaxed) >= minfill || full();
+		  });
+	 }
+
+	 // MARK: - any thread
+
+	 /**
+	  * Request that all queued blocks be discarded.  The consumer thread
+	  * performs the discard on its next pull, so this is safe to call from
+	  * a control thread while the producer and consumer are running.
+	  */
+	 void flush()
+	 {
+		  m_flush_request.store(true, memory_order_release);
+		  wake_consumer();
+	 }
+
+	 /** Return number of samples in the ring. */
+	 size_t queued_samples() const
+	 {
+		  return m_qlen.load(memory_order_relaxed);
+	 }
+
+	 /** Return number of blocks in the ring. */
+	 size_t queued_blocks() const
+	 {
+		  return m_head.load(memory_order_acquire) - m_tail.load(memory_order_acquire);
+	 }
+
+	 size_t capacity_blocks() const { return m_mask + 1; }
+
+	 bool empty() const { return queued_blocks() == 0; }
+	 bool full() const  { return queued_blocks() > m_mask; }
+
+	 /** Return true if the end has been reached at the pull side. */
+	 bool pull_end_reached() const
+	 {
+		  return empty() && m_end_marked.load(memory_order_acquire);
+	 }
+
+	 /** Most samples ever queued at once. */
+	 size_t high_water() const { return m_high_water.load(memory_order_relaxed); }
+
+	 /** Blocks and samples dropped because the ring was full. */
+	 uint64_t drops() const { return m_drops.load(memory_order_relaxed); }
+	 uint64_t dropped_samples() const { return m_dropped_samples.load(memory_order_relaxed); }
+
+	 void reset_stats()
+	 {
+		  m_high_water.store(queued_samples(), memory_order_relaxed);
+		  m_drops.store(0, memory_order_relaxed);
+		  m_dropped_samples.store(0, memory_order_relaxed);
+	 }
+
+private:
+
+	 void drop(Block& samples)
+	 {
+		  m_drops.fetch_add(1, memory_order_relaxed);
+		  m_dropped_samples.fetch_add(samples.size(), memory_order_relaxed);
+		  samples.clear();
+	 }
+
+	 // Discard everything queued, runs on the consumer thread only.
+	 void handle_flush()
+	 {
+		  if (!m_flush_request.exchange(false, memory_order_acquire))
+				return;
+
+		  size_t tail = m_tail.load(memory_order_relaxed);
+		  size_t head = m_head.load(memory_order_acquire);
+		  for (; tail != head; tail++) {
+				Block& slot = m_slots[tail & m_mask];
+				m_qlen.fetch_sub(slot.size(), memory_order_relaxed);
+				slot.clear();
+		  }
+		  m_tail.store(tail, memory_order_release);
+	 }
+
+	 void wake_consumer()
+	 {
+		  // Pairs with the seq_cst store in wait_for(), either the consumer
+		  // sees the new head or we see it waiting.
+		  if (m_consumer_waiting.load(memory_order_seq_cst)) {
+				lock_guard<mutex> lock(m_mutex);
+				m_cond.notify_one();
+		  }
+	 }
+
+	 template <class Pred>
+	 void wait_for(Pred ready)
+	 {
+		  unique_lock<mutex> lock(m_mutex);
+		  m_consumer_waiting.store(true, memory_order_seq_cst);
+		  atomic_thread_fence(memory_order_seq_cst);
+		  while (!ready()
+					&& !m_end_marked.load(memory_order_acquire)
+					&& !m_flush_request.load(memory_order_acquire)) {
+				// the timeout is only a backstop, wake_consumer() does the work.
+				m_cond.wait_for(lock, chrono::milliseconds(100));
+		  }
+		  m_consumer_waiting.store(false, memory_order_relaxed);
+	 }
+
+	 size_t                  m_mask;
+	 vector<Block>           m_slots;
+
+	 // producer writes m_head, consumer writes m_tail.
+	 alignas(64) atomic<size_t>  m_head;
+	 alignas(64) atomic<size_t>  m_tail;
+
+	 atomic<size_t>          m_qlen;
+	 atomic<bool>            m_end_marked;
+	 atomic<bool>            m_flush_request;
+	 atomic<bool>            m_consumer_waiting;
+	 atomic_flag             m_producer_busy;
+
+	 atomic<size_t>          m_high_water;
+	 atomic<uint64_t>        m_drops;
+	 atomic<uint64_t>        m_dropped_samples;
+
+	 mutex                   m_mutex;
+	 condition_variable      m_cond;
+};
+
+/** Ring of plain sample vectors. */
+template <class Element>
+using SPSCRing = SPSCBlockRing<vector<Element>>;
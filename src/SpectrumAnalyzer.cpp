@@ -0,0 +1,335 @@
+//
+//  SpectrumAnalyzer.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+#include <sched.h>
+
+#include "SpectrumAnalyzer.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+static double mono_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double thread_cpu_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// MARK: -   SpectrumAnalyzer
+
+SpectrumAnalyzer::SpectrumAnalyzer(unsigned int fftSize, unsigned int columns, size_t blockLength){
+
+	// radix 2, and at least one bin per column
+	unsigned int n = 16;
+	while(n < fftSize || n < columns)
+		n <<= 1;
+
+	_fftSize = n;
+	_columns = columns;
+
+	// 4 term Blackman-Harris, -92 dB sidelobes keep a strong station
+	// from smearing across the band
+	_window.resize(n);
+	double wsum = 0;
+	for(unsigned int i = 0; i < n; i++){
+		double x = 2.0 * M_PI * i / n;
+		_window[i] = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+		wsum += _window[i];
+	}
+	_windowPower = wsum * wsum;
+
+	_twiddle.resize(n / 2);
+	for(unsigned int k = 0; k < n / 2; k++)
+		_twiddle[k] = polar(1.0f, float(-2.0 * M_PI * k / n));
+
+	unsigned int bits = 0;
+	while((1u << bits) < n)
+		bits++;
+
+	_bitrev.resize(n);
+	for(unsigned int i = 0; i < n; i++){
+		unsigned int r = 0;
+		for(unsigned int b = 0; b < bits; b++)
+			if(i & (1u << b))
+				r |= 1u << (bits - 1 - b);
+		_bitrev[i] = r;
+	}
+
+	_buf.resize(n);
+	_power.assign(n, 0);
+	_averaged = 0;
+
+	// offer() swaps this out to the SDR thread as its next block, give it
+	// the room of one so the first refill doesn't allocate
+	_mailbox.reserve(blockLength);
+
+	_running = false;
+	_enabled = false;
+	_busy = false;
+	_cpuBudget = default_cpuBudget;
+	_frameCB = NULL;
+	_frame = 0;
+
+	_load = 0;
+	_blocks = 0;
+	_refused = 0;
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer(){
+	stop();
+}
+
+bool SpectrumAnalyzer::begin(){
+
+	if(_running)
+		return true;
+
+	_running = true;
+	pthread_create(&_analyzerTID, NULL,
+						(THREADFUNCPTR) &SpectrumAnalyzer::AnalyzerThread, (void*)this);
+	return true;
+}
+
+void SpectrumAnalyzer::stop(){
+
+	if(!_running)
+		return;
+
+	{
+		lock_guard<mutex> lock(_mutex);
+		_running = false;
+	}
+	_cond.notify_one();
+	pthread_join(_analyzerTID, NULL);
+}
+
+void SpectrumAnalyzer::setEnabled(bool enable){
+
+	lock_guard<mutex> lock(_mutex);
+
+	_enabled = enable;
+
+	// don't show a stale picture next time
+	if(!enable){
+		_spectrum.clear();
+		_load = 0;
+	}
+}
+
+void SpectrumAnalyzer::setCPUBudget(double fraction){
+	_cpuBudget = min(max(fraction, 0.01), 1.0);
+}
+
+void SpectrumAnalyzer::setFrameCallback(frameCallback_t cb){
+	lock_guard<mutex> lock(_mutex);
+	_frameCB = cb;
+}
+
+bool SpectrumAnalyzer::offer(IQSampleVector& samples){
+
+	if(!_enabled)
+		return false;
+
+	if(_busy){
+		_refused++;
+		return false;
+	}
+
+	// the analyzer only holds the lock for a moment, but never wait on it
+	unique_lock<mutex> lock(_mutex, try_to_lock);
+	if(!lock.owns_lock()){
+		_refused++;
+		return false;
+	}
+
+	_mailbox.swap(samples);
+	_busy = true;
+	lock.unlock();
+
+	_cond.notify_one();
+	return true;
+}
+
+bool SpectrumAnalyzer::getSpectrum(vector<float>& columns, uint64_t* frame){
+
+	lock_guard<mutex> lock(_mutex);
+
+	if(_spectrum.empty())
+		return false;
+
+	columns.assign(_spectrum.begin(), _spectrum.end());
+	if(frame)
+		*frame = _frame;
+
+	return true;
+}
+
+SpectrumAnalyzer::stats_t SpectrumAnalyzer::getStats(){
+	return {_load, _blocks, _refused, _frame};
+}
+
+// Transform in place.  The input is expected in bit reversed order, the
+// output comes out in natural order.
+void SpectrumAnalyzer::fft(vector<complex<float>>& buf){
+
+	unsigned int n = _fftSize;
+	float* x = reinterpret_cast<float*>(buf.data());
+	const float* tw = reinterpret_cast<const float*>(_twiddle.data());
+
+	for(unsigned int len = 2; len <= n; len <<= 1){
+		unsigned int half = len >> 1;
+		unsigned int tstep = n / len;
+
+		for(unsigned int i = 0; i < n; i += len){
+			for(unsigned int j = 0; j < half; j++){
+				const float* w = tw + 2 * (j * tstep);
+				float* a = x + 2 * (i + j);
+				float* b = x + 2 * (i + j + half);
+
+				float vr = b[0] * w[0] - b[1] * w[1];
+				float vi = b[0] * w[1] + b[1] * w[0];
+
+				b[0] = a[0] - vr;
+				b[1] = a[1] - vi;
+				a[0] += vr;
+				a[1] += vi;
+			}
+		}
+	}
+}
+
+void SpectrumAnalyzer::process(const IQSampleVector& samples){
+
+	unsigned int n = samples.size();
+	if(n < _fftSize)
+		return;
+
+	// spread the frames over the block rather than take the first few
+	unsigned int frames = min(max_framesPerBlock, n / _fftSize);
+	unsigned int step = frames > 1 ? (n - _fftSize) / (frames - 1) : 0;
+
+	for(unsigned int f = 0; f < frames; f++){
+		const IQSample* in = samples.data() + f * step;
+
+		for(unsigned int i = 0; i < _fftSize; i++)
+			_buf[_bitrev[i]] = in[i] * _window[i];
+
+		fft(_buf);
+
+		for(unsigned int i = 0; i < _fftSize; i++)
+			_power[i] += norm(_buf[i]);
+	}
+
+	_averaged += frames;
+}
+
+void SpectrumAnalyzer::finishFrame(vector<float>& columns){
+
+	columns.resize(_columns);
+
+	double scale = _averaged ? 1.0 / (_averaged * double(_windowPower)) : 0;
+	unsigned int half = _fftSize / 2;
+
+	// peak of the bins under each column, so a narrow carrier still shows
+	for(unsigned int c = 0; c < _columns; c++){
+		unsigned int first = c * _fftSize / _columns;
+		unsigned int last = (c + 1) * _fftSize / _columns;
+
+		double peak = 0;
+		for(unsigned int b = first; b < last; b++)
+			peak = max(peak, _power[(b + half) % _fftSize]);
+
+		columns[c] = 10 * log10(peak * scale + 1.0e-20);
+	}
+
+	fill(_power.begin(), _power.end(), 0);
+	_averaged = 0;
+}
+
+void SpectrumAnalyzer::Analyzer(){
+
+#if defined(__linux__)
+	// the band view is a nicety, never compete with the decoder
+	struct sched_param param = {0};
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+	vector<float> columns;
+
+	double lastFrame = mono_secs();
+	double loadStart = lastFrame;
+	double loadCPU = 0;
+
+	while(true){
+
+		{
+			unique_lock<mutex> lock(_mutex);
+			_cond.wait(lock, [this]{ return _busy || !_running; });
+			if(!_running)
+				break;
+		}
+
+		double cpu0 = thread_cpu_secs();
+
+		process(_mailbox);
+		_blocks++;
+
+		double now = mono_secs();
+		if((now - lastFrame) * 1000 >= default_frameInterval){
+			lastFrame = now;
+			finishFrame(columns);
+
+			frameCallback_t cb;
+			{
+				lock_guard<mutex> lock(_mutex);
+				if(_enabled){
+					_spectrum.swap(columns);
+					_frame++;
+					cb = _frameCB;
+				}
+			}
+
+			if(cb)
+				cb();
+		}
+
+		double busy = thread_cpu_secs() - cpu0;
+		loadCPU += busy;
+
+		// hold the mailbox long enough that the work done stays inside
+		// the budget, offers are refused meanwhile
+		double rest = busy * (1.0 / _cpuBudget - 1.0);
+		if(rest > 0){
+			struct timespec ts;
+			ts.tv_sec = (time_t) rest;
+			ts.tv_nsec = (long) ((rest - ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+
+		now = mono_secs();
+		if(now - loadStart >= 1.0){
+			_load = loadCPU / (now - loadStart);
+			loadStart = now;
+			loadCPU = 0;
+		}
+
+		_busy = false;
+	}
+}
+
+void* SpectrumAnalyzer::AnalyzerThread(void *context){
+	SpectrumAnalyzer* d = (SpectrumAnalyzer*)context;
+
+	d->Analyzer();
+
+	pthread_exit(NULL);
+	return((void *)1);
+}
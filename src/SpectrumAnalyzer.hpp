@@ -0,0 +1,127 @@
+//
+//  SpectrumAnalyzer.hpp
+//  carradio
+//
+//  Power spectrum of the live IQ stream for the band activity view.
+//
+//  SDRProcessor offers every block once it is done decoding it.  When the
+//  analyzer is idle the block is swapped into its mailbox and the processor
+//  gets the spent vector from the last analysis back, so the decoder path
+//  neither copies nor waits.  A block offered while the analyzer is busy,
+//  disabled or over its CPU budget is simply not taken.
+//
+//  The analyzer thread runs at idle priority.  Each block is cut into
+//  windowed frames, FFTed and the power averaged.  Once per frame interval
+//  the average is reduced to one dB value per display column, lowest
+//  frequency first with the tuner LO in the middle.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <complex>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <pthread.h>
+#include <time.h>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class SpectrumAnalyzer
+{
+public:
+
+	static constexpr unsigned int default_fftSize 	= 1024;
+	static constexpr unsigned int default_columns 	= 128;		// VFD width
+	static constexpr size_t 		default_blockLength = 65536;		// samples offered, as RtlSdr
+	static constexpr unsigned int max_framesPerBlock = 8;
+	static constexpr double 		default_cpuBudget 	= 0.10;		// fraction of one core
+	static constexpr int 			default_frameInterval = 250;		// ms between spectra
+
+	typedef std::function<void()> frameCallback_t;
+
+	typedef struct {
+		double		load;			// analyzer CPU time over wall time, recent
+		uint64_t		blocks;		// blocks analyzed
+		uint64_t		refused;		// blocks offered while busy or over budget
+		uint64_t		frames;		// spectra published
+	} stats_t;
+
+	SpectrumAnalyzer(unsigned int fftSize = default_fftSize,
+						  unsigned int columns = default_columns,
+						  size_t blockLength = default_blockLength);
+	~SpectrumAnalyzer();
+
+	/** Start the analyzer thread. */
+	bool begin();
+	void stop();
+
+	/** Only take blocks while something is showing the result. */
+	void setEnabled(bool enable);
+	bool isEnabled() {return _enabled;};
+
+	/** Cap on the analyzer's share of one core, 0.01 .. 1.0. */
+	void setCPUBudget(double fraction);
+	double getCPUBudget() {return _cpuBudget;};
+
+	/** Called from the analyzer thread each time a spectrum is published. */
+	void setFrameCallback(frameCallback_t cb);
+
+	/**
+	 * Hand a block to the analyzer, called from SDRProcessor.  Never blocks.
+	 * When taken, samples is swapped with a spent block and true returned.
+	 */
+	bool offer(IQSampleVector& samples);
+
+	/** Latest spectrum in dBFS per column, false if there is none yet. */
+	bool getSpectrum(vector<float>& columns, uint64_t* frame = NULL);
+
+	stats_t getStats();
+
+	// MARK: - synchronous use, for the benchmark
+
+	/** Window, FFT and accumulate the frames of one block. */
+	void process(const IQSampleVector& samples);
+
+	/** Reduce the accumulated power to columns and start a new average. */
+	void finishFrame(vector<float>& columns);
+
+private:
+
+	void fft(vector<complex<float>>& buf);
+
+	void Analyzer();
+	static void* AnalyzerThread(void *context);
+
+	unsigned int					_fftSize;
+	unsigned int					_columns;
+	vector<float>					_window;
+	float								_windowPower;		// sum(w)^2, full scale tone is 0 dB
+	vector<complex<float>>		_twiddle;
+	vector<unsigned int>			_bitrev;
+	vector<complex<float>>		_buf;
+	vector<double>					_power;
+	unsigned int					_averaged;
+
+	mutex								_mutex;
+	condition_variable			_cond;
+	IQSampleVector					_mailbox;
+	atomic<bool>					_running;
+	atomic<bool>					_enabled;
+	atomic<bool>					_busy;			// mailbox belongs to the analyzer
+	atomic<double>					_cpuBudget;
+	pthread_t						_analyzerTID;
+
+	frameCallback_t				_frameCB;
+	vector<float>					_spectrum;
+	atomic<uint64_t>				_frame;			// bumped under _mutex, getStats() reads it without
+
+	atomic<double>					_load;
+	atomic<uint64_t>				_blocks;
+	atomic<uint64_t>				_refused;
+};
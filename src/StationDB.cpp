@@ -0,0 +1,434 @@
+//
+//  StationDB.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+#include "StationDB.hpp"
+#include "ErrorMgr.hpp"
+#include "Utils.hpp"
+#include "utm.hpp"
+
+using namespace Utils;
+
+// the UTM conversion keeps its ellipsoid in globals
+static std::mutex s_utmMutex;
+
+// MARK: -   StationDB
+
+StationDB::StationDB(){
+	clear();
+}
+
+void StationDB::clear(){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_entries.clear();
+	_byFrequency.clear();
+	_anywhere.clear();
+	_cells.clear();
+}
+
+size_t StationDB::size(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _entries.size();
+}
+
+void StationDB::add(const station_info_t& info){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	uint32_t id = (uint32_t) _entries.size();
+	_entries.push_back(info);
+
+	insertByFrequency(_byFrequency[info.band], id);
+
+	if(info.range > 0)
+		indexStation(_entries[id], id, _cells);
+	else
+		insertByFrequency(_anywhere[info.band], id);
+}
+
+void StationDB::insertByFrequency(vector<uint32_t>& list, uint32_t id){
+
+	uint32_t freq = _entries[id].frequency;
+	auto pos = upper_bound(list.begin(), list.end(), freq,
+								  [this](uint32_t f, uint32_t e){ return f < _entries[e].frequency; });
+	list.insert(pos, id);
+}
+
+// MARK: -   grid
+
+bool StationDB::toUTM(double latitude, double longitude,
+							 long &zone, char &hemisphere, double &easting, double &northing){
+	char latBand;
+
+	std::lock_guard<std::mutex> lock(s_utmMutex);
+
+	return Convert_Geodetic_To_UTM(latitude * M_PI / 180., longitude * M_PI / 180.,
+											 &zone, &latBand, &hemisphere, &easting, &northing) == UTM_NO_ERROR;
+}
+
+StationDB::cell_key_t StationDB::cellKey(long zone, char hemisphere, long e, long n){
+	return ((cell_key_t) zone << 48)
+			| ((cell_key_t) (hemisphere == 'S') << 47)
+			| (((cell_key_t) e & 0xFFFFFF) << 23)
+			| ((cell_key_t) n & 0x7FFFFF);
+}
+
+bool StationDB::cellOf(const GPSLocation_t& here, cell_key_t &key){
+	long zone;
+	char hemisphere;
+	double easting, northing;
+
+	if(!toUTM(here.latitude, here.longitude, zone, hemisphere, easting, northing))
+		return false;
+
+	key = cellKey(zone, hemisphere, long(floor(easting / cell_size)), long(floor(northing / cell_size)));
+	return true;
+}
+
+// Enter the station in every cell its coverage circle touches.  Points
+// around the circle are converted one by one since the circle may reach
+// into the next UTM zone, each zone gets the bounding box of its points
+// grown by a cell to cover the curve between them.
+void StationDB::indexStation(const station_info_t& info, uint32_t id, cells_t& cells){
+
+	constexpr int    circle_points = 16;
+	constexpr double earth_radius = 6371.0e3;
+
+	double lat1 = info.latitude * M_PI / 180.;
+	double lon1 = info.longitude * M_PI / 180.;
+	double d = info.range / earth_radius;
+
+	typedef struct { double minE, maxE, minN, maxN; } box_t;
+	map<pair<long,char>, box_t> boxes;
+
+	for(int i = 0; i <= circle_points; i++){
+		double lat = info.latitude;
+		double lon = info.longitude;
+
+		// the last point is the center itself
+		if(i < circle_points){
+			double theta = 2 * M_PI * i / circle_points;
+			double lat2 = asin(sin(lat1) * cos(d) + cos(lat1) * sin(d) * cos(theta));
+			double lon2 = lon1 + atan2(sin(theta) * sin(d) * cos(lat1), cos(d) - sin(lat1) * sin(lat2));
+			lat = lat2 * 180. / M_PI;
+			lon = remainder(lon2 * 180. / M_PI, 360.);
+		}
+
+		long zone;
+		char hemisphere;
+		double e, n;
+		if(!toUTM(lat, lon, zone, hemisphere, e, n))
+			continue;
+
+		auto key = make_pair(zone, hemisphere);
+		if(boxes.count(key) == 0){
+			boxes[key] = {e, e, n, n};
+		}
+		else {
+			box_t& b = boxes[key];
+			b.minE = min(b.minE, e);
+			b.maxE = max(b.maxE, e);
+			b.minN = min(b.minN, n);
+			b.maxN = max(b.maxN, n);
+		}
+	}
+
+	for(auto &[zh, b] : boxes){
+		long e0 = long(floor(b.minE / cell_size)) - 1;
+		long e1 = long(floor(b.maxE / cell_size)) + 1;
+		long n0 = long(floor(b.minN / cell_size)) - 1;
+		long n1 = long(floor(b.maxN / cell_size)) + 1;
+
+		for(long e = max(e0, 0L); e <= e1; e++)
+			for(long n = max(n0, 0L); n <= n1; n++)
+				cells[cellKey(zh.first, zh.second, e, n)].push_back(id);
+	}
+}
+
+const vector<uint32_t>* StationDB::stationsInCell(const GPSLocation_t& here){
+
+	cell_key_t key;
+	if(!cellOf(here, key))
+		return NULL;
+
+	auto it = _cells.find(key);
+	return it == _cells.end() ? NULL : &it->second;
+}
+
+bool StationDB::isReceivable(const station_info_t& info, const GPSLocation_t& here){
+
+	if(info.range <= 0 || !here.isValid)
+		return true;
+
+	GPSLocation_t there = here;
+	there.latitude = info.latitude;
+	there.longitude = info.longitude;
+
+	double km = GPSmgr::dist_bearing(here, there).first;
+	return km * 1000. <= info.range;
+}
+
+// MARK: -   queries
+
+bool StationDB::lookup(RadioMgr::radio_mode_t band, uint32_t frequency,
+							  const GPSLocation_t& here, station_info_t& info){
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto cmp = [this](uint32_t e, uint32_t f){ return _entries[e].frequency < f; };
+
+	if(here.isValid){
+
+		// a positioned station that reaches us beats one from the hand list
+		const vector<uint32_t>* cell = stationsInCell(here);
+		if(cell){
+			double best = INFINITY;
+			for(auto id : *cell){
+				const station_info_t& e = _entries[id];
+				if(e.band != band || e.frequency != frequency || !isReceivable(e, here))
+					continue;
+
+				GPSLocation_t there = here;
+				there.latitude = e.latitude;
+				there.longitude = e.longitude;
+				double km = GPSmgr::dist_bearing(here, there).first;
+				if(km < best){
+					best = km;
+					info = e;
+				}
+			}
+			if(best != INFINITY)
+				return true;
+		}
+
+		auto &list = _anywhere[band];
+		auto it = lower_bound(list.begin(), list.end(), frequency, cmp);
+		if(it != list.end() && _entries[*it].frequency == frequency){
+			info = _entries[*it];
+			return true;
+		}
+		return false;
+	}
+
+	// we don't know where we are, anything on the frequency will do
+	auto &list = _byFrequency[band];
+	auto it = lower_bound(list.begin(), list.end(), frequency, cmp);
+	if(it != list.end() && _entries[*it].frequency == frequency){
+		info = _entries[*it];
+		return true;
+	}
+
+	return false;
+}
+
+bool StationDB::next(RadioMgr::radio_mode_t band, uint32_t frequency, bool up,
+							const GPSLocation_t& here, station_info_t& info){
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto below = [this](uint32_t e, uint32_t f){ return _entries[e].frequency < f; };
+	auto above = [this](uint32_t f, uint32_t e){ return f < _entries[e].frequency; };
+
+	// nearest in a frequency sorted list, -1 for none
+	auto nearest = [&](const vector<uint32_t>& list) -> int64_t {
+		if(up){
+			auto it = upper_bound(list.begin(), list.end(), frequency, above);
+			return it == list.end() ? -1 : (int64_t) *it;
+		}
+		auto it = lower_bound(list.begin(), list.end(), frequency, below);
+		return it == list.begin() ? -1 : (int64_t) *(--it);
+	};
+
+	int64_t found = nearest(here.isValid ? _anywhere[band] : _byFrequency[band]);
+
+	if(here.isValid){
+		const vector<uint32_t>* cell = stationsInCell(here);
+		if(cell){
+			for(auto id : *cell){
+				const station_info_t& e = _entries[id];
+				if(e.band != band || !isReceivable(e, here))
+					continue;
+
+				if(up ? e.frequency <= frequency : e.frequency >= frequency)
+					continue;
+
+				if(found < 0
+					|| (up ? e.frequency < _entries[found].frequency
+						 	 : e.frequency > _entries[found].frequency))
+					found = id;
+			}
+		}
+	}
+
+	if(found < 0)
+		return false;
+
+	info = _entries[found];
+	return true;
+}
+
+bool StationDB::hasStations(RadioMgr::radio_mode_t band, const GPSLocation_t& here){
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(!here.isValid)
+		return !_byFrequency[band].empty();
+
+	if(!_anywhere[band].empty())
+		return true;
+
+	const vector<uint32_t>* cell = stationsInCell(here);
+	if(cell){
+		for(auto id : *cell){
+			if(_entries[id].band == band && isReceivable(_entries[id], here))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// MARK: -   file
+
+// The table is built on the side and swapped in whole, so lookups see
+// the old stations or the new ones and never a half loaded file.  The
+// frequency lists are sorted once at the end, not kept sorted per line.
+
+bool StationDB::restoreFromFile(string filePath){
+	bool success = false;
+
+	std::ifstream	ifs;
+
+	vector<station_info_t>	entries;
+	band_lists_t				byFrequency;
+	band_lists_t				anywhere;
+	cells_t						cells;
+
+	try{
+		string line;
+
+		// open the file
+		ifs.open(filePath, ios::in);
+		if(!ifs.is_open()) return false;
+
+		while ( std::getline(ifs, line) ) {
+
+			// split the line looking for a token: and rest and ignore comments
+			line = Utils::trimStart(line);
+			if(line.size() == 0) continue;
+			if(line[0] == '#')  continue;
+
+			vector<string> v = split<string>(line, "\t");
+			if(v.size() < 3)  continue;
+
+			RadioMgr::radio_mode_t mode =  RadioMgr::stringToMode(v[0]);
+			uint32_t freq = atoi(v[1].c_str());
+
+			// "-" holds the place of a title we don't know yet
+			string title = trimCNTRL(v[2]);
+			if(title == "-")
+				title = "";
+			string location = trimCNTRL((v.size() >3) ?v[3]: string());
+			if(location == "-")
+				location = "";
+
+			station_info_t info = {mode, freq, title, location, 0, 0, 0};
+
+			if(v.size() > 6){
+				info.latitude = atof(v[4].c_str());
+				info.longitude = atof(v[5].c_str());
+				info.range = atof(v[6].c_str()) * 1000.;
+			}
+
+			if(freq != 0
+				&& mode != RadioMgr::MODE_UNKNOWN){
+				entries.push_back(info);
+			}
+		}
+
+		ifs.close();
+	}
+	catch(std::ifstream::failure &err) {
+		ELOG_MESSAGE("READ stations:FAIL: %s", err.what());
+		return false;
+	}
+
+	for(uint32_t id = 0; id < entries.size(); id++){
+		const station_info_t& info = entries[id];
+
+		byFrequency[info.band].push_back(id);
+		if(info.range > 0)
+			indexStation(info, id, cells);
+		else
+			anywhere[info.band].push_back(id);
+	}
+
+	// stable, stations on the same frequency stay in file order
+	auto lower = [&entries](uint32_t a, uint32_t b){ return entries[a].frequency < entries[b].frequency; };
+	for(auto &[band, list] : byFrequency)
+		stable_sort(list.begin(), list.end(), lower);
+	for(auto &[band, list] : anywhere)
+		stable_sort(list.begin(), list.end(), lower);
+
+	success = entries.size() > 0;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_entries.swap(entries);
+	_byFrequency.swap(byFrequency);
+	_anywhere.swap(anywhere);
+	_cells.swap(cells);
+
+	return success;
+}
+
+bool StationDB::saveToFile(string filePath){
+	bool success = false;
+
+	std::ofstream	ofs;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	try{
+		ofs.open(filePath, std::ios_base::trunc);
+		if(ofs.fail())
+			return false;
+
+		ofs << "# mode\tfrequency\ttitle\tlocation\t[latitude\tlongitude\trange_km]\n";
+
+		for( auto &[band, list]: _byFrequency){
+			for(auto id : list){
+				const station_info_t& e = _entries[id];
+
+				ofs << RadioMgr::modeString(e.band) << "\t"
+					 << e.frequency << "\t"
+					 << (e.title.empty() ? "-" : e.title);
+
+				if(e.range > 0){
+					char buf[64];
+					snprintf(buf, sizeof(buf), "%.5f\t%.5f\t%.0f",
+								e.latitude, e.longitude, e.range / 1000.);
+					ofs << "\t" << (e.location.empty() ? "-" : e.location)
+						 << "\t" << buf;
+				}
+				else if(!e.location.empty())
+					ofs << "\t" << e.location;
+
+				ofs << "\n";
+			}
+		}
+
+		ofs.flush();
+		ofs.close();
+		success = true;
+	}
+	catch(std::ofstream::failure &err) {
+		ELOG_MESSAGE("WRITE stations:FAIL: %s", err.what());
+		success = false;
+	}
+	return success;
+}
@@ -0,0 +1,97 @@
+//
+//  StationDB.hpp
+//  carradio
+//
+//  Known stations, and where each of them can be heard.
+//
+//  A station either has no position, in which case it is taken to be
+//  receivable anywhere (the hand kept entries), or a position and a range
+//  in meters around it.  Positioned stations are entered into a grid of
+//  cells over UTM coordinates, every cell their coverage circle touches,
+//  so finding what can be heard at a place is one map lookup plus a
+//  distance check of the few stations in that cell.  Each band also keeps
+//  its stations sorted by frequency for the binary searches.
+//
+//  File format, tab separated, one station per line, # for comments:
+//
+//    mode  frequency  title  location  [latitude  longitude  range_km]
+//
+//  A "-" holds the place of an empty title or location.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "RadioMgr.hpp"
+#include "GPSmgr.hpp"
+
+using namespace std;
+
+class StationDB
+{
+public:
+
+	static constexpr double default_range	= 80.0e3;		// m, FM heard from a car
+	static constexpr double cell_size		= 25.0e3;		// m
+
+	typedef struct {
+		RadioMgr::radio_mode_t	band;
+		uint32_t						frequency;
+		string						title;
+		string						location;		// place name, free text
+		double						latitude;		// degrees
+		double						longitude;
+		double						range;			// m around the position, 0 for anywhere
+	} station_info_t;
+
+	StationDB();
+
+	void clear();
+	void add(const station_info_t& info);
+	size_t size();
+
+	bool restoreFromFile(string filePath);
+	bool saveToFile(string filePath);
+
+	/** True if the station can be heard at here, or here is not known. */
+	static bool isReceivable(const station_info_t& info, const GPSLocation_t& here);
+
+	/** The station on frequency that can be heard at here, the closest if several. */
+	bool lookup(RadioMgr::radio_mode_t band, uint32_t frequency,
+					const GPSLocation_t& here, station_info_t& info);
+
+	/** The next receivable station above or below frequency. */
+	bool next(RadioMgr::radio_mode_t band, uint32_t frequency, bool up,
+				 const GPSLocation_t& here, station_info_t& info);
+
+	/** Anything in the band receivable at here. */
+	bool hasStations(RadioMgr::radio_mode_t band, const GPSLocation_t& here);
+
+private:
+
+	typedef uint64_t cell_key_t;
+
+	static bool toUTM(double latitude, double longitude,
+							long &zone, char &hemisphere, double &easting, double &northing);
+	static cell_key_t cellKey(long zone, char hemisphere, long e, long n);
+	static bool cellOf(const GPSLocation_t& here, cell_key_t &key);
+
+	typedef map<RadioMgr::radio_mode_t, vector<uint32_t>>	band_lists_t;
+	typedef map<cell_key_t, vector<uint32_t>>				cells_t;
+
+	static void indexStation(const station_info_t& info, uint32_t id, cells_t& cells);
+	void insertByFrequency(vector<uint32_t>& list, uint32_t id);
+
+	const vector<uint32_t>* stationsInCell(const GPSLocation_t& here);
+
+	mutable std::mutex							_mutex;
+	vector<station_info_t>						_entries;
+	band_lists_t									_byFrequency;	// all of the band
+	band_lists_t									_anywhere;		// the ones without a position
+	cells_t											_cells;
+};
@@ -0,0 +1,254 @@
+//
+//  ToneControl.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+
+#include "ToneControl.hpp"
+
+// MARK: -   biquads
+
+// Shelf slope S = 1, the steepest without a bump.
+static void lowShelf(double freq, double sampleRate, double db,
+							double& b0, double& b1, double& b2, double& a0, double& a1, double& a2){
+	double A = pow(10, db / 40);
+	double w0 = 2 * M_PI * freq / sampleRate;
+	double cw = cos(w0);
+	double alpha = sin(w0) / 2 * sqrt(2.0);
+	double sqA = 2 * sqrt(A) * alpha;
+
+	b0 =     A * ((A + 1) - (A - 1) * cw + sqA);
+	b1 = 2 * A * ((A - 1) - (A + 1) * cw);
+	b2 =     A * ((A + 1) - (A - 1) * cw - sqA);
+	a0 =          (A + 1) + (A - 1) * cw + sqA;
+	a1 =    -2 * ((A - 1) + (A + 1) * cw);
+	a2 =          (A + 1) + (A - 1) * cw - sqA;
+}
+
+static void highShelf(double freq, double sampleRate, double db,
+							 double& b0, double& b1, double& b2, double& a0, double& a1, double& a2){
+	double A = pow(10, db / 40);
+	double w0 = 2 * M_PI * freq / sampleRate;
+	double cw = cos(w0);
+	double alpha = sin(w0) / 2 * sqrt(2.0);
+	double sqA = 2 * sqrt(A) * alpha;
+
+	b0 =      A * ((A + 1) + (A - 1) * cw + sqA);
+	b1 = -2 * A * ((A - 1) + (A + 1) * cw);
+	b2 =      A * ((A + 1) + (A - 1) * cw - sqA);
+	a0 =           (A + 1) - (A - 1) * cw + sqA;
+	a1 =      2 * ((A - 1) - (A + 1) * cw);
+	a2 =           (A + 1) - (A - 1) * cw - sqA;
+}
+
+static void peak(double freq, double Q, double sampleRate, double db,
+					  double& b0, double& b1, double& b2, double& a0, double& a1, double& a2){
+	double A = pow(10, db / 40);
+	double w0 = 2 * M_PI * freq / sampleRate;
+	double cw = cos(w0);
+	double alpha = sin(w0) / (2 * Q);
+
+	b0 = 1 + alpha * A;
+	b1 = -2 * cw;
+	b2 = 1 - alpha * A;
+	a0 = 1 + alpha / A;
+	a1 = -2 * cw;
+	a2 = 1 - alpha / A;
+}
+
+// MARK: -   ToneControl
+
+ToneControl::ToneControl(){
+	for(auto &b : _bands)
+		b = 0;
+	_balance = 0;
+	_generation = 1;
+
+	_appliedGeneration = 0;
+	_channels = 0;
+	_sampleRate = 0;
+	_gainActive = false;
+	_flat = true;
+
+	for(int b = 0; b < BAND_COUNT; b++){
+		_bandActive[b] = false;
+		_biquad[b] = {1, 0, 0, 0, 0};
+	}
+	for(unsigned int c = 0; c < max_channels; c++)
+		_gain[c] = 1;
+
+	reset();
+}
+
+void ToneControl::setParam(atomic<float>& param, double val){
+	param.store(fmax(-1, fmin(1, val)), memory_order_relaxed);
+	_generation.fetch_add(1, memory_order_release);
+}
+
+void ToneControl::setBass(double val)		{ setParam(_bands[BAND_BASS], val); }
+void ToneControl::setMidrange(double val)	{ setParam(_bands[BAND_MIDRANGE], val); }
+void ToneControl::setTreble(double val)	{ setParam(_bands[BAND_TREBLE], val); }
+void ToneControl::setBalance(double val)	{ setParam(_balance, val); }
+
+void ToneControl::reset(){
+	for(int b = 0; b < BAND_COUNT; b++)
+		for(unsigned int c = 0; c < max_channels; c++){
+			_z1[b][c] = 0;
+			_z2[b][c] = 0;
+		}
+}
+
+// Same rule the mixer used, the far side is turned down by the setting.
+// Four channel blocks are FL FR RL RR, so both pairs get it.
+void ToneControl::computeGains(float balance, float headroom){
+
+	float left = headroom, right = headroom;
+
+	if(balance > 0)
+		left *= 1 - balance;
+	else if(balance < 0)
+		right *= 1 + balance;
+
+	for(unsigned int c = 0; c < max_channels; c++)
+		_gain[c] = headroom;
+
+	if(_channels == 2 || _channels == 4)
+		for(unsigned int c = 0; c < _channels; c += 2){
+			_gain[c] = left;
+			_gain[c + 1] = right;
+		}
+
+	_gainActive = false;
+	for(unsigned int c = 0; c < _channels; c++)
+		if(_gain[c] != 1)
+			_gainActive = true;
+}
+
+bool ToneControl::update(unsigned int channels, double sampleRate){
+
+	if(channels == 0 || channels > max_channels || sampleRate <= 0)
+		return false;
+
+	uint32_t generation = _generation.load(memory_order_acquire);
+
+	if(generation == _appliedGeneration
+		&& channels == _channels && sampleRate == _sampleRate)
+		return !_flat;
+
+	// the old state belongs to another stream
+	if(channels != _channels || sampleRate != _sampleRate)
+		reset();
+
+	_appliedGeneration = generation;
+	_channels = channels;
+	_sampleRate = sampleRate;
+
+	double nyquist = 0.45 * sampleRate;
+	double boost = 0;
+
+	for(int b = 0; b < BAND_COUNT; b++){
+		double db = _bands[b].load(memory_order_relaxed) * max_gain;
+		bool active = fabs(db) >= 0.05;
+
+		if(active)
+			boost = max(boost, db);
+
+		// coming back in from flat, don't replay stale history
+		if(active && !_bandActive[b])
+			for(unsigned int c = 0; c < max_channels; c++)
+				_z1[b][c] = _z2[b][c] = 0;
+
+		_bandActive[b] = active;
+		if(!active)
+			continue;
+
+		double b0, b1, b2, a0, a1, a2;
+		switch(b){
+			case BAND_BASS:
+				lowShelf(bass_freq, sampleRate, db, b0, b1, b2, a0, a1, a2);
+				break;
+			case BAND_MIDRANGE:
+				peak(min(midrange_freq, nyquist), midrange_Q, sampleRate, db, b0, b1, b2, a0, a1, a2);
+				break;
+			default:
+				highShelf(min(treble_freq, nyquist), sampleRate, db, b0, b1, b2, a0, a1, a2);
+				break;
+		}
+
+		_biquad[b] = {float(b0 / a0), float(b1 / a0), float(b2 / a0),
+						  float(a1 / a0), float(a2 / a0)};
+	}
+
+	// A boosted band can take a full scale signal past full scale, where
+	// the PCM clips it hard.  The block is turned down by the largest
+	// boost, so the loudest band comes out no louder than it went in.
+	computeGains(_balance.load(memory_order_relaxed), pow(10, -boost / 20));
+
+	_flat = !_gainActive;
+	for(int b = 0; b < BAND_COUNT; b++)
+		if(_bandActive[b])
+			_flat = false;
+
+	return !_flat;
+}
+
+// One band at a time over the block, the channels of each frame in
+// parallel.  NCH is a constant so the inner loops unroll into vector code.
+template <unsigned int NCH>
+void ToneControl::processBands(Sample* samples, size_t frames){
+
+	for(int b = 0; b < BAND_COUNT; b++){
+		if(!_bandActive[b])
+			continue;
+
+		const biquad_t q = _biquad[b];
+		float z1[NCH], z2[NCH];
+		for(unsigned int c = 0; c < NCH; c++){
+			z1[c] = _z1[b][c];
+			z2[c] = _z2[b][c];
+		}
+
+		Sample* p = samples;
+		for(size_t i = 0; i < frames; i++, p += NCH){
+			for(unsigned int c = 0; c < NCH; c++){
+				float x = p[c];
+				float y = q.b0 * x + z1[c];
+				z1[c] = q.b1 * x - q.a1 * y + z2[c];
+				z2[c] = q.b2 * x - q.a2 * y;
+				p[c] = y;
+			}
+		}
+
+		for(unsigned int c = 0; c < NCH; c++){
+			_z1[b][c] = z1[c];
+			_z2[b][c] = z2[c];
+		}
+	}
+
+	if(_gainActive){
+		float g[NCH];
+		for(unsigned int c = 0; c < NCH; c++)
+			g[c] = _gain[c];
+
+		Sample* p = samples;
+		for(size_t i = 0; i < frames; i++, p += NCH)
+			for(unsigned int c = 0; c < NCH; c++)
+				p[c] *= g[c];
+	}
+}
+
+void ToneControl::process(Sample* samples, size_t frames){
+
+	if(_flat)
+		return;
+
+	switch(_channels){
+		case 1: processBands<1>(samples, frames); break;
+		case 2: processBands<2>(samples, frames); break;
+		case 3: processBands<3>(samples, frames); break;
+		case 4: processBands<4>(samples, frames); break;
+		default: break;
+	}
+}
@@ -0,0 +1,100 @@
+//
+//  ToneControl.hpp
+//  carradio
+//
+//  Bass, midrange and treble EQ plus the balance gains, applied to every
+//  block on its way to the PCM.  The fader belongs to QuadRouter, which
+//  makes the rear pair.
+//
+//  Each band is a biquad from the RBJ cookbook: a low shelf for the bass,
+//  a peak for the midrange and a high shelf for the treble, run on every
+//  channel with the same coefficients.  The channels of a frame sit next
+//  to each other, so the inner loop over them is what the compiler turns
+//  into vector code.  A band left at 0 dB is skipped, and with everything
+//  flat the block is not touched at all.  Any boost is taken back off the
+//  whole block as headroom, so a full scale source doesn't clip.
+//
+//  The knobs are turned on the UI thread while OutputProcessor is in the
+//  middle of a block.  The setters only store atomics and bump a
+//  generation count, and the audio thread recomputes its coefficients
+//  the next time it sees the count change, so neither side ever waits on
+//  the other.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class ToneControl
+{
+public:
+
+	static constexpr double 		bass_freq 		= 100;		// Hz, shelf midpoint
+	static constexpr double 		midrange_freq	= 1000;		// Hz, peak center
+	static constexpr double 		midrange_Q		= 0.7;
+	static constexpr double 		treble_freq		= 10000;		// Hz, shelf midpoint
+	static constexpr double 		max_gain			= 12;			// dB at a setting of 1.0
+	static constexpr unsigned int max_channels	= 4;
+
+	ToneControl();
+
+	// MARK: - control side, any thread, never blocks
+
+	/** -1.0 - 1.0, cut or boost up to max_gain. */
+	void setBass(double val);
+	void setMidrange(double val);
+	void setTreble(double val);
+
+	/** -1.0 - 1.0, positive pulls the left channels down. */
+	void setBalance(double val);
+
+	// MARK: - audio thread
+
+	/**
+	 * Pick up any new settings for blocks of this format.  Returns false
+	 * when the audio would come out unchanged and process() can be skipped.
+	 */
+	bool update(unsigned int channels, double sampleRate);
+
+	/** Filter interleaved frames in place, after update(). */
+	void process(Sample* samples, size_t frames);
+
+	/** Forget the filter history, for a new source. */
+	void reset();
+
+private:
+
+	typedef struct {
+		float b0, b1, b2, a1, a2;
+	} biquad_t;
+
+	enum { BAND_BASS = 0, BAND_MIDRANGE, BAND_TREBLE, BAND_COUNT };
+
+	void setParam(atomic<float>& param, double val);
+	void computeGains(float balance, float headroom);
+
+	template <unsigned int NCH>
+	void processBands(Sample* samples, size_t frames);
+
+	atomic<float>				_bands[BAND_COUNT];
+	atomic<float>				_balance;
+	atomic<uint32_t>			_generation;
+
+	// audio thread only
+	uint32_t						_appliedGeneration;
+	unsigned int				_channels;
+	double						_sampleRate;
+	bool							_bandActive[BAND_COUNT];
+	bool							_gainActive;
+	bool							_flat;
+	biquad_t						_biquad[BAND_COUNT];
+	float							_gain[max_channels];
+	float							_z1[BAND_COUNT][max_channels];		// transposed direct form II state
+	float							_z2[BAND_COUNT][max_channels];
+};
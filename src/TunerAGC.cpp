@@ -0,0 +1,238 @@
+//
+//  TunerAGC.cpp
+//  carradio
+//
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+#include "TunerAGC.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+static double mono_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// MARK: -   TunerAGC
+
+TunerAGC::TunerAGC(){
+	_running = false;
+	_enabled = false;
+	_setGainCB = NULL;
+	_gain = 0;
+	_lowLevel = default_lowLevel;
+	_highLevel = default_highLevel;
+	_level = 0;
+	_reports = 0;
+	_resetPending = false;
+
+	_telemetry.resize(telemetrySize);
+	_telemetryNext = 0;
+	_telemetryCount = 0;
+}
+
+TunerAGC::~TunerAGC(){
+	stop();
+}
+
+bool TunerAGC::begin(setGainCallback_t cb){
+
+	if(_running)
+		return true;
+
+	_setGainCB = cb;
+	_running = true;
+	pthread_create(&_controllerTID, NULL,
+						(THREADFUNCPTR) &TunerAGC::ControllerThread, (void*)this);
+	return true;
+}
+
+void TunerAGC::stop(){
+
+	if(!_running)
+		return;
+
+	{
+		lock_guard<mutex> lock(_mutex);
+		_running = false;
+	}
+	_cond.notify_one();
+	pthread_join(_controllerTID, NULL);
+}
+
+void TunerAGC::setEnabled(bool enable, vector<int> gains, int startGain){
+
+	lock_guard<mutex> lock(_mutex);
+
+	if(enable){
+		sort(gains.begin(), gains.end());
+		_gains = gains;
+		_gain = startGain;
+		_resetPending = true;
+		log(NAN, startGain, startGain, AGC_ENABLED);
+	}
+
+	_enabled = enable && !_gains.empty();
+}
+
+void TunerAGC::setTargetWindow(double lowLevel, double highLevel){
+
+	lock_guard<mutex> lock(_mutex);
+
+	_lowLevel = min(lowLevel, highLevel);
+	_highLevel = max(lowLevel, highLevel);
+}
+
+void TunerAGC::reportLevel(double ifLevel){
+
+	if(!_enabled)
+		return;
+
+	_level.store(ifLevel, memory_order_relaxed);
+	_reports.fetch_add(1, memory_order_release);
+}
+
+void TunerAGC::reset(){
+	_resetPending = true;
+}
+
+void TunerAGC::getTelemetry(vector<agc_event_t>& events){
+
+	lock_guard<mutex> lock(_mutex);
+
+	events.clear();
+
+	size_t count = min<uint64_t>(_telemetryCount, telemetrySize);
+	size_t first = (_telemetryNext + telemetrySize - count) % telemetrySize;
+	for(size_t i = 0; i < count; i++)
+		events.push_back(_telemetry[(first + i) % telemetrySize]);
+}
+
+// call with _mutex held
+void TunerAGC::log(double level, int fromGain, int toGain, agc_action_t action){
+
+	_telemetry[_telemetryNext] = {mono_secs(), level, fromGain, toGain, action};
+	_telemetryNext = (_telemetryNext + 1) % telemetrySize;
+	_telemetryCount++;
+}
+
+// call with _mutex held
+int TunerAGC::nextGain(double level){
+
+	int gain = _gain;
+
+	if(level >= _lowLevel && level <= _highLevel)
+		return gain;
+
+	// aim for the middle of the window, but no more than one max step
+	double want = (_lowLevel + _highLevel) / 2 - level;
+	want = min(max(want, -default_maxStep), default_maxStep);
+	double target = gain + want * 10;
+
+	int best = gain;
+	for(auto g : _gains){
+		bool rightWay = want > 0 ? g > gain : g < gain;
+		if(rightWay && (best == gain || fabs(g - target) < fabs(best - target)))
+			best = g;
+	}
+
+	return best;
+}
+
+void TunerAGC::Controller(){
+
+	double settleUntil = 0;
+	uint64_t lastReports = 0;
+	bool atLimit = false;
+
+	while(true){
+
+		{
+			unique_lock<mutex> lock(_mutex);
+			_cond.wait_for(lock, chrono::milliseconds(pollInterval), [this]{ return !_running; });
+			if(!_running)
+				break;
+		}
+
+		if(!_enabled)
+			continue;
+
+		double now = mono_secs();
+
+		// the decoder's IF level is smoothed, give it time to catch up
+		if(_resetPending.exchange(false)){
+			settleUntil = now + default_settleTime;
+			atLimit = false;
+			continue;
+		}
+
+		if(now < settleUntil)
+			continue;
+
+		// nothing decoded since last time, nothing to judge
+		uint64_t reports = _reports.load(memory_order_acquire);
+		if(reports == lastReports)
+			continue;
+		lastReports = reports;
+
+		double ifLevel = _level.load(memory_order_relaxed);
+		if(ifLevel <= 0)
+			continue;
+
+		double level = 20 * log10(ifLevel);
+
+		int fromGain, toGain;
+		{
+			lock_guard<mutex> lock(_mutex);
+
+			fromGain = _gain;
+			toGain = nextGain(level);
+
+			bool outside = level < _lowLevel || level > _highLevel;
+			if(toGain == fromGain){
+				if(outside && !atLimit)
+					log(level, fromGain, toGain, AGC_AT_LIMIT);
+				atLimit = outside;
+				continue;
+			}
+			atLimit = false;
+		}
+
+		// a slow USB transfer, with no lock held
+		bool success = false;
+		try {
+			success = _setGainCB && _setGainCB(toGain);
+		}
+		catch(...) {
+			success = false;
+		}
+
+		{
+			lock_guard<mutex> lock(_mutex);
+
+			if(success){
+				_gain = toGain;
+				log(level, fromGain, toGain, toGain > fromGain ? AGC_STEP_UP : AGC_STEP_DOWN);
+			}
+			else
+				log(level, fromGain, toGain, AGC_FAILED);
+		}
+
+		// don't judge the new gain, or retry a refused one, right away
+		settleUntil = mono_secs() + default_settleTime;
+	}
+}
+
+void* TunerAGC::ControllerThread(void *context){
+	TunerAGC* d = (TunerAGC*)context;
+
+	d->Controller();
+
+	pthread_exit(NULL);
+	return((void *)1);
+}
@@ -0,0 +1,122 @@
+//
+//  TunerAGC.hpp
+//  carradio
+//
+//  Software gain control for the tuner, driven by the decoder's IF level.
+//
+//  The RTL auto gain knows nothing about the station being listened to,
+//  and one manual gain does not suit a strong local station and a weak
+//  distant one alike.  SDRProcessor reports the decoder's IF level after
+//  each block, which is only an atomic store, and the controller thread
+//  steps the tuner through its list of gains to keep the level inside a
+//  target window.  Gain changes go over USB and can take milliseconds,
+//  which is why they never happen on the DSP thread.
+//
+//  The window gives hysteresis, and after every step or retune the
+//  controller waits for the smoothed IF level to settle before it looks
+//  again, which also limits the rate of steps.  Every decision is kept
+//  in a small telemetry ring, oldest entries overwritten, for tuning the
+//  window from the field.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <pthread.h>
+
+using namespace std;
+
+class TunerAGC
+{
+public:
+
+	static constexpr double 		default_lowLevel 	= -35.0;		// dBFS IF level, step up below
+	static constexpr double 		default_highLevel	= -12.0;		// dBFS, step down above
+	static constexpr double 		default_settleTime = 1.5;		// seconds after a step or retune
+	static constexpr double 		default_maxStep 	= 10.0;		// dB per step
+	static constexpr int 			pollInterval		= 100;		// ms
+	static constexpr size_t 		telemetrySize		= 64;
+
+	/** Sets the tuner gain in 0.1 dB, from the controller thread. */
+	typedef std::function<bool(int gain)> setGainCallback_t;
+
+	typedef enum {
+		AGC_ENABLED = 0,
+		AGC_STEP_UP,
+		AGC_STEP_DOWN,
+		AGC_AT_LIMIT,		// wanted a step, no gain left that way
+		AGC_FAILED,			// the tuner refused the gain
+	} agc_action_t;
+
+	typedef struct {
+		double			time;			// CLOCK_MONOTONIC seconds
+		double			level;		// dBFS IF level the decision was made on
+		int				fromGain;	// 0.1 dB
+		int				toGain;
+		agc_action_t	action;
+	} agc_event_t;
+
+	TunerAGC();
+	~TunerAGC();
+
+	/** Start the controller thread. */
+	bool begin(setGainCallback_t cb);
+	void stop();
+
+	/**
+	 * Take over the tuner gain, starting from startGain.  gains is the
+	 * tuner's list in 0.1 dB, as IQSource::getTunerGains().
+	 */
+	void setEnabled(bool enable, vector<int> gains = {}, int startGain = 0);
+	bool isEnabled() {return _enabled;};
+
+	/** The IF level window in dBFS, steps keep the level inside it. */
+	void setTargetWindow(double lowLevel, double highLevel);
+
+	/** Called from SDRProcessor after each block, never blocks. */
+	void reportLevel(double ifLevel);
+
+	/** New station, wait for its level to settle before judging it. */
+	void reset();
+
+	/** Current gain in 0.1 dB. */
+	int getGain() {return _gain;};
+
+	/** Decisions so far, oldest first. */
+	void getTelemetry(vector<agc_event_t>& events);
+
+private:
+
+	void log(double level, int fromGain, int toGain, agc_action_t action);
+
+	/** Pick the gain to move to, or the current one to hold. */
+	int nextGain(double level);
+
+	void Controller();
+	static void* ControllerThread(void *context);
+
+	mutex								_mutex;
+	condition_variable			_cond;
+	atomic<bool>					_running;
+	atomic<bool>					_enabled;
+	pthread_t						_controllerTID;
+	setGainCallback_t				_setGainCB;
+
+	vector<int>						_gains;			// ascending
+	atomic<int>						_gain;
+	double							_lowLevel;
+	double							_highLevel;
+
+	atomic<double>					_level;			// latest report
+	atomic<uint64_t>				_reports;
+	atomic<bool>					_resetPending;
+
+	vector<agc_event_t>			_telemetry;		// ring of telemetrySize
+	size_t							_telemetryNext;
+	uint64_t							_telemetryCount;
+};
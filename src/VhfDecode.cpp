@@ -1,6 +1,7 @@
 
 #include <cassert>
 #include <cmath>
+#include <random>
 
 #include "VhfDecode.hpp"
 
@@ -55,7 +56,8 @@ static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
 
 /* ****************  class VhfDecoder  **************** */
 
-VhfDecoder::VhfDecoder(double sample_rate_if,
+template <class T>
+VhfDecoderT<T>::VhfDecoderT(double sample_rate_if,
 							double tuning_offset,
 							double sample_rate_pcm,
 							double deemphasis,
@@ -76,29 +78,31 @@ VhfDecoder::VhfDecoder(double sample_rate_if,
 	 , m_baseband_mean(0)
 	 , m_baseband_level(0)
 	 , m_squelch_level(squelch_level)
-	 , m_squelch_dwell(25)
 	 , m_is_squelched(false)
-	 , m_signal_hits(0)
-	 , m_squelch_hits(0)
+	 , m_fixed_point(false)
+	 , m_bandwidth_if(0)
 
 	 // Construct FineTuner
 	 , m_finetuner(m_tuning_table_size, m_tuning_shift)
 
-	 // Construct LowPassFilterFirIQ
-	 , m_iffilter(10, bandwidth_if / sample_rate_if)
+	 // Construct DecimatingFilterFirIQ, isolates the channel and drops
+	 // the IF rate to the baseband rate in one pass.
+	 , m_iffilter(8 * downsample, bandwidth_if / sample_rate_if, downsample)
 
-	 // Construct PhaseDiscriminator
-	 , m_phasedisc(freq_dev / sample_rate_if)
+	 // Construct PhaseDiscriminator, runs at the baseband rate
+	 , m_phasedisc(freq_dev / m_sample_rate_baseband)
 
-	 // Construct DownsampleFilter for baseband
-	 , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
+	 // Same three stages in fixed point
+	 , m_frontend_q15(m_tuning_table_size, m_tuning_shift,
+							8 * downsample, bandwidth_if / sample_rate_if, downsample,
+							freq_dev / m_sample_rate_baseband)
 
-	 // Construct DownsampleFilter for mono channel
+	 // Construct RationalResampler for mono channel
 	 , m_resample_mono(
 		  int(m_sample_rate_baseband / 1000.0),               // filter_order
 		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-	  false)                                              // integer_factor
+		  lrint(m_sample_rate_baseband),                      // rate_in
+		  lrint(sample_rate_pcm))                             // rate_out
 
 	 // Construct HighPassFilterIir
 	 , m_dcblock_mono(30.0 / sample_rate_pcm)
@@ -107,52 +111,117 @@ VhfDecoder::VhfDecoder(double sample_rate_if,
 	 // Construct LowPassFilterRC
 	 , m_deemph_mono(
 		  (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
+
+	 // Construct NoiseSquelch, on the discriminator output
+	 , m_squelch(m_sample_rate_baseband)
 {
 //	printf("VhfDecoder PCM at %f\n", sample_rate_pcm);
 
-	 // nothing more to do
+	 calibrate_squelch(bandwidth_if);
 }
 
 
-void VhfDecoder::process(const IQSampleVector& samples_in,
-								SampleVector& audio)
+// Receiver noise is white over the channel, so seeded Gaussian noise
+// through a fresh copy of the IF filter and discriminator gives what the
+// squelch hears on an empty channel.  Its level does not matter, and the
+// Q15 front end hears the same noise, so one reference serves both.
+template <class T>
+void VhfDecoderT<T>::calibrate_squelch(double bandwidth_if)
 {
-	// Fine tuning.
-	m_finetuner.process(samples_in, m_buf_iftuned);
-	
-	// Low pass filter to isolate station.
-	m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
-	
+	 if (bandwidth_if == m_bandwidth_if)
+		  return;
+
+	 m_bandwidth_if = bandwidth_if;
+
+	 const unsigned int n = 1 << 17;
+
+	 mt19937 gen(1);
+	 normal_distribution<float> noise(0, 0.1);
+
+	 IQSampleVector samples(n);
+	 for (auto& s : samples)
+		  s = IQSample(noise(gen), noise(gen));
+
+	 DecimatingFilterFirIQ iffilter(8 * m_downsample, bandwidth_if / m_sample_rate_if, m_downsample);
+	 PhaseDiscriminatorT<T> phasedisc(m_freq_dev / m_sample_rate_baseband);
+
+	 IQSampleVector filtered;
+	 vector<T> baseband;
+
+	 iffilter.process(samples, filtered);
+	 phasedisc.process(filtered, baseband);
+	 m_squelch.calibrate(baseband);
+}
+
+
+template <class T>
+void VhfDecoderT<T>::retune(double tuning_offset, double bandwidth_if)
+{
+	 m_tuning_shift = lrint(-double(m_tuning_table_size) * tuning_offset / m_sample_rate_if);
+
+	 m_finetuner.set_freq_shift(m_tuning_shift);
+	 m_iffilter.set_cutoff(bandwidth_if / m_sample_rate_if);
+	 m_frontend_q15.retune(m_tuning_shift, bandwidth_if / m_sample_rate_if);
+
+	 // No history of the old channel is carried into the new one.
+	 m_finetuner.reset();
+	 m_iffilter.reset();
+	 m_phasedisc.reset();
+	 m_resample_mono.reset();
+	 m_dcblock_mono.reset();
+	 m_dcblock_stereo.reset();
+	 m_deemph_mono.reset();
+
+	 // Squelch behaves as on a freshly created decoder, the first block
+	 // on the new channel decides.
+	 calibrate_squelch(bandwidth_if);
+	 m_squelch.reset();
+	 m_if_level = 0;
+	 m_baseband_mean = 0;
+	 m_baseband_level = 0;
+	 m_is_squelched = false;
+}
+
+
+template <class T>
+void VhfDecoderT<T>::process(const IQSampleVector& samples_in,
+								vector<T>& audio)
+{
+	double if_rms;
+
+	if (m_fixed_point) {
+
+		// Tune, filter and demodulate in Q15.
+		m_frontend_q15.process(samples_in, m_buf_baseband_q15);
+		if_rms = m_frontend_q15.get_if_rms();
+		q15_to_samples(m_buf_baseband_q15, m_frontend_q15.full_scale(), m_buf_baseband);
+
+	} else {
+
+		// Fine tuning.
+		m_finetuner.process(samples_in, m_buf_iftuned);
+
+		// Low pass filter to isolate station and decimate to baseband rate.
+		m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
+		if_rms = rms_level_approx(m_buf_iffiltered);
+
+		// Extract carrier frequency.
+		m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
+	}
+
 	// Measure IF level.
-	double if_rms = rms_level_approx(m_buf_iffiltered);
 	m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
 	
-	// rms level is faster responding for triggering squelch
-	int current_level  = int (20*log10(if_rms));
-	
-	bool hasSignal =  m_squelch_level == 0 || current_level >   m_squelch_level;
+	// The noise squelch decides, the IF level only has to be reached to
+	// open it.  The rms level is faster responding than m_if_level.
+	bool hasSignal = true;
 	
-	if(hasSignal){
-		m_signal_hits++;
-		m_squelch_hits = 0;
-		m_is_squelched	 = false;
+	if (m_squelch_level != 0) {
+		int current_level  = int (20*log10(if_rms));
+		hasSignal = m_squelch.process(m_buf_baseband, current_level > m_squelch_level);
 	}
-	else {
-		m_squelch_hits++;
-		
-		if(m_signal_hits){
-			// if we already had a signal we wait m_squelch_dwell before marking as squelched
-			if (m_squelch_hits > m_squelch_dwell){
-				m_signal_hits = 0;
-				m_is_squelched	 = true;
-			}
-		}
-		
-		// if we havnt had a signal yet. then wait a few tries before marking as squelched
-		else 	if(m_squelch_hits > 2){
-			m_is_squelched	 = true;
-		}
- 	}
+	
+	m_is_squelched = !hasSignal;
 
 	if(!hasSignal){
 		// squelch output
@@ -165,15 +234,6 @@ void VhfDecoder::process(const IQSampleVector& samples_in,
 	{
 		
  //		printf("ON rms: %.5f\t if: %.5f\t squelch: %3d <  %3d\n", if_rms, m_if_level, current_level ,m_squelch_level);
-		// Extract carrier frequency.
-		m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
-		
-		// Downsample baseband signal to reduce processing.
-		if (m_downsample > 1) {
-			SampleVector tmp(move(m_buf_baseband));
-			m_resample_baseband.process(tmp, m_buf_baseband);
-		}
-		
 		// Measure baseband level.
 		double baseband_mean, baseband_rms;
 		samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
@@ -193,14 +253,15 @@ void VhfDecoder::process(const IQSampleVector& samples_in,
 
 
 // Duplicate mono signal in left/right channels.
-void VhfDecoder::mono_to_left_right(const SampleVector& samples_mono,
-											  SampleVector& audio)
+template <class T>
+void VhfDecoderT<T>::mono_to_left_right(const vector<T>& samples_mono,
+											  vector<T>& audio)
 {
 	 unsigned int n = samples_mono.size();
 
 	 audio.resize(2*n);
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample m = samples_mono[i];
+		  T m = samples_mono[i];
 		  audio[2*i]   = m;
 		  audio[2*i+1] = m;
 	 }
@@ -208,7 +269,8 @@ void VhfDecoder::mono_to_left_right(const SampleVector& samples_mono,
 
 
 
-bool VhfDecoder::isNarrowBand(double frequency){
+template <class T>
+bool VhfDecoderT<T>::isNarrowBand(double frequency){
 	
  	/*
 	 
@@ -222,3 +284,8 @@ bool VhfDecoder::isNarrowBand(double frequency){
 						 
 	return isNarrow;
 }
+
+/* ****************  instantiations  **************** */
+
+template class VhfDecoderT<float>;
+template class VhfDecoderT<double>;
@@ -24,11 +24,13 @@
 #include "Filter.hpp"
 #include "SDRDecoder.hpp"
 #include "FmDecode.hpp"
+#include "NoiseSquelch.hpp"
 
 
 
 /** Complete decoder for FM broadcast signal. */
-class VhfDecoder : public SDRDecoder
+template <class T>
+class VhfDecoderT : public SDRDecoderT<T>
 {
 public:
 	
@@ -54,10 +56,10 @@ public:
 	  *                     (75 kHz for broadcast FM)
 	  * bandwidth_pcm    :: Half bandwidth of audio signal in Hz
 	  *                     (15 kHz for broadcast FM)
-	  * downsample       :: Downsampling factor to apply after FM demodulation.
-	  *                     Set to 1 to disable.
+	  * downsample       :: Decimation factor applied by the IF filter, before
+	  *                     FM demodulation.  Set to 1 to disable.
 	  */
-	VhfDecoder(double sample_rate_if,  //
+	VhfDecoderT(double sample_rate_if,  //
 				  double tuning_offset,   //
 				  double sample_rate_pcm, //
 				  double deemphasis=50,
@@ -76,7 +78,10 @@ public:
 	  * vector only contains samples for one channel.
 	  */
 	 void process(const IQSampleVector& samples_in,
-					  SampleVector& audio);
+					  std::vector<T>& audio);
+
+	 /** Move to another channel without rebuilding the decoder. */
+	 void retune(double tuning_offset, double bandwidth_if);
 
 
 	 /** Return actual frequency offset in Hz with respect to receiver LO. */
@@ -101,6 +106,7 @@ public:
 
 	bool canSquelch() const  { return true; };
  
+	/** Minimum IF level in dB to open, 0 turns the squelch off. */
 	void set_squelch_level(int level) 
 	{
 		m_squelch_level = level;
@@ -110,45 +116,72 @@ public:
 		return m_is_squelched;
 	};
 	
-	void set_squelch_dwell(uint count){
-		m_squelch_dwell = count;
+	/** Tail in ms, how long the squelch stays open after the signal drops. */
+	void set_squelch_dwell(uint ms){
+		m_squelch.set_tail(ms / 1000.0);
 	}
 
+	/** Quieting in dB the noise squelch opens at, and drops by before closing. */
+	void set_squelch_snr(double db)        { m_squelch.set_threshold(db); }
+	void set_squelch_hysteresis(double db) { m_squelch.set_hysteresis(db); }
+
+	/** Quieting of the last block in dB, see NoiseSquelch. */
+	double get_squelch_snr() const { return m_squelch.get_snr(); }
+
+	 /** Select exact or fast atan2 in the FM discriminator. */
+	 void set_discriminator_method(typename PhaseDiscriminatorT<T>::method_t method)
+	 {
+		  m_phasedisc.set_method(method);
+	 }
+
+	 /**
+	  * Run tuner, IF filter and discriminator in Q15 fixed point, the
+	  * audio stages stay in the decoder's sample type.
+	  */
+	 void set_fixed_point(bool enable) { m_fixed_point = enable; }
+	 bool fixed_point() const { return m_fixed_point; }
+
 	static bool isNarrowBand(double frequency);
 
 private:
  
 	 /** Duplicate mono signal in left/right channels. */
-	 void mono_to_left_right(const SampleVector& samples_mono,
-									 SampleVector& audio);
+	 void mono_to_left_right(const std::vector<T>& samples_mono,
+									 std::vector<T>& audio);
+
+	 /** Set the squelch reference from noise through this IF filter. */
+	 void calibrate_squelch(double bandwidth_if);
  
 	 // Data members.
 	 const double    m_sample_rate_if;
 	 const double    m_sample_rate_baseband;
 	 const int       m_tuning_table_size;
-	 const int       m_tuning_shift;
+	 int             m_tuning_shift;
 	 const double    m_freq_dev;
 	 const unsigned int m_downsample;
 	 double          m_if_level;
 	 double          m_baseband_mean;
 	 double          m_baseband_level;
 	 int	           m_squelch_level;
-	 uint 			  m_squelch_dwell;
 	 bool      	     m_is_squelched;
- 	 uint 			  m_signal_hits;
-  	 uint 			  m_squelch_hits;
+	 bool            m_fixed_point;
+	 double          m_bandwidth_if;
 
 	 IQSampleVector  m_buf_iftuned;
 	 IQSampleVector  m_buf_iffiltered;
-	 SampleVector    m_buf_baseband;
-	 SampleVector    m_buf_mono;
-
-	FineTuner           m_finetuner;
-	LowPassFilterFirIQ  m_iffilter;
-	PhaseDiscriminator  m_phasedisc;
-	 DownsampleFilter    m_resample_baseband;
-	 DownsampleFilter    m_resample_mono;
-	 HighPassFilterIir   m_dcblock_mono;
-	 HighPassFilterIir   m_dcblock_stereo;
-	 LowPassFilterRC     m_deemph_mono;
+	 SampleQ15Vector m_buf_baseband_q15;
+	 std::vector<T>    m_buf_baseband;
+	 std::vector<T>    m_buf_mono;
+
+	FineTuner              m_finetuner;
+	DecimatingFilterFirIQ  m_iffilter;
+	PhaseDiscriminatorT<T> m_phasedisc;
+	 FmFrontEndQ15          m_frontend_q15;
+	 RationalResamplerT<T>  m_resample_mono;
+	 HighPassFilterIirT<T>  m_dcblock_mono;
+	 HighPassFilterIirT<T>  m_dcblock_stereo;
+	 LowPassFilterRCT<T>    m_deemph_mono;
+	 NoiseSquelchT<T>       m_squelch;
 };
+
+typedef VhfDecoderT<Sample> VhfDecoder;